@@ -0,0 +1,111 @@
+#pragma once
+
+/// @file
+/// @brief Minimal timing helpers and test data shared by the benchmarks.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace bench {
+
+//! Read a whole file. Exits, if it can't be opened.
+inline std::string
+read_file(const std::string &path)
+{
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+                std::fprintf(stderr, "failed to open %s\n", path.c_str());
+                std::exit(1);
+        }
+
+        std::ostringstream content;
+        content << file.rdbuf();
+        return content.str();
+}
+
+//! Keep the compiler from optimizing away the computation of `value`.
+template<class T>
+inline void
+do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static volatile const void *sink;
+        sink = &value;
+#endif
+}
+
+//! Number of iterations, either the default or the one passed as first argument.
+inline std::size_t
+iterations(int argc, char **argv, std::size_t fallback)
+{
+        if (argc > 1)
+                return std::max<std::size_t>(1, std::strtoul(argv[1], nullptr, 10));
+        return fallback;
+}
+
+//! Run `f` once to warm up and then `iterations` times. Prints and returns the median time of
+//! a single run in microseconds.
+template<class F>
+double
+run(const char *name, std::size_t iterations, F &&f)
+{
+        f();
+
+        std::vector<double> samples;
+        samples.reserve(iterations);
+        for (std::size_t i = 0; i < iterations; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                f();
+                const auto end = std::chrono::steady_clock::now();
+                samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+        std::printf("%-44s median %12.1f us   min %12.1f us\n", name, median, samples.front());
+        return median;
+}
+
+#ifdef FIXTURES_DIR
+//! A /sync response with `room_count` joined rooms, made from the rooms of the sync.json fixture.
+//! Each room gets up to `events_per_room` events, taken from the state and the timeline of the
+//! fixture rooms.
+inline std::string
+synthetic_sync(std::size_t room_count, std::size_t events_per_room = 20)
+{
+        using json = nlohmann::json;
+
+        const auto fixture = json::parse(read_file(FIXTURES_DIR "/responses/sync.json"));
+        const auto &joined = fixture.at("rooms").at("join");
+
+        std::vector<json> templates;
+        for (const auto &room : joined) {
+                auto r = room;
+                for (const auto section : {"state", "timeline"}) {
+                        auto &events = r[section]["events"];
+                        if (events.size() > events_per_room / 2)
+                                events.erase(events.begin() + events_per_room / 2, events.end());
+                }
+                templates.push_back(std::move(r));
+        }
+
+        json sync = {{"next_batch", fixture.at("next_batch")}};
+        for (std::size_t i = 0; i < room_count; ++i)
+                sync["rooms"]["join"]["!room" + std::to_string(i) + ":example.org"] =
+                  templates[i % templates.size()];
+
+        return sync.dump();
+}
+#endif
+}
@@ -0,0 +1,166 @@
+// Compares decompressing a gzip encoded /sync response with boost::iostreams after the whole
+// response was received, as it used to be done, against inflating it while it is parsed.
+//
+// Usage: decompress_bench [iterations]
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include <boost/beast/http.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "mtxclient/http/inflating_body.hpp"
+#include "mtxclient/utils.hpp"
+
+#include "benchmark.hpp"
+
+namespace http = boost::beast::http;
+
+namespace {
+//! Size of the chunks fed to the parser, roughly what a single TLS read returns.
+constexpr std::size_t chunk_size = 16 * 1024;
+
+//! The previous implementation of mtx::client::utils::decompress.
+std::string
+legacy_decompress(const boost::iostreams::array_source &src, const std::string &type) noexcept
+{
+        try {
+                boost::iostreams::filtering_istream is;
+                is.set_auto_close(true);
+
+                std::stringstream decompressed;
+
+                if (type == "deflate")
+                        is.push(boost::iostreams::zlib_decompressor{});
+                else if (type == "gzip")
+                        is.push(boost::iostreams::gzip_decompressor{});
+
+                is.push(src);
+                boost::iostreams::copy(is, decompressed);
+
+                return decompressed.str();
+        } catch (boost::iostreams::gzip_error &) {
+        } catch (boost::iostreams::zlib_error &) {
+        }
+
+        boost::iostreams::filtering_istream is;
+        is.set_auto_close(true);
+
+        std::stringstream decompressed;
+
+        is.push(src);
+        boost::iostreams::copy(is, decompressed);
+
+        return decompressed.str();
+}
+
+std::string
+gzip(const std::string &data)
+{
+        boost::iostreams::filtering_istream is;
+        is.push(boost::iostreams::gzip_compressor{});
+        is.push(boost::iostreams::array_source{data.data(), data.size()});
+
+        std::stringstream compressed;
+        boost::iostreams::copy(is, compressed);
+        return compressed.str();
+}
+
+//! Feed the raw response to the parser in chunks, like a socket read would.
+template<class Body>
+http::response<Body>
+parse(const std::string &raw)
+{
+        http::response_parser<Body> parser;
+        parser.body_limit(1024 * 1024 * 1024);
+        parser.eager(true);
+
+        std::size_t pos = 0;
+        std::size_t end = 0;
+        while (!parser.is_done()) {
+                end = std::min(raw.size(), std::max(end, pos + chunk_size));
+
+                boost::system::error_code ec;
+                pos += parser.put(boost::asio::buffer(raw.data() + pos, end - pos), ec);
+
+                if (ec == http::error::need_more && end < raw.size()) {
+                        end += chunk_size;
+                } else if (ec && ec != http::error::need_more) {
+                        std::fprintf(stderr, "parse error: %s\n", ec.message().c_str());
+                        std::exit(1);
+                }
+        }
+
+        return parser.release();
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 50);
+
+        const auto json       = bench::read_file(FIXTURES_DIR "/responses/sync.json");
+        const auto compressed = gzip(json);
+
+        const auto raw = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: application/json\r\n"
+                         "Content-Encoding: gzip\r\n"
+                         "Content-Length: " +
+                         std::to_string(compressed.size()) + "\r\n\r\n" + compressed;
+
+        std::printf("sync.json: %zu bytes, %zu bytes gzip compressed, %zu iterations\n\n",
+                    json.size(),
+                    compressed.size(),
+                    n);
+
+        const auto legacy_body = legacy_decompress(
+          boost::iostreams::array_source{compressed.data(), compressed.size()}, "gzip");
+        const auto inflated_body = parse<mtx::http::InflatingBody>(raw).body();
+        if (legacy_body != json || inflated_body != json) {
+                std::fprintf(stderr, "decompressed body doesn't match the input\n");
+                return 1;
+        }
+
+        const auto legacy = bench::run("legacy decompress", n, [&] {
+                bench::do_not_optimize(legacy_decompress(
+                  boost::iostreams::array_source{compressed.data(), compressed.size()}, "gzip"));
+        });
+        const auto single = bench::run("utils::decompress", n, [&] {
+                bench::do_not_optimize(mtx::client::utils::decompress(
+                  boost::iostreams::array_source{compressed.data(), compressed.size()}, "gzip"));
+        });
+        const auto chunked = bench::run("Inflater, 16 KiB chunks", n, [&] {
+                std::string out;
+                mtx::client::utils::Inflater inflater("gzip");
+                for (std::size_t pos = 0; pos < compressed.size(); pos += chunk_size)
+                        inflater.inflate(compressed.data() + pos,
+                                         std::min(chunk_size, compressed.size() - pos),
+                                         out);
+                bench::do_not_optimize(out);
+        });
+
+        std::printf("\n");
+
+        const auto old_path = bench::run("parse string_body + legacy decompress", n, [&] {
+                auto res = parse<http::string_body>(raw);
+                bench::do_not_optimize(legacy_decompress(
+                  boost::iostreams::array_source{res.body().data(), res.body().size()},
+                  std::string(res[http::field::content_encoding])));
+        });
+        const auto new_path = bench::run("parse InflatingBody", n, [&] {
+                bench::do_not_optimize(parse<mtx::http::InflatingBody>(raw));
+        });
+
+        std::printf("\nspeedup: utils::decompress %.2fx, Inflater %.2fx, response path %.2fx\n",
+                    legacy / single,
+                    legacy / chunked,
+                    old_path / new_path);
+
+        return 0;
+}
@@ -0,0 +1,254 @@
+// Compares looking up the type of the events in a large synthetic timeline with the previous
+// chain of string comparisons against the perfect hash, and shows how long parsing the whole
+// timeline takes in comparison.
+//
+// Usage: event_type_bench [iterations]
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "mtx/events.hpp"
+#include "mtx/events/collections.hpp"
+#include "mtx/responses/common.hpp"
+
+#include "benchmark.hpp"
+
+using mtx::events::EventType;
+using json = nlohmann::json;
+
+namespace {
+constexpr std::size_t timeline_size = 100'000;
+
+//! The previous implementation of mtx::events::getEventType.
+EventType
+legacy_get_event_type(const std::string &type)
+{
+        if (type == "m.key.verification.request")
+                return EventType::KeyVerificationRequest;
+        else if (type == "m.key.verification.start")
+                return EventType::KeyVerificationStart;
+        else if (type == "m.key.verification.accept")
+                return EventType::KeyVerificationAccept;
+        else if (type == "m.key.verification.ready")
+                return EventType::KeyVerificationReady;
+        else if (type == "m.key.verification.done")
+                return EventType::KeyVerificationDone;
+        else if (type == "m.key.verification.key")
+                return EventType::KeyVerificationKey;
+        else if (type == "m.key.verification.mac")
+                return EventType::KeyVerificationMac;
+        else if (type == "m.key.verification.cancel")
+                return EventType::KeyVerificationCancel;
+        else if (type == "m.reaction")
+                return EventType::Reaction;
+        else if (type == "m.room_key")
+                return EventType::RoomKey;
+        else if (type == "m.forwarded_room_key")
+                return EventType::ForwardedRoomKey;
+        else if (type == "m.room_key_request")
+                return EventType::RoomKeyRequest;
+        else if (type == "m.room.aliases")
+                return EventType::RoomAliases;
+        else if (type == "m.room.avatar")
+                return EventType::RoomAvatar;
+        else if (type == "m.room.canonical_alias")
+                return EventType::RoomCanonicalAlias;
+        else if (type == "m.room.create")
+                return EventType::RoomCreate;
+        else if (type == "m.room.encrypted")
+                return EventType::RoomEncrypted;
+        else if (type == "m.room.encryption")
+                return EventType::RoomEncryption;
+        else if (type == "m.room.guest_access")
+                return EventType::RoomGuestAccess;
+        else if (type == "m.room.history_visibility")
+                return EventType::RoomHistoryVisibility;
+        else if (type == "m.room.join_rules")
+                return EventType::RoomJoinRules;
+        else if (type == "m.room.member")
+                return EventType::RoomMember;
+        else if (type == "m.room.message")
+                return EventType::RoomMessage;
+        else if (type == "m.room.name")
+                return EventType::RoomName;
+        else if (type == "m.room.power_levels")
+                return EventType::RoomPowerLevels;
+        else if (type == "m.room.topic")
+                return EventType::RoomTopic;
+        else if (type == "m.room.redaction")
+                return EventType::RoomRedaction;
+        else if (type == "m.room.pinned_events")
+                return EventType::RoomPinnedEvents;
+        else if (type == "m.room.tombstone")
+                return EventType::RoomTombstone;
+        else if (type == "m.sticker")
+                return EventType::Sticker;
+        else if (type == "m.tag")
+                return EventType::Tag;
+        else if (type == "m.presence")
+                return EventType::Presence;
+        else if (type == "m.push_rules")
+                return EventType::PushRules;
+        else if (type == "m.call.invite")
+                return EventType::CallInvite;
+        else if (type == "m.call.candidates")
+                return EventType::CallCandidates;
+        else if (type == "m.call.answer")
+                return EventType::CallAnswer;
+        else if (type == "m.call.hangup")
+                return EventType::CallHangUp;
+        else if (type == "m.secret.request")
+                return EventType::SecretRequest;
+        else if (type == "m.secret.send")
+                return EventType::SecretSend;
+        else if (type == "m.typing")
+                return EventType::Typing;
+        else if (type == "m.receipt")
+                return EventType::Receipt;
+        else if (type == "m.fully_read")
+                return EventType::FullyRead;
+        else if (type == "im.nheko.hidden_events")
+                return EventType::NhekoHiddenEvents;
+        else
+                return EventType::Unsupported;
+}
+
+//! A minimal valid event of the given type.
+json
+make_event(const std::string &type, std::size_t i)
+{
+        json event = {{"type", type},
+                      {"event_id", "$" + std::to_string(i) + ":example.org"},
+                      {"sender", "@alice:example.org"},
+                      {"origin_server_ts", 1600000000000 + i},
+                      {"unsigned", {{"age", 100}}},
+                      {"content", json::object()}};
+        auto &content = event["content"];
+
+        if (type == "m.room.encrypted") {
+                content = {{"algorithm", "m.megolm.v1.aes-sha2"},
+                           {"ciphertext", std::string(200, 'A')},
+                           {"device_id", "ABCDEFGHIJ"},
+                           {"sender_key", std::string(43, 'k')},
+                           {"session_id", std::string(43, 's')}};
+        } else if (type == "m.room.message") {
+                content = {{"msgtype", "m.text"}, {"body", "message " + std::to_string(i)}};
+        } else if (type == "m.room.member") {
+                event["state_key"] = "@bob:example.org";
+                content            = {{"membership", "join"}, {"displayname", "Bob"}};
+        } else if (type == "m.reaction") {
+                content = {{"m.relates_to",
+                            {{"rel_type", "m.annotation"}, {"event_id", "$0"}, {"key", "+1"}}}};
+        } else if (type == "m.room.redaction") {
+                event["redacts"] = "$0:example.org";
+        } else if (type == "m.sticker") {
+                content = {
+                  {"body", "sticker"}, {"url", "mxc://example.org/s"}, {"info", json::object()}};
+        } else if (type == "m.room.name") {
+                event["state_key"] = "";
+                content            = {{"name", "Room"}};
+        } else if (type == "m.room.topic") {
+                event["state_key"] = "";
+                content            = {{"topic", "Topic"}};
+        } else if (type == "m.room.power_levels") {
+                event["state_key"] = "";
+        } else if (type == "m.call.invite") {
+                content = {{"call_id", "c"},
+                           {"version", 0},
+                           {"lifetime", 60000},
+                           {"offer", {{"type", "offer"}, {"sdp", "v=0"}}}};
+        } else if (type == "m.call.hangup") {
+                content = {{"call_id", "c"}, {"version", 0}};
+        }
+
+        return event;
+}
+
+//! A timeline, whose types roughly follow a busy encrypted room.
+json
+synthetic_timeline()
+{
+        const std::vector<std::pair<const char *, int>> types = {
+          {"m.room.encrypted", 40},
+          {"m.room.message", 25},
+          {"m.room.member", 12},
+          {"m.reaction", 10},
+          {"m.room.redaction", 4},
+          {"m.sticker", 2},
+          {"m.room.power_levels", 1},
+          {"m.room.name", 1},
+          {"m.room.topic", 1},
+          {"m.call.invite", 1},
+          {"m.call.hangup", 1},
+          {"org.example.custom", 2},
+        };
+        std::vector<int> weights;
+        for (const auto &type : types)
+                weights.push_back(type.second);
+
+        std::minstd_rand rng(42);
+        std::discrete_distribution<std::size_t> pick(weights.begin(), weights.end());
+
+        json timeline = json::array();
+        for (std::size_t i = 0; i < timeline_size; ++i)
+                timeline.push_back(make_event(types[pick(rng)].first, i));
+
+        return timeline;
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 50);
+
+        const auto timeline = synthetic_timeline();
+        std::vector<std::string> types;
+        for (const auto &event : timeline)
+                types.push_back(event.at("type").get<std::string>());
+
+        for (const auto &type : types) {
+                if (legacy_get_event_type(type) != mtx::events::getEventType(type)) {
+                        std::fprintf(stderr, "lookup of %s doesn't match\n", type.c_str());
+                        return 1;
+                }
+        }
+
+        std::printf("%zu events, %zu iterations\n\n", timeline.size(), n);
+
+        const auto legacy = bench::run("legacy getEventType(std::string)", n, [&] {
+                for (const auto &type : types)
+                        bench::do_not_optimize(legacy_get_event_type(type));
+        });
+        const auto hashed = bench::run("getEventType(std::string_view)", n, [&] {
+                for (const auto &type : types)
+                        bench::do_not_optimize(mtx::events::getEventType(std::string_view(type)));
+        });
+
+        std::printf("\n");
+
+        const auto legacy_json = bench::run("legacy, type copied out of the json", n, [&] {
+                for (const auto &event : timeline)
+                        bench::do_not_optimize(
+                          legacy_get_event_type(event.at("type").get<std::string>()));
+        });
+        const auto hashed_json = bench::run("getEventType(json)", n, [&] {
+                for (const auto &event : timeline)
+                        bench::do_not_optimize(mtx::events::getEventType(event));
+        });
+        bench::run("parse_timeline_events", std::max<std::size_t>(1, n / 10), [&] {
+                std::vector<mtx::events::collections::TimelineEvents> events;
+                mtx::responses::utils::parse_timeline_events(timeline, events);
+                bench::do_not_optimize(events);
+        });
+
+        std::printf("\nspeedup: lookup %.2fx, lookup from json %.2fx\n",
+                    legacy / hashed,
+                    legacy_json / hashed_json);
+
+        return 0;
+}
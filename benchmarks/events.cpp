@@ -0,0 +1,121 @@
+// Measures decoding and encoding single events of the common kinds, among them an edit with
+// `m.new_content`, in time and in heap allocations per event.
+//
+// Usage: events_bench [iterations]
+
+#include <cstdio>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "mtx/events.hpp"
+#include "mtx/events/collections.hpp"
+
+#include "benchmark.hpp"
+#include "heap_tracking.hpp"
+
+using json = nlohmann::json;
+using namespace mtx::events;
+
+namespace {
+//! Events decoded or encoded in every run, so that the timer resolution doesn't matter.
+constexpr std::size_t batch = 10000;
+
+const json text = R"({
+  "origin_server_ts": 1510489356530,
+  "sender": "@nheko_test:matrix.org",
+  "event_id": "$15104893562785758wEgEU:matrix.org",
+  "unsigned": {"age": 2225, "transaction_id": "m1510489356267.2"},
+  "content": {
+    "body": "hey there, this is a message, that is long enough to not fit into a small string",
+    "msgtype": "m.text",
+    "m.relates_to": {"m.in_reply_to": {"event_id": "$6GKhAfJOcwNd69lgSizdcTob8z2pWQgBOZPrnsWMA1E"}}
+  },
+  "type": "m.room.message",
+  "room_id": "!lfoDRlNFWlvOnvkBwQ:matrix.org"
+})"_json;
+
+const json edit = R"({
+  "origin_server_ts": 1510489356530,
+  "sender": "@nheko_test:matrix.org",
+  "event_id": "$15104893562785758wEgEU:matrix.org",
+  "content": {
+    "body": "* hey there, this is a message, that is long enough to not fit into a small string",
+    "format": "org.matrix.custom.html",
+    "formatted_body": "* <b>hey there</b>, this is a message, that is long enough to not fit",
+    "msgtype": "m.text",
+    "m.new_content": {
+      "body": "hey there, this is a message, that is long enough to not fit into a small string",
+      "format": "org.matrix.custom.html",
+      "formatted_body": "<b>hey there</b>, this is a message, that is long enough to not fit",
+      "msgtype": "m.text"
+    },
+    "m.relates_to": {"rel_type": "m.replace", "event_id": "$6GKhAfJOcwNd69lgSizdcTob8z2pWQgBOZPr"}
+  },
+  "type": "m.room.message",
+  "room_id": "!lfoDRlNFWlvOnvkBwQ:matrix.org"
+})"_json;
+
+const json member = R"({
+  "origin_server_ts": 1510473133072,
+  "sender": "@nheko_test:matrix.org",
+  "event_id": "$15104731332646268uOFJp:matrix.org",
+  "unsigned": {"age": 2970, "prev_content": {"membership": "leave"}},
+  "state_key": "@nheko_test:matrix.org",
+  "content": {
+    "avatar_url": "mxc://matrix.org/JKiSOBDDxCHxmaLAgoQwSAHa",
+    "displayname": "NhekoTest",
+    "membership": "join"
+  },
+  "type": "m.room.member",
+  "room_id": "!lfoDRlNFWlvOnvkBwQ:matrix.org"
+})"_json;
+
+const json device = R"({
+  "sender": "@alice:example.com",
+  "type": "m.key.verification.done",
+  "content": {"transaction_id": "S0meUniqueAndOpaqueString"}
+})"_json;
+
+template<class Event>
+void
+run_case(const char *name, const json &data, std::size_t n)
+{
+        const auto decode = std::string("decode ") + name;
+        const auto encode = std::string("encode ") + name;
+
+        bench::run(decode.c_str(), n, [&] {
+                for (std::size_t i = 0; i < batch; ++i)
+                        bench::do_not_optimize(data.get<Event>());
+        });
+
+        const auto event = data.get<Event>();
+        bench::run(encode.c_str(), n, [&] {
+                for (std::size_t i = 0; i < batch; ++i)
+                        bench::do_not_optimize(json(event));
+        });
+
+        const auto before = bench::allocations.load();
+        bench::do_not_optimize(data.get<Event>());
+        const auto decoded = bench::allocations.load();
+        bench::do_not_optimize(json(event));
+        std::printf("  allocations: decode %zu, encode %zu\n",
+                    decoded - before,
+                    bench::allocations.load() - decoded);
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 10);
+        std::printf("%zu events per run, %zu iterations\n\n", batch, n);
+
+        run_case<RoomEvent<msg::Text>>("text message", text, n);
+        run_case<RoomEvent<msg::Text>>("edited text message", edit, n);
+        run_case<RoomEvent<Unknown>>("edited unknown message", edit, n);
+        run_case<StateEvent<state::Member>>("member", member, n);
+        run_case<DeviceEvent<msg::KeyVerificationDone>>("device event", device, n);
+
+        return 0;
+}
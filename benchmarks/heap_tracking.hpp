@@ -0,0 +1,88 @@
+#pragma once
+
+/// @file
+/// @brief Replaces the global operator new and delete to measure the heap used by a benchmark
+/// and count its allocations.
+///
+/// The replacements are not inline, so include this in exactly one file of a benchmark.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace bench {
+
+//! Bytes allocated with operator new and not freed yet.
+inline std::atomic<std::size_t> heap_in_use{0};
+//! The most bytes in use since the last peak_heap().
+inline std::atomic<std::size_t> heap_peak{0};
+//! Calls of operator new.
+inline std::atomic<std::size_t> allocations{0};
+
+//! Peak heap usage in bytes while running `f`, above the usage before.
+template<class F>
+std::size_t
+peak_heap(F &&f)
+{
+        const auto before = heap_in_use.load();
+        heap_peak         = before;
+        f();
+        return heap_peak - before;
+}
+
+namespace detail {
+//! Stores the size of an allocation in front of it and keeps it aligned like malloc does.
+constexpr std::size_t heap_header = alignof(std::max_align_t);
+}
+}
+
+void *
+operator new(std::size_t size)
+{
+        auto p = static_cast<char *>(std::malloc(size + bench::detail::heap_header));
+        if (!p)
+                throw std::bad_alloc();
+
+        ++bench::allocations;
+        *reinterpret_cast<std::size_t *>(p) = size;
+        const auto in_use                   = bench::heap_in_use += size;
+        auto peak                           = bench::heap_peak.load();
+        while (in_use > peak && !bench::heap_peak.compare_exchange_weak(peak, in_use)) {
+        }
+
+        return p + bench::detail::heap_header;
+}
+
+void
+operator delete(void *ptr) noexcept
+{
+        if (!ptr)
+                return;
+
+        auto p = static_cast<char *>(ptr) - bench::detail::heap_header;
+        bench::heap_in_use -= *reinterpret_cast<std::size_t *>(p);
+        std::free(p);
+}
+
+void
+operator delete(void *ptr, std::size_t) noexcept
+{
+        operator delete(ptr);
+}
+
+void *
+operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+        try {
+                return operator new(size);
+        } catch (...) {
+                return nullptr;
+        }
+}
+
+void
+operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+        operator delete(ptr);
+}
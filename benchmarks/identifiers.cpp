@@ -0,0 +1,105 @@
+// Compares parsed and interned user ids for the member lists of many rooms, where the same users
+// show up again and again: the heap used by the lists, building them and comparing the ids.
+//
+// Usage: identifiers_bench [iterations]
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mtx/identifiers.hpp"
+
+#include "benchmark.hpp"
+#include "heap_tracking.hpp"
+
+using mtx::identifiers::User;
+
+namespace {
+constexpr std::size_t member_count = 100000;
+//! Different users among the members.
+constexpr std::size_t user_count = 20000;
+
+//! Ids of the members, like they are parsed from the member events of the rooms.
+std::vector<std::string>
+member_ids()
+{
+        std::vector<std::string> ids;
+        for (std::size_t i = 0; i < member_count; ++i)
+                ids.push_back("@user" + std::to_string(i * 7919 % user_count) + ":matrix.org");
+        return ids;
+}
+
+//! The member list built by `make`, and the heap used by it in bytes.
+template<class F>
+std::vector<User>
+members(const std::vector<std::string> &ids, F &&make, std::size_t &heap)
+{
+        const auto before = bench::heap_in_use.load();
+
+        std::vector<User> users;
+        users.reserve(ids.size());
+        for (const auto &id : ids)
+                users.push_back(make(id));
+
+        heap = bench::heap_in_use - before;
+        return users;
+}
+
+//! The number of members, that are the same user as the member before.
+std::size_t
+repeated(const std::vector<User> &users)
+{
+        std::size_t count = 0;
+        for (std::size_t i = 1; i < users.size(); ++i)
+                count += users[i] == users[i - 1];
+        return count;
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 10);
+
+        const auto ids = member_ids();
+        std::printf("%zu members, %zu users, sizeof(User) %zu, %zu iterations\n\n",
+                    member_count,
+                    user_count,
+                    sizeof(User),
+                    n);
+
+        const auto parse  = [](const std::string &id) { return mtx::identifiers::parse<User>(id); };
+        const auto intern = [](const std::string &id) { return mtx::identifiers::intern<User>(id); };
+
+        // The first run fills the table of interned ids, which is counted once.
+        std::size_t parsed_heap = 0, interned_heap = 0, table_heap = 0;
+        const auto parsed = members(ids, parse, parsed_heap);
+        members(ids, intern, table_heap);
+        const auto interned = members(ids, intern, interned_heap);
+        table_heap -= interned_heap;
+
+        const auto parse_time = bench::run("parse", n, [&] {
+                std::size_t heap = 0;
+                bench::do_not_optimize(members(ids, parse, heap));
+        });
+        const auto intern_time = bench::run("intern", n, [&] {
+                std::size_t heap = 0;
+                bench::do_not_optimize(members(ids, intern, heap));
+        });
+        const auto compare_parsed = bench::run("compare parsed", n, [&] {
+                bench::do_not_optimize(repeated(parsed));
+        });
+        const auto compare_interned = bench::run("compare interned", n, [&] {
+                bench::do_not_optimize(repeated(interned));
+        });
+
+        std::printf("\nheap: parsed %.1f MiB, interned %.1f MiB + %.1f MiB table\n",
+                    parsed_heap / 1024.0 / 1024.0,
+                    interned_heap / 1024.0 / 1024.0,
+                    table_heap / 1024.0 / 1024.0);
+        std::printf("speedup of interning: build %.2fx, compare %.2fx\n",
+                    parse_time / intern_time,
+                    compare_parsed / compare_interned);
+
+        return 0;
+}
@@ -0,0 +1,131 @@
+// Compares std::map, std::unordered_map and mtx::common::FlatMap for the maps in the responses,
+// like the rooms of a sync or the users in the power levels of a room: building them from json
+// and from a range of entries in server order, looking up every key and iterating over them.
+//
+// Usage: maps_bench [iterations]
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "mtx/flat_map.hpp"
+
+#include "benchmark.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+//! Something the size of a room with its events, and a power level.
+struct Room
+{
+        std::vector<std::string> events;
+        std::string prev_batch;
+        int64_t level = 0;
+};
+
+void
+from_json(const json &obj, Room &room)
+{
+        room.level = obj.get<int64_t>();
+}
+
+//! Ids like room or user ids, in no particular order, as a server sends them.
+std::vector<std::string>
+ids(std::size_t count)
+{
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> letter('a', 'z');
+
+        std::vector<std::string> ids;
+        for (std::size_t i = 0; i < count; ++i) {
+                std::string id = "!";
+                for (int j = 0; j < 18; ++j)
+                        id += static_cast<char>(letter(rng));
+                ids.push_back(id + ":matrix.org");
+        }
+        return ids;
+}
+
+template<class Map>
+void
+run_case(const char *map_name,
+         const std::vector<std::string> &keys,
+         const json &obj,
+         std::size_t n,
+         std::vector<std::pair<std::string, double>> &results)
+{
+        std::vector<std::pair<std::string, Room>> entries;
+        for (const auto &key : keys)
+                entries.emplace_back(key, Room{});
+
+        auto lookups = keys;
+        std::shuffle(lookups.begin(), lookups.end(), std::mt19937(7));
+
+        const auto name = [&](const char *what) {
+                return std::string(map_name) + " " + what + " " + std::to_string(keys.size());
+        };
+
+        results.emplace_back(name("from json"), bench::run(name("from json").c_str(), n, [&] {
+                                     bench::do_not_optimize(obj.get<Map>());
+                             }));
+        results.emplace_back(name("insert range"), bench::run(name("insert range").c_str(), n, [&] {
+                                     Map map;
+                                     map.insert(entries.begin(), entries.end());
+                                     bench::do_not_optimize(map);
+                             }));
+
+        Map map;
+        map.insert(entries.begin(), entries.end());
+        // Many lookups per run, so that the timer resolution doesn't matter for small maps.
+        const std::size_t rounds = std::max<std::size_t>(1, 100000 / keys.size());
+        results.emplace_back(name("lookup"), bench::run(name("lookup").c_str(), n, [&] {
+                                     int64_t sum = 0;
+                                     for (std::size_t r = 0; r < rounds; ++r)
+                                             for (const auto &key : lookups)
+                                                     sum += map.find(key)->second.level;
+                                     bench::do_not_optimize(sum);
+                             }));
+        results.emplace_back(name("iterate"), bench::run(name("iterate").c_str(), n, [&] {
+                                     int64_t sum = 0;
+                                     for (std::size_t r = 0; r < rounds; ++r)
+                                             for (const auto &[id, room] : map)
+                                                     sum += room.level + id.size();
+                                     bench::do_not_optimize(sum);
+                             }));
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 20);
+
+        for (const std::size_t size : {10, 100, 1000, 10000}) {
+                const auto keys = ids(size);
+                json obj        = json::object();
+                for (std::size_t i = 0; i < keys.size(); ++i)
+                        obj[keys[i]] = i;
+
+                std::vector<std::pair<std::string, double>> std_map, unordered, flat;
+                run_case<std::map<std::string, Room>>("std::map", keys, obj, n, std_map);
+                run_case<std::unordered_map<std::string, Room>>(
+                  "std::unordered_map", keys, obj, n, unordered);
+                run_case<mtx::common::FlatMap<std::string, Room>>("FlatMap", keys, obj, n, flat);
+
+                for (std::size_t i = 0; i < flat.size(); ++i)
+                        std::printf("  %-40s speedup over std::map: %.2fx, "
+                                    "over std::unordered_map: %.2fx\n",
+                                    flat[i].first.c_str(),
+                                    std_map[i].second / flat[i].second,
+                                    unordered[i].second / flat[i].second);
+                std::printf("\n");
+        }
+
+        return 0;
+}
@@ -0,0 +1,146 @@
+// Measures decrypting megolm messages through OlmClient::decrypt_group_message and in batches
+// through OlmClient::decrypt_group_messages, in events per second, for short text messages and
+// for larger events. Also compares unpickling the session for every event against keeping it in
+// an InboundSessionCache.
+//
+// Usage: megolm_bench [iterations]
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mtxclient/crypto/client.hpp"
+#include "mtxclient/crypto/session_cache.hpp"
+
+#include "benchmark.hpp"
+
+using namespace mtx::crypto;
+
+namespace {
+//! Messages decrypted in every run, all of the same session like in a busy room.
+constexpr std::size_t batch = 1000;
+
+void
+run_case(const char *name, std::size_t plaintext_size, std::size_t n)
+{
+        auto client = std::make_shared<OlmClient>();
+        client->create_new_account();
+
+        auto outbound = client->init_outbound_group_session();
+        auto inbound  = client->init_inbound_group_session(session_key(outbound.get()));
+
+        const std::string plaintext(plaintext_size, 'x');
+        std::vector<std::string> messages;
+        for (std::size_t i = 0; i < batch; ++i)
+                messages.push_back(
+                  to_string(client->encrypt_group_message(outbound.get(), plaintext)));
+
+        const auto time = bench::run(name, n, [&] {
+                for (const auto &message : messages)
+                        bench::do_not_optimize(
+                          client->decrypt_group_message(inbound.get(), message));
+        });
+        std::printf("  %.0f events/s\n", batch / time * 1e6);
+
+        std::vector<GroupCiphertext> ciphertexts;
+        for (const auto &message : messages)
+                ciphertexts.push_back({inbound.get(), message});
+
+        const auto batch_name = std::string(name) + " in a batch";
+        const auto batch_time = bench::run(batch_name.c_str(), n, [&] {
+                bench::do_not_optimize(client->decrypt_group_messages(ciphertexts));
+        });
+        std::printf("  %.0f events/s\n", batch / batch_time * 1e6);
+}
+
+//! Messages of `session_count` rooms decrypted in one batch, on a growing number of threads.
+void
+run_rooms_case(std::size_t session_count, std::size_t n)
+{
+        auto client = std::make_shared<OlmClient>();
+        client->create_new_account();
+
+        std::vector<InboundGroupSessionPtr> sessions;
+        std::vector<std::string> messages;
+        for (std::size_t s = 0; s < session_count; ++s) {
+                auto outbound = client->init_outbound_group_session();
+                sessions.push_back(
+                  client->init_inbound_group_session(session_key(outbound.get())));
+                for (std::size_t i = 0; i < batch / session_count; ++i)
+                        messages.push_back(to_string(
+                          client->encrypt_group_message(outbound.get(), std::string(100, 'x'))));
+        }
+
+        std::vector<GroupCiphertext> ciphertexts;
+        for (std::size_t i = 0; i < messages.size(); ++i)
+                ciphertexts.push_back(
+                  {sessions[i / (batch / session_count)].get(), messages[i]});
+
+        for (const unsigned threads : {0U, 2U, 4U}) {
+                const auto name = std::to_string(session_count) + " rooms in a batch, " +
+                                  std::to_string(threads) + " threads";
+                const auto time = bench::run(name.c_str(), n, [&] {
+                        bench::do_not_optimize(
+                          client->decrypt_group_messages(ciphertexts, threads));
+                });
+                std::printf("  %.0f events/s\n", messages.size() / time * 1e6);
+        }
+}
+
+//! Messages of one busy room, with the session stored pickled between the events.
+void
+run_pickled_case(std::size_t n)
+{
+        auto client = std::make_shared<OlmClient>();
+        client->create_new_account();
+
+        auto outbound = client->init_outbound_group_session();
+        auto inbound  = client->init_inbound_group_session(session_key(outbound.get()));
+        const InboundSessionKey key{"!room:example.org", "sender", session_id(outbound.get())};
+        const auto pickled = pickle<InboundSessionObject>(inbound.get(), "secret");
+
+        std::vector<std::string> messages;
+        for (std::size_t i = 0; i < batch; ++i)
+                messages.push_back(
+                  to_string(client->encrypt_group_message(outbound.get(), std::string(100, 'x'))));
+
+        const auto unpickled = bench::run("unpickle for every event", n, [&] {
+                for (const auto &message : messages) {
+                        auto session = unpickle<InboundSessionObject>(pickled, "secret");
+                        bench::do_not_optimize(
+                          client->decrypt_group_message(session.get(), message));
+                }
+        });
+
+        InboundSessionCache cache(
+          100,
+          "secret",
+          [&](const InboundSessionKey &) -> std::optional<std::string> { return pickled; },
+          [](const InboundSessionKey &, const std::string &) {});
+        const auto cached = bench::run("InboundSessionCache", n, [&] {
+                for (const auto &message : messages)
+                        bench::do_not_optimize(cache.decrypt(*client, key, message));
+        });
+
+        const auto stats = cache.stats();
+        std::printf("  speedup: %.2fx, hits %llu, misses %llu\n",
+                    unpickled / cached,
+                    static_cast<unsigned long long>(stats.hits),
+                    static_cast<unsigned long long>(stats.misses));
+}
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 10);
+        std::printf("%zu events per run, %zu iterations\n\n", batch, n);
+
+        run_case("decrypt 100 byte events", 100, n);
+        run_case("decrypt 4 KiB events", 4096, n);
+        run_rooms_case(50, n);
+        run_pickled_case(n);
+
+        return 0;
+}
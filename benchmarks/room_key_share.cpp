@@ -0,0 +1,77 @@
+// Compares sharing a room key with the devices of a room by calling
+// OlmClient::create_olm_encrypted_content for every device, like the crypto bot example does,
+// against OlmClient::create_olm_encrypted_to_device_body on a growing number of threads.
+//
+// Usage: room_key_share_bench [iterations] [devices]
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "mtxclient/crypto/client.hpp"
+
+#include "benchmark.hpp"
+
+using json = nlohmann::json;
+using namespace mtx::crypto;
+
+int
+main(int argc, char **argv)
+{
+        const auto n                   = bench::iterations(argc, argv, 5);
+        const std::size_t device_count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500;
+
+        auto alice = std::make_shared<OlmClient>("@alice:example.org", "ALICEDEVICE");
+        alice->create_new_account();
+
+        // The sessions are only encrypted with, so one account of the other side is enough.
+        auto bob = std::make_shared<OlmClient>("@bob:example.org", "BOBDEVICE");
+        bob->create_new_account();
+        bob->generate_one_time_keys(device_count);
+        const auto bob_keys = bob->identity_keys();
+
+        std::vector<OlmSessionPtr> sessions;
+        std::vector<OlmRecipient> recipients;
+        for (const auto &[id, key] : bob->one_time_keys().curve25519) {
+                sessions.push_back(alice->create_outbound_session(bob_keys.curve25519, key));
+                recipients.push_back({"@user" + std::to_string(sessions.size()) + ":example.org",
+                                      "DEVICE",
+                                      bob_keys.ed25519,
+                                      bob_keys.curve25519,
+                                      sessions.back().get()});
+        }
+
+        const json room_key = {{"type", "m.room_key"},
+                               {"content",
+                                {{"algorithm", "m.megolm.v1.aes-sha2"},
+                                 {"room_id", "!room:example.org"},
+                                 {"session_id", std::string(43, 's')},
+                                 {"session_key", std::string(229, 'k')}}}};
+
+        std::printf("%zu devices, %zu iterations\n\n", recipients.size(), n);
+
+        const auto serial = bench::run("create_olm_encrypted_content per device", n, [&] {
+                json body;
+                for (const auto &r : recipients)
+                        body["messages"][r.user_id][r.device_id] =
+                          alice->create_olm_encrypted_content(
+                            r.session, room_key, UserId(r.user_id), r.ed25519, r.curve25519);
+                bench::do_not_optimize(body);
+        });
+
+        for (const unsigned threads : {0U, 1U, 2U, 4U, 8U}) {
+                const auto name =
+                  "create_olm_encrypted_to_device_body " + std::to_string(threads) + " threads";
+                const auto time = bench::run(name.c_str(), n, [&] {
+                        bench::do_not_optimize(alice->create_olm_encrypted_to_device_body(
+                          room_key, recipients, threads));
+                });
+                std::printf("  speedup: %.2fx\n", serial / time);
+        }
+
+        return 0;
+}
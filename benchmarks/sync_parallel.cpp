@@ -0,0 +1,44 @@
+// Compares decoding the rooms of a large /sync response on the parsing thread, against decoding
+// them on a number of threads.
+//
+// Usage: sync_parallel_bench [iterations]
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "mtx/responses/sync.hpp"
+
+#include "benchmark.hpp"
+
+namespace {
+constexpr std::size_t room_count = 5000;
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 5);
+
+        const auto data = bench::synthetic_sync(room_count);
+        std::printf("%zu rooms, %.1f MiB, %zu iterations, %u hardware threads\n\n",
+                    room_count,
+                    data.size() / 1024.0 / 1024.0,
+                    n,
+                    std::thread::hardware_concurrency());
+
+        const auto serial = bench::run("parse_sync", n, [&] {
+                bench::do_not_optimize(mtx::responses::parse_sync(data));
+        });
+
+        for (const unsigned threads : {1U, 2U, 4U, 8U, 16U}) {
+                const auto name = "parse_sync " + std::to_string(threads) + " decode threads";
+                const auto time = bench::run(name.c_str(), n, [&] {
+                        bench::do_not_optimize(
+                          mtx::responses::parse_sync(data, false, {}, threads));
+                });
+                std::printf("  speedup: %.2fx\n", serial / time);
+        }
+
+        return 0;
+}
@@ -0,0 +1,74 @@
+// Compares parsing a large /sync response into a json document and converting it, against
+// filling the Sync directly from the SAX events of the parser, with and without lazy events and
+// with a filter keeping the messages of 5 rooms. Besides the time, the peak heap usage of them is
+// measured.
+//
+// Usage: sync_parse_bench [iterations]
+
+#include <cstdio>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "mtx/responses/sync.hpp"
+
+#include "benchmark.hpp"
+#include "heap_tracking.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+constexpr std::size_t room_count = 2000;
+}
+
+int
+main(int argc, char **argv)
+{
+        const auto n = bench::iterations(argc, argv, 10);
+
+        const auto data = bench::synthetic_sync(room_count);
+        std::printf("%zu rooms, %.1f MiB, %zu iterations\n\n",
+                    room_count,
+                    data.size() / 1024.0 / 1024.0,
+                    n);
+
+        const auto dom_heap = bench::peak_heap(
+          [&] { bench::do_not_optimize(json::parse(data).get<mtx::responses::Sync>()); });
+        const auto sax_heap =
+          bench::peak_heap([&] { bench::do_not_optimize(mtx::responses::parse_sync(data)); });
+        mtx::responses::SyncParseFilter filter;
+        for (std::size_t i = 0; i < room_count; i += room_count / 5)
+                filter.rooms.insert("!room" + std::to_string(i) + ":example.org");
+        filter.event_types = {mtx::events::EventType::RoomMessage};
+
+        const auto lazy_heap =
+          bench::peak_heap([&] { bench::do_not_optimize(mtx::responses::parse_sync(data, true)); });
+        const auto filtered_heap = bench::peak_heap(
+          [&] { bench::do_not_optimize(mtx::responses::parse_sync(data, false, filter)); });
+
+        const auto dom = bench::run("json::parse + from_json", n, [&] {
+                bench::do_not_optimize(json::parse(data).get<mtx::responses::Sync>());
+        });
+        const auto sax = bench::run("parse_sync", n, [&] {
+                bench::do_not_optimize(mtx::responses::parse_sync(data));
+        });
+        const auto lazy = bench::run("parse_sync lazy events", n, [&] {
+                bench::do_not_optimize(mtx::responses::parse_sync(data, true));
+        });
+        const auto filtered = bench::run("parse_sync filtered", n, [&] {
+                bench::do_not_optimize(mtx::responses::parse_sync(data, false, filter));
+        });
+
+        std::printf("\npeak heap: json::parse + from_json %.1f MiB, parse_sync %.1f MiB, "
+                    "lazy events %.1f MiB, filtered %.1f MiB\n",
+                    dom_heap / 1024.0 / 1024.0,
+                    sax_heap / 1024.0 / 1024.0,
+                    lazy_heap / 1024.0 / 1024.0,
+                    filtered_heap / 1024.0 / 1024.0);
+        std::printf("speedup: parse_sync %.2fx, lazy events %.2fx, filtered %.2fx\n",
+                    dom / sax,
+                    dom / lazy,
+                    dom / filtered);
+
+        return 0;
+}
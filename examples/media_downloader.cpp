@@ -1,6 +1,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <variant>
 
 #include "mtx.hpp"
@@ -104,32 +105,38 @@ print_message(const TimelineEvent &event)
         if (auto url = get_url(event); !url.empty()) {
                 cout << "found url: " << url << "\n";
 
-                client->download(url,
-                                 [url](const std::string &data,
-                                       const std::string &content_type,
-                                       const std::string &original_filename,
-                                       RequestErr err) {
-                                         if (err) {
-                                                 cout << "download error:\n";
-                                                 print_errors(err);
-                                                 return;
-                                         }
-                                         std::string_view urlv = url;
-                                         urlv.remove_prefix(std::size("mxc://") - 1);
-                                         std::filesystem::path p(urlv);
-                                         std::filesystem::create_directories(p.parent_path());
-
-                                         ofstream file(p, std::ios::binary);
-                                         file.write(data.data(), data.size());
-
-                                         if (file.good())
-                                                 cout << "Wrote to: " << p
-                                                      << ", original filename was '"
-                                                      << original_filename << "', content_type '"
-                                                      << content_type << "'\n";
-                                         else
-                                                 cout << "Write to '" << p << "' failed!\n";
-                                 });
+                std::string_view urlv = url;
+                urlv.remove_prefix(std::size("mxc://") - 1);
+                std::filesystem::path p(urlv);
+                std::filesystem::create_directories(p.parent_path());
+
+                // Write the file as it arrives, instead of keeping it in memory.
+                auto file = std::make_shared<ofstream>(p, std::ios::binary);
+
+                client->download(
+                  url,
+                  [file](const char *data, std::size_t size) {
+                          file->write(data, size);
+                          return file->good();
+                  },
+                  [file, p](const std::string &content_type,
+                            const std::string &original_filename,
+                            RequestErr err) {
+                          if (err) {
+                                  cout << "download error:\n";
+                                  print_errors(err);
+                                  return;
+                          }
+
+                          file->close();
+
+                          if (file->good())
+                                  cout << "Wrote to: " << p << ", original filename was '"
+                                       << original_filename << "', content_type '" << content_type
+                                       << "'\n";
+                          else
+                                  cout << "Write to '" << p << "' failed!\n";
+                  });
         }
 }
 
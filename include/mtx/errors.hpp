@@ -3,6 +3,8 @@
 /// @file
 /// @brief The error struct returned by the Matrix API.
 
+#include <cstdint>
+
 #include "lightweight_error.hpp"
 #include "user_interactive.hpp"
 
@@ -18,6 +20,9 @@ struct Error
 
         //! Auth flows in case of 401
         user_interactive::Unauthorized unauthorized;
+        //! How long to wait before retrying a request rejected with M_LIMIT_EXCEEDED, in
+        //! milliseconds. 0 if the server didn't say.
+        std::uint64_t retry_after_ms = 0;
 };
 
 void
@@ -10,6 +10,8 @@
 #endif
 
 #include <string>
+#include <string_view>
+
 namespace mtx {
 namespace events {
 
@@ -115,6 +117,10 @@ enum class EventType
 std::string
 to_string(EventType type);
 
+//! Parse a string into an event type. Takes constant time, independent of the type.
+EventType
+getEventType(std::string_view type);
+
 //! Parse a string into an event type.
 EventType
 getEventType(const std::string &type);
@@ -11,6 +11,8 @@
 
 #include <string>
 
+#include "mtx/flat_map.hpp"
+
 namespace mtx {
 namespace events {
 namespace state {
@@ -59,10 +61,11 @@ struct PowerLevels
         //! Returns the power_level for a given user id.
         inline power_level_t user_level(const std::string &user_id) const
         {
-                if (users.find(user_id) == users.end())
+                auto it = users.find(user_id);
+                if (it == users.end())
                         return users_default;
 
-                return users.at(user_id);
+                return it->second;
         }
 
         //! The level required to ban a user. Defaults to **50** if unspecified.
@@ -87,10 +90,10 @@ struct PowerLevels
         power_level_t state_default = Moderator;
         //! The level required to send specific event types.
         //! This is a mapping from event type to power level required.
-        std::map<std::string, power_level_t> events;
+        mtx::common::Map<std::string, power_level_t> events;
         //! The power levels for specific users.
         //! This is a mapping from user_id to power level for that user.
-        std::map<std::string, power_level_t> users;
+        mtx::common::Map<std::string, power_level_t> users;
 };
 
 void
@@ -15,6 +15,45 @@ template<typename Content>
 struct can_edit<Content, std::void_t<decltype(Content::relations)>>
   : std::is_same<decltype(Content::relations), mtx::common::Relations>
 {};
+
+//! Keys of `m.new_content`, that don't replace the ones of the edited content.
+inline bool
+keeps_original(const std::string &key)
+{
+        return key == "m.relates_to" || key == "im.nheko.relations.v1.relations";
+}
+
+//! The content of an edit: the keys of `m.new_content` over the ones of `content`, except for the
+//! relations. Every value is copied once, the replaced values of `content` aren't copied at all.
+//! Of `m.new_content` itself only the relations are kept, unless `full_new_content` is set,
+//! because only parse_relations() looks at it.
+inline json
+edited_content(const json &content, bool full_new_content)
+{
+        const auto &new_content = content.at("m.new_content");
+
+        json merged = json::object();
+        for (const auto &e : content.items()) {
+                if (e.key() == "m.new_content") {
+                        if (full_new_content)
+                                merged[e.key()] = e.value();
+                        else if (auto rel = e.value().find("m.relates_to"); rel != e.value().end())
+                                merged[e.key()]["m.relates_to"] = *rel;
+                        continue;
+                }
+
+                auto replacement = new_content.find(e.key());
+                if (replacement != new_content.end() && !keeps_original(e.key()))
+                        merged[e.key()] = *replacement;
+                else
+                        merged[e.key()] = e.value();
+        }
+        for (const auto &e : new_content.items())
+                if (!keeps_original(e.key()) && !content.contains(e.key()))
+                        merged[e.key()] = e.value();
+
+        return merged;
+}
 }
 
 template<class Content>
@@ -33,19 +72,15 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 from_json(const json &obj, Event<Content> &event)
 {
-        if (obj.at("content").contains("m.new_content")) {
-                auto new_content = obj.at("content");
-                for (const auto &e : obj["content"]["m.new_content"].items()) {
-                        if (e.key() != "m.relates_to" &&
-                            e.key() != "im.nheko.relations.v1.relations")
-                                new_content[e.key()] = e.value();
-                }
-                event.content = new_content.get<Content>();
-        } else {
-                event.content = obj.at("content").get<Content>();
-        }
+        const auto &content = obj.at("content");
+        if (content.contains("m.new_content"))
+                // Unknown keeps the whole content as text.
+                event.content = detail::edited_content(content, std::is_same_v<Unknown, Content>)
+                                  .template get<Content>();
+        else
+                event.content = content.get<Content>();
 
-        event.type   = getEventType(obj.at("type").get<std::string>());
+        event.type   = getEventType(obj.at("type").get_ref<const std::string &>());
         event.sender = obj.value("sender", "");
 
         if constexpr (std::is_same_v<Unknown, Content>)
@@ -56,19 +91,18 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 from_json(const json &obj, DeviceEvent<Content> &event)
 {
-        Event<Content> base_event = event;
-        from_json(obj, base_event);
-        event.content = base_event.content;
-        event.type    = base_event.type;
-        event.sender  = obj.at("sender");
+        Event<Content> &base = event;
+        from_json(obj, base);
+
+        event.sender = obj.at("sender").get<std::string>();
 }
 
 template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const DeviceEvent<Content> &event)
 {
-        Event<Content> base_event = event;
-        to_json(obj, base_event);
+        const Event<Content> &base = event;
+        to_json(obj, base);
 
         obj["sender"] = event.sender;
 }
@@ -132,8 +166,8 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const StrippedEvent<Content> &event)
 {
-        Event<Content> base_event = event;
-        to_json(obj, base_event);
+        const Event<Content> &base = event;
+        to_json(obj, base);
 
         obj["state_key"] = event.state_key;
 }
@@ -160,8 +194,8 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const RoomEvent<Content> &event)
 {
-        Event<Content> base_event = event;
-        to_json(obj, base_event);
+        const Event<Content> &base = event;
+        to_json(obj, base);
 
         if (!event.room_id.empty())
                 obj["room_id"] = event.room_id;
@@ -175,8 +209,8 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const StateEvent<Content> &event)
 {
-        RoomEvent<Content> base_event = event;
-        to_json(obj, base_event);
+        const RoomEvent<Content> &base = event;
+        to_json(obj, base);
 
         obj["state_key"] = event.state_key;
 }
@@ -195,8 +229,8 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const RedactionEvent<Content> &event)
 {
-        RoomEvent<Content> base_event = event;
-        to_json(obj, base_event);
+        const RoomEvent<Content> &base = event;
+        to_json(obj, base);
 
         obj["redacts"] = event.redacts;
 }
@@ -215,8 +249,8 @@ template<class Content>
 [[gnu::used, llvm::used]] void
 to_json(json &obj, const EncryptedEvent<Content> &event)
 {
-        RoomEvent<Content> base_event = event;
-        to_json(obj, base_event);
+        const RoomEvent<Content> &base = event;
+        to_json(obj, base);
 }
 
 template<class Content>
@@ -246,7 +280,7 @@ template<class Content>
 from_json(const json &obj, EphemeralEvent<Content> &event)
 {
         event.content = obj.at("content").get<Content>();
-        event.type    = getEventType(obj.at("type").get<std::string>());
+        event.type    = getEventType(obj.at("type").get_ref<const std::string &>());
         if constexpr (std::is_same_v<Unknown, Content>)
                 event.content.type = obj.at("type").get<std::string>();
 
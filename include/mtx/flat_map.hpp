@@ -0,0 +1,273 @@
+#pragma once
+
+/// @file
+/// @brief A map, that keeps its entries sorted in a single contiguous array.
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace mtx {
+namespace common {
+
+//! An ordered map stored as a sorted vector of key value pairs.
+//!
+//! Lookups are a binary search over contiguous memory and iteration walks an array, instead of
+//! following the nodes of a tree. It offers the interface of std::map, that the response structs
+//! need, with the same iteration order. Inserting or erasing entries in the middle moves the
+//! entries after them and invalidates all iterators and references, so maps, that are built in
+//! bulk, should be filled with a single insert of a range.
+template<class Key, class T, class Compare = std::less<>>
+class FlatMap
+{
+public:
+        using key_type               = Key;
+        using mapped_type            = T;
+        using value_type             = std::pair<Key, T>;
+        using key_compare            = Compare;
+        using container_type         = std::vector<value_type>;
+        using size_type              = typename container_type::size_type;
+        using difference_type        = typename container_type::difference_type;
+        using reference              = value_type &;
+        using const_reference        = const value_type &;
+        using iterator               = typename container_type::iterator;
+        using const_iterator         = typename container_type::const_iterator;
+        using reverse_iterator       = typename container_type::reverse_iterator;
+        using const_reverse_iterator = typename container_type::const_reverse_iterator;
+
+        FlatMap() = default;
+        template<class InputIt>
+        FlatMap(InputIt first, InputIt last)
+        {
+                insert(first, last);
+        }
+        FlatMap(std::initializer_list<value_type> values) { insert(values.begin(), values.end()); }
+
+        FlatMap &operator=(std::initializer_list<value_type> values)
+        {
+                clear();
+                insert(values.begin(), values.end());
+                return *this;
+        }
+
+        iterator begin() noexcept { return data_.begin(); }
+        const_iterator begin() const noexcept { return data_.begin(); }
+        const_iterator cbegin() const noexcept { return data_.cbegin(); }
+        iterator end() noexcept { return data_.end(); }
+        const_iterator end() const noexcept { return data_.end(); }
+        const_iterator cend() const noexcept { return data_.cend(); }
+        reverse_iterator rbegin() noexcept { return data_.rbegin(); }
+        const_reverse_iterator rbegin() const noexcept { return data_.rbegin(); }
+        reverse_iterator rend() noexcept { return data_.rend(); }
+        const_reverse_iterator rend() const noexcept { return data_.rend(); }
+
+        bool empty() const noexcept { return data_.empty(); }
+        size_type size() const noexcept { return data_.size(); }
+        size_type max_size() const noexcept { return data_.max_size(); }
+        size_type capacity() const noexcept { return data_.capacity(); }
+        void reserve(size_type n) { data_.reserve(n); }
+        void shrink_to_fit() { data_.shrink_to_fit(); }
+        void clear() noexcept { data_.clear(); }
+        void swap(FlatMap &other) noexcept { data_.swap(other.data_); }
+
+        key_compare key_comp() const { return Compare{}; }
+
+        template<class K>
+        iterator lower_bound(const K &key)
+        {
+                return std::lower_bound(begin(), end(), key, KeyLess{});
+        }
+        template<class K>
+        const_iterator lower_bound(const K &key) const
+        {
+                return std::lower_bound(begin(), end(), key, KeyLess{});
+        }
+        template<class K>
+        iterator upper_bound(const K &key)
+        {
+                return std::upper_bound(begin(), end(), key, KeyLess{});
+        }
+        template<class K>
+        const_iterator upper_bound(const K &key) const
+        {
+                return std::upper_bound(begin(), end(), key, KeyLess{});
+        }
+        template<class K>
+        iterator find(const K &key)
+        {
+                auto it = lower_bound(key);
+                return it != end() && !Compare{}(key, it->first) ? it : end();
+        }
+        template<class K>
+        const_iterator find(const K &key) const
+        {
+                auto it = lower_bound(key);
+                return it != end() && !Compare{}(key, it->first) ? it : end();
+        }
+        template<class K>
+        size_type count(const K &key) const
+        {
+                return find(key) != end() ? 1 : 0;
+        }
+
+        template<class K>
+        T &at(const K &key)
+        {
+                auto it = find(key);
+                if (it == end())
+                        throw std::out_of_range("FlatMap::at");
+                return it->second;
+        }
+        template<class K>
+        const T &at(const K &key) const
+        {
+                auto it = find(key);
+                if (it == end())
+                        throw std::out_of_range("FlatMap::at");
+                return it->second;
+        }
+
+        T &operator[](const Key &key) { return try_emplace(key).first->second; }
+        T &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
+
+        template<class K, class... Args>
+        std::pair<iterator, bool> try_emplace(K &&key, Args &&... args)
+        {
+                auto it = lower_bound(key);
+                if (it != end() && !Compare{}(key, it->first))
+                        return {it, false};
+
+                it = data_.emplace(it,
+                                   std::piecewise_construct,
+                                   std::forward_as_tuple(std::forward<K>(key)),
+                                   std::forward_as_tuple(std::forward<Args>(args)...));
+                return {it, true};
+        }
+        template<class K, class M>
+        std::pair<iterator, bool> insert_or_assign(K &&key, M &&value)
+        {
+                auto result = try_emplace(std::forward<K>(key), std::forward<M>(value));
+                if (!result.second)
+                        result.first->second = std::forward<M>(value);
+                return result;
+        }
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args &&... args)
+        {
+                return insert(value_type(std::forward<Args>(args)...));
+        }
+
+        std::pair<iterator, bool> insert(const value_type &value)
+        {
+                return insert(value_type(value));
+        }
+        std::pair<iterator, bool> insert(value_type &&value)
+        {
+                auto it = lower_bound(value.first);
+                if (it != end() && !Compare{}(value.first, it->first))
+                        return {it, false};
+                return {data_.insert(it, std::move(value)), true};
+        }
+        //! Insert `value` before `hint`, if that is where it belongs. Inserting sorted values at
+        //! the end, like std::inserter does, doesn't need to search.
+        iterator insert(const_iterator hint, value_type &&value)
+        {
+                if ((hint == end() || Compare{}(value.first, hint->first)) &&
+                    (hint == begin() || Compare{}(std::prev(hint)->first, value.first)))
+                        return data_.insert(hint, std::move(value));
+                return insert(std::move(value)).first;
+        }
+        iterator insert(const_iterator hint, const value_type &value)
+        {
+                return insert(hint, value_type(value));
+        }
+        //! Insert a range of values at once, sorting them instead of inserting one by one. Like
+        //! with std::map, keys, that are in the map already or repeated, keep their first value.
+        template<class InputIt>
+        void insert(InputIt first, InputIt last)
+        {
+                const auto old_size = data_.size();
+                data_.insert(data_.end(), first, last);
+
+                auto middle = data_.begin() + static_cast<difference_type>(old_size);
+                if (!std::is_sorted(middle, data_.end(), ValueLess{}))
+                        std::stable_sort(middle, data_.end(), ValueLess{});
+                if (old_size != 0)
+                        std::inplace_merge(data_.begin(), middle, data_.end(), ValueLess{});
+                data_.erase(std::unique(data_.begin(),
+                                        data_.end(),
+                                        [](const value_type &a, const value_type &b) {
+                                                return !Compare{}(a.first, b.first);
+                                        }),
+                            data_.end());
+        }
+        void insert(std::initializer_list<value_type> values)
+        {
+                insert(values.begin(), values.end());
+        }
+
+        iterator erase(const_iterator pos) { return data_.erase(pos); }
+        iterator erase(iterator pos) { return data_.erase(pos); }
+        iterator erase(const_iterator first, const_iterator last)
+        {
+                return data_.erase(first, last);
+        }
+        size_type erase(const Key &key)
+        {
+                auto it = find(key);
+                if (it == end())
+                        return 0;
+                data_.erase(it);
+                return 1;
+        }
+
+        friend bool operator==(const FlatMap &a, const FlatMap &b) { return a.data_ == b.data_; }
+        friend bool operator!=(const FlatMap &a, const FlatMap &b) { return a.data_ != b.data_; }
+        friend bool operator<(const FlatMap &a, const FlatMap &b) { return a.data_ < b.data_; }
+        friend void swap(FlatMap &a, FlatMap &b) noexcept { a.swap(b); }
+
+private:
+        struct KeyLess
+        {
+                template<class K>
+                bool operator()(const value_type &value, const K &key) const
+                {
+                        return Compare{}(value.first, key);
+                }
+                template<class K>
+                bool operator()(const K &key, const value_type &value) const
+                {
+                        return Compare{}(key, value.first);
+                }
+        };
+        struct ValueLess
+        {
+                bool operator()(const value_type &a, const value_type &b) const
+                {
+                        return Compare{}(a.first, b.first);
+                }
+        };
+
+        container_type data_;
+};
+
+//! The map used for collections in the responses, that are keyed by ids and can get large, like
+//! the rooms of a sync or the devices of the users. It is a FlatMap, unless the library is built
+//! with MTX_USE_STD_MAP (the USE_STD_MAP cmake option), which switches back to std::map.
+#ifdef MTX_USE_STD_MAP
+template<class Key, class T>
+using Map = std::map<Key, T, std::less<>>;
+#else
+template<class Key, class T>
+using Map = FlatMap<Key, T>;
+#endif
+
+} // namespace common
+} // namespace mtx
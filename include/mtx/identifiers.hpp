@@ -9,31 +9,56 @@
 #include <nlohmann/json.hpp>
 #endif
 
+#include <cstdint>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 
 namespace mtx {
 namespace identifiers {
 
 //! Base class for all the identifiers.
 //
-//! Each identifier has the following format `(sigil)``(localpart)`:`(hostname)`.
+//! Each identifier has the following format `(sigil)``(localpart)`:`(hostname)`. It is stored as
+//! one string and the position of the `:`, or as a pointer to a string in the table of interned
+//! identifiers, which is shared by all the identifiers with the same text. See intern().
 class ID
 {
 public:
         //! Returns the unique local part of the identifier.
-        std::string localpart() const { return localpart_; }
+        std::string localpart() const
+        {
+                const auto id = view();
+                return separator_ ? std::string(id.substr(1, separator_ - 1)) : std::string(id);
+        }
         //! Returns the name of the originating homeserver.
-        std::string hostname() const { return hostname_; }
+        std::string hostname() const
+        {
+                const auto id = view();
+                return separator_ ? std::string(id.substr(separator_ + 1)) : std::string(id);
+        }
         //! Returns the whole identifier (localpart + hostname).
-        std::string to_string() const { return id_; }
+        std::string to_string() const { return std::string(view()); }
+        //! Returns the whole identifier without copying it.
+        std::string_view view() const { return interned_ ? *interned_ : id_; }
+        //! Whether the identifier is stored in the table of interned identifiers.
+        bool is_interned() const { return interned_ != nullptr; }
 
 protected:
-        //! Local part of the identifier.
-        std::string localpart_;
-        //! The name of the originating homeserver.
-        std::string hostname_;
-        //! The whole identifier.
+        //! Whether two identifiers have the same text. Interned identifiers compare by pointer.
+        static bool equal(const ID &a, const ID &b)
+        {
+                if (a.interned_ && b.interned_)
+                        return a.interned_ == b.interned_;
+                return a.view() == b.view();
+        }
+
+        //! The whole identifier, unless it is interned.
         std::string id_;
+        //! The whole identifier in the table of interned identifiers.
+        const std::string *interned_ = nullptr;
+        //! Position of the `:` between the localpart and the hostname, 0 if there is none.
+        std::uint32_t separator_ = 0;
 };
 
 //! An event id.
@@ -42,10 +67,14 @@ class Event : public ID
 public:
         template<typename Identifier>
         friend Identifier parse(const std::string &id);
+        template<typename Identifier>
+        friend Identifier intern(const std::string &id);
+        friend bool operator==(const Event &a, const Event &b) { return equal(a, b); }
+        friend bool operator!=(const Event &a, const Event &b) { return !equal(a, b); }
 
 private:
         //! The `sigil` used to represent an Event.
-        std::string sigil = "$";
+        static constexpr char sigil = '$';
 };
 
 //! A room id.
@@ -54,9 +83,13 @@ class Room : public ID
 public:
         template<typename Identifier>
         friend Identifier parse(const std::string &id);
+        template<typename Identifier>
+        friend Identifier intern(const std::string &id);
+        friend bool operator==(const Room &a, const Room &b) { return equal(a, b); }
+        friend bool operator!=(const Room &a, const Room &b) { return !equal(a, b); }
 
 private:
-        std::string sigil = "!";
+        static constexpr char sigil = '!';
 };
 
 //! A user id.
@@ -65,12 +98,35 @@ class User : public ID
 public:
         template<typename Identifier>
         friend Identifier parse(const std::string &id);
-        friend bool operator<(const User &a, const User &b) { return a.id_ < b.id_; }
+        template<typename Identifier>
+        friend Identifier intern(const std::string &id);
+        friend bool operator<(const User &a, const User &b) { return a.view() < b.view(); }
+        friend bool operator==(const User &a, const User &b) { return equal(a, b); }
+        friend bool operator!=(const User &a, const User &b) { return !equal(a, b); }
 
 private:
-        std::string sigil = "@";
+        static constexpr char sigil = '@';
 };
 
+namespace detail {
+//! Position of the `:` in `id`, 0 if there is none.
+//! \throws std::invalid_argument if `id` doesn't start with `sigil`.
+inline std::uint32_t
+separator(const std::string &id, char sigil)
+{
+        if (id.front() != sigil)
+                throw std::invalid_argument(id + ": missing sigil " + sigil + "\n");
+
+        // V3 event ids don't use ':' at all, don't parse them the same way.
+        const auto pos = id.find_first_of(':');
+        return pos != std::string::npos ? static_cast<std::uint32_t>(pos) : 0;
+}
+
+//! The copy of `id` in the table of interned identifiers. Thread safe.
+const std::string *
+intern(std::string_view id);
+}
+
 //! Parses the given string into a @p Identifier.
 //! \param id String to parse.
 //! \returns The parsed @p Identifier.
@@ -88,23 +144,29 @@ parse(const std::string &id)
                 return identifier;
         }
 
-        if (std::string(1, id.at(0)) != identifier.sigil)
-                throw std::invalid_argument(
-                  std::string(id + ": missing sigil " + identifier.sigil + "\n"));
-
-        const auto parts = id.find_first_of(':');
-
-        // Split into localpart and server.
-        if (parts != std::string::npos) {
-                identifier.localpart_ = id.substr(1, parts - 1);
-                identifier.hostname_  = id.substr(parts + 1);
-                identifier.id_        = id;
-        } else {
-                // V3 event ids don't use ':' at all, don't parse them the same way.
-                identifier.localpart_ = id;
-                identifier.hostname_  = id;
-                identifier.id_        = id;
-        }
+        identifier.separator_ = detail::separator(id, Identifier::sigil);
+        identifier.id_        = id;
+
+        return identifier;
+}
+
+//! Parses the given string into a @p Identifier, that is stored in a process wide table of
+//! interned identifiers. Every identifier with the same text shares the same copy of it, so
+//! copies don't allocate and comparisons between interned identifiers compare a pointer. The
+//! table is never emptied, so this is meant for ids, that are seen over and over again, like
+//! the ids of the members of the rooms.
+//! \throws std::invalid_argument in case of invalid input.
+template<typename Identifier>
+Identifier
+intern(const std::string &id)
+{
+        Identifier identifier;
+
+        if (id.empty())
+                return identifier;
+
+        identifier.separator_ = detail::separator(id, Identifier::sigil);
+        identifier.interned_  = detail::intern(id);
 
         return identifier;
 }
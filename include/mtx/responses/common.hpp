@@ -81,6 +81,10 @@ log_error(std::exception &err, const nlohmann::json &event);
 void
 log_error(std::string err, const nlohmann::json &event);
 
+//! Parse a single account_data event and append it to the container, unless it is invalid.
+void
+parse_room_account_data_event(const nlohmann::json &event, RoomAccountDataEvents &container);
+
 //! Parse multiple account_data events.
 void
 parse_room_account_data_events(const nlohmann::json &events, RoomAccountDataEvents &container);
@@ -88,22 +92,42 @@ parse_room_account_data_events(const nlohmann::json &events, RoomAccountDataEven
 void
 compose_timeline_events(nlohmann::json &events, const TimelineEvents &container);
 
+//! Parse a single timeline event and append it to the container, unless it is invalid.
+void
+parse_timeline_event(const nlohmann::json &event, TimelineEvents &container);
+
 //! Parse multiple timeline events.
 void
 parse_timeline_events(const nlohmann::json &events, TimelineEvents &container);
 
+//! Parse a single state event and append it to the container, unless it is invalid.
+void
+parse_state_event(const nlohmann::json &event, StateEvents &container);
+
 //! Parse multiple state events.
 void
 parse_state_events(const nlohmann::json &events, StateEvents &container);
 
+//! Parse a single stripped event and append it to the container, unless it is invalid.
+void
+parse_stripped_event(const nlohmann::json &event, StrippedEvents &container);
+
 //! Parse multiple stripped events.
 void
 parse_stripped_events(const nlohmann::json &events, StrippedEvents &container);
 
+//! Parse a single device event and append it to the container, unless it is invalid.
+void
+parse_device_event(const nlohmann::json &event, DeviceEvents &container);
+
 //! Parse multiple device events.
 void
 parse_device_events(const nlohmann::json &events, DeviceEvents &container);
 
+//! Parse a single ephemeral event and append it to the container, unless it is invalid.
+void
+parse_ephemeral_event(const nlohmann::json &event, EphemeralEvents &container);
+
 //! Parse multiple ephemeral events.
 void
 parse_ephemeral_events(const nlohmann::json &events, EphemeralEvents &container);
@@ -10,6 +10,7 @@
 #endif
 
 #include "mtx/common.hpp"
+#include "mtx/flat_map.hpp"
 #include "mtx/lightweight_error.hpp"
 
 #include <map>
@@ -28,7 +29,7 @@ struct UploadKeys
 void
 from_json(const nlohmann::json &obj, UploadKeys &response);
 
-using DeviceToKeysMap = std::map<std::string, mtx::crypto::DeviceKeys>;
+using DeviceToKeysMap = mtx::common::Map<std::string, mtx::crypto::DeviceKeys>;
 
 //! Response from the `POST /_matrix/client/r0/keys/query` endpoint.
 struct QueryKeys
@@ -41,7 +42,7 @@ struct QueryKeys
         //! A map from user ID, to a map from device ID to device information.
         //! For each device, the information returned will be the same
         //! as uploaded via /keys/upload, with the addition of an unsigned property
-        std::map<std::string, DeviceToKeysMap> device_keys;
+        mtx::common::Map<std::string, DeviceToKeysMap> device_keys;
         //! A map from user ID, to information about master_keys.
         std::map<std::string, mtx::crypto::CrossSigningKeys> master_keys;
         //! A map from user ID, to information about user_signing_keys.
@@ -75,7 +76,7 @@ struct ClaimKeys
         std::map<std::string, nlohmann::json> failures;
         //! One-time keys for the queried devices. A map from user ID,
         //! to a map from <algorithm>:<key_id> to the key object.
-        std::map<std::string, std::map<std::string, nlohmann::json>> one_time_keys;
+        mtx::common::Map<std::string, mtx::common::Map<std::string, nlohmann::json>> one_time_keys;
 };
 
 void
@@ -152,7 +153,7 @@ to_json(nlohmann::json &obj, const RoomKeysBackup &response);
 struct KeysBackup
 {
         //! map of room id to map of session ids to backups of individual sessions
-        std::map<std::string, RoomKeysBackup> rooms;
+        mtx::common::Map<std::string, RoomKeysBackup> rooms;
 };
 void
 from_json(const nlohmann::json &obj, KeysBackup &response);
@@ -3,11 +3,15 @@
 /// @file
 /// @brief Response from the /sync API.
 
-#include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "mtx/events/collections.hpp"
+#include "mtx/flat_map.hpp"
 
 #if __has_include(<nlohmann/json_fwd.hpp>)
 #include <nlohmann/json_fwd.hpp>
@@ -28,11 +32,53 @@ struct AccountData
 void
 from_json(const nlohmann::json &obj, AccountData &account_data);
 
+//! Memory for the text of the lazily parsed events of a Sync. The text is copied into a few
+//! large blocks, that are released together, instead of being allocated string by string.
+class SyncArena
+{
+public:
+        //! Copy `text` into the arena. The copy lives as long as the arena.
+        std::string_view store(std::string_view text);
+        //! Take over the blocks of `other`, so that the text stored there lives as long as this
+        //! arena.
+        void adopt(SyncArena &&other);
+        //! The number of bytes allocated for the blocks.
+        std::size_t capacity() const { return capacity_; }
+
+private:
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        char *pos_            = nullptr;
+        char *end_            = nullptr;
+        std::size_t capacity_ = 0;
+};
+
+//! An event of a /sync response parsed with lazy events. Only the fields needed to pick the
+//! events of interest are extracted, the event itself is kept as json text until it is decoded.
+//! The text is stored in the SyncArena of the Sync, which the State or Timeline holding the event
+//! keeps alive.
+struct RawEvent
+{
+        //! The type of the event.
+        events::EventType type = events::EventType::Unsupported;
+        //! The sender of the event.
+        std::string_view sender;
+        //! The id of the event.
+        std::string_view event_id;
+        //! The state key, if it is a state event.
+        std::optional<std::string_view> state_key;
+        //! The whole event as json.
+        std::string_view json;
+};
+
 //! State events.
 struct State
 {
         //! List of events.
         std::vector<events::collections::StateEvents> events;
+        //! The events, if the response was parsed with lazy events. `events` is empty then.
+        std::vector<RawEvent> raw_events;
+        //! The text of `raw_events`, so that copies of the state outlive the Sync.
+        std::shared_ptr<SyncArena> arena;
 };
 
 void
@@ -43,6 +89,10 @@ struct Timeline
 {
         //! List of events.
         std::vector<events::collections::TimelineEvents> events;
+        //! The events, if the response was parsed with lazy events. `events` is empty then.
+        std::vector<RawEvent> raw_events;
+        //! The text of `raw_events`, so that copies of the timeline outlive the Sync.
+        std::shared_ptr<SyncArena> arena;
         //! A token that can be supplied to to the from parameter of
         //! the rooms/{roomId}/messages endpoint.
         std::string prev_batch;
@@ -132,11 +182,11 @@ from_json(const nlohmann::json &obj, InvitedRoom &room);
 struct Rooms
 {
         //! The rooms that the user has joined.
-        std::map<std::string, JoinedRoom> join;
+        mtx::common::Map<std::string, JoinedRoom> join;
         //! The rooms that the user has left or been banned from.
-        std::map<std::string, LeftRoom> leave;
+        mtx::common::Map<std::string, LeftRoom> leave;
         //! The rooms that the user has been invited to.
-        std::map<std::string, InvitedRoom> invite;
+        mtx::common::Map<std::string, InvitedRoom> invite;
 };
 
 void
@@ -182,12 +232,66 @@ struct Sync
         DeviceLists device_lists;
         //! A mapping from algorithm to the number of one time keys
         //! the server has for the current device.
-        std::map<std::string, uint16_t> device_one_time_keys_count;
+        mtx::common::Map<std::string, uint16_t> device_one_time_keys_count;
         //! global account data
         AccountData account_data;
+        //! The text of the lazily parsed events. Shared by the copies of the Sync and the states
+        //! and timelines of its rooms.
+        std::shared_ptr<SyncArena> arena;
 };
 
 void
 from_json(const nlohmann::json &obj, Sync &response);
+
+//! Restricts the rooms and room events, that parse_sync keeps. Unlike the filter of the /sync
+//! request, this is applied by the client, so it also works when the server can't express or
+//! ignores a filter. Everything else is skipped while parsing, without being converted or checked.
+struct SyncParseFilter
+{
+        //! The ids of the rooms to keep. All rooms are kept, if it is empty.
+        std::set<std::string> rooms;
+        //! The types of the room events to keep, in the state, timeline, ephemeral, account data
+        //! and invite state of the rooms. All of them are kept, if it is empty.
+        std::set<events::EventType> event_types;
+
+        //! Whether everything is kept.
+        bool empty() const { return rooms.empty() && event_types.empty(); }
+};
+
+//! Parse a /sync response without building a json document of the whole response first. Only
+//! single events and small values are turned into json values, before they are converted.
+//! Gives the same result as converting `nlohmann::json::parse(data)` and throws the same
+//! exceptions.
+//!
+//! With `lazy_events` the state and timeline events of the rooms are only stored as RawEvent,
+//! so that the cost of converting them is only paid for the events, that are decoded. Their text
+//! is stored in the `arena` of the Sync.
+//!
+//! Only the rooms and room events selected by `filter` are kept.
+//!
+//! With `decode_threads` the rooms are decoded on that many threads, while the rest of the
+//! response is read on the calling thread. The result doesn't depend on the order the rooms are
+//! decoded in. If the response has more than one error, the one thrown may differ.
+Sync
+parse_sync(const std::string &data,
+           bool lazy_events              = false,
+           const SyncParseFilter &filter = {},
+           unsigned decode_threads       = 0);
+
+//! Decode a lazily parsed timeline event. Empty, if it isn't a valid timeline event.
+std::optional<events::collections::TimelineEvents>
+decode_timeline_event(const RawEvent &event);
+
+//! Decode a lazily parsed state event. Empty, if it isn't a valid state event.
+std::optional<events::collections::StateEvents>
+decode_state_event(const RawEvent &event);
+
+//! Decode all the raw events of the timeline into its events.
+void
+decode_events(Timeline &timeline);
+
+//! Decode all the raw events of the state into its events.
+void
+decode_events(State &state);
 }
 }
@@ -7,6 +7,8 @@
 #include <exception>
 #include <memory>
 #include <new>
+#include <string_view>
+#include <vector>
 
 #if __has_include(<nlohmann/json_fwd.hpp>)
 #include <nlohmann/json_fwd.hpp>
@@ -112,7 +114,7 @@ template<class T>
 std::string
 pickle(typename T::olm_type *object, const std::string &key)
 {
-        auto tmp       = create_buffer(T::pickle_length(object));
+        auto tmp       = create_scratch_buffer(T::pickle_length(object));
         const auto ret = T::pickle(object, key.data(), key.size(), tmp.data(), tmp.size());
 
         if (ret == olm_error())
@@ -147,6 +149,40 @@ struct GroupPlaintext
         uint32_t message_index;
 };
 
+//! A megolm message to decrypt with OlmClient::decrypt_group_messages().
+struct GroupCiphertext
+{
+        //! The inbound session of the message.
+        OlmInboundGroupSession *session = nullptr;
+        //! The ciphertext of the message. It has to stay valid until the messages are decrypted.
+        std::string_view ciphertext;
+};
+
+//! A device to send an olm encrypted event to with
+//! OlmClient::create_olm_encrypted_to_device_body().
+struct OlmRecipient
+{
+        //! The user of the device.
+        std::string user_id;
+        //! The id of the device.
+        std::string device_id;
+        //! The ed25519 key of the device.
+        std::string ed25519;
+        //! The curve25519 key of the device.
+        std::string curve25519;
+        //! The outbound olm session with the device.
+        OlmSession *session = nullptr;
+};
+
+//! Return value for every message decrypted with OlmClient::decrypt_group_messages().
+struct GroupDecryptionResult
+{
+        //! The plain text and message index, if the message was decrypted.
+        GroupPlaintext plaintext{};
+        //! Why olm couldn't decrypt the message, SUCCESS if it could.
+        OlmErrorCode error = OlmErrorCode::SUCCESS;
+};
+
 //! Helper to generate Short Authentication Strings (SAS)
 struct SAS
 {
@@ -254,6 +290,18 @@ public:
         GroupPlaintext decrypt_group_message(OlmInboundGroupSession *session,
                                              const std::string &message,
                                              uint32_t message_index = 0);
+        /// @brief Decrypt a batch of megolm messages, for example the events of a sync.
+        ///
+        /// A message, that can't be decrypted, doesn't stop the batch, its result holds the
+        /// error instead. The messages share scratch space per thread, so only the plain texts
+        /// are allocated. With `threads` the sessions are decrypted on that many threads; the
+        /// messages of one session are always decrypted one after another in their order. The
+        /// threads are started for every batch, so only the calling thread reuses its scratch
+        /// space across batches.
+        /// @returns The results in the order of `messages`.
+        std::vector<GroupDecryptionResult> decrypt_group_messages(
+          const std::vector<GroupCiphertext> &messages,
+          unsigned threads = 0);
         //! Encrypt a message using megolm.
         BinaryBuf encrypt_group_message(OlmOutboundGroupSession *session,
                                         const std::string &plaintext);
@@ -309,6 +357,19 @@ public:
                                                     const std::string &recipient_ed25519_key,
                                                     const std::string &recipient_curve25519_key);
 
+        /// @brief Olm encrypt `event` for every device in `recipients` and create the body of an
+        /// m.room.encrypted /sendToDevice request, like for sharing a room key with a room.
+        ///
+        /// Produces the same content as create_olm_encrypted_content() for every device, but
+        /// serializes the parts of the event, that are the same for all devices, only once. With
+        /// `threads` the devices are encrypted on that many threads; devices sharing a session
+        /// are encrypted one after another.
+        /// @returns `{"messages": {user_id: {device_id: content}}}`
+        nlohmann::json create_olm_encrypted_to_device_body(
+          nlohmann::json event,
+          const std::vector<OlmRecipient> &recipients,
+          unsigned threads = 0);
+
         //! store the account in a pickled string encrypted by `key`
         std::string save(const std::string &key);
         /// @brief Restore the account from a pickled string encrypted by `key`
@@ -0,0 +1,193 @@
+#pragma once
+
+/// @file
+/// @brief A cache of unpickled inbound megolm sessions.
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mtxclient/crypto/client.hpp"
+
+namespace mtx {
+namespace crypto {
+
+//! Identifies an inbound megolm session.
+struct InboundSessionKey
+{
+        //! The room the session belongs to.
+        std::string room_id;
+        //! The curve25519 key of the device, that created the session.
+        std::string sender_key;
+        //! The id of the session.
+        std::string session_id;
+
+        friend bool operator==(const InboundSessionKey &a, const InboundSessionKey &b)
+        {
+                return a.session_id == b.session_id && a.sender_key == b.sender_key &&
+                       a.room_id == b.room_id;
+        }
+};
+
+//! Hash for InboundSessionKey.
+struct InboundSessionKeyHash
+{
+        std::size_t operator()(const InboundSessionKey &key) const noexcept;
+};
+
+//! Counters of an InboundSessionCache.
+struct SessionCacheStats
+{
+        //! Lookups of a session, that was cached.
+        std::uint64_t hits = 0;
+        //! Lookups of a session, that had to be loaded and unpickled.
+        std::uint64_t misses = 0;
+        //! Sessions dropped from the cache to stay within its capacity.
+        std::uint64_t evictions = 0;
+        //! Sessions pickled and stored, because they changed while cached.
+        std::uint64_t write_backs = 0;
+};
+
+/// @brief A bounded, thread safe LRU cache of unpickled inbound megolm sessions.
+///
+/// Unpickling a session decrypts and authenticates the pickle and allocates the session, which
+/// costs more than decrypting a short message with it. The cache keeps the sessions, that were
+/// used last, unpickled. It loads the pickle of a session, that isn't cached, with the `load`
+/// function and hands changed sessions to `store` as a pickle, when they are evicted, flushed or
+/// the cache is destroyed. Both are called without holding the lock of the cache, possibly from
+/// several threads at once. An evicted session stays available until `store` returned, so that
+/// it isn't loaded again in an older state or reported as unknown in the meantime.
+///
+/// Messages of different sessions can be decrypted on several threads at once, the uses of one
+/// session are serialized.
+class InboundSessionCache
+{
+public:
+        //! Returns the pickle of a session, or nothing, if the session is unknown.
+        using Load = std::function<std::optional<std::string>(const InboundSessionKey &)>;
+        //! Persists the pickle of a session.
+        using Store = std::function<void(const InboundSessionKey &, const std::string &pickled)>;
+
+        //! Create a cache for at most `capacity` sessions, pickled with `pickle_key`.
+        InboundSessionCache(std::size_t capacity, std::string pickle_key, Load load, Store store);
+        //! Writes back the changed sessions. Errors of `store` are ignored, call flush() to see
+        //! them.
+        ~InboundSessionCache();
+
+        InboundSessionCache(const InboundSessionCache &) = delete;
+        InboundSessionCache &operator=(const InboundSessionCache &) = delete;
+
+        /// @brief Run `f` with the session `key`, loading it if needed.
+        ///
+        /// If `f` returns a bool, it tells whether `f` changed the session, otherwise the session
+        /// is marked as changed. Only changed sessions are written back. `f` must not use the
+        /// cache itself.
+        /// @returns false, if the session is unknown.
+        template<class F>
+        bool with_session(const InboundSessionKey &key, F &&f)
+        {
+                auto entry = acquire(key);
+                if (!entry)
+                        return false;
+
+                std::lock_guard<std::mutex> lock(entry->mutex);
+                if constexpr (std::is_same_v<std::invoke_result_t<F, OlmInboundGroupSession *>,
+                                             bool>) {
+                        if (std::forward<F>(f)(entry->session.get()))
+                                entry->dirty = true;
+                } else {
+                        entry->dirty = true;
+                        std::forward<F>(f)(entry->session.get());
+                }
+                // Evicted and written back while waiting for the lock, so nobody else will write it
+                // back.
+                if (entry->evicted)
+                        write_back(key, *entry);
+                return true;
+        }
+
+        //! Decrypt a megolm message with the session `key`. Returns nothing, if the session is
+        //! unknown, and throws an olm_exception, if olm can't decrypt the message. Decrypting
+        //! doesn't mark the session as changed.
+        std::optional<GroupPlaintext> decrypt(OlmClient &client,
+                                              const InboundSessionKey &key,
+                                              const std::string &message);
+
+        //! Add a new session, for example from an m.room_key event. It is stored on eviction
+        //! like a changed session.
+        void insert(const InboundSessionKey &key, InboundGroupSessionPtr session);
+        //! Drop a session from the cache without storing it.
+        void erase(const InboundSessionKey &key);
+        //! Store all sessions, that changed since they were loaded or last stored.
+        void flush();
+
+        //! The counters of the cache.
+        SessionCacheStats stats() const;
+        //! The number of cached sessions.
+        std::size_t size() const;
+        //! The maximum number of cached sessions.
+        std::size_t capacity() const { return capacity_; }
+
+private:
+        struct Entry
+        {
+                //! Serializes the uses of the session.
+                std::mutex mutex;
+                InboundGroupSessionPtr session;
+                //! Changed since it was loaded or last stored.
+                bool dirty = false;
+                //! Dropped from the cache and written back, while it was in use.
+                bool evicted = false;
+        };
+        using Lru = std::list<InboundSessionKey>;
+        struct Slot
+        {
+                std::shared_ptr<Entry> entry;
+                Lru::iterator position;
+        };
+
+        std::shared_ptr<Entry> acquire(const InboundSessionKey &key);
+        //! Return the cached entry of `key` as the most recently used one. An entry, that is
+        //! still being written back, is cached again. Needs `mutex_`.
+        std::shared_ptr<Entry> find(
+          const InboundSessionKey &key,
+          std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> &evicted);
+        //! Add `entry` as the most recently used one and return the entries evicted for it.
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> add(
+          const InboundSessionKey &key,
+          std::shared_ptr<Entry> entry);
+        void write_back(const InboundSessionKey &key, Entry &entry);
+        void evict(std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted);
+        //! Forget an evicted `entry`, that was written back, unless it was cached again.
+        void release(const InboundSessionKey &key, const std::shared_ptr<Entry> &entry);
+
+        const std::size_t capacity_;
+        const std::string pickle_key_;
+        Load load_;
+        Store store_;
+
+        mutable std::mutex mutex_;
+        //! The keys from the most to the least recently used.
+        Lru lru_;
+        std::unordered_map<InboundSessionKey, Slot, InboundSessionKeyHash> entries_;
+        //! Evicted entries, until they are written back.
+        std::unordered_map<InboundSessionKey, std::shared_ptr<Entry>, InboundSessionKeyHash>
+          writing_back_;
+
+        std::atomic<std::uint64_t> hits_{0};
+        std::atomic<std::uint64_t> misses_{0};
+        std::atomic<std::uint64_t> evictions_{0};
+        std::atomic<std::uint64_t> write_backs_{0};
+};
+
+} // namespace crypto
+} // namespace mtx
@@ -0,0 +1,130 @@
+#pragma once
+
+/// @file
+/// @brief A persistent store for the pickled olm account and sessions.
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace mtx {
+namespace crypto {
+
+/// @brief Persists the pickled olm account, olm sessions and megolm sessions in a single file.
+///
+/// The file is an append only log of records. Saving or erasing an entry appends one record, so
+/// a change costs the size of that entry, no matter how many sessions the store holds. An index
+/// in memory maps every entry to its record, so lookups are a hash lookup and a single read.
+/// When most of the file is taken by records, that were replaced or erased, it is rewritten with
+/// only the current ones. Opening the store reads the whole log once to build the index, and
+/// drops a record at the end, that was only partially written, for example when the application
+/// crashed while saving it.
+///
+/// The store doesn't pickle the olm objects itself: pass it the output of
+/// mtx::crypto::pickle() and unpickle() what it returns. All functions are thread safe and throw
+/// a crypto_exception, when the file can't be read or written.
+class CryptoStore
+{
+public:
+        //! Open the store in the file at `path`, creating it, if it doesn't exist.
+        explicit CryptoStore(std::string path);
+
+        CryptoStore(const CryptoStore &) = delete;
+        CryptoStore &operator=(const CryptoStore &) = delete;
+
+        //! Save the pickled olm account.
+        void save_account(std::string_view pickled);
+        //! The pickled olm account, if one was saved.
+        std::optional<std::string> account() const;
+
+        //! Save an olm session with the device with the curve25519 key `curve25519`.
+        void save_olm_session(std::string_view curve25519,
+                              std::string_view session_id,
+                              std::string_view pickled);
+        //! The pickled olm session `session_id` with the device with the key `curve25519`.
+        std::optional<std::string> olm_session(std::string_view curve25519,
+                                               std::string_view session_id) const;
+        //! The ids of the olm sessions with the device with the curve25519 key `curve25519`.
+        std::vector<std::string> olm_session_ids(std::string_view curve25519) const;
+        //! Erase an olm session. Returns false, if there was no such session.
+        bool erase_olm_session(std::string_view curve25519, std::string_view session_id);
+
+        //! Save the inbound megolm session `session_id` of the room `room_id`.
+        void save_inbound_group_session(std::string_view room_id,
+                                        std::string_view session_id,
+                                        std::string_view pickled);
+        //! The pickled inbound megolm session `session_id` of the room `room_id`.
+        std::optional<std::string> inbound_group_session(std::string_view room_id,
+                                                         std::string_view session_id) const;
+        //! Erase an inbound megolm session. Returns false, if there was no such session.
+        bool erase_inbound_group_session(std::string_view room_id, std::string_view session_id);
+
+        //! Save the outbound megolm session of the room `room_id`, replacing the previous one.
+        void save_outbound_group_session(std::string_view room_id, std::string_view pickled);
+        //! The pickled outbound megolm session of the room `room_id`.
+        std::optional<std::string> outbound_group_session(std::string_view room_id) const;
+        //! Erase the outbound megolm session of a room. Returns false, if there was none.
+        bool erase_outbound_group_session(std::string_view room_id);
+
+        //! Rewrite the file with only the current entries.
+        void compact();
+
+        //! The size of the file in bytes.
+        std::uint64_t file_size() const;
+        //! The bytes of the file taken by records, that were replaced or erased.
+        std::uint64_t garbage_size() const;
+
+private:
+        //! The kinds of entries. The values are stored in the file, so don't change them.
+        enum class Table : std::uint8_t
+        {
+                Account               = 1,
+                OlmSessions           = 2,
+                InboundGroupSessions  = 3,
+                OutboundGroupSessions = 4,
+        };
+
+        //! Where the value of an entry is stored in the file.
+        struct Location
+        {
+                std::uint64_t offset = 0;
+                std::uint32_t size   = 0;
+                //! The size of the whole record, to account for it as garbage, once replaced.
+                std::uint64_t record_size = 0;
+        };
+
+        static std::string key(Table table, std::string_view a, std::string_view b = {});
+
+        void put(std::string entry_key, std::string_view value);
+        bool erase(const std::string &entry_key);
+        std::optional<std::string> get(const std::string &entry_key) const;
+
+        void load();
+        //! Append a record and return where its value is stored. An erased entry has no value.
+        Location append(std::fstream &file,
+                        std::uint64_t offset,
+                        std::string_view entry_key,
+                        const std::string_view *value);
+        void index_olm_session(std::string_view entry_key, bool stored);
+        void compact_if_needed();
+        void compact_locked();
+
+        std::string path_;
+        mutable std::fstream file_;
+        mutable std::mutex mutex_;
+
+        std::unordered_map<std::string, Location> index_;
+        //! The olm session ids by the curve25519 key of the device.
+        std::unordered_map<std::string, std::unordered_set<std::string>> olm_sessions_;
+        std::uint64_t file_size_    = 0;
+        std::uint64_t garbage_size_ = 0;
+};
+
+} // namespace crypto
+} // namespace mtx
@@ -34,10 +34,19 @@ using BinaryBuf = std::vector<uint8_t>;
 const std::string HEADER_LINE("-----BEGIN MEGOLM SESSION DATA-----");
 const std::string TRAILER_LINE("-----END MEGOLM SESSION DATA-----");
 
-//! Create a uint8_t buffer which is initialized with random bytes.
+//! Create a uint8_t buffer which is initialized with random bytes. Use it only for random input
+//! to olm and the ciphers, like keys, nonces and salts, since every call draws from the CSPRNG.
 BinaryBuf
 create_buffer(std::size_t nbytes);
 
+//! Create a zero initialized uint8_t buffer, for output and scratch space, that is overwritten
+//! anyway.
+inline BinaryBuf
+create_scratch_buffer(std::size_t nbytes)
+{
+        return BinaryBuf(nbytes);
+}
+
 //! Convert a string to a binary buffer.
 inline BinaryBuf
 to_binary_buf(const std::string &str)
@@ -17,6 +17,7 @@
 #include "mtx/pushrules.hpp"
 #include "mtx/requests.hpp"
 #include "mtx/responses/empty.hpp" // for Empty, Logout, RoomInvite
+#include "mtx/responses/sync.hpp"  // for SyncParseFilter
 #include "mtx/secret_storage.hpp"
 #include "mtxclient/http/errors.hpp" // for ClientError
 #include "mtxclient/utils.hpp"       // for random_token, url_encode, des...
@@ -26,6 +27,9 @@
 #include <boost/beast/http/status.hpp> // for status
 #include <boost/system/error_code.hpp> // for error_code
 
+#include <array>      // for array
+#include <chrono>     // for seconds
+#include <cstddef>    // for size_t
 #include <cstdint>    // for uint16_t, uint64_t
 #include <functional> // for function
 #include <memory>     // for allocator, shared_ptr, enable...
@@ -35,10 +39,17 @@
 #include <vector>     // for vector
 
 // forward declarations
+namespace boost {
+namespace asio {
+class io_context;
+}
+}
+
 namespace mtx {
 namespace http {
 struct ClientPrivate;
 struct Session;
+class ThreadPool;
 }
 namespace requests {
 struct CreateRoom;
@@ -119,6 +130,21 @@ using TypeErasedCallback = std::function<void(HeaderFields,
                                               const boost::system::error_code &,
                                               boost::beast::http::status)>;
 
+//! Receives the body of a streamed download chunk by chunk. Return false to abort the download.
+using DownloadSink = std::function<bool(const char *data, std::size_t size)>;
+//! Called, after the body of a streamed download was passed to the sink completely.
+using DownloadCallback = std::function<
+  void(const std::string &content_type, const std::string &original_filename, RequestErr err)>;
+
+//! Produces the data of a streamed upload. Write up to `size` bytes into `buffer` and set `size`
+//! to the amount written, 0 marks the end of the data. Return false to abort the upload.
+using UploadSource = std::function<bool(char *buffer, std::size_t &size)>;
+
+//! Create a sink, that writes the downloaded data to a file descriptor. The file descriptor is
+//! not closed afterwards.
+DownloadSink
+fd_sink(int fd);
+
 //! Sync configuration options.
 struct SyncOpts
 {
@@ -132,6 +158,14 @@ struct SyncOpts
         bool full_state = false;
         //! Explicitly set the presence of the user
         std::optional<mtx::presence::PresenceState> set_presence;
+        //! Keep the state and timeline events of the rooms as mtx::responses::RawEvent, to
+        //! decode only the ones that are needed. See mtx::responses::parse_sync.
+        bool lazy_events = false;
+        //! Only keep these rooms and room events of the response.
+        mtx::responses::SyncParseFilter parse_filter;
+        //! Decode the rooms of the response on this many threads. See
+        //! mtx::responses::parse_sync.
+        unsigned decode_threads = 0;
 };
 
 //! Configuration for the /messages endpoint.
@@ -160,6 +194,156 @@ struct ThumbOpts
         std::string mxc_url;
 };
 
+//! Configuration of the keep-alive connection pool.
+struct ConnectionPoolOpts
+{
+        //! Whether connections are kept open after a request to be reused by later requests.
+        bool enabled = true;
+        //! The maximum amount of idle connections kept open per host.
+        std::size_t max_idle_per_host = 8;
+        //! Idle connections are closed after this time without being used.
+        std::chrono::seconds idle_timeout{30};
+        //! Offer HTTP/2 when connecting and send concurrent requests to the same host over a
+        //! single connection, if the server supports it. Has no effect, if mtxclient was built
+        //! without HTTP/2 support.
+        bool http2 = true;
+};
+
+//! Configuration of the name resolution and of how connections are established.
+struct ResolverOpts
+{
+        //! Whether resolved addresses are cached and shared between requests.
+        bool cache_enabled = true;
+        //! How long resolved addresses are reused, before the host is looked up again.
+        std::chrono::seconds ttl{60};
+        //! Time to wait for a connection attempt, before the next address is tried in parallel.
+        std::chrono::milliseconds connection_attempt_delay{250};
+};
+
+//! Counters about the resumption of TLS sessions on new connections.
+struct TlsSessionStats
+{
+        //! Successful TLS handshakes on new connections.
+        uint64_t handshakes = 0;
+        //! Handshakes, where a cached session was offered to the server.
+        uint64_t offered = 0;
+        //! Handshakes, where the server accepted the cached session.
+        uint64_t resumed = 0;
+};
+
+//! Priority classes of requests. Each class has its own limit of concurrent requests, so that a
+//! burst of requests of one class can't starve the others.
+enum class RequestPriority
+{
+        //! The long-polling /sync request.
+        Sync,
+        //! Requests a user waits for, like sending a message. Any request not covered by the
+        //! other classes.
+        Interactive,
+        //! Uploading, querying and claiming keys, to-device messages and key backups.
+        KeyManagement,
+        //! Uploads, downloads and thumbnails.
+        Media,
+};
+
+//! Number of request priority classes.
+constexpr std::size_t request_priority_count = 4;
+
+//! Limits of a single request priority class.
+struct RequestClassOpts
+{
+        //! How many requests of the class may be in flight at the same time. 0 means unlimited.
+        std::size_t max_in_flight = 0;
+        //! Relative share of the free slots the class gets, while requests of several classes
+        //! are waiting.
+        unsigned weight = 1;
+};
+
+//! Configuration of how requests are scheduled.
+struct RequestSchedulerOpts
+{
+        //! How many requests may be in flight at the same time across all classes. 0 means
+        //! unlimited.
+        std::size_t max_in_flight = 32;
+        //! Limits per priority class, indexed by RequestPriority.
+        std::array<RequestClassOpts, request_priority_count> classes = {{
+          {4, 8},  // Sync
+          {16, 8}, // Interactive
+          {8, 4},  // KeyManagement
+          {6, 2},  // Media
+        }};
+
+        RequestClassOpts &operator[](RequestPriority priority)
+        {
+                return classes[static_cast<std::size_t>(priority)];
+        }
+        const RequestClassOpts &operator[](RequestPriority priority) const
+        {
+                return classes[static_cast<std::size_t>(priority)];
+        }
+};
+
+//! Requests of a priority class, that wait for a slot or are in flight.
+struct RequestQueueDepth
+{
+        //! Requests waiting for a free slot.
+        std::size_t queued = 0;
+        //! Requests sent and not yet completed.
+        std::size_t in_flight = 0;
+};
+
+//! Snapshot of the request queues.
+struct RequestQueueStats
+{
+        //! Queue depths per priority class, indexed by RequestPriority.
+        std::array<RequestQueueDepth, request_priority_count> classes;
+
+        const RequestQueueDepth &operator[](RequestPriority priority) const
+        {
+                return classes[static_cast<std::size_t>(priority)];
+        }
+};
+
+//! Configuration of the automatic retries of failed requests.
+struct RetryOpts
+{
+        //! Whether failed requests are retried. Pending retries are dropped, when the Client is
+        //! destroyed.
+        bool enabled = false;
+        //! How often a single request is retried at most.
+        unsigned max_retries = 3;
+        //! Delay before the first retry. Each further retry waits twice as long. The actual delay
+        //! is chosen randomly between half and the full value, so that clients don't retry in
+        //! lockstep.
+        std::chrono::milliseconds initial_delay{500};
+        //! Upper bound of the delay. If the server asks to wait longer, the error is passed on.
+        std::chrono::milliseconds max_delay{30'000};
+        //! Retry requests rejected with M_LIMIT_EXCEEDED (429), after the time the server asks
+        //! for with retry_after_ms or Retry-After. The server didn't process those, so any
+        //! request is retried.
+        bool rate_limited = true;
+        //! Retry requests failing with 502, 503, 504 or a network error. Only done for requests,
+        //! that are safe to repeat: GET, PUT (message sends carry a transaction id), DELETE and
+        //! POSTs that don't change anything, like key queries.
+        bool server_errors = true;
+};
+
+//! Counters about the automatic retries.
+struct RetryStats
+{
+        //! Requests sent again.
+        uint64_t retries = 0;
+        //! Retries of requests rejected with M_LIMIT_EXCEEDED.
+        uint64_t rate_limited = 0;
+        //! Retries after a 502, 503 or 504.
+        uint64_t server_errors = 0;
+        //! Retries after a network error.
+        uint64_t network_errors = 0;
+        //! Requests, whose error was passed on, because the retries were used up or the server
+        //! asked to wait longer than the maximum delay.
+        uint64_t gave_up = 0;
+};
+
 struct ClientPrivate;
 struct Session;
 
@@ -167,10 +351,26 @@ struct Session;
 class Client : public std::enable_shared_from_this<Client>
 {
 public:
-        Client(const std::string &server = "", uint16_t port = 443);
+        //! Run the requests on `threads` threads of the client's own. By default
+        //! min(8, hardware threads) are started. A single thread doesn't need to serialize the
+        //! handlers of a connection and has the lowest latency.
+        Client(const std::string &server = "", uint16_t port = 443, unsigned threads = 0);
+        //! Run the requests on an io_context of the caller, who needs to keep it running while the
+        //! client is used. Set `single_threaded`, if only a single thread runs it.
+        Client(boost::asio::io_context &ios,
+               const std::string &server = "",
+               uint16_t port             = 443,
+               bool single_threaded      = false);
+        //! Run the requests on a thread pool shared with other clients.
+        Client(std::shared_ptr<ThreadPool> pool,
+               const std::string &server = "",
+               uint16_t port             = 443);
+        //! Abort the pending requests without calling them back. A client, that runs its own
+        //! threads, needs to be closed first.
         ~Client();
 
-        //! Wait for the client to close.
+        //! Wait for the client to close. If the client doesn't run its own threads, pending
+        //! requests aren't waited for, only aborted if `force` is set.
         void close(bool force = false);
         //! Set the homeserver domain name.
         void set_user(const mtx::identifiers::User &user) { user_id_ = user; }
@@ -200,6 +400,28 @@ public:
         std::string generate_txn_id() { return client::utils::random_token(32, false); }
         //! Abort all active pending requests.
         void shutdown();
+        //! Configure how connections are kept alive and reused between requests.
+        void set_connection_pool_opts(const ConnectionPoolOpts &opts);
+        //! Retrieve the configuration of the connection pool.
+        ConnectionPoolOpts connection_pool_opts() const;
+        //! Configure the DNS cache and the connection attempts to the resolved addresses.
+        void set_resolver_opts(const ResolverOpts &opts);
+        //! Retrieve the configuration of the name resolution.
+        ResolverOpts resolver_opts() const;
+        //! Retrieve how many new connections could resume a previous TLS session.
+        TlsSessionStats tls_session_stats() const;
+        //! Configure the priority classes and how many requests may run concurrently.
+        void set_request_scheduler_opts(const RequestSchedulerOpts &opts);
+        //! Retrieve the configuration of the request scheduling.
+        RequestSchedulerOpts request_scheduler_opts() const;
+        //! Retrieve how many requests of each priority class are queued and in flight.
+        RequestQueueStats request_queue_stats() const;
+        //! Configure the automatic retries of failed requests.
+        void set_retry_opts(const RetryOpts &opts);
+        //! Retrieve the configuration of the automatic retries.
+        RetryOpts retry_opts() const;
+        //! Retrieve how often requests were retried.
+        RetryStats retry_stats() const;
         //! Remove all saved configuration.
         void clear()
         {
@@ -380,6 +602,19 @@ public:
                     const std::string &content_type,
                     const std::string &filename,
                     Callback<mtx::responses::ContentURI> cb);
+        //! Upload data to the content repository, that is read from `source` in chunks. If the
+        //! size is unknown, the data is sent using chunked transfer encoding.
+        void upload(UploadSource source,
+                    std::optional<std::uint64_t> size,
+                    const std::string &content_type,
+                    const std::string &filename,
+                    Callback<mtx::responses::ContentURI> cb);
+        //! Upload a file to the content repository, without reading it into memory completely.
+        //! Files without a size, like pipes, are sent using chunked transfer encoding.
+        void upload_file(const std::string &path,
+                         const std::string &content_type,
+                         const std::string &filename,
+                         Callback<mtx::responses::ContentURI> cb);
         //! Retrieve data from the content repository.
         void download(const std::string &mxc_url,
                       std::function<void(const std::string &data,
@@ -392,6 +627,13 @@ public:
                                          const std::string &content_type,
                                          const std::string &original_filename,
                                          RequestErr err)> cb);
+        //! Retrieve data from the content repository and pass it to the sink, as it arrives. The
+        //! data is never held in memory completely, which makes this suitable for large files.
+        void download(const std::string &mxc_url, DownloadSink sink, DownloadCallback cb);
+        void download(const std::string &server,
+                      const std::string &media_id,
+                      DownloadSink sink,
+                      DownloadCallback cb);
 
         //! Retrieve a thumbnail from the given mxc url.
         //! If the thumbnail isn't found and `try_download` is `true` it will try
@@ -585,13 +827,13 @@ private:
 
         // type erased versions of http verbs
         void post(const std::string &endpoint,
-                  const json &req,
+                  std::string req,
                   TypeErasedCallback cb,
                   bool requires_auth,
                   const std::string &content_type);
 
         void put(const std::string &endpoint,
-                 const json &req,
+                 std::string req,
                  TypeErasedCallback cb,
                  bool requires_auth);
 
@@ -606,6 +848,9 @@ private:
         TypeErasedCallback prepare_callback(HeadersCallback<Response> callback);
 
         std::shared_ptr<Session> create_session(TypeErasedCallback type_erased_cb);
+        //! Start the session, once its priority class has a free slot. `attempt` counts the
+        //! previous attempts of the same request.
+        void run_session(std::shared_ptr<Session> session, unsigned attempt = 0);
 
         //! Setup http header with the access token if needed.
         void setup_auth(Session *session, bool auth);
@@ -33,6 +33,11 @@ deserialize<std::string>(const std::string &data)
         return data;
 }
 
+//! /sync responses are parsed without building a json document of the whole response.
+template<>
+mtx::responses::Sync
+deserialize<mtx::responses::Sync>(const std::string &data);
+
 /// @brief serialize a type or string to json.
 ///
 /// Used internally to serialize the request types for the various http methods.
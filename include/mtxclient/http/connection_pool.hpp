@@ -0,0 +1,155 @@
+#pragma once
+
+/// @file
+/// @brief Pool of idle keep-alive connections, that sessions borrow and return.
+///
+/// You usually don't need to include this as connection handling is done by the library for you.
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mtxclient/http/client.hpp"
+
+namespace mtx {
+namespace http {
+
+//! A connection that carries several requests at the same time, i.e. HTTP/2.
+class MultiplexedConnection
+{
+public:
+        //! Called once, when the response arrived or the request failed. `responded` tells, if
+        //! the server started to answer and therefore may have processed the request.
+        using ResponseHandler = std::function<void(
+          const boost::system::error_code &ec,
+          boost::beast::http::response<boost::beast::http::string_body> &&response,
+          bool responded)>;
+
+        virtual ~MultiplexedConnection() = default;
+
+        //! Send a request over the connection. Can be called from any thread. If `sink` is set,
+        //! the body of a successful response is passed to it instead of being stored. If `source`
+        //! is set, the request body is read from it instead of from `request`.
+        virtual void submit(
+          const boost::beast::http::request<boost::beast::http::string_body> &request,
+          ResponseHandler handler,
+          DownloadSink sink,
+          UploadSource source) = 0;
+        //! Whether the connection accepts new requests.
+        virtual bool is_usable() const = 0;
+        //! Since when no request is active on the connection. Empty, while requests are active.
+        virtual std::optional<std::chrono::steady_clock::time_point> idle_since() const = 0;
+        //! Close the connection. Active requests fail.
+        virtual void close() = 0;
+};
+
+//! Keeps finished TLS connections open per host, so later requests can skip the DNS lookup, the
+//! TCP connect and the TLS handshake.
+class ConnectionPool
+{
+public:
+        //! The type of a pooled connection.
+        using Stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+        //! Called with the multiplexed connection, once it is established. Called with nullptr,
+        //! if the host doesn't support multiplexing or the connection failed.
+        using MultiplexedCallback = std::function<void(std::shared_ptr<MultiplexedConnection>)>;
+
+        //! What a request should do, if there is no connection it can use right away.
+        enum class Probe
+        {
+                //! The host doesn't support multiplexing. Open a connection as usual.
+                Unsupported,
+                //! Open a connection and report its protocol with add_multiplexed() or
+                //! multiplexing_unavailable().
+                Connect,
+                //! Another request is connecting to the host. The callback will be called.
+                Wait,
+        };
+
+        explicit ConnectionPool(const ConnectionPoolOpts &opts = {});
+        ~ConnectionPool();
+
+        ConnectionPool(const ConnectionPool &) = delete;
+        ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+        //! Change the pool configuration. Connections exceeding the new limits are closed.
+        void set_options(const ConnectionPoolOpts &opts);
+        //! Retrieve the pool configuration.
+        ConnectionPoolOpts options() const;
+
+        //! Take a healthy idle connection to the given host.
+        //! Returns nullptr, if there is none and a new connection needs to be established.
+        std::unique_ptr<Stream> acquire(const std::string &host, uint16_t port);
+        //! Hand back a connection after its response has been read completely.
+        void release(const std::string &host, uint16_t port, std::unique_ptr<Stream> stream);
+
+        //! Retrieve the multiplexed connection to the given host, if there is a usable one. It
+        //! stays in the pool and can be used by several requests at the same time.
+        std::shared_ptr<MultiplexedConnection> acquire_multiplexed(const std::string &host,
+                                                                   uint16_t port);
+        //! Share a multiplexed connection with later requests to the host. Requests waiting for
+        //! the connection are resumed.
+        void add_multiplexed(const std::string &host,
+                             uint16_t port,
+                             std::shared_ptr<MultiplexedConnection> connection);
+
+        /// @brief Coordinate new connections to hosts, that may support multiplexing.
+        ///
+        /// Only the first of several concurrent requests opens a connection, the others wait for
+        /// it, so that they can share the connection, if the server supports multiplexing.
+        Probe probe_multiplexed(const std::string &host,
+                                uint16_t port,
+                                MultiplexedCallback on_ready);
+        //! Report that the connection opened after Probe::Connect can't be shared. If
+        //! `unsupported` is set, the server doesn't support multiplexing and later requests don't
+        //! wait anymore. Waiting requests are resumed with nullptr.
+        void multiplexing_unavailable(const std::string &host, uint16_t port, bool unsupported);
+
+        //! Close all idle connections and forget which hosts support multiplexing.
+        void clear();
+        //! Number of idle connections currently kept open.
+        std::size_t idle_connections() const;
+
+private:
+        struct IdleConnection
+        {
+                std::unique_ptr<Stream> stream;
+                std::chrono::steady_clock::time_point since;
+        };
+
+        struct ProbeState
+        {
+                bool connecting  = false;
+                bool unsupported = false;
+                std::vector<MultiplexedCallback> waiting;
+        };
+
+        //! Check that the server didn't close the connection or sent unexpected data.
+        static bool is_healthy(Stream &stream);
+        //! Close idle connections exceeding the timeout or the per host limit.
+        //! Needs to be called with the mutex held.
+        void prune(std::chrono::steady_clock::time_point now);
+
+        mutable std::mutex mutex_;
+        ConnectionPoolOpts opts_;
+        //! Idle connections per "host:port", the most recently used at the back.
+        std::map<std::string, std::vector<IdleConnection>> idle_;
+        //! Multiplexed connections per "host:port".
+        std::map<std::string, std::shared_ptr<MultiplexedConnection>> multiplexed_;
+        //! Whether hosts support multiplexing, per "host:port".
+        std::map<std::string, ProbeState> probes_;
+};
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/// @file
+/// @brief Shared DNS cache and concurrent connection attempts to the resolved addresses.
+///
+/// You usually don't need to include this as name resolution is handled by the library for you.
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mtxclient/http/client.hpp"
+
+namespace mtx {
+namespace http {
+
+//! Type of the callback of a name lookup.
+using ResolveCallback = std::function<void(const boost::system::error_code &ec,
+                                           std::vector<boost::asio::ip::tcp::endpoint> endpoints)>;
+//! Function performing the actual name lookup.
+using ResolveFunction =
+  std::function<void(const std::string &host, uint16_t port, ResolveCallback callback)>;
+
+//! Caches resolved addresses per host for a fixed time. Concurrent lookups of the same host are
+//! merged into a single query.
+class DnsCache : public std::enable_shared_from_this<DnsCache>
+{
+public:
+        //! Resolve names using the system resolver.
+        explicit DnsCache(boost::asio::io_context &ios, const ResolverOpts &opts = {});
+        //! Resolve names using a custom lookup function, i.e. a stub resolver for testing.
+        DnsCache(boost::asio::io_context &ios,
+                 ResolveFunction lookup,
+                 const ResolverOpts &opts = {});
+
+        //! Change the configuration. Cached entries are dropped, if the cache got disabled.
+        void set_options(const ResolverOpts &opts);
+        //! Retrieve the configuration.
+        ResolverOpts options() const;
+
+        //! Resolve the host. The callback is always invoked asynchronously.
+        void resolve(const std::string &host, uint16_t port, ResolveCallback callback);
+
+        //! Drop all cached addresses.
+        void clear();
+
+private:
+        struct Entry
+        {
+                std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+                std::chrono::steady_clock::time_point expires;
+                //! Callbacks waiting for a lookup in progress.
+                std::vector<ResolveCallback> waiting;
+                bool in_flight = false;
+        };
+
+        void on_resolved(const std::string &key,
+                         const boost::system::error_code &ec,
+                         std::vector<boost::asio::ip::tcp::endpoint> endpoints);
+
+        boost::asio::io_context &ios_;
+        ResolveFunction lookup_;
+
+        mutable std::mutex mutex_;
+        ResolverOpts opts_;
+        std::map<std::string, Entry> entries_;
+};
+
+//! Order addresses as recommended by RFC 8305: alternate between IPv6 and IPv4, starting with
+//! the family of the first address.
+std::vector<boost::asio::ip::tcp::endpoint>
+interleave_address_families(const std::vector<boost::asio::ip::tcp::endpoint> &endpoints);
+
+/// @brief Connect the socket to one of the endpoints.
+///
+/// The endpoints are tried in order, but a new attempt is started in parallel, whenever the
+/// previous one didn't finish after `attempt_delay` (Happy Eyeballs, RFC 8305). The first
+/// connection to succeed is moved into `socket`, all others are closed. The caller needs to keep
+/// `socket` alive until the handler is called.
+void
+async_connect_happy_eyeballs(boost::asio::ip::tcp::socket &socket,
+                             const std::vector<boost::asio::ip::tcp::endpoint> &endpoints,
+                             std::chrono::milliseconds attempt_delay,
+                             std::function<void(const boost::system::error_code &)> handler);
+}
+}
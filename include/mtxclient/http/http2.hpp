@@ -0,0 +1,112 @@
+#pragma once
+
+/// @file
+/// @brief HTTP/2 transport, that multiplexes concurrent requests over a single TLS connection.
+///
+/// Only available, if mtxclient was built with HTTP/2 support (libnghttp2). You usually don't
+/// need to include this as connection handling is done by the library for you.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "mtxclient/http/connection_pool.hpp"
+#include "mtxclient/utils.hpp"
+
+struct nghttp2_session;
+
+namespace mtx {
+namespace http {
+
+//! A HTTP/2 connection to a single host. All requests submitted to it share the same TLS
+//! connection and their headers are compressed with HPACK.
+class Http2Connection
+  : public MultiplexedConnection
+  , public std::enable_shared_from_this<Http2Connection>
+{
+public:
+        //! Offer HTTP/2 and HTTP/1.1 via ALPN on a new connection, before the handshake.
+        static void offer_alpn(SSL *ssl);
+        //! Whether the server selected HTTP/2 during the handshake.
+        static bool negotiated(SSL *ssl);
+
+        //! Take over a connected stream, on which the server selected HTTP/2.
+        //! Returns nullptr, if the HTTP/2 session couldn't be initialized.
+        static std::shared_ptr<Http2Connection> create(
+          std::unique_ptr<ConnectionPool::Stream> stream,
+          const std::string &host);
+
+        ~Http2Connection() override;
+
+        //! The request needs to stay alive, until the handler was called.
+        void submit(const boost::beast::http::request<boost::beast::http::string_body> &request,
+                    ResponseHandler handler,
+                    DownloadSink sink,
+                    UploadSource source) override;
+        bool is_usable() const override;
+        std::optional<std::chrono::steady_clock::time_point> idle_since() const override;
+        void close() override;
+
+private:
+        struct Stream
+        {
+                const boost::beast::http::request<boost::beast::http::string_body> *request;
+                ResponseHandler handler;
+                DownloadSink sink;
+                UploadSource source;
+                boost::beast::http::response<boost::beast::http::string_body> response;
+                //! How much of the request body was already handed to nghttp2.
+                std::size_t body_offset = 0;
+                bool responded          = false;
+                //! Decompresses a body, that isn't passed to the sink.
+                std::optional<mtx::client::utils::Inflater> inflater;
+                //! Whether the sink aborted the download.
+                bool aborted = false;
+                //! Whether the body couldn't be decompressed.
+                bool corrupt = false;
+        };
+
+        Http2Connection(std::unique_ptr<ConnectionPool::Stream> stream, const std::string &host);
+        bool init();
+
+        void do_submit(const boost::beast::http::request<boost::beast::http::string_body> &request,
+                       ResponseHandler handler,
+                       DownloadSink sink,
+                       UploadSource source);
+        void do_read();
+        void on_read(const boost::system::error_code &ec, std::size_t bytes_transferred);
+        void do_write();
+        void on_write(const boost::system::error_code &ec, std::size_t bytes_transferred);
+        //! Fail all active requests and close the connection.
+        void fail(const boost::system::error_code &ec);
+        //! Refresh the state visible to other threads.
+        void update_state();
+        //! Account for requests, whose handler was called.
+        void finished(std::size_t count);
+
+        //! Callbacks of nghttp2.
+        friend struct Http2Callbacks;
+
+        std::unique_ptr<ConnectionPool::Stream> stream_;
+        std::string host_;
+        nghttp2_session *session_ = nullptr;
+
+        //! Active requests by stream id.
+        std::map<int32_t, Stream> streams_;
+
+        std::array<uint8_t, 16 * 1024> read_buf_;
+        std::string write_buf_;
+        bool reading_ = false;
+        bool writing_ = false;
+        bool closed_  = false;
+
+        std::atomic<bool> usable_{true};
+        std::atomic<std::size_t> active_streams_{0};
+        std::atomic<std::chrono::steady_clock::rep> idle_since_;
+};
+}
+}
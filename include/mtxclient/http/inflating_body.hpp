@@ -0,0 +1,112 @@
+#pragma once
+
+/// @file
+/// @brief A response body, that is decompressed while it is received.
+///
+/// You usually don't need to include this as responses are read by the library for you.
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/buffers_range.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+
+#include "mtxclient/utils.hpp"
+
+namespace mtx {
+namespace http {
+
+//! Body of a response, that is decompressed according to its Content-Encoding chunk by chunk,
+//! as the parser receives it. The Content-Encoding header is removed, once it was applied.
+struct InflatingBody
+{
+        //! The decompressed body.
+        using value_type = std::string;
+
+        static std::uint64_t size(const value_type &body) { return body.size(); }
+
+        //! Parses the body. Meets the requirements of BodyReader.
+        class reader
+        {
+        public:
+                //! The reader is constructed before the header was parsed.
+                template<bool isRequest, class Fields>
+                reader(boost::beast::http::header<isRequest, Fields> &h, value_type &body)
+                  : fields_(static_cast<Fields *>(&h))
+                  , content_encoding_(&content_encoding<Fields>)
+                  , body_(body)
+                {}
+
+                void init(const boost::optional<std::uint64_t> &length,
+                          boost::system::error_code &ec)
+                {
+                        ec = {};
+
+                        const auto encoding   = content_encoding_(fields_, false);
+                        const bool compressed = encoding == "gzip" || encoding == "deflate";
+
+                        inflater_.emplace(encoding);
+                        if (compressed)
+                                content_encoding_(fields_, true);
+
+                        if (!length)
+                                return;
+
+                        // Compressed JSON usually inflates to at least four times its size.
+                        const std::uint64_t factor = compressed ? 4 : 1;
+                        if (*length > body_.max_size() / factor) {
+                                ec = boost::beast::http::error::buffer_overflow;
+                                return;
+                        }
+
+                        body_.reserve(static_cast<std::size_t>(*length * factor));
+                }
+
+                template<class ConstBufferSequence>
+                std::size_t put(const ConstBufferSequence &buffers, boost::system::error_code &ec)
+                {
+                        ec = {};
+
+                        std::size_t consumed = 0;
+                        for (auto b : boost::beast::buffers_range_ref(buffers)) {
+                                if (!inflater_->inflate(
+                                      static_cast<const char *>(b.data()), b.size(), body_)) {
+                                        ec = boost::system::errc::make_error_code(
+                                          boost::system::errc::illegal_byte_sequence);
+                                        return consumed;
+                                }
+                                consumed += b.size();
+                        }
+
+                        return consumed;
+                }
+
+                void finish(boost::system::error_code &ec) { ec = {}; }
+
+        private:
+                //! Return the Content-Encoding of the header or remove it.
+                template<class Fields>
+                static std::string content_encoding(void *fields, bool erase)
+                {
+                        auto &f = *static_cast<Fields *>(fields);
+                        if (erase) {
+                                f.erase(boost::beast::http::field::content_encoding);
+                                return {};
+                        }
+
+                        return std::string(f[boost::beast::http::field::content_encoding]);
+                }
+
+                void *fields_;
+                std::string (*content_encoding_)(void *fields, bool erase);
+                value_type &body_;
+                std::optional<mtx::client::utils::Inflater> inflater_;
+        };
+};
+}
+}
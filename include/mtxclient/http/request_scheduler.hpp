@@ -0,0 +1,87 @@
+#pragma once
+
+/// @file
+/// @brief Queues requests per priority class and limits how many of them run concurrently.
+///
+/// You usually don't need to include this as requests are scheduled by the library for you.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mtxclient/http/client.hpp"
+
+namespace mtx {
+namespace http {
+
+//! Priority class of a request to the given target, based on the API it belongs to.
+RequestPriority
+request_priority(std::string_view target);
+
+//! Starts requests, once their priority class has a free slot. Waiting classes share the free
+//! slots according to their weight, requests of the same class start in the order they were
+//! submitted.
+class RequestScheduler : public std::enable_shared_from_this<RequestScheduler>
+{
+public:
+        //! Held by a request, that was started. Frees its slot, when it is released or destroyed.
+        class Slot
+        {
+        public:
+                Slot(std::weak_ptr<RequestScheduler> scheduler, RequestPriority priority);
+                ~Slot();
+
+                Slot(const Slot &) = delete;
+                Slot &operator=(const Slot &) = delete;
+
+                //! Free the slot. Only the first call has an effect.
+                void release();
+
+        private:
+                std::weak_ptr<RequestScheduler> scheduler_;
+                RequestPriority priority_;
+                std::atomic<bool> released_{false};
+        };
+
+        //! Starts a request. The request keeps the slot, until it releases or destroys it.
+        using Job = std::function<void(std::shared_ptr<Slot> slot)>;
+
+        explicit RequestScheduler(const RequestSchedulerOpts &opts = {});
+
+        void set_options(const RequestSchedulerOpts &opts);
+        RequestSchedulerOpts options() const;
+
+        //! Start the job right away, if a slot is free, or queue it otherwise.
+        void submit(RequestPriority priority, Job job);
+        //! Drop all queued jobs. Jobs in flight keep their slots.
+        void clear();
+
+        RequestQueueStats stats() const;
+
+private:
+        //! Called by the slot of a finished request.
+        void finished(RequestPriority priority);
+        //! Take the jobs, that can start now, off the queues. Called with the mutex held.
+        std::vector<std::pair<RequestPriority, Job>> take_runnable();
+        //! Start the jobs taken off the queues. Called without the mutex held.
+        void start(std::vector<std::pair<RequestPriority, Job>> jobs);
+
+        mutable std::mutex mutex_;
+        RequestSchedulerOpts opts_;
+
+        std::array<std::deque<Job>, request_priority_count> queued_;
+        std::array<std::size_t, request_priority_count> in_flight_{};
+        std::size_t total_in_flight_ = 0;
+        //! Credit of each class for the smooth weighted round robin between waiting classes.
+        std::array<std::int64_t, request_priority_count> credit_{};
+};
+}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/// @file
+/// @brief Decides, if and when failed requests are sent again.
+///
+/// You usually don't need to include this as retries are handled by the library for you.
+
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/verb.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string_view>
+
+#include "mtxclient/http/client.hpp"
+
+namespace mtx {
+namespace http {
+
+//! Whether sending the request again can't have any effect besides the one of the first attempt.
+bool
+is_idempotent(boost::beast::http::verb method, std::string_view target);
+
+//! How long the server asks to wait before retrying, taken from retry_after_ms of a Matrix error
+//! or from the Retry-After header.
+std::optional<std::chrono::milliseconds>
+retry_after(const boost::beast::http::response<boost::beast::http::string_body> &response);
+
+//! Applies the RetryOpts to failed requests and counts the retries.
+class RetryPolicy
+{
+public:
+        explicit RetryPolicy(const RetryOpts &opts = {});
+
+        void set_options(const RetryOpts &opts);
+        RetryOpts options() const;
+
+        //! Delay before attempt `attempt` + 1 of a request, that got the `response` or failed with
+        //! `ec` before a complete response arrived. Empty, if the outcome is final.
+        //! `resendable` tells, if the request body can be sent again, `streamed` if the response
+        //! body is passed on as it arrives, so that only error responses may be retried.
+        std::optional<std::chrono::milliseconds> next_attempt(
+          const boost::beast::http::request<boost::beast::http::string_body> &request,
+          const boost::beast::http::response<boost::beast::http::string_body> *response,
+          const boost::system::error_code &ec,
+          unsigned attempt,
+          bool resendable,
+          bool streamed);
+
+        RetryStats stats() const;
+
+private:
+        //! Jittered exponential backoff. Called with the mutex held.
+        std::chrono::milliseconds backoff(unsigned attempt);
+
+        mutable std::mutex mutex_;
+        RetryOpts opts_;
+        RetryStats stats_;
+        std::minstd_rand rng_;
+};
+}
+}
@@ -11,7 +11,11 @@
 
 #include <nlohmann/json.hpp>
 
+#include <memory>
+#include <vector>
+
 #include "mtxclient/http/errors.hpp"
+#include "mtxclient/http/inflating_body.hpp"
 #include "mtxclient/utils.hpp"
 
 namespace mtx {
@@ -30,29 +34,37 @@ using SuccessCallback =
 using FailureCallback =
   std::function<void(RequestID request_id, const boost::system::error_code ec)>;
 
+class ConnectionPool;
+class DnsCache;
+class MultiplexedConnection;
+class TlsSessionCache;
+
 //! Represents a context of a single request.
 struct Session : public std::enable_shared_from_this<Session>
 {
         Session(boost::asio::io_service &ios,
-                boost::asio::ssl::context &ssl_ctx,
+                std::shared_ptr<boost::asio::ssl::context> ssl_ctx,
                 const std::string &host,
                 uint16_t port,
                 RequestID id,
                 SuccessCallback on_success,
-                FailureCallback on_failure);
-
-        //! DNS resolver.
-        boost::asio::ip::tcp::resolver resolver_;
-        //! Socket used for communication.
-        boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
+                FailureCallback on_failure,
+                std::shared_ptr<ConnectionPool> pool          = nullptr,
+                std::shared_ptr<TlsSessionCache> tls_sessions = nullptr,
+                std::shared_ptr<DnsCache> dns                 = nullptr,
+                bool single_threaded                          = false);
+
+        //! Socket used for communication. Either taken from the connection pool or newly
+        //! established by the session.
+        std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> socket;
         //! Remote host.
         std::string host;
         //! Remote port.
         uint16_t port;
         //! Buffer where the response will be stored.
         boost::beast::flat_buffer output_buf;
-        //! Parser that will the response data.
-        boost::beast::http::response_parser<boost::beast::http::string_body> parser;
+        //! Parser that will the response data. The body is decompressed as it arrives.
+        boost::beast::http::response_parser<InflatingBody> parser;
         //! Request string.
         boost::beast::http::request<boost::beast::http::string_body> request;
         //! Contains the description of an error if one occurs
@@ -64,22 +76,86 @@ struct Session : public std::enable_shared_from_this<Session>
         SuccessCallback on_success;
         //! Function to be called when the request fails.
         FailureCallback on_failure;
+        //! If set, the body of a successful response is passed to this function in chunks, as
+        //! it arrives, instead of being stored in the response. Return false to abort.
+        std::function<bool(const char *data, std::size_t size)> body_sink;
+        //! If set, the body of the request is read from this function in chunks, instead of being
+        //! taken from `request`. See UploadSource.
+        std::function<bool(char *buffer, std::size_t &size)> body_source;
 
         void run() noexcept;
         //! Force shutdown all connections. Pending responses will not be processed.
         void terminate();
 
 private:
+        void connect();
+        void send_request();
+        //! Send the request with the body read from `body_source`.
+        void send_streamed_request();
+        void write_body_chunk();
+        void on_write_body_chunk(const boost::system::error_code &ec,
+                                 std::size_t bytes_transferred);
+        //! Send the request over a connection shared with other sessions, i.e. HTTP/2.
+        void send_multiplexed(std::shared_ptr<MultiplexedConnection> connection);
+        //! Called, when the connection another session opened to the host is established.
+        void on_multiplexed_ready(std::shared_ptr<MultiplexedConnection> connection);
+        //! Tell sessions waiting for our connection, that they can't share it.
+        void end_probe(bool unsupported);
+        //! Retry the request on a new connection, if a reused connection was closed by the
+        //! server before the response arrived.
+        bool retry_with_new_connection();
         void shutdown();
-        void on_resolve(boost::system::error_code ec,
-                        boost::asio::ip::tcp::resolver::results_type results);
+        void on_resolve(const boost::system::error_code &ec,
+                        std::vector<boost::asio::ip::tcp::endpoint> endpoints);
         void on_close(boost::system::error_code ec);
         void on_connect(const boost::system::error_code &ec);
         void on_handshake(const boost::system::error_code &ec);
         void on_read(const boost::system::error_code &ec, std::size_t bytes_transferred);
+        void read_body_chunk();
+        void on_read_header(const boost::system::error_code &ec, std::size_t bytes_transferred);
+        void on_read_chunk(const boost::system::error_code &ec, std::size_t bytes_transferred);
         void on_request_complete();
+        void on_multiplexed_response(
+          const boost::system::error_code &ec,
+          boost::beast::http::response<boost::beast::http::string_body> &&response,
+          bool responded);
         void on_write(const boost::system::error_code &ec, std::size_t bytes_transferred);
 
+        boost::asio::io_service &ios_;
+        //! Shared with the client, which may be destroyed before the session.
+        std::shared_ptr<boost::asio::ssl::context> ssl_ctx_;
+        //! Pool to borrow idle connections from and return them to. May be null.
+        std::shared_ptr<ConnectionPool> pool_;
+        //! Cache of TLS sessions to resume on new connections. May be null.
+        std::shared_ptr<TlsSessionCache> tls_sessions_;
+        //! Resolver shared between sessions.
+        std::shared_ptr<DnsCache> dns_;
+        //! Whether the io_context is run by a single thread, so that no strand is needed.
+        bool single_threaded_ = false;
+        //! Whether the current connection was taken from the pool.
+        bool reused_connection_ = false;
+        //! Whether other sessions wait for the connection we are opening, to share it.
+        bool probing_multiplexed_ = false;
+        //! Parser used instead of `parser`, if the body is passed to the `body_sink`.
+        std::unique_ptr<
+          boost::beast::http::response_parser<boost::beast::http::buffer_body>>
+          streaming_parser_;
+        //! Buffer, that the body chunks are read into.
+        std::vector<char> chunk_buf_;
+        //! Body of an error response, which is not passed to the sink.
+        std::string error_body_;
+        //! Request and serializer used instead of `request`, if the body is read from the
+        //! `body_source`.
+        std::unique_ptr<boost::beast::http::request<boost::beast::http::buffer_body>>
+          upload_request_;
+        std::unique_ptr<boost::beast::http::request_serializer<boost::beast::http::buffer_body>>
+          upload_serializer_;
+        //! Buffer, that the body chunks are read into.
+        std::vector<char> upload_buf_;
+        //! Whether data was read from the `body_source`. The request can't be retried then.
+        std::atomic_bool upload_started_{false};
+        //! Whether the `body_source` aborted the upload.
+        std::atomic_bool upload_aborted_{false};
         //! Flag to indicate that the connection of this session is closing and no
         //! response should be processed.
         std::atomic_bool is_shutting_down_;
@@ -88,7 +164,7 @@ private:
 template<boost::beast::http::verb HttpVerb>
 void
 setup_headers(mtx::http::Session *session,
-              const nlohmann::json &req,
+              std::string req,
               const std::string &endpoint,
               const std::string &content_type       = "",
               const std::string &endpoint_namespace = "/_matrix")
@@ -99,7 +175,7 @@ setup_headers(mtx::http::Session *session,
 
         session->request.method(HttpVerb);
         session->request.target(endpoint_namespace + endpoint);
-        session->request.body() = req;
+        session->request.body() = std::move(req);
         session->request.prepare_payload();
 
         if (!content_type.empty())
@@ -0,0 +1,68 @@
+#pragma once
+
+/// @file
+/// @brief A pool of threads running an io_context, that several clients can share.
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace mtx {
+namespace http {
+
+//! Runs an io_context on a fixed number of threads. Pass it to the Client constructor to let
+//! many clients share the same threads, instead of each starting its own.
+class ThreadPool
+{
+public:
+        //! Start the threads. 0 picks min(8, hardware threads). A pool with a single thread lets
+        //! its clients skip serializing the handlers of a connection.
+        explicit ThreadPool(unsigned threads = 0);
+        //! Waits for the pending work to finish. If the last owner of the pool is released on one
+        //! of its threads, the pending work is aborted instead and the threads exit on their own.
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        //! The io_context run by the threads.
+        boost::asio::io_context &context() { return ctx_->ios; }
+        //! Number of threads running the io_context.
+        unsigned threads() const { return threads_; }
+
+        //! Let the threads exit, once there is no more work, and wait for them. Must not be called
+        //! from one of the threads.
+        void join();
+        //! Abort all pending work and wait for the threads.
+        void stop();
+
+private:
+        //! The state used by the threads. They share it, so that it outlives a pool, that is
+        //! destroyed on one of them.
+        struct Context
+        {
+                explicit Context(int concurrency_hint)
+                  : ios(concurrency_hint)
+                  , work(boost::asio::make_work_guard(ios))
+                {}
+
+                boost::asio::io_context ios;
+                //! Keeps the threads running, while there is no work.
+                std::optional<
+                  boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>
+                  work;
+        };
+
+        //! Whether the calling thread is one of the threads of the pool.
+        bool on_pool_thread() const;
+
+        unsigned threads_;
+        std::shared_ptr<Context> ctx_;
+        std::vector<boost::thread> workers_;
+};
+}
+}
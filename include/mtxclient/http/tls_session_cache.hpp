@@ -0,0 +1,57 @@
+#pragma once
+
+/// @file
+/// @brief Client side cache of TLS sessions, used to resume sessions on reconnects.
+///
+/// You usually don't need to include this as session handling is handled by the library for you.
+
+#include <boost/asio/ssl/context.hpp>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "mtxclient/http/client.hpp"
+
+namespace mtx {
+namespace http {
+
+//! Remembers the last TLS session (or session ticket) per host, so that new connections to the
+//! same host can do an abbreviated handshake.
+class TlsSessionCache
+{
+public:
+        //! Attach the cache to the ssl context. The cache needs to be destroyed before any other
+        //! cache is attached to the same context.
+        explicit TlsSessionCache(boost::asio::ssl::context &ctx);
+        ~TlsSessionCache();
+
+        TlsSessionCache(const TlsSessionCache &) = delete;
+        TlsSessionCache &operator=(const TlsSessionCache &) = delete;
+
+        //! Offer the cached session for the host on a new connection. Needs to be called before
+        //! the handshake and after the SNI hostname was set.
+        void prepare(SSL *ssl, const std::string &host);
+        //! Record the outcome of a successful handshake.
+        void handshake_done(SSL *ssl);
+
+        //! Retrieve the resumption counters.
+        TlsSessionStats stats() const;
+        //! Forget all cached sessions.
+        void clear();
+
+private:
+        //! Called by OpenSSL, when the server issued a new session or session ticket.
+        static int on_new_session(SSL *ssl, SSL_SESSION *session);
+        void store(const std::string &host, SSL_SESSION *session);
+
+        SSL_CTX *ctx_;
+
+        mutable std::mutex mutex_;
+        //! The most recent session per host. Each entry holds a reference.
+        std::map<std::string, SSL_SESSION *> sessions_;
+        TlsSessionStats stats_;
+};
+}
+}
@@ -4,8 +4,10 @@
 /// @brief Various utility functions for http requests.
 
 #include <boost/iostreams/device/array.hpp>
+#include <cstddef>
 #include <iosfwd>
 #include <map>
+#include <memory>
 #include <string>
 
 namespace mtx {
@@ -42,6 +44,30 @@ query_params(const std::map<std::string, std::string> &params) noexcept;
 std::string
 decompress(const boost::iostreams::array_source &src, const std::string &type) noexcept;
 
+//! Decompresses a gzip or deflate encoded body incrementally, as it arrives.
+//!
+//! The output is appended directly to the caller's string, so the body is never copied after
+//! it was decompressed. If the data turns out not to be compressed at all, it is passed through
+//! unchanged.
+class Inflater
+{
+public:
+        //! Any encoding besides "gzip" and "deflate" is passed through unchanged.
+        explicit Inflater(const std::string &encoding);
+        ~Inflater();
+
+        Inflater(Inflater &&) noexcept;
+        Inflater &operator=(Inflater &&) noexcept;
+
+        //! Decompress the next chunk of the body and append it to `out`.
+        //! Returns false, if the data is corrupt.
+        bool inflate(const char *data, std::size_t size, std::string &out);
+
+private:
+        struct Impl;
+        std::unique_ptr<Impl> p;
+};
+
 //! URL-encode the input string.
 std::string
 url_encode(const std::string &s) noexcept;
@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iostream>
+#include <thread>
+#include <unordered_map>
 
 #include <nlohmann/json.hpp>
 
 #include <openssl/aes.h>
+#include <openssl/crypto.h>
 #include <openssl/sha.h>
 
 #include "mtxclient/crypto/client.hpp"
@@ -69,7 +75,7 @@ OlmClient::restore_account(const std::string &saved_data, const std::string &key
 mtx::crypto::IdentityKeys
 OlmClient::identity_keys() const
 {
-        auto tmp_buf = create_buffer(olm_account_identity_keys_length(account_.get()));
+        auto tmp_buf = create_scratch_buffer(olm_account_identity_keys_length(account_.get()));
         auto ret =
           olm_account_identity_keys(account_.get(), (void *)tmp_buf.data(), tmp_buf.size());
 
@@ -82,7 +88,7 @@ OlmClient::identity_keys() const
 std::string
 OlmClient::sign_message(const std::string &msg) const
 {
-        auto signature_buf = create_buffer(olm_account_signature_length(account_.get()));
+        auto signature_buf = create_scratch_buffer(olm_account_signature_length(account_.get()));
         olm_account_sign(
           account_.get(), msg.data(), msg.size(), signature_buf.data(), signature_buf.size());
 
@@ -126,7 +132,7 @@ OlmClient::generate_one_time_keys(std::size_t number_of_keys)
 mtx::crypto::OneTimeKeys
 OlmClient::one_time_keys()
 {
-        auto buf = create_buffer(olm_account_one_time_keys_length(account_.get()));
+        auto buf = create_scratch_buffer(olm_account_one_time_keys_length(account_.get()));
 
         const auto ret = olm_account_one_time_keys(account_.get(), buf.data(), buf.size());
 
@@ -249,43 +255,143 @@ OlmClient::import_inbound_group_session(const std::string &session_key)
         return session;
 }
 
-GroupPlaintext
-OlmClient::decrypt_group_message(OlmInboundGroupSession *session,
-                                 const std::string &message,
-                                 uint32_t message_index)
+//! Scratch space of a thread for decrypting megolm messages, reused for every message. The plain
+//! text is wiped after every message.
+struct GroupDecryptScratch
+{
+        BinaryBuf message;
+        BinaryBuf plaintext;
+};
+
+//! Decrypt `message` into `plaintext`, using the scratch space of the calling thread. Returns
+//! olm_error(), if olm couldn't decrypt it.
+static std::size_t
+group_decrypt(OlmInboundGroupSession *session,
+              std::string_view message,
+              BinaryBuf &plaintext,
+              uint32_t &message_index)
 {
-        // TODO handle errors
-        auto tmp_msg = create_buffer(message.size());
-        std::copy(message.begin(), message.end(), tmp_msg.begin());
+        thread_local GroupDecryptScratch scratch;
+
+        // olm decodes the message in place, so it needs a fresh copy for every call.
+        scratch.message.assign(message.begin(), message.end());
 
-        auto plaintext_len =
-          olm_group_decrypt_max_plaintext_length(session, tmp_msg.data(), tmp_msg.size());
-        auto plaintext = create_buffer(plaintext_len);
+        const std::size_t max_length = olm_group_decrypt_max_plaintext_length(
+          session, scratch.message.data(), scratch.message.size());
+        if (max_length == olm_error())
+                return max_length;
 
-        tmp_msg = create_buffer(message.size());
-        std::copy(message.begin(), message.end(), tmp_msg.begin());
+        if (scratch.plaintext.size() < max_length)
+                scratch.plaintext.resize(max_length);
+        scratch.message.assign(message.begin(), message.end());
 
         const std::size_t nbytes = olm_group_decrypt(session,
-                                                     tmp_msg.data(),
-                                                     tmp_msg.size(),
-                                                     plaintext.data(),
-                                                     plaintext.size(),
+                                                     scratch.message.data(),
+                                                     scratch.message.size(),
+                                                     scratch.plaintext.data(),
+                                                     max_length,
                                                      &message_index);
+        if (nbytes == olm_error()) {
+                OPENSSL_cleanse(scratch.plaintext.data(), max_length);
+                return nbytes;
+        }
 
-        if (nbytes == olm_error())
+        plaintext.assign(scratch.plaintext.begin(), scratch.plaintext.begin() + nbytes);
+        // The scratch space lives as long as the thread, so don't leave the plain text in it.
+        OPENSSL_cleanse(scratch.plaintext.data(), nbytes);
+        return nbytes;
+}
+
+//! Run `f(i)` for the indices of `count` items on `threads` threads, or on the calling thread
+//! without threads. Using a session changes it, so the items of one session, given by
+//! `session(i)`, are run by one thread in their order.
+template<class SessionOf, class F>
+static void
+for_each_by_session(std::size_t count, SessionOf &&session, unsigned threads, F &&f)
+{
+        if (threads == 0 || count < 2) {
+                for (std::size_t i = 0; i < count; ++i)
+                        f(i);
+                return;
+        }
+
+        std::vector<std::vector<std::size_t>> sessions;
+        std::unordered_map<const void *, std::size_t> session_index;
+        for (std::size_t i = 0; i < count; ++i) {
+                auto [it, inserted] = session_index.try_emplace(session(i), sessions.size());
+                if (inserted)
+                        sessions.emplace_back();
+                sessions[it->second].push_back(i);
+        }
+
+        std::atomic<std::size_t> next{0};
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+        const auto run = [&] {
+                try {
+                        for (auto s = next++; s < sessions.size() && !failed; s = next++)
+                                for (auto i : sessions[s])
+                                        f(i);
+                } catch (...) {
+                        if (!failed.exchange(true))
+                                error = std::current_exception();
+                }
+        };
+
+        std::vector<std::thread> workers;
+        const auto thread_count = std::min<std::size_t>(threads, sessions.size());
+        for (std::size_t i = 1; i < thread_count; ++i)
+                workers.emplace_back(run);
+        run();
+        for (auto &worker : workers)
+                worker.join();
+
+        if (error)
+                std::rethrow_exception(error);
+}
+
+GroupPlaintext
+OlmClient::decrypt_group_message(OlmInboundGroupSession *session,
+                                 const std::string &message,
+                                 uint32_t message_index)
+{
+        GroupPlaintext result{BinaryBuf{}, message_index};
+
+        if (group_decrypt(session, message, result.data, result.message_index) == olm_error())
                 throw olm_exception("olm_group_decrypt", session);
 
-        auto output = create_buffer(nbytes);
-        std::memcpy(output.data(), plaintext.data(), nbytes);
+        return result;
+}
 
-        return GroupPlaintext{std::move(output), message_index};
+std::vector<GroupDecryptionResult>
+OlmClient::decrypt_group_messages(const std::vector<GroupCiphertext> &messages, unsigned threads)
+{
+        std::vector<GroupDecryptionResult> results(messages.size());
+
+        const auto decrypt = [&messages, &results](std::size_t i) {
+                auto &result = results[i];
+                if (group_decrypt(messages[i].session,
+                                  messages[i].ciphertext,
+                                  result.plaintext.data,
+                                  result.plaintext.message_index) == olm_error())
+                        result.error =
+                          olm_exception("olm_group_decrypt", messages[i].session).error_code();
+        };
+
+        for_each_by_session(
+          messages.size(),
+          [&messages](std::size_t i) { return messages[i].session; },
+          threads,
+          decrypt);
+
+        return results;
 }
 
 BinaryBuf
 OlmClient::encrypt_group_message(OlmOutboundGroupSession *session, const std::string &plaintext)
 {
         auto encrypted_len     = olm_group_encrypt_message_length(session, plaintext.size());
-        auto encrypted_message = create_buffer(encrypted_len);
+        auto encrypted_message = create_scratch_buffer(encrypted_len);
 
         const std::size_t nbytes =
           olm_group_encrypt(session,
@@ -305,13 +411,13 @@ OlmClient::decrypt_message(OlmSession *session,
                            size_t msgtype,
                            const std::string &one_time_key_message)
 {
-        auto tmp = create_buffer(one_time_key_message.size());
+        auto tmp = create_scratch_buffer(one_time_key_message.size());
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         auto declen =
           olm_decrypt_max_plaintext_length(session, msgtype, (void *)tmp.data(), tmp.size());
 
-        auto decrypted = create_buffer(declen);
+        auto decrypted = create_scratch_buffer(declen);
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         const std::size_t nbytes = olm_decrypt(
@@ -321,16 +427,15 @@ OlmClient::decrypt_message(OlmSession *session,
                 throw olm_exception("olm_decrypt", session);
 
         // Removing the extra padding from the origial buffer.
-        auto output = create_buffer(nbytes);
-        std::memcpy(output.data(), decrypted.data(), nbytes);
+        decrypted.resize(nbytes);
 
-        return output;
+        return decrypted;
 }
 
 BinaryBuf
 OlmClient::encrypt_message(OlmSession *session, const std::string &msg)
 {
-        auto ciphertext = create_buffer(olm_encrypt_message_length(session, msg.size()));
+        auto ciphertext = create_scratch_buffer(olm_encrypt_message_length(session, msg.size()));
         auto random_buf = create_buffer(olm_encrypt_random_length(session));
 
         const auto ret = olm_encrypt(session,
@@ -362,7 +467,7 @@ OlmClient::create_inbound_session_from(const std::string &their_curve25519,
 {
         auto session = create_olm_object<SessionObject>();
 
-        auto tmp = create_buffer(one_time_key_message.size());
+        auto tmp = create_scratch_buffer(one_time_key_message.size());
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         std::size_t ret = olm_create_inbound_session_from(session.get(),
@@ -397,7 +502,7 @@ OlmClient::create_inbound_session(const BinaryBuf &one_time_key_message)
 {
         auto session = create_olm_object<SessionObject>();
 
-        auto tmp = create_buffer(one_time_key_message.size());
+        auto tmp = create_scratch_buffer(one_time_key_message.size());
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         std::size_t ret =
@@ -445,7 +550,7 @@ OlmClient::sas_init()
 SAS::SAS()
 {
         this->sas       = create_olm_object<SASObject>();
-        auto random_buf = BinaryBuf(olm_create_sas_random_length(sas.get()));
+        auto random_buf = create_buffer(olm_create_sas_random_length(sas.get()));
 
         const auto ret = olm_create_sas(this->sas.get(), random_buf.data(), random_buf.size());
 
@@ -456,7 +561,7 @@ SAS::SAS()
 std::string
 SAS::public_key()
 {
-        auto pub_key_buffer = create_buffer(olm_sas_pubkey_length(this->sas.get()));
+        auto pub_key_buffer = create_scratch_buffer(olm_sas_pubkey_length(this->sas.get()));
 
         const auto ret =
           olm_sas_get_pubkey(this->sas.get(), pub_key_buffer.data(), pub_key_buffer.size());
@@ -622,6 +727,64 @@ OlmClient::create_olm_encrypted_content(OlmSession *session,
                      {{recipient_curve25519_key, {{"body", encrypted_str}, {"type", msg_type}}}}}};
 }
 
+nlohmann::json
+OlmClient::create_olm_encrypted_to_device_body(nlohmann::json event,
+                                               const std::vector<OlmRecipient> &recipients,
+                                               unsigned threads)
+{
+        const auto keys = identity_keys();
+
+        event["keys"]["ed25519"] = keys.ed25519;
+        event["sender"]          = user_id_;
+        event["sender_device"]   = device_id_;
+        event.erase("recipient");
+        event.erase("recipient_keys");
+
+        // The event without its closing brace, to which the recipient of every device is
+        // appended. The object isn't empty, so the recipient follows a comma.
+        auto base = event.dump();
+        base.pop_back();
+
+        struct Encrypted
+        {
+                std::string body;
+                std::size_t type = 0;
+        };
+        std::vector<Encrypted> encrypted(recipients.size());
+
+        for_each_by_session(
+          recipients.size(),
+          [&recipients](std::size_t i) { return recipients[i].session; },
+          threads,
+          [&](std::size_t i) {
+                  const auto &recipient = recipients[i];
+
+                  auto plaintext = base;
+                  plaintext += ",\"recipient\":";
+                  plaintext += json(recipient.user_id).dump();
+                  plaintext += ",\"recipient_keys\":{\"ed25519\":";
+                  plaintext += json(recipient.ed25519).dump();
+                  plaintext += "}}";
+
+                  encrypted[i].type = olm_encrypt_message_type(recipient.session);
+                  encrypted[i].body = to_string(encrypt_message(recipient.session, plaintext));
+          });
+
+        json body{{"messages", json::object()}};
+        auto &messages = body["messages"];
+        for (std::size_t i = 0; i < recipients.size(); ++i) {
+                const auto &recipient = recipients[i];
+                messages[recipient.user_id][recipient.device_id] = json{
+                  {"algorithm", "m.olm.v1.curve25519-aes-sha2"},
+                  {"sender_key", keys.curve25519},
+                  {"ciphertext",
+                   {{recipient.curve25519,
+                     {{"body", std::move(encrypted[i].body)}, {"type", encrypted[i].type}}}}}};
+        }
+
+        return body;
+}
+
 std::string
 OlmClient::save(const std::string &key)
 {
@@ -634,7 +797,7 @@ OlmClient::save(const std::string &key)
 std::string
 mtx::crypto::session_id(OlmSession *s)
 {
-        auto tmp = create_buffer(olm_session_id_length(s));
+        auto tmp = create_scratch_buffer(olm_session_id_length(s));
         olm_session_id(s, tmp.data(), tmp.size());
 
         return std::string(tmp.begin(), tmp.end());
@@ -643,7 +806,7 @@ mtx::crypto::session_id(OlmSession *s)
 std::string
 mtx::crypto::session_id(OlmOutboundGroupSession *s)
 {
-        auto tmp = create_buffer(olm_outbound_group_session_id_length(s));
+        auto tmp = create_scratch_buffer(olm_outbound_group_session_id_length(s));
         olm_outbound_group_session_id(s, tmp.data(), tmp.size());
 
         return std::string(tmp.begin(), tmp.end());
@@ -652,7 +815,7 @@ mtx::crypto::session_id(OlmOutboundGroupSession *s)
 std::string
 mtx::crypto::session_key(OlmOutboundGroupSession *s)
 {
-        auto tmp = create_buffer(olm_outbound_group_session_key_length(s));
+        auto tmp = create_scratch_buffer(olm_outbound_group_session_key_length(s));
         olm_outbound_group_session_key(s, tmp.data(), tmp.size());
 
         return std::string(tmp.begin(), tmp.end());
@@ -664,7 +827,7 @@ mtx::crypto::export_session(OlmInboundGroupSession *s)
         const size_t len     = olm_export_inbound_group_session_length(s);
         const uint32_t index = olm_inbound_group_session_first_known_index(s);
 
-        auto session_key = create_buffer(len);
+        auto session_key = create_scratch_buffer(len);
         const std::size_t ret =
           olm_export_inbound_group_session(s, session_key.data(), session_key.size(), index);
 
@@ -691,7 +854,7 @@ mtx::crypto::import_session(const std::string &session_key)
 bool
 mtx::crypto::matches_inbound_session(OlmSession *session, const std::string &one_time_key_message)
 {
-        auto tmp = create_buffer(one_time_key_message.size());
+        auto tmp = create_scratch_buffer(one_time_key_message.size());
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         return olm_matches_inbound_session(session, (void *)tmp.data(), tmp.size());
@@ -702,7 +865,7 @@ mtx::crypto::matches_inbound_session_from(OlmSession *session,
                                           const std::string &id_key,
                                           const std::string &one_time_key_message)
 {
-        auto tmp = create_buffer(one_time_key_message.size());
+        auto tmp = create_scratch_buffer(one_time_key_message.size());
         std::copy(one_time_key_message.begin(), one_time_key_message.end(), tmp.begin());
 
         return olm_matches_inbound_session_from(
@@ -779,10 +942,8 @@ mtx::crypto::encrypt_exported_sessions(const mtx::crypto::ExportedSessionKeys &k
 
         auto salt = create_buffer(pwhash_SALTBYTES);
 
-        auto buf = create_buffer(64U);
-
         uint32_t iterations = 100000;
-        buf                 = mtx::crypto::PBKDF2_HMAC_SHA_512(pass, salt, iterations);
+        auto buf            = mtx::crypto::PBKDF2_HMAC_SHA_512(pass, salt, iterations);
 
         BinaryBuf aes256 = BinaryBuf(buf.begin(), buf.begin() + 32);
 
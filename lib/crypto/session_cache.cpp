@@ -0,0 +1,244 @@
+#include "mtxclient/crypto/session_cache.hpp"
+
+using namespace mtx::crypto;
+
+std::size_t
+InboundSessionKeyHash::operator()(const InboundSessionKey &key) const noexcept
+{
+        // The session id alone is random enough, the other parts only tell apart copies of it.
+        std::size_t hash = std::hash<std::string>{}(key.session_id);
+        hash ^= std::hash<std::string>{}(key.sender_key) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        hash ^= std::hash<std::string>{}(key.room_id) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        return hash;
+}
+
+InboundSessionCache::InboundSessionCache(std::size_t capacity,
+                                         std::string pickle_key,
+                                         Load load,
+                                         Store store)
+  : capacity_(capacity > 0 ? capacity : 1)
+  , pickle_key_(std::move(pickle_key))
+  , load_(std::move(load))
+  , store_(std::move(store))
+{}
+
+InboundSessionCache::~InboundSessionCache()
+{
+        try {
+                flush();
+        } catch (...) {
+        }
+}
+
+std::shared_ptr<InboundSessionCache::Entry>
+InboundSessionCache::find(
+  const InboundSessionKey &key,
+  std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> &evicted)
+{
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second.position);
+                return it->second.entry;
+        }
+
+        auto writing = writing_back_.find(key);
+        if (writing == writing_back_.end())
+                return nullptr;
+
+        // The thread writing it back notices, that it was cached again, and leaves it alone.
+        auto entry = std::move(writing->second);
+        writing_back_.erase(writing);
+        evicted = add(key, entry);
+        return entry;
+}
+
+std::shared_ptr<InboundSessionCache::Entry>
+InboundSessionCache::acquire(const InboundSessionKey &key)
+{
+        std::shared_ptr<Entry> entry;
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                entry = find(key, evicted);
+        }
+
+        if (entry) {
+                ++hits_;
+                evict(std::move(evicted));
+                return entry;
+        }
+
+        // Loading and unpickling happen outside of the lock, so that a miss doesn't hold up the
+        // other threads.
+        ++misses_;
+        auto pickled = load_(key);
+        if (!pickled)
+                return nullptr;
+
+        entry          = std::make_shared<Entry>();
+        entry->session = unpickle<InboundSessionObject>(*pickled, pickle_key_);
+
+        std::shared_ptr<Entry> cached;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                // Another thread loaded the same session in the meantime.
+                cached = find(key, evicted);
+                if (!cached)
+                        evicted = add(key, entry);
+        }
+
+        evict(std::move(evicted));
+        return cached ? cached : entry;
+}
+
+std::vector<std::pair<InboundSessionKey, std::shared_ptr<InboundSessionCache::Entry>>>
+InboundSessionCache::add(const InboundSessionKey &key, std::shared_ptr<Entry> entry)
+{
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted;
+        while (entries_.size() >= capacity_) {
+                auto it = entries_.find(lru_.back());
+                writing_back_[lru_.back()] = it->second.entry;
+                evicted.emplace_back(std::move(lru_.back()), std::move(it->second.entry));
+                entries_.erase(it);
+                lru_.pop_back();
+        }
+
+        lru_.push_front(key);
+        entries_.emplace(key, Slot{std::move(entry), lru_.begin()});
+        return evicted;
+}
+
+void
+InboundSessionCache::write_back(const InboundSessionKey &key, Entry &entry)
+{
+        if (!entry.dirty)
+                return;
+
+        store_(key, pickle<InboundSessionObject>(entry.session.get(), pickle_key_));
+        entry.dirty = false;
+        ++write_backs_;
+}
+
+void
+InboundSessionCache::evict(
+  std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted)
+{
+        for (auto &[key, entry] : evicted) {
+                ++evictions_;
+
+                std::lock_guard<std::mutex> lock(entry->mutex);
+                write_back(key, *entry);
+                release(key, entry);
+        }
+}
+
+void
+InboundSessionCache::release(const InboundSessionKey &key, const std::shared_ptr<Entry> &entry)
+{
+        // Only now a lookup may load the stored pickle. Users, that got the entry before, write
+        // it back themselves.
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = writing_back_.find(key);
+        if (it != writing_back_.end() && it->second == entry) {
+                writing_back_.erase(it);
+                entry->evicted = true;
+        }
+}
+
+std::optional<GroupPlaintext>
+InboundSessionCache::decrypt(OlmClient &client,
+                             const InboundSessionKey &key,
+                             const std::string &message)
+{
+        std::optional<GroupPlaintext> plaintext;
+        with_session(key, [&](OlmInboundGroupSession *session) {
+                plaintext = client.decrypt_group_message(session, message);
+                // Olm only advances its cached ratchet, which the stored pickle can do again.
+                return false;
+        });
+        return plaintext;
+}
+
+void
+InboundSessionCache::insert(const InboundSessionKey &key, InboundGroupSessionPtr session)
+{
+        auto entry     = std::make_shared<Entry>();
+        entry->session = std::move(session);
+        entry->dirty   = true;
+
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                auto it = entries_.find(key);
+                if (it != entries_.end()) {
+                        // The new session replaces the cached one, which isn't stored anymore.
+                        lru_.erase(it->second.position);
+                        entries_.erase(it);
+                }
+                writing_back_.erase(key);
+
+                evicted = add(key, std::move(entry));
+        }
+
+        evict(std::move(evicted));
+}
+
+void
+InboundSessionCache::erase(const InboundSessionKey &key)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        writing_back_.erase(key);
+
+        auto it = entries_.find(key);
+        if (it == entries_.end())
+                return;
+
+        lru_.erase(it->second.position);
+        entries_.erase(it);
+}
+
+void
+InboundSessionCache::flush()
+{
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> cached;
+        // Evicted entries, whose write-back failed.
+        std::vector<std::pair<InboundSessionKey, std::shared_ptr<Entry>>> evicted;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                cached.reserve(entries_.size());
+                for (const auto &[key, slot] : entries_)
+                        cached.emplace_back(key, slot.entry);
+                evicted.assign(writing_back_.begin(), writing_back_.end());
+        }
+
+        for (auto &[key, entry] : cached) {
+                std::lock_guard<std::mutex> lock(entry->mutex);
+                write_back(key, *entry);
+        }
+        for (auto &[key, entry] : evicted) {
+                std::lock_guard<std::mutex> lock(entry->mutex);
+                write_back(key, *entry);
+                release(key, entry);
+        }
+}
+
+SessionCacheStats
+InboundSessionCache::stats() const
+{
+        SessionCacheStats stats;
+        stats.hits        = hits_;
+        stats.misses      = misses_;
+        stats.evictions   = evictions_;
+        stats.write_backs = write_backs_;
+        return stats;
+}
+
+std::size_t
+InboundSessionCache::size() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+}
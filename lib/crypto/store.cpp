@@ -0,0 +1,464 @@
+#include "mtxclient/crypto/store.hpp"
+
+#include <array>
+#include <filesystem>
+#include <limits>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mtxclient/crypto/utils.hpp"
+
+using namespace mtx::crypto;
+
+namespace fs = std::filesystem;
+
+//! Identifies the file format, written at the start of the file.
+static constexpr std::string_view file_magic = "MTXCRYP1";
+//! Key size, value size and checksum in front of the key and the value of every record.
+static constexpr std::size_t record_header_size = 12;
+//! The value size of a record, that erases its entry.
+static constexpr std::uint32_t erased = std::numeric_limits<std::uint32_t>::max();
+//! Files with less garbage aren't compacted, since rewriting them wouldn't save much.
+static constexpr std::uint64_t min_garbage_to_compact = 1024 * 1024;
+
+static void
+write_u32(char *out, std::uint32_t value)
+{
+        for (int i = 0; i < 4; ++i)
+                out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+static std::uint32_t
+read_u32(const char *in)
+{
+        std::uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+                value |= static_cast<std::uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        return value;
+}
+
+//! FNV-1a over the key and the value of a record, to detect records, that were partially
+//! written.
+static std::uint32_t
+checksum(std::string_view entry_key, std::string_view value)
+{
+        std::uint32_t hash = 2166136261u;
+        for (auto part : {entry_key, value})
+                for (unsigned char c : part)
+                        hash = (hash ^ c) * 16777619u;
+        return hash;
+}
+
+//! Write the contents of the file or directory at `path` to the disk. Flushing a stream only
+//! hands the data to the operating system, which may persist a rename before the data.
+static bool
+sync_to_disk(const std::string &path, bool directory)
+{
+#ifdef _WIN32
+        // Windows persists renames with the file and can't open directories this way.
+        if (directory)
+                return true;
+
+        const int fd = ::_open(path.c_str(), _O_RDWR | _O_BINARY);
+        if (fd < 0)
+                return false;
+        const bool synced = ::_commit(fd) == 0;
+        ::_close(fd);
+#else
+        const int fd = ::open(path.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDWR);
+        if (fd < 0)
+                return false;
+        const bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+#endif
+        return synced;
+}
+
+CryptoStore::CryptoStore(std::string path)
+  : path_(std::move(path))
+{
+        load();
+}
+
+std::string
+CryptoStore::key(Table table, std::string_view a, std::string_view b)
+{
+        std::string k;
+        k.reserve(1 + a.size() + 1 + b.size());
+        k += static_cast<char>(table);
+        k += a;
+        // Ids and keys never contain a NUL byte, so it separates the parts of the key.
+        k += '\0';
+        k += b;
+        return k;
+}
+
+void
+CryptoStore::load()
+{
+        std::error_code ec;
+        if (!fs::exists(path_, ec) || fs::file_size(path_, ec) == 0) {
+                std::ofstream create(path_, std::ios::binary | std::ios::trunc);
+                create.write(file_magic.data(), file_magic.size());
+                if (!create.flush())
+                        throw crypto_exception("CryptoStore", ("can't create " + path_).c_str());
+        }
+
+        const auto file_size = fs::file_size(path_, ec);
+        if (ec)
+                throw crypto_exception("CryptoStore",
+                                       ("can't read " + path_ + ": " + ec.message()).c_str());
+
+        std::uint64_t valid_size = 0;
+        {
+                std::ifstream in(path_, std::ios::binary);
+                std::array<char, file_magic.size()> magic{};
+                if (!in.read(magic.data(), magic.size()) ||
+                    std::string_view(magic.data(), magic.size()) != file_magic)
+                        throw crypto_exception("CryptoStore",
+                                               (path_ + " is not a crypto store").c_str());
+
+                valid_size = file_magic.size();
+                std::array<char, record_header_size> header{};
+                std::string entry_key, value;
+                while (in.read(header.data(), header.size())) {
+                        const auto key_size   = read_u32(header.data());
+                        const auto value_size = read_u32(header.data() + 4);
+                        const auto stored_sum = read_u32(header.data() + 8);
+
+                        // The sizes of a torn record may be garbage, so check them, before
+                        // allocating anything for it.
+                        const std::uint64_t data_size =
+                          std::uint64_t{key_size} + (value_size == erased ? 0 : value_size);
+                        if (data_size > file_size - valid_size - record_header_size)
+                                break;
+
+                        entry_key.resize(key_size);
+                        value.resize(value_size == erased ? 0 : value_size);
+                        if (!in.read(entry_key.data(), entry_key.size()) ||
+                            !in.read(value.data(), value.size()) ||
+                            checksum(entry_key, value) != stored_sum)
+                                break;
+
+                        const std::uint64_t record_size =
+                          record_header_size + entry_key.size() + value.size();
+                        auto it = index_.find(entry_key);
+                        if (it != index_.end())
+                                garbage_size_ += it->second.record_size;
+
+                        if (value_size == erased) {
+                                garbage_size_ += record_size;
+                                if (it != index_.end())
+                                        index_.erase(it);
+                                index_olm_session(entry_key, false);
+                        } else {
+                                Location location;
+                                location.offset      = valid_size + record_header_size + key_size;
+                                location.size        = value_size;
+                                location.record_size = record_size;
+                                index_[entry_key]    = location;
+                                index_olm_session(entry_key, true);
+                        }
+
+                        valid_size += record_size;
+                }
+        }
+
+        // Drop a record at the end, that was only partially written.
+        if (file_size != valid_size) {
+                fs::resize_file(path_, valid_size, ec);
+                if (ec)
+                        throw crypto_exception(
+                          "CryptoStore", ("can't truncate " + path_ + ": " + ec.message()).c_str());
+        }
+
+        file_size_ = valid_size;
+        file_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file_)
+                throw crypto_exception("CryptoStore", ("can't open " + path_).c_str());
+
+        compact_if_needed();
+}
+
+CryptoStore::Location
+CryptoStore::append(std::fstream &file,
+                    std::uint64_t offset,
+                    std::string_view entry_key,
+                    const std::string_view *value)
+{
+        if (entry_key.size() >= erased || (value && value->size() >= erased))
+                throw crypto_exception("CryptoStore", "entry too large");
+
+        const std::string_view data = value ? *value : std::string_view();
+
+        std::array<char, record_header_size> header{};
+        write_u32(header.data(), static_cast<std::uint32_t>(entry_key.size()));
+        write_u32(header.data() + 4, value ? static_cast<std::uint32_t>(data.size()) : erased);
+        write_u32(header.data() + 8, checksum(entry_key, data));
+
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(header.data(), header.size());
+        file.write(entry_key.data(), entry_key.size());
+        file.write(data.data(), data.size());
+        if (!file.flush()) {
+                // The next record overwrites this one, so later writes may still succeed.
+                file.clear();
+                throw crypto_exception("CryptoStore", ("can't write to " + path_).c_str());
+        }
+
+        Location location;
+        location.offset      = offset + record_header_size + entry_key.size();
+        location.size        = static_cast<std::uint32_t>(data.size());
+        location.record_size = record_header_size + entry_key.size() + data.size();
+        return location;
+}
+
+void
+CryptoStore::index_olm_session(std::string_view entry_key, bool stored)
+{
+        if (entry_key.empty() || entry_key[0] != static_cast<char>(Table::OlmSessions))
+                return;
+
+        const auto separator = entry_key.find('\0', 1);
+        if (separator == std::string_view::npos)
+                return;
+
+        std::string curve25519(entry_key.substr(1, separator - 1));
+        std::string session_id(entry_key.substr(separator + 1));
+        if (stored) {
+                olm_sessions_[std::move(curve25519)].insert(std::move(session_id));
+        } else if (auto it = olm_sessions_.find(curve25519); it != olm_sessions_.end()) {
+                it->second.erase(session_id);
+                if (it->second.empty())
+                        olm_sessions_.erase(it);
+        }
+}
+
+void
+CryptoStore::put(std::string entry_key, std::string_view value)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        const auto location = append(file_, file_size_, entry_key, &value);
+        file_size_ += location.record_size;
+
+        index_olm_session(entry_key, true);
+        auto [it, inserted] = index_.try_emplace(std::move(entry_key), location);
+        if (!inserted) {
+                garbage_size_ += it->second.record_size;
+                it->second = location;
+        }
+
+        compact_if_needed();
+}
+
+bool
+CryptoStore::erase(const std::string &entry_key)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = index_.find(entry_key);
+        if (it == index_.end())
+                return false;
+
+        const auto location = append(file_, file_size_, entry_key, nullptr);
+        file_size_ += location.record_size;
+        garbage_size_ += it->second.record_size + location.record_size;
+
+        index_.erase(it);
+        index_olm_session(entry_key, false);
+
+        compact_if_needed();
+        return true;
+}
+
+std::optional<std::string>
+CryptoStore::get(const std::string &entry_key) const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = index_.find(entry_key);
+        if (it == index_.end())
+                return std::nullopt;
+
+        std::string value(it->second.size, '\0');
+        file_.seekg(static_cast<std::streamoff>(it->second.offset));
+        if (!file_.read(value.data(), value.size())) {
+                file_.clear();
+                throw crypto_exception("CryptoStore", ("can't read from " + path_).c_str());
+        }
+
+        return value;
+}
+
+void
+CryptoStore::compact_if_needed()
+{
+        if (garbage_size_ >= min_garbage_to_compact && garbage_size_ * 2 > file_size_)
+                compact_locked();
+}
+
+void
+CryptoStore::compact()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        compact_locked();
+}
+
+void
+CryptoStore::compact_locked()
+{
+        const auto tmp_path = path_ + ".tmp";
+
+        std::unordered_map<std::string, Location> index;
+        index.reserve(index_.size());
+        std::uint64_t size = file_magic.size();
+        {
+                std::fstream out(tmp_path, std::ios::binary | std::ios::out | std::ios::trunc);
+                out.write(file_magic.data(), file_magic.size());
+
+                std::string value;
+                for (const auto &[entry_key, location] : index_) {
+                        value.resize(location.size);
+                        file_.seekg(static_cast<std::streamoff>(location.offset));
+                        if (!file_.read(value.data(), value.size())) {
+                                file_.clear();
+                                throw crypto_exception("CryptoStore",
+                                                       ("can't read from " + path_).c_str());
+                        }
+
+                        const std::string_view data = value;
+                        const auto new_location     = append(out, size, entry_key, &data);
+                        size += new_location.record_size;
+                        index.emplace(entry_key, new_location);
+                }
+        }
+
+        // Replacing the file is atomic. The new log is on the disk before the rename, so a crash
+        // leaves either the old or the complete new log.
+        if (!sync_to_disk(tmp_path, false))
+                throw crypto_exception("CryptoStore", ("can't sync " + tmp_path).c_str());
+
+        std::error_code ec;
+        file_.close();
+        fs::rename(tmp_path, path_, ec);
+        file_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+        if (ec)
+                throw crypto_exception("CryptoStore",
+                                       ("can't replace " + path_ + ": " + ec.message()).c_str());
+        if (!file_)
+                throw crypto_exception("CryptoStore", ("can't open " + path_).c_str());
+
+        index_        = std::move(index);
+        file_size_    = size;
+        garbage_size_ = 0;
+
+        // Persist the rename itself.
+        auto directory = fs::path(path_).parent_path();
+        if (directory.empty())
+                directory = ".";
+        if (!sync_to_disk(directory.string(), true))
+                throw crypto_exception("CryptoStore",
+                                       ("can't sync the directory of " + path_).c_str());
+}
+
+std::uint64_t
+CryptoStore::file_size() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return file_size_;
+}
+
+std::uint64_t
+CryptoStore::garbage_size() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return garbage_size_;
+}
+
+void
+CryptoStore::save_account(std::string_view pickled)
+{
+        put(key(Table::Account, {}), pickled);
+}
+
+std::optional<std::string>
+CryptoStore::account() const
+{
+        return get(key(Table::Account, {}));
+}
+
+void
+CryptoStore::save_olm_session(std::string_view curve25519,
+                              std::string_view session_id,
+                              std::string_view pickled)
+{
+        put(key(Table::OlmSessions, curve25519, session_id), pickled);
+}
+
+std::optional<std::string>
+CryptoStore::olm_session(std::string_view curve25519, std::string_view session_id) const
+{
+        return get(key(Table::OlmSessions, curve25519, session_id));
+}
+
+std::vector<std::string>
+CryptoStore::olm_session_ids(std::string_view curve25519) const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = olm_sessions_.find(std::string(curve25519));
+        if (it == olm_sessions_.end())
+                return {};
+
+        return std::vector<std::string>(it->second.begin(), it->second.end());
+}
+
+bool
+CryptoStore::erase_olm_session(std::string_view curve25519, std::string_view session_id)
+{
+        return erase(key(Table::OlmSessions, curve25519, session_id));
+}
+
+void
+CryptoStore::save_inbound_group_session(std::string_view room_id,
+                                        std::string_view session_id,
+                                        std::string_view pickled)
+{
+        put(key(Table::InboundGroupSessions, room_id, session_id), pickled);
+}
+
+std::optional<std::string>
+CryptoStore::inbound_group_session(std::string_view room_id, std::string_view session_id) const
+{
+        return get(key(Table::InboundGroupSessions, room_id, session_id));
+}
+
+bool
+CryptoStore::erase_inbound_group_session(std::string_view room_id, std::string_view session_id)
+{
+        return erase(key(Table::InboundGroupSessions, room_id, session_id));
+}
+
+void
+CryptoStore::save_outbound_group_session(std::string_view room_id, std::string_view pickled)
+{
+        put(key(Table::OutboundGroupSessions, room_id), pickled);
+}
+
+std::optional<std::string>
+CryptoStore::outbound_group_session(std::string_view room_id) const
+{
+        return get(key(Table::OutboundGroupSessions, room_id));
+}
+
+bool
+CryptoStore::erase_outbound_group_session(std::string_view room_id)
+{
+        return erase(key(Table::OutboundGroupSessions, room_id));
+}
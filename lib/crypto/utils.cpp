@@ -178,7 +178,7 @@ AES_CTR_256_Encrypt(const std::string plaintext, const BinaryBuf aes256Key, Bina
         int ciphertext_len;
 
         // The ciphertext expand up to block size, which is 128 for AES256
-        BinaryBuf encrypted = create_buffer(plaintext.size() + AES_BLOCK_SIZE);
+        BinaryBuf encrypted = create_scratch_buffer(plaintext.size() + AES_BLOCK_SIZE);
 
         uint8_t *iv_data = iv.data();
         // need to set bit 63 to 0
@@ -231,7 +231,7 @@ AES_CTR_256_Decrypt(const std::string ciphertext, const BinaryBuf aes256Key, Bin
 
         int plaintext_len;
 
-        BinaryBuf decrypted = create_buffer(ciphertext.size());
+        BinaryBuf decrypted = create_scratch_buffer(ciphertext.size());
 
         /* Create and initialise the context */
         if (!(ctx = EVP_CIPHER_CTX_new())) {
@@ -1,22 +1,40 @@
 #include "mtxclient/http/client.hpp"
 #include "mtxclient/http/client_impl.hpp"
 
+#include <atomic>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
 #include <mutex>
 #include <thread>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include <nlohmann/json.hpp>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/utility/typed_in_place_factory.hpp>
 
+#include <boost/asio/post.hpp>
 #include <boost/asio/ssl/context.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/http/message.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/signals2/signal_type.hpp>
 #include <boost/thread/thread.hpp>
 
+#include "mtxclient/http/connection_pool.hpp"
+#include "mtxclient/http/dns_cache.hpp"
+#include "mtxclient/http/request_scheduler.hpp"
+#include "mtxclient/http/retry.hpp"
 #include "mtxclient/http/session.hpp"
+#include "mtxclient/http/thread_pool.hpp"
+#include "mtxclient/http/tls_session_cache.hpp"
 #include "mtxclient/utils.hpp"
 
 #include "mtx/requests.hpp"
@@ -25,42 +43,285 @@
 using namespace mtx::http;
 using namespace boost::beast;
 
+namespace {
+//! Extract the content type and the original file name from the headers of a media download.
+void
+parse_media_headers(HeaderFields fields, std::string &content_type, std::string &original_filename)
+{
+        if (!fields)
+                return;
+
+        if (fields->find("Content-Type") != fields->end())
+                content_type = fields->at("Content-Type").to_string();
+        if (fields->find("Content-Disposition") != fields->end()) {
+                auto value = fields->at("Content-Disposition").to_string();
+
+                std::vector<std::string> results;
+                boost::split(results, value, [](char c) { return c == '='; });
+
+                original_filename = results.back();
+        }
+}
+}
+
+template<>
+mtx::responses::Sync
+mtx::client::utils::deserialize<mtx::responses::Sync>(const std::string &data)
+{
+        return mtx::responses::parse_sync(data);
+}
+
+DownloadSink
+mtx::http::fd_sink(int fd)
+{
+        return [fd](const char *data, std::size_t size) {
+                while (size > 0) {
+#ifdef _WIN32
+                        const auto written = ::_write(fd, data, static_cast<unsigned int>(size));
+#else
+                        const auto written = ::write(fd, data, size);
+#endif
+                        if (written < 0 && errno == EINTR)
+                                continue;
+                        if (written <= 0)
+                                return false;
+
+                        data += written;
+                        size -= static_cast<std::size_t>(written);
+                }
+
+                return true;
+        };
+}
+
 namespace mtx::http {
+//! Everything a request needs to run and to be retried. Queued requests and pending retries only
+//! hold a weak reference to it, so that they are dropped instead of touching a destroyed client,
+//! whose io_context may still be running.
+struct RequestContext : public std::enable_shared_from_this<RequestContext>
+{
+        RequestContext(boost::asio::io_context &ios, bool single_threaded)
+          : ios_(ios)
+          , single_threaded_(single_threaded)
+        {}
+
+        //! Create a session, that is terminated by a shutdown of the client.
+        std::shared_ptr<Session> create_session(const std::string &host,
+                                                uint16_t port,
+                                                RequestID id,
+                                                SuccessCallback on_success,
+                                                FailureCallback on_failure);
+        //! Start the session, once its priority class has a free slot. `attempt` counts the
+        //! previous attempts of the same request.
+        void run_session(std::shared_ptr<Session> session, unsigned attempt);
+
+        boost::asio::io_context &ios_;
+        //! Whether a single thread runs the io_context.
+        bool single_threaded_;
+        //! SSL context for requests. Shared with the sessions, which may outlive the client.
+        std::shared_ptr<boost::asio::ssl::context> ssl_ctx_ =
+          std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::sslv23_client);
+        //! Idle keep-alive connections shared by the sessions.
+        std::shared_ptr<ConnectionPool> pool_ = std::make_shared<ConnectionPool>();
+        //! TLS sessions to resume, when a new connection is needed.
+        std::shared_ptr<TlsSessionCache> tls_sessions_ =
+          std::make_shared<TlsSessionCache>(*ssl_ctx_);
+        //! Resolved addresses shared by the sessions.
+        std::shared_ptr<DnsCache> dns_ = std::make_shared<DnsCache>(ios_);
+        //! Limits the concurrent requests per priority class.
+        std::shared_ptr<RequestScheduler> scheduler_ = std::make_shared<RequestScheduler>();
+        //! Decides, which failed requests are sent again.
+        std::shared_ptr<RetryPolicy> retry_ = std::make_shared<RetryPolicy>();
+        //! All the active sessions will shutdown the connection.
+        boost::signals2::signal<void()> shutdown_signal;
+        //! Set, when the client is destroyed. Requests, that would start afterwards, are dropped.
+        std::atomic<bool> closed_{false};
+};
+
 struct ClientPrivate
 {
-        boost::asio::io_service ios_;
+        //! Run the requests on a private io_context.
+        explicit ClientPrivate(unsigned threads)
+          : own_ios_(std::make_unique<boost::asio::io_context>(static_cast<int>(threads)))
+          , ios_(*own_ios_)
+          , work_(std::in_place, *own_ios_)
+          , requests_(std::make_shared<RequestContext>(ios_, threads == 1))
+        {}
+        //! Run the requests on an io_context of the caller.
+        ClientPrivate(boost::asio::io_context &ios,
+                      bool single_threaded,
+                      std::shared_ptr<ThreadPool> thread_pool = nullptr)
+          : thread_pool_(std::move(thread_pool))
+          , ios_(ios)
+          , requests_(std::make_shared<RequestContext>(ios_, single_threaded))
+        {}
+
+        //! The io_context, if the client runs its own threads.
+        std::unique_ptr<boost::asio::io_context> own_ios_;
+        //! The thread pool shared with other clients, if any.
+        std::shared_ptr<ThreadPool> thread_pool_;
+        boost::asio::io_context &ios_;
         //! Used to prevent the event loop from shutting down.
-        std::optional<boost::asio::io_context::work> work_{ios_};
+        std::optional<boost::asio::io_context::work> work_;
         //! Worker threads for the requests.
         boost::thread_group thread_group_;
-        //! SSL context for requests.
-        boost::asio::ssl::context ssl_ctx_{boost::asio::ssl::context::sslv23_client};
-        //! All the active sessions will shutdown the connection.
-        boost::signals2::signal<void()> shutdown_signal;
+        //! The state shared with the requests in flight.
+        std::shared_ptr<RequestContext> requests_;
 };
 }
 
-Client::Client(const std::string &server, uint16_t port)
+Client::Client(const std::string &server, uint16_t port, unsigned threads)
   : server_{server}
   , port_{port}
-  , p{new ClientPrivate}
 {
-        using namespace boost::asio;
-        const auto threads_num = std::min(8U, std::max(1U, std::thread::hardware_concurrency()));
+        const auto threads_num =
+          threads != 0 ? threads
+                       : std::min(8U, std::max(1U, std::thread::hardware_concurrency()));
 
+        p = std::make_unique<ClientPrivate>(threads_num);
         for (unsigned int i = 0; i < threads_num; ++i)
                 p->thread_group_.add_thread(new boost::thread([this]() { p->ios_.run(); }));
 }
 
-// call destuctor of work queue and ios first!
-Client::~Client() { p.reset(); }
+Client::Client(boost::asio::io_context &ios,
+               const std::string &server,
+               uint16_t port,
+               bool single_threaded)
+  : server_{server}
+  , port_{port}
+  , p{new ClientPrivate(ios, single_threaded)}
+{}
+
+Client::Client(std::shared_ptr<ThreadPool> pool, const std::string &server, uint16_t port)
+  : server_{server}
+  , port_{port}
+{
+        const bool single_threaded = pool->threads() == 1;
+        p = std::make_unique<ClientPrivate>(pool->context(), single_threaded, std::move(pool));
+}
+
+Client::~Client()
+{
+        // Requests in flight can outlive the client, if it doesn't own the io_context. They must
+        // neither call back nor start retries or queued requests anymore.
+        p->requests_->closed_ = true;
+        shutdown();
+
+        // call destuctor of work queue and ios first!
+        p.reset();
+}
+
+std::shared_ptr<Session>
+RequestContext::create_session(const std::string &host,
+                               uint16_t port,
+                               RequestID id,
+                               SuccessCallback on_success,
+                               FailureCallback on_failure)
+{
+        auto session = std::make_shared<Session>(std::ref(ios_),
+                                                 ssl_ctx_,
+                                                 host,
+                                                 port,
+                                                 std::move(id),
+                                                 std::move(on_success),
+                                                 std::move(on_failure),
+                                                 pool_,
+                                                 tls_sessions_,
+                                                 dns_,
+                                                 single_threaded_);
+        shutdown_signal.connect(
+          boost::signals2::signal<void()>::slot_type(&Session::terminate, session.get())
+            .track_foreign(session));
+
+        return session;
+}
+
+void
+RequestContext::run_session(std::shared_ptr<Session> session, unsigned attempt)
+{
+        const auto target   = session->request.target();
+        const auto priority = request_priority(std::string_view(target.data(), target.size()));
+
+        scheduler_->submit(priority, [weak = weak_from_this(), session, attempt](
+                                       std::shared_ptr<RequestScheduler::Slot> slot) {
+                // The job may be started by a request finishing after the client was destroyed.
+                auto self = weak.lock();
+                if (!self || self->closed_)
+                        return;
+
+                auto on_success = std::move(session->on_success);
+                auto on_failure = std::move(session->on_failure);
+
+                // Send the request again after a delay, if the retry policy allows it. Returns
+                // false, if the outcome is passed on to the callback.
+                auto retry = [weak, attempt, on_success, on_failure](
+                               const Session &failed,
+                               const boost::beast::http::response<boost::beast::http::string_body>
+                                 *res,
+                               const boost::system::error_code &ec) {
+                        // The client was destroyed, drop the request like a terminated one.
+                        auto self = weak.lock();
+                        if (!self || self->closed_)
+                                return true;
+
+                        const auto delay =
+                          self->retry_->next_attempt(failed.request,
+                                                     res,
+                                                     ec,
+                                                     attempt,
+                                                     !failed.body_source,
+                                                     static_cast<bool>(failed.body_sink));
+                        if (!delay)
+                                return false;
+
+                        auto next = self->create_session(
+                          failed.host, failed.port, failed.id, on_success, on_failure);
+                        next->request   = failed.request;
+                        next->body_sink = failed.body_sink;
+
+                        auto timer =
+                          std::make_shared<boost::asio::steady_timer>(self->ios_, *delay);
+                        self->shutdown_signal.connect(
+                          boost::signals2::signal<void()>::slot_type([timer]() { timer->cancel(); })
+                            .track_foreign(timer));
+
+                        timer->async_wait(
+                          [weak, timer, next, attempt](const boost::system::error_code &timer_ec) {
+                                  // A shutdown cancels the timer and drops the request.
+                                  auto self = weak.lock();
+                                  if (!timer_ec && self)
+                                          self->run_session(next, attempt + 1);
+                          });
+
+                        return true;
+                };
+
+                // The slot is freed before the callback runs, so that a follow-up request can
+                // take it. A terminated session never calls back and frees it when destroyed.
+                session->on_success =
+                  [slot, session = session.get(), retry, on_success](
+                    RequestID id,
+                    const boost::beast::http::response<boost::beast::http::string_body> &res,
+                    const boost::system::error_code &ec) {
+                          slot->release();
+                          if (!retry(*session, &res, ec))
+                                  on_success(std::move(id), res, ec);
+                  };
+                session->on_failure = [slot, session = session.get(), retry, on_failure](
+                                        RequestID id, const boost::system::error_code ec) {
+                        slot->release();
+                        if (!retry(*session, nullptr, ec))
+                                on_failure(std::move(id), ec);
+                };
+
+                session->run();
+        });
+}
 
 std::shared_ptr<Session>
 Client::create_session(TypeErasedCallback type_erased_cb)
 {
-        auto session = std::make_shared<Session>(
-          std::ref(p->ios_),
-          std::ref(p->ssl_ctx_),
+        return p->requests_->create_session(
           server_,
           port_,
           client::utils::random_token(),
@@ -74,33 +335,97 @@ Client::create_session(TypeErasedCallback type_erased_cb)
                           return type_erased_cb(header, "", err_code, {});
                   }
 
-                  // Decompress the response.
-                  const auto body = client::utils::decompress(
-                    boost::iostreams::array_source{response.body().data(), response.body().size()},
-                    header["Content-Encoding"].to_string());
-
-                  type_erased_cb(header, body, err_code, response.result());
+                  // The body was already decompressed, while it was received.
+                  type_erased_cb(header, response.body(), err_code, response.result());
           },
           [type_erased_cb](RequestID, const boost::system::error_code ec) {
                   type_erased_cb(std::nullopt, "", ec, {});
           });
-        if (session)
-                p->shutdown_signal.connect(
-                  boost::signals2::signal<void()>::slot_type(&Session::terminate, session.get())
-                    .track_foreign(session));
+}
 
-        return session;
+void
+Client::run_session(std::shared_ptr<Session> session, unsigned attempt)
+{
+        p->requests_->run_session(std::move(session), attempt);
 }
 
 void
 Client::shutdown()
 {
-        p->shutdown_signal();
+        p->requests_->scheduler_->clear();
+        p->requests_->shutdown_signal();
+        p->requests_->pool_->clear();
+}
+
+void
+Client::set_connection_pool_opts(const ConnectionPoolOpts &opts)
+{
+        p->requests_->pool_->set_options(opts);
+}
+
+ConnectionPoolOpts
+Client::connection_pool_opts() const
+{
+        return p->requests_->pool_->options();
+}
+
+void
+Client::set_request_scheduler_opts(const RequestSchedulerOpts &opts)
+{
+        p->requests_->scheduler_->set_options(opts);
+}
+
+RequestSchedulerOpts
+Client::request_scheduler_opts() const
+{
+        return p->requests_->scheduler_->options();
+}
+
+RequestQueueStats
+Client::request_queue_stats() const
+{
+        return p->requests_->scheduler_->stats();
+}
+
+void
+Client::set_retry_opts(const RetryOpts &opts)
+{
+        p->requests_->retry_->set_options(opts);
+}
+
+RetryOpts
+Client::retry_opts() const
+{
+        return p->requests_->retry_->options();
+}
+
+RetryStats
+Client::retry_stats() const
+{
+        return p->requests_->retry_->stats();
+}
+
+void
+Client::set_resolver_opts(const ResolverOpts &opts)
+{
+        p->requests_->dns_->set_options(opts);
+}
+
+ResolverOpts
+Client::resolver_opts() const
+{
+        return p->requests_->dns_->options();
+}
+
+TlsSessionStats
+Client::tls_session_stats() const
+{
+        return p->requests_->tls_sessions_->stats();
 }
 
 void
 mtx::http::Client::post(const std::string &endpoint,
-                        const nlohmann::json &req,
+                        std::string req,
                         mtx::http::TypeErasedCallback cb,
                         bool requires_auth,
                         const std::string &content_type)
@@ -111,9 +436,10 @@ mtx::http::Client::post(const std::string &endpoint,
                 return;
 
         setup_auth(session.get(), requires_auth);
-        setup_headers<boost::beast::http::verb::post>(session.get(), req, endpoint, content_type);
+        setup_headers<boost::beast::http::verb::post>(
+          session.get(), std::move(req), endpoint, content_type);
 
-        session->run();
+        run_session(std::move(session));
 }
 
 void
@@ -156,12 +482,12 @@ mtx::http::Client::delete_(const std::string &endpoint, ErrCallback cb, bool req
         setup_auth(session.get(), requires_auth);
         setup_headers<boost::beast::http::verb::delete_>(session.get(), "", endpoint, "");
 
-        session->run();
+        run_session(std::move(session));
 }
 
 void
 mtx::http::Client::put(const std::string &endpoint,
-                       const nlohmann::json &req,
+                       std::string req,
                        mtx::http::TypeErasedCallback cb,
                        bool requires_auth)
 {
@@ -172,9 +498,9 @@ mtx::http::Client::put(const std::string &endpoint,
 
         setup_auth(session.get(), requires_auth);
         setup_headers<boost::beast::http::verb::put>(
-          session.get(), req, endpoint, "application/json");
+          session.get(), std::move(req), endpoint, "application/json");
 
-        session->run();
+        run_session(std::move(session));
 }
 
 void
@@ -192,7 +518,7 @@ mtx::http::Client::get(const std::string &endpoint,
         setup_headers<boost::beast::http::verb::get>(
           session.get(), client::utils::serialize(std::string{}), endpoint, "", endpoint_namespace);
 
-        session->run();
+        run_session(std::move(session));
 }
 
 void
@@ -229,11 +555,18 @@ void
 Client::close(bool force)
 {
         // We close all open connections.
-        if (force) {
+        if (force)
                 shutdown();
-                p->ios_.stop();
+
+        // The io_context is shared. Whoever runs it, decides when to stop it.
+        if (!p->own_ios_) {
+                p->requests_->pool_->clear();
+                return;
         }
 
+        if (force)
+                p->ios_.stop();
+
         // Destroy work object. This allows the I/O thread to
         // exit the event loop when there are no more pending
         // asynchronous operations.
@@ -241,6 +574,9 @@ Client::close(bool force)
 
         // Wait for the worker threads to exit.
         p->thread_group_.join_all();
+
+        // Idle connections have no pending operations, so they don't keep the threads alive.
+        p->requests_->pool_->clear();
 }
 
 void
@@ -711,7 +1047,30 @@ Client::sync(const SyncOpts &opts, Callback<mtx::responses::Sync> callback)
 
         params.emplace("timeout", std::to_string(opts.timeout));
 
-        get<mtx::responses::Sync>("/client/r0/sync?" + mtx::client::utils::query_params(params),
+        const auto api_path = "/client/r0/sync?" + mtx::client::utils::query_params(params);
+
+        if (opts.lazy_events || !opts.parse_filter.empty() || opts.decode_threads > 0) {
+                get<std::string>(
+                  api_path,
+                  [callback, opts](const std::string &res, HeaderFields, RequestErr err) {
+                          if (err)
+                                  return callback({}, err);
+
+                          mtx::responses::Sync sync;
+                          try {
+                                  sync = mtx::responses::parse_sync(
+                                    res, opts.lazy_events, opts.parse_filter, opts.decode_threads);
+                          } catch (const nlohmann::json::exception &e) {
+                                  mtx::http::ClientError client_error;
+                                  client_error.parse_error = std::string(e.what()) + ": " + res;
+                                  return callback({}, client_error);
+                          }
+                          callback(sync, {});
+                  });
+                return;
+        }
+
+        get<mtx::responses::Sync>(api_path,
                                   [callback](const mtx::responses::Sync &res,
                                              HeaderFields,
                                              RequestErr err) { callback(res, err); });
@@ -738,6 +1097,91 @@ Client::upload(const std::string &data,
         post<std::string, mtx::responses::ContentURI>(api_path, data, cb, true, content_type);
 }
 
+void
+Client::upload(UploadSource source,
+               std::optional<std::uint64_t> size,
+               const std::string &content_type,
+               const std::string &filename,
+               Callback<mtx::responses::ContentURI> cb)
+{
+        std::map<std::string, std::string> params = {{"filename", filename}};
+
+        const auto api_path = "/media/r0/upload?" + client::utils::query_params(params);
+
+        auto session = create_session(prepare_callback<mtx::responses::ContentURI>(
+          [cb](const mtx::responses::ContentURI &res, HeaderFields, RequestErr err) {
+                  cb(res, err);
+          }));
+
+        if (!session)
+                return;
+
+        session->body_source = std::move(source);
+
+        setup_auth(session.get(), true);
+        setup_headers<boost::beast::http::verb::post>(session.get(), "", api_path, content_type);
+
+        session->request.content_length(boost::none);
+        if (size)
+                session->request.content_length(*size);
+        else
+                session->request.chunked(true);
+
+        run_session(std::move(session));
+}
+
+void
+Client::upload_file(const std::string &path,
+                    const std::string &content_type,
+                    const std::string &filename,
+                    Callback<mtx::responses::ContentURI> cb)
+{
+        auto fail = [this, cb](const boost::system::error_code &ec) {
+                boost::asio::post(p->ios_, [cb, ec]() {
+                        mtx::http::ClientError client_error;
+                        client_error.error_code = ec;
+                        cb({}, client_error);
+                });
+        };
+        auto fail_with = [&fail](const std::error_code &ec) {
+                fail(boost::system::error_code(ec.value(),
+                                               ec.category() == std::generic_category()
+                                                 ? boost::system::generic_category()
+                                                 : boost::system::system_category()));
+        };
+
+        // A stream doesn't tell, why it can't open a file, so ask the filesystem first.
+        std::error_code ec;
+        const auto status = std::filesystem::status(path, ec);
+        if (ec)
+                return fail_with(ec);
+        if (std::filesystem::is_directory(status))
+                return fail_with(std::make_error_code(std::errc::is_a_directory));
+
+        // Pipes and other special files have no size and are sent chunked.
+        std::optional<std::uint64_t> file_size;
+        if (std::filesystem::is_regular_file(status)) {
+                file_size = std::filesystem::file_size(path, ec);
+                if (ec)
+                        return fail_with(ec);
+        }
+
+        auto file = std::make_shared<std::ifstream>(path, std::ios::binary);
+        if (!file->is_open())
+                return fail_with(std::make_error_code(std::errc::io_error));
+
+        upload(
+          [file](char *buffer, std::size_t &size) {
+                  file->read(buffer, static_cast<std::streamsize>(size));
+                  size = static_cast<std::size_t>(file->gcount());
+                  return !file->bad();
+          },
+          file_size,
+          content_type,
+          filename,
+          std::move(cb));
+}
+
 void
 Client::download(const std::string &mxc_url,
                  std::function<void(const std::string &res,
@@ -795,22 +1239,47 @@ Client::download(const std::string &server,
         get<std::string>(
           api_path, [callback](const std::string &res, HeaderFields fields, RequestErr err) {
                   std::string content_type, original_filename;
+                  parse_media_headers(fields, content_type, original_filename);
+
+                  callback(res, content_type, original_filename, err);
+          });
+}
+
+void
+Client::download(const std::string &mxc_url, DownloadSink sink, DownloadCallback callback)
+{
+        auto url = mtx::client::utils::parse_mxc_url(mxc_url);
+        download(url.server, url.media_id, std::move(sink), std::move(callback));
+}
+
+void
+Client::download(const std::string &server,
+                 const std::string &media_id,
+                 DownloadSink sink,
+                 DownloadCallback callback)
+{
+        const auto api_path = "/media/r0/download/" + server + "/" + media_id;
+
+        auto session = create_session(prepare_callback<std::string>(
+          [callback](const std::string &, HeaderFields fields, RequestErr err) {
+                  std::string content_type, original_filename;
+                  parse_media_headers(fields, content_type, original_filename);
 
-                  if (fields) {
-                          if (fields->find("Content-Type") != fields->end())
-                                  content_type = fields->at("Content-Type").to_string();
-                          if (fields->find("Content-Disposition") != fields->end()) {
-                                  auto value = fields->at("Content-Disposition").to_string();
+                  callback(content_type, original_filename, err);
+          }));
 
-                                  std::vector<std::string> results;
-                                  boost::split(results, value, [](char c) { return c == '='; });
+        if (!session)
+                return;
 
-                                  original_filename = results.back();
-                          }
-                  }
+        session->body_sink = std::move(sink);
 
-                  callback(res, content_type, original_filename, err);
-          });
+        setup_auth(session.get(), true);
+        setup_headers<boost::beast::http::verb::get>(
+          session.get(), client::utils::serialize(std::string{}), api_path);
+        // The chunks are passed on as they arrive, so they can't be decompressed.
+        session->request.set(boost::beast::http::field::accept_encoding, "identity");
+
+        run_session(std::move(session));
 }
 
 void
@@ -0,0 +1,265 @@
+#include "mtxclient/http/connection_pool.hpp"
+
+#include <algorithm>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+
+using namespace mtx::http;
+
+namespace {
+std::string
+pool_key(const std::string &host, uint16_t port)
+{
+        return host + ":" + std::to_string(port);
+}
+
+void
+close_stream(ConnectionPool::Stream &stream)
+{
+        boost::system::error_code ec;
+        stream.lowest_layer().close(ec);
+}
+}
+
+ConnectionPool::ConnectionPool(const ConnectionPoolOpts &opts)
+  : opts_(opts)
+{}
+
+ConnectionPool::~ConnectionPool() { clear(); }
+
+void
+ConnectionPool::set_options(const ConnectionPoolOpts &opts)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        opts_ = opts;
+        prune(std::chrono::steady_clock::now());
+}
+
+ConnectionPoolOpts
+ConnectionPool::options() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opts_;
+}
+
+std::unique_ptr<ConnectionPool::Stream>
+ConnectionPool::acquire(const std::string &host, uint16_t port)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opts_.enabled)
+                return nullptr;
+
+        prune(std::chrono::steady_clock::now());
+
+        auto it = idle_.find(pool_key(host, port));
+        if (it == idle_.end())
+                return nullptr;
+
+        auto &connections = it->second;
+        while (!connections.empty()) {
+                auto stream = std::move(connections.back().stream);
+                connections.pop_back();
+
+                if (is_healthy(*stream))
+                        return stream;
+
+                close_stream(*stream);
+        }
+
+        return nullptr;
+}
+
+void
+ConnectionPool::release(const std::string &host, uint16_t port, std::unique_ptr<Stream> stream)
+{
+        if (!stream)
+                return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opts_.enabled || opts_.max_idle_per_host == 0) {
+                close_stream(*stream);
+                return;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        idle_[pool_key(host, port)].push_back(IdleConnection{std::move(stream), now});
+        prune(now);
+}
+
+std::shared_ptr<MultiplexedConnection>
+ConnectionPool::acquire_multiplexed(const std::string &host, uint16_t port)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opts_.enabled)
+                return nullptr;
+
+        prune(std::chrono::steady_clock::now());
+
+        auto it = multiplexed_.find(pool_key(host, port));
+        if (it == multiplexed_.end())
+                return nullptr;
+
+        return it->second;
+}
+
+void
+ConnectionPool::add_multiplexed(const std::string &host,
+                                uint16_t port,
+                                std::shared_ptr<MultiplexedConnection> connection)
+{
+        std::vector<MultiplexedCallback> waiting;
+
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const auto key = pool_key(host, port);
+
+                auto &probe      = probes_[key];
+                probe.connecting = false;
+                waiting.swap(probe.waiting);
+
+                auto &entry = multiplexed_[key];
+                // Concurrent requests may have raced to establish a connection. Keep the existing
+                // one, the new one closes on its own when its requests finish.
+                if (!entry || !entry->is_usable())
+                        entry = connection;
+                else
+                        connection = entry;
+        }
+
+        for (const auto &callback : waiting)
+                callback(connection);
+}
+
+ConnectionPool::Probe
+ConnectionPool::probe_multiplexed(const std::string &host,
+                                  uint16_t port,
+                                  MultiplexedCallback on_ready)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opts_.enabled || !opts_.http2)
+                return Probe::Unsupported;
+
+        auto &probe = probes_[pool_key(host, port)];
+        if (probe.unsupported)
+                return Probe::Unsupported;
+
+        if (probe.connecting) {
+                probe.waiting.push_back(std::move(on_ready));
+                return Probe::Wait;
+        }
+
+        probe.connecting = true;
+        return Probe::Connect;
+}
+
+void
+ConnectionPool::multiplexing_unavailable(const std::string &host, uint16_t port, bool unsupported)
+{
+        std::vector<MultiplexedCallback> waiting;
+
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                auto &probe       = probes_[pool_key(host, port)];
+                probe.connecting  = false;
+                probe.unsupported = probe.unsupported || unsupported;
+                waiting.swap(probe.waiting);
+        }
+
+        for (const auto &callback : waiting)
+                callback(nullptr);
+}
+
+void
+ConnectionPool::clear()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &[key, connections] : idle_)
+                for (auto &conn : connections)
+                        close_stream(*conn.stream);
+
+        for (auto &[key, connection] : multiplexed_)
+                connection->close();
+
+        idle_.clear();
+        multiplexed_.clear();
+
+        for (auto &[key, probe] : probes_)
+                probe.unsupported = false;
+}
+
+std::size_t
+ConnectionPool::idle_connections() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::size_t count = 0;
+        for (const auto &[key, connections] : idle_)
+                count += connections.size();
+
+        return count;
+}
+
+bool
+ConnectionPool::is_healthy(Stream &stream)
+{
+        auto &socket = stream.next_layer();
+        if (!socket.is_open())
+                return false;
+
+        // An idle connection has nothing to read. If a read doesn't block, the server either
+        // closed the connection or sent data we can't associate with a request.
+        boost::system::error_code ec;
+        socket.non_blocking(true, ec);
+        if (ec)
+                return false;
+
+        char c;
+        socket.receive(boost::asio::buffer(&c, 1), boost::asio::socket_base::message_peek, ec);
+        const bool healthy = ec == boost::asio::error::would_block;
+
+        socket.non_blocking(false, ec);
+        return healthy && !ec;
+}
+
+void
+ConnectionPool::prune(std::chrono::steady_clock::time_point now)
+{
+        const auto max_idle = opts_.enabled ? opts_.max_idle_per_host : 0;
+
+        for (auto it = idle_.begin(); it != idle_.end();) {
+                auto &connections = it->second;
+
+                // Connections are ordered by the time they were released, so the expired ones
+                // and the ones exceeding the limit are at the front.
+                auto last = std::find_if(
+                  connections.begin(), connections.end(), [this, now](const IdleConnection &c) {
+                          return now - c.since < opts_.idle_timeout;
+                  });
+                if (static_cast<std::size_t>(std::distance(last, connections.end())) > max_idle)
+                        last = connections.end() - max_idle;
+
+                for (auto conn = connections.begin(); conn != last; ++conn)
+                        close_stream(*conn->stream);
+                connections.erase(connections.begin(), last);
+
+                if (connections.empty())
+                        it = idle_.erase(it);
+                else
+                        ++it;
+        }
+
+        for (auto it = multiplexed_.begin(); it != multiplexed_.end();) {
+                const auto idle_since = it->second->idle_since();
+
+                if (opts_.enabled && it->second->is_usable() &&
+                    (!idle_since || now - *idle_since < opts_.idle_timeout)) {
+                        ++it;
+                        continue;
+                }
+
+                it->second->close();
+                it = multiplexed_.erase(it);
+        }
+}
@@ -0,0 +1,273 @@
+#include "mtxclient/http/dns_cache.hpp"
+
+#include <memory>
+
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+using namespace mtx::http;
+using boost::asio::ip::tcp;
+
+namespace {
+ResolveFunction
+system_lookup(boost::asio::io_context &ios)
+{
+        return [&ios](const std::string &host, uint16_t port, ResolveCallback callback) {
+                auto resolver = std::make_shared<tcp::resolver>(ios);
+                resolver->async_resolve(
+                  host,
+                  std::to_string(port),
+                  [resolver, callback = std::move(callback)](const boost::system::error_code &ec,
+                                                             tcp::resolver::results_type results) {
+                          std::vector<tcp::endpoint> endpoints;
+                          for (const auto &result : results)
+                                  endpoints.push_back(result.endpoint());
+
+                          callback(ec, std::move(endpoints));
+                  });
+        };
+}
+
+//! State of a single Happy Eyeballs connection race. All handlers run on the executor of the
+//! target socket, which is a strand.
+struct ConnectRace : public std::enable_shared_from_this<ConnectRace>
+{
+        ConnectRace(tcp::socket &socket,
+                    std::vector<tcp::endpoint> endpoints,
+                    std::chrono::milliseconds attempt_delay,
+                    std::function<void(const boost::system::error_code &)> handler)
+          : socket(socket)
+          , endpoints(std::move(endpoints))
+          , attempt_delay(attempt_delay)
+          , handler(std::move(handler))
+          , timer(socket.get_executor())
+        {}
+
+        void start_next()
+        {
+                const auto index = next++;
+
+                attempts.push_back(std::make_unique<tcp::socket>(socket.get_executor()));
+                attempts.back()->async_connect(
+                  endpoints[index],
+                  [self = shared_from_this(), index](const boost::system::error_code &ec) {
+                          self->on_connect(index, ec);
+                  });
+                pending++;
+
+                if (next >= endpoints.size())
+                        return;
+
+                // Start the next attempt in parallel, if this one takes too long.
+                const auto generation = ++timer_generation;
+                timer.expires_after(attempt_delay);
+                timer.async_wait(
+                  [self = shared_from_this(), generation](const boost::system::error_code &ec) {
+                          if (!ec && !self->done && generation == self->timer_generation)
+                                  self->start_next();
+                  });
+        }
+
+        void on_connect(std::size_t index, const boost::system::error_code &ec)
+        {
+                pending--;
+
+                if (done)
+                        return;
+
+                if (!ec) {
+                        done = true;
+                        timer.cancel();
+
+                        boost::system::error_code ignored;
+                        for (std::size_t i = 0; i < attempts.size(); ++i)
+                                if (i != index)
+                                        attempts[i]->close(ignored);
+
+                        socket = std::move(*attempts[index]);
+                        return handler(ec);
+                }
+
+                last_error = ec;
+
+                // A failed attempt starts the next one right away.
+                if (next < endpoints.size()) {
+                        timer_generation++;
+                        timer.cancel();
+                        start_next();
+                } else if (pending == 0) {
+                        done = true;
+                        handler(last_error);
+                }
+        }
+
+        tcp::socket &socket;
+        std::vector<tcp::endpoint> endpoints;
+        std::chrono::milliseconds attempt_delay;
+        std::function<void(const boost::system::error_code &)> handler;
+
+        boost::asio::steady_timer timer;
+        std::size_t timer_generation = 0;
+
+        std::vector<std::unique_ptr<tcp::socket>> attempts;
+        std::size_t next    = 0;
+        std::size_t pending = 0;
+        bool done           = false;
+        boost::system::error_code last_error;
+};
+}
+
+DnsCache::DnsCache(boost::asio::io_context &ios, const ResolverOpts &opts)
+  : DnsCache(ios, system_lookup(ios), opts)
+{}
+
+DnsCache::DnsCache(boost::asio::io_context &ios, ResolveFunction lookup, const ResolverOpts &opts)
+  : ios_(ios)
+  , lookup_(std::move(lookup))
+  , opts_(opts)
+{}
+
+void
+DnsCache::set_options(const ResolverOpts &opts)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        opts_ = opts;
+
+        if (!opts_.cache_enabled)
+                for (auto &[key, entry] : entries_)
+                        entry.endpoints.clear();
+}
+
+ResolverOpts
+DnsCache::options() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opts_;
+}
+
+void
+DnsCache::resolve(const std::string &host, uint16_t port, ResolveCallback callback)
+{
+        const auto key = host + ":" + std::to_string(port);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (!opts_.cache_enabled) {
+                lock.unlock();
+                lookup_(host, port, std::move(callback));
+                return;
+        }
+
+        auto &entry = entries_[key];
+        if (!entry.in_flight && !entry.endpoints.empty() &&
+            std::chrono::steady_clock::now() < entry.expires) {
+                boost::asio::post(ios_,
+                                  [callback = std::move(callback), endpoints = entry.endpoints]() {
+                                          callback({}, endpoints);
+                                  });
+                return;
+        }
+
+        entry.waiting.push_back(std::move(callback));
+        if (entry.in_flight)
+                return;
+
+        entry.in_flight = true;
+        lock.unlock();
+
+        lookup_(host,
+                port,
+                [self = shared_from_this(), key](const boost::system::error_code &ec,
+                                                 std::vector<tcp::endpoint> endpoints) {
+                        self->on_resolved(key, ec, std::move(endpoints));
+                });
+}
+
+void
+DnsCache::on_resolved(const std::string &key,
+                      const boost::system::error_code &ec,
+                      std::vector<tcp::endpoint> endpoints)
+{
+        std::vector<ResolveCallback> waiting;
+
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                auto &entry     = entries_[key];
+                entry.in_flight = false;
+                waiting.swap(entry.waiting);
+
+                // Failed lookups are not cached, the next request tries again.
+                if (!ec && !endpoints.empty() && opts_.cache_enabled) {
+                        entry.endpoints = endpoints;
+                        entry.expires   = std::chrono::steady_clock::now() + opts_.ttl;
+                } else {
+                        entries_.erase(key);
+                }
+        }
+
+        for (const auto &callback : waiting)
+                callback(ec, endpoints);
+}
+
+void
+DnsCache::clear()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto it = entries_.begin(); it != entries_.end();) {
+                if (it->second.in_flight) {
+                        it->second.endpoints.clear();
+                        ++it;
+                } else {
+                        it = entries_.erase(it);
+                }
+        }
+}
+
+std::vector<tcp::endpoint>
+mtx::http::interleave_address_families(const std::vector<tcp::endpoint> &endpoints)
+{
+        if (endpoints.empty())
+                return {};
+
+        std::vector<tcp::endpoint> first_family, second_family;
+        const bool first_is_v6 = endpoints.front().address().is_v6();
+        for (const auto &endpoint : endpoints) {
+                if (endpoint.address().is_v6() == first_is_v6)
+                        first_family.push_back(endpoint);
+                else
+                        second_family.push_back(endpoint);
+        }
+
+        std::vector<tcp::endpoint> ordered;
+        ordered.reserve(endpoints.size());
+        for (std::size_t i = 0; i < std::max(first_family.size(), second_family.size()); ++i) {
+                if (i < first_family.size())
+                        ordered.push_back(first_family[i]);
+                if (i < second_family.size())
+                        ordered.push_back(second_family[i]);
+        }
+
+        return ordered;
+}
+
+void
+mtx::http::async_connect_happy_eyeballs(
+  tcp::socket &socket,
+  const std::vector<tcp::endpoint> &endpoints,
+  std::chrono::milliseconds attempt_delay,
+  std::function<void(const boost::system::error_code &)> handler)
+{
+        if (endpoints.empty()) {
+                boost::asio::post(socket.get_executor(), [handler = std::move(handler)]() {
+                        handler(boost::asio::error::host_not_found);
+                });
+                return;
+        }
+
+        auto race = std::make_shared<ConnectRace>(
+          socket, interleave_address_families(endpoints), attempt_delay, std::move(handler));
+        boost::asio::dispatch(socket.get_executor(), [race]() { race->start_next(); });
+}
@@ -0,0 +1,487 @@
+#include "mtxclient/http/http2.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/write.hpp>
+
+#include <nghttp2/nghttp2.h>
+
+using namespace mtx::http;
+
+namespace {
+//! ALPN protocol list in wire format, preferring HTTP/2 over HTTP/1.1.
+constexpr unsigned char alpn_protocols[] = {2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+
+//! Window size per stream and for the connection. The default of 64KiB severely limits the
+//! throughput of large responses, like an initial sync.
+constexpr int32_t window_size = 16 * 1024 * 1024;
+
+std::chrono::steady_clock::rep
+now()
+{
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+//! Whether the header is connection specific and therefore forbidden in HTTP/2.
+bool
+is_connection_header(const std::string &name)
+{
+        return name == "host" || name == "connection" || name == "keep-alive" ||
+               name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade";
+}
+
+nghttp2_nv
+make_nv(const std::string &name, const std::string &value)
+{
+        return {reinterpret_cast<uint8_t *>(const_cast<char *>(name.data())),
+                reinterpret_cast<uint8_t *>(const_cast<char *>(value.data())),
+                name.size(),
+                value.size(),
+                NGHTTP2_NV_FLAG_NONE};
+}
+}
+
+namespace mtx {
+namespace http {
+struct Http2Callbacks
+{
+        static int on_header(nghttp2_session *,
+                             const nghttp2_frame *frame,
+                             const uint8_t *name,
+                             size_t namelen,
+                             const uint8_t *value,
+                             size_t valuelen,
+                             uint8_t,
+                             void *user_data)
+        {
+                if (frame->hd.type != NGHTTP2_HEADERS)
+                        return 0;
+
+                auto conn = static_cast<Http2Connection *>(user_data);
+                auto it   = conn->streams_.find(frame->hd.stream_id);
+                if (it == conn->streams_.end())
+                        return 0;
+
+                auto &stream     = it->second;
+                stream.responded = true;
+
+                const auto n =
+                  boost::beast::string_view(reinterpret_cast<const char *>(name), namelen);
+                const auto v =
+                  boost::beast::string_view(reinterpret_cast<const char *>(value), valuelen);
+
+                if (n == ":status") {
+                        stream.response.result(std::stoi(std::string(v.data(), v.size())));
+                } else if (!n.empty() && n.front() != ':') {
+                        stream.response.insert(n, v);
+                }
+
+                return 0;
+        }
+
+        static int on_data_chunk(nghttp2_session *session,
+                                 uint8_t,
+                                 int32_t stream_id,
+                                 const uint8_t *data,
+                                 size_t len,
+                                 void *user_data)
+        {
+                auto conn = static_cast<Http2Connection *>(user_data);
+                auto it   = conn->streams_.find(stream_id);
+                if (it == conn->streams_.end())
+                        return 0;
+
+                auto &stream      = it->second;
+                const auto chunk  = reinterpret_cast<const char *>(data);
+                const auto status = stream.response.result_int();
+
+                // Only a successful response is passed to the sink. Error responses are kept, so
+                // that the error can be parsed.
+                if (!stream.sink || status < 200 || status >= 300) {
+                        auto &response = stream.response;
+                        if (!stream.inflater) {
+                                const auto encoding = boost::beast::http::field::content_encoding;
+                                stream.inflater.emplace(std::string(response[encoding]));
+                                response.erase(encoding);
+                        }
+
+                        if (!stream.corrupt &&
+                            !stream.inflater->inflate(chunk, len, response.body())) {
+                                stream.corrupt = true;
+                                nghttp2_submit_rst_stream(
+                                  session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+                        }
+                } else if (!stream.aborted && !stream.sink(chunk, len)) {
+                        stream.aborted = true;
+                        nghttp2_submit_rst_stream(
+                          session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+                }
+
+                return 0;
+        }
+
+        static int on_stream_close(nghttp2_session *,
+                                   int32_t stream_id,
+                                   uint32_t error_code,
+                                   void *user_data)
+        {
+                auto conn = static_cast<Http2Connection *>(user_data);
+                auto it   = conn->streams_.find(stream_id);
+                if (it == conn->streams_.end())
+                        return 0;
+
+                auto stream = std::move(it->second);
+                conn->streams_.erase(it);
+
+                // A stream refused by the server was never processed and can be retried.
+                if (error_code == NGHTTP2_REFUSED_STREAM)
+                        stream.responded = false;
+
+                boost::system::error_code ec;
+                if (stream.aborted)
+                        ec = boost::asio::error::operation_aborted;
+                else if (stream.corrupt)
+                        ec = boost::system::errc::make_error_code(
+                          boost::system::errc::illegal_byte_sequence);
+                else if (error_code != NGHTTP2_NO_ERROR)
+                        ec = boost::asio::error::connection_reset;
+
+                stream.response.version(20);
+                stream.response.prepare_payload();
+                stream.handler(ec, std::move(stream.response), stream.responded);
+                conn->finished(1);
+
+                return 0;
+        }
+
+        static ssize_t read_body(nghttp2_session *,
+                                 int32_t,
+                                 uint8_t *buf,
+                                 size_t length,
+                                 uint32_t *data_flags,
+                                 nghttp2_data_source *source,
+                                 void *)
+        {
+                auto stream = static_cast<Http2Connection::Stream *>(source->ptr);
+
+                if (stream->source) {
+                        std::size_t size = length;
+                        if (!stream->source(reinterpret_cast<char *>(buf), size))
+                                return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+
+                        if (size == 0)
+                                *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+                        return static_cast<ssize_t>(size);
+                }
+
+                const auto &body = stream->request->body();
+
+                const auto n = std::min(length, body.size() - stream->body_offset);
+                std::memcpy(buf, body.data() + stream->body_offset, n);
+                stream->body_offset += n;
+
+                if (stream->body_offset == body.size())
+                        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+
+                return static_cast<ssize_t>(n);
+        }
+};
+}
+}
+
+void
+Http2Connection::offer_alpn(SSL *ssl)
+{
+        SSL_set_alpn_protos(ssl, alpn_protocols, sizeof(alpn_protocols));
+}
+
+bool
+Http2Connection::negotiated(SSL *ssl)
+{
+        const unsigned char *protocol = nullptr;
+        unsigned int len              = 0;
+        SSL_get0_alpn_selected(ssl, &protocol, &len);
+
+        return len == 2 && std::memcmp(protocol, "h2", 2) == 0;
+}
+
+std::shared_ptr<Http2Connection>
+Http2Connection::create(std::unique_ptr<ConnectionPool::Stream> stream, const std::string &host)
+{
+        std::shared_ptr<Http2Connection> conn(new Http2Connection(std::move(stream), host));
+        if (!conn->init())
+                return nullptr;
+
+        return conn;
+}
+
+Http2Connection::Http2Connection(std::unique_ptr<ConnectionPool::Stream> stream,
+                                 const std::string &host)
+  : stream_(std::move(stream))
+  , host_(host)
+  , idle_since_(now())
+{}
+
+Http2Connection::~Http2Connection()
+{
+        if (session_)
+                nghttp2_session_del(session_);
+
+        boost::system::error_code ignored;
+        stream_->lowest_layer().close(ignored);
+}
+
+bool
+Http2Connection::init()
+{
+        nghttp2_session_callbacks *callbacks = nullptr;
+        if (nghttp2_session_callbacks_new(&callbacks) != 0)
+                return false;
+
+        nghttp2_session_callbacks_set_on_header_callback(callbacks, &Http2Callbacks::on_header);
+        nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                                  &Http2Callbacks::on_data_chunk);
+        nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                               &Http2Callbacks::on_stream_close);
+
+        const int rv = nghttp2_session_client_new(&session_, callbacks, this);
+        nghttp2_session_callbacks_del(callbacks);
+        if (rv != 0)
+                return false;
+
+        const nghttp2_settings_entry settings[] = {
+          {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+          {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window_size},
+        };
+        if (nghttp2_submit_settings(
+              session_, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0])) != 0)
+                return false;
+
+        return nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE, 0, window_size) ==
+               0;
+}
+
+void
+Http2Connection::submit(
+  const boost::beast::http::request<boost::beast::http::string_body> &request,
+  ResponseHandler handler,
+  DownloadSink sink,
+  UploadSource source)
+{
+        active_streams_++;
+
+        boost::asio::post(stream_->get_executor(),
+                          [self = shared_from_this(),
+                           &request,
+                           handler = std::move(handler),
+                           sink    = std::move(sink),
+                           source  = std::move(source)]() mutable {
+                                  self->do_submit(request,
+                                                  std::move(handler),
+                                                  std::move(sink),
+                                                  std::move(source));
+                          });
+}
+
+bool
+Http2Connection::is_usable() const
+{
+        return usable_;
+}
+
+std::optional<std::chrono::steady_clock::time_point>
+Http2Connection::idle_since() const
+{
+        if (active_streams_ > 0)
+                return std::nullopt;
+
+        return std::chrono::steady_clock::time_point(
+          std::chrono::steady_clock::duration(idle_since_.load()));
+}
+
+void
+Http2Connection::close()
+{
+        usable_ = false;
+
+        boost::asio::post(stream_->get_executor(), [self = shared_from_this()]() {
+                self->fail(boost::asio::error::operation_aborted);
+        });
+}
+
+void
+Http2Connection::do_submit(
+  const boost::beast::http::request<boost::beast::http::string_body> &request,
+  ResponseHandler handler,
+  DownloadSink sink,
+  UploadSource source)
+{
+        if (closed_) {
+                handler(boost::asio::error::not_connected, {}, false);
+                return finished(1);
+        }
+
+        // Header names need to be lowercase in HTTP/2. nghttp2 copies them on submission.
+        std::vector<std::pair<std::string, std::string>> headers;
+        headers.emplace_back(":method", std::string(request.method_string()));
+        headers.emplace_back(":scheme", "https");
+        headers.emplace_back(":authority", host_);
+        headers.emplace_back(":path", std::string(request.target()));
+        for (const auto &field : request) {
+                std::string name(field.name_string());
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+                        return static_cast<char>(std::tolower(c));
+                });
+
+                if (!is_connection_header(name))
+                        headers.emplace_back(std::move(name), std::string(field.value()));
+        }
+
+        std::vector<nghttp2_nv> nva;
+        nva.reserve(headers.size());
+        for (const auto &[name, value] : headers)
+                nva.push_back(make_nv(name, value));
+
+        // Reserve the stream state first, the data provider needs a stable pointer to it.
+        auto stream_id = nghttp2_session_get_next_stream_id(session_);
+        auto &stream   = streams_[stream_id];
+        stream.request = &request;
+        stream.handler = std::move(handler);
+        stream.sink    = std::move(sink);
+        stream.source  = std::move(source);
+
+        nghttp2_data_provider body;
+        body.source.ptr    = &stream;
+        body.read_callback = &Http2Callbacks::read_body;
+
+        const bool has_body = stream.source || !request.body().empty();
+        const auto rv       = nghttp2_submit_request(
+          session_, nullptr, nva.data(), nva.size(), has_body ? &body : nullptr, nullptr);
+        if (rv < 0) {
+                auto failed = std::move(stream);
+                streams_.erase(stream_id);
+                update_state();
+                failed.handler(boost::asio::error::not_connected, {}, false);
+                return finished(1);
+        }
+
+        do_write();
+        do_read();
+}
+
+void
+Http2Connection::do_read()
+{
+        if (reading_ || closed_)
+                return;
+
+        reading_ = true;
+        stream_->async_read_some(
+          boost::asio::buffer(read_buf_),
+          [self = shared_from_this()](const boost::system::error_code &ec, std::size_t bytes) {
+                  self->on_read(ec, bytes);
+          });
+}
+
+void
+Http2Connection::on_read(const boost::system::error_code &ec, std::size_t bytes_transferred)
+{
+        reading_ = false;
+
+        if (ec)
+                return fail(ec);
+
+        if (nghttp2_session_mem_recv(session_, read_buf_.data(), bytes_transferred) < 0)
+                return fail(boost::asio::error::connection_reset);
+
+        do_write();
+        update_state();
+
+        // Stop reading while there are no active requests, so that the io_context can run out of
+        // work and the client can be shut down. The connection is picked up by the next request.
+        if (!streams_.empty())
+                do_read();
+}
+
+void
+Http2Connection::do_write()
+{
+        if (writing_ || closed_)
+                return;
+
+        write_buf_.clear();
+        for (;;) {
+                const uint8_t *data = nullptr;
+                const auto len      = nghttp2_session_mem_send(session_, &data);
+                if (len < 0)
+                        return fail(boost::asio::error::connection_reset);
+                if (len == 0)
+                        break;
+
+                write_buf_.append(reinterpret_cast<const char *>(data), len);
+        }
+
+        if (write_buf_.empty())
+                return;
+
+        writing_ = true;
+        boost::asio::async_write(
+          *stream_,
+          boost::asio::buffer(write_buf_),
+          [self = shared_from_this()](const boost::system::error_code &ec, std::size_t bytes) {
+                  self->on_write(ec, bytes);
+          });
+}
+
+void
+Http2Connection::on_write(const boost::system::error_code &ec, std::size_t)
+{
+        writing_ = false;
+
+        if (ec)
+                return fail(ec);
+
+        do_write();
+        update_state();
+}
+
+void
+Http2Connection::fail(const boost::system::error_code &ec)
+{
+        closed_ = true;
+        usable_ = false;
+
+        auto streams = std::move(streams_);
+        streams_.clear();
+
+        for (auto &[id, stream] : streams)
+                stream.handler(ec, std::move(stream.response), stream.responded);
+        finished(streams.size());
+
+        boost::system::error_code ignored;
+        stream_->lowest_layer().close(ignored);
+}
+
+void
+Http2Connection::update_state()
+{
+        if (closed_)
+                return;
+
+        usable_ = nghttp2_session_check_request_allowed(session_) != 0;
+
+        // Nothing left to do after the server sent a GOAWAY and all streams are done.
+        if (!nghttp2_session_want_read(session_) && !nghttp2_session_want_write(session_))
+                fail(boost::asio::error::eof);
+}
+
+void
+Http2Connection::finished(std::size_t count)
+{
+        if (count > 0 && active_streams_.fetch_sub(count) == count)
+                idle_since_ = now();
+}
@@ -0,0 +1,192 @@
+#include "mtxclient/http/request_scheduler.hpp"
+
+#include <algorithm>
+
+using namespace mtx::http;
+
+namespace {
+std::size_t
+index(RequestPriority priority)
+{
+        return static_cast<std::size_t>(priority);
+}
+
+bool
+starts_with(std::string_view s, std::string_view prefix)
+{
+        return s.substr(0, prefix.size()) == prefix;
+}
+}
+
+RequestPriority
+mtx::http::request_priority(std::string_view target)
+{
+        const auto path = target.substr(0, target.find('?'));
+
+        if (starts_with(path, "/_matrix/media/"))
+                return RequestPriority::Media;
+
+        constexpr std::string_view client_api = "/_matrix/client/";
+        if (!starts_with(path, client_api))
+                return RequestPriority::Interactive;
+
+        // Skip the version, i.e. r0 or unstable.
+        auto endpoint        = path.substr(client_api.size());
+        const auto separator = endpoint.find('/');
+        endpoint = separator == std::string_view::npos ? std::string_view{}
+                                                       : endpoint.substr(separator + 1);
+
+        if (endpoint == "sync")
+                return RequestPriority::Sync;
+
+        if (starts_with(endpoint, "keys/") || starts_with(endpoint, "sendToDevice/") ||
+            starts_with(endpoint, "room_keys/"))
+                return RequestPriority::KeyManagement;
+
+        return RequestPriority::Interactive;
+}
+
+RequestScheduler::Slot::Slot(std::weak_ptr<RequestScheduler> scheduler, RequestPriority priority)
+  : scheduler_(std::move(scheduler))
+  , priority_(priority)
+{}
+
+RequestScheduler::Slot::~Slot() { release(); }
+
+void
+RequestScheduler::Slot::release()
+{
+        if (released_.exchange(true))
+                return;
+
+        if (auto scheduler = scheduler_.lock())
+                scheduler->finished(priority_);
+}
+
+RequestScheduler::RequestScheduler(const RequestSchedulerOpts &opts)
+  : opts_(opts)
+{}
+
+void
+RequestScheduler::set_options(const RequestSchedulerOpts &opts)
+{
+        std::vector<std::pair<RequestPriority, Job>> runnable;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                opts_    = opts;
+                runnable = take_runnable();
+        }
+
+        start(std::move(runnable));
+}
+
+RequestSchedulerOpts
+RequestScheduler::options() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opts_;
+}
+
+void
+RequestScheduler::submit(RequestPriority priority, Job job)
+{
+        std::vector<std::pair<RequestPriority, Job>> runnable;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queued_[index(priority)].push_back(std::move(job));
+                runnable = take_runnable();
+        }
+
+        start(std::move(runnable));
+}
+
+void
+RequestScheduler::clear()
+{
+        std::array<std::deque<Job>, request_priority_count> dropped;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                dropped.swap(queued_);
+                credit_.fill(0);
+        }
+}
+
+RequestQueueStats
+RequestScheduler::stats() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        RequestQueueStats stats;
+        for (std::size_t i = 0; i < request_priority_count; ++i) {
+                stats.classes[i].queued    = queued_[i].size();
+                stats.classes[i].in_flight = in_flight_[i];
+        }
+
+        return stats;
+}
+
+void
+RequestScheduler::finished(RequestPriority priority)
+{
+        std::vector<std::pair<RequestPriority, Job>> runnable;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --in_flight_[index(priority)];
+                --total_in_flight_;
+                runnable = take_runnable();
+        }
+
+        start(std::move(runnable));
+}
+
+std::vector<std::pair<RequestPriority, RequestScheduler::Job>>
+RequestScheduler::take_runnable()
+{
+        std::vector<std::pair<RequestPriority, Job>> runnable;
+
+        while (opts_.max_in_flight == 0 || total_in_flight_ < opts_.max_in_flight) {
+                // Every waiting class earns credit according to its weight, the one with the
+                // most credit goes next and pays for it. This spreads the slots evenly between
+                // the classes, instead of serving a class in bursts.
+                std::int64_t total_weight = 0;
+                std::size_t next          = request_priority_count;
+
+                for (std::size_t i = 0; i < request_priority_count; ++i) {
+                        const auto &limits = opts_.classes[i];
+                        if (queued_[i].empty() ||
+                            (limits.max_in_flight != 0 && in_flight_[i] >= limits.max_in_flight))
+                                continue;
+
+                        const auto weight = static_cast<std::int64_t>(std::max(1U, limits.weight));
+                        credit_[i] += weight;
+                        total_weight += weight;
+
+                        if (next == request_priority_count || credit_[i] > credit_[next])
+                                next = i;
+                }
+
+                if (next == request_priority_count)
+                        break;
+
+                credit_[next] -= total_weight;
+
+                runnable.emplace_back(static_cast<RequestPriority>(next),
+                                      std::move(queued_[next].front()));
+                queued_[next].pop_front();
+                ++in_flight_[next];
+                ++total_in_flight_;
+
+                // Credit is only meaningful while a class is waiting.
+                if (queued_[next].empty())
+                        credit_[next] = 0;
+        }
+
+        return runnable;
+}
+
+void
+RequestScheduler::start(std::vector<std::pair<RequestPriority, Job>> jobs)
+{
+        for (auto &[priority, job] : jobs)
+                job(std::make_shared<Slot>(weak_from_this(), priority));
+}
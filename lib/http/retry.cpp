@@ -0,0 +1,177 @@
+#include "mtxclient/http/retry.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include <boost/asio/error.hpp>
+
+#include <nlohmann/json.hpp>
+
+using namespace mtx::http;
+
+using Field    = boost::beast::http::field;
+using Request  = boost::beast::http::request<boost::beast::http::string_body>;
+using Response = boost::beast::http::response<boost::beast::http::string_body>;
+using Status   = boost::beast::http::status;
+using Verb     = boost::beast::http::verb;
+
+namespace {
+bool
+ends_with(std::string_view s, std::string_view suffix)
+{
+        return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+}
+
+//! Whether the request failed because of the server or the network, not because of the request.
+bool
+is_server_error(Status status)
+{
+        return status == Status::bad_gateway || status == Status::service_unavailable ||
+               status == Status::gateway_timeout;
+}
+}
+
+bool
+mtx::http::is_idempotent(Verb method, std::string_view target)
+{
+        switch (method) {
+        case Verb::get:
+        case Verb::head:
+        case Verb::options:
+        case Verb::delete_:
+        // Messages and to-device messages are sent with a transaction id, which the server uses
+        // to deduplicate them. Other PUTs replace a resource.
+        case Verb::put:
+                return true;
+        case Verb::post: {
+                // Searches and queries, that don't change anything on the server.
+                const auto path = target.substr(0, target.find('?'));
+                return ends_with(path, "/keys/query") || ends_with(path, "/search") ||
+                       ends_with(path, "/publicRooms");
+        }
+        default:
+                return false;
+        }
+}
+
+std::optional<std::chrono::milliseconds>
+mtx::http::retry_after(const Response &response)
+{
+        const auto json = nlohmann::json::parse(response.body(), nullptr, false);
+        if (json.is_object() && json.contains("retry_after_ms") &&
+            json["retry_after_ms"].is_number_unsigned())
+                return std::chrono::milliseconds(json["retry_after_ms"].get<std::uint64_t>());
+
+        // Only the delay in seconds is supported, not the HTTP date.
+        const auto header = response[Field::retry_after];
+        if (header.empty() || header.size() > 9 ||
+            !std::all_of(header.begin(), header.end(), [](unsigned char c) {
+                    return std::isdigit(c);
+            }))
+                return std::nullopt;
+
+        return std::chrono::seconds(std::stoul(std::string(header)));
+}
+
+RetryPolicy::RetryPolicy(const RetryOpts &opts)
+  : opts_(opts)
+  , rng_(std::random_device{}())
+{}
+
+void
+RetryPolicy::set_options(const RetryOpts &opts)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        opts_ = opts;
+}
+
+RetryOpts
+RetryPolicy::options() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opts_;
+}
+
+RetryStats
+RetryPolicy::stats() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+}
+
+std::optional<std::chrono::milliseconds>
+RetryPolicy::next_attempt(const Request &request,
+                          const Response *response,
+                          const boost::system::error_code &ec,
+                          unsigned attempt,
+                          bool resendable,
+                          bool streamed)
+{
+        // Aborted by the caller, i.e. by a download sink or an upload source.
+        if (ec == boost::asio::error::operation_aborted)
+                return std::nullopt;
+
+        const bool network_error = static_cast<bool>(ec) || !response;
+        const auto status        = network_error ? Status::unknown : response->result();
+        const bool rate_limited  = status == Status::too_many_requests;
+        const auto target        = request.target();
+        const bool idempotent =
+          is_idempotent(request.method(), std::string_view(target.data(), target.size()));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!opts_.enabled || !resendable)
+                return std::nullopt;
+
+        if (rate_limited) {
+                if (!opts_.rate_limited)
+                        return std::nullopt;
+        } else if (network_error) {
+                // A streamed response may have been passed on partially.
+                if (!opts_.server_errors || !idempotent || streamed)
+                        return std::nullopt;
+        } else if (!opts_.server_errors || !idempotent || !is_server_error(status)) {
+                return std::nullopt;
+        }
+
+        std::optional<std::chrono::milliseconds> requested;
+        if (response && !network_error)
+                requested = retry_after(*response);
+
+        if (attempt >= opts_.max_retries || (requested && *requested > opts_.max_delay)) {
+                stats_.gave_up++;
+                return std::nullopt;
+        }
+
+        std::chrono::milliseconds delay;
+        if (requested) {
+                // Honour the server, but don't let all clients return at the same moment.
+                std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(
+                  0, requested->count() / 10);
+                delay = *requested + std::chrono::milliseconds(jitter(rng_));
+        } else {
+                delay = backoff(attempt);
+        }
+
+        stats_.retries++;
+        if (rate_limited)
+                stats_.rate_limited++;
+        else if (network_error)
+                stats_.network_errors++;
+        else
+                stats_.server_errors++;
+
+        return delay;
+}
+
+std::chrono::milliseconds
+RetryPolicy::backoff(unsigned attempt)
+{
+        auto delay = opts_.initial_delay;
+        for (unsigned i = 0; i < attempt && delay < opts_.max_delay; ++i)
+                delay *= 2;
+        delay = std::min(delay, opts_.max_delay);
+
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(delay.count() / 2,
+                                                                             delay.count());
+        return std::chrono::milliseconds(jitter(rng_));
+}
@@ -1,29 +1,41 @@
 #include "mtxclient/http/session.hpp"
+#include "mtxclient/http/connection_pool.hpp"
+#include "mtxclient/http/dns_cache.hpp"
+#include "mtxclient/http/tls_session_cache.hpp"
+
+#ifdef MTXCLIENT_HTTP2
+#include "mtxclient/http/http2.hpp"
+#endif
 
 #include <boost/asio/strand.hpp>
 
 #include <iostream>
+#include <limits>
 
 using namespace mtx::http;
 
 Session::Session(boost::asio::io_service &ios,
-                 boost::asio::ssl::context &ssl_ctx,
+                 std::shared_ptr<boost::asio::ssl::context> ssl_ctx,
                  const std::string &host,
                  uint16_t port,
                  RequestID id,
                  SuccessCallback on_success,
-                 FailureCallback on_failure)
-  // Use a strand for synchronisation.
-  // I don't know, if we need to use the same strand for both the socket and the resolver or if one
-  // for each works as well. Taken from this example:
-  // https://www.boost.org/doc/libs/1_71_0/libs/beast/example/http/client/async-ssl/http_client_async_ssl.cpp
-  : resolver_(boost::asio::make_strand(ios))
-  , socket(boost::asio::make_strand(ios), ssl_ctx)
-  , host(std::move(host))
+                 FailureCallback on_failure,
+                 std::shared_ptr<ConnectionPool> pool,
+                 std::shared_ptr<TlsSessionCache> tls_sessions,
+                 std::shared_ptr<DnsCache> dns,
+                 bool single_threaded)
+  : host(std::move(host))
   , port{port}
   , id(std::move(id))
   , on_success(std::move(on_success))
   , on_failure(std::move(on_failure))
+  , ios_(ios)
+  , ssl_ctx_(std::move(ssl_ctx))
+  , pool_(std::move(pool))
+  , tls_sessions_(std::move(tls_sessions))
+  , dns_(dns ? std::move(dns) : std::make_shared<DnsCache>(ios, ResolverOpts{false}))
+  , single_threaded_(single_threaded)
   , is_shutting_down_(false)
 {
         parser.header_limit(8192);
@@ -31,17 +43,19 @@ Session::Session(boost::asio::io_service &ios,
 }
 
 void
-Session::on_resolve(boost::system::error_code ec,
-                    boost::asio::ip::tcp::resolver::results_type results)
+Session::on_resolve(const boost::system::error_code &ec,
+                    std::vector<boost::asio::ip::tcp::endpoint> endpoints)
 {
         if (ec) {
+                end_probe(false);
                 on_failure(id, ec);
                 return;
         }
 
-        boost::asio::async_connect(
-          socket.next_layer(),
-          results,
+        async_connect_happy_eyeballs(
+          socket->next_layer(),
+          endpoints,
+          dns_->options().connection_attempt_delay,
           std::bind(&Session::on_connect, shared_from_this(), std::placeholders::_1));
 }
 
@@ -72,12 +86,16 @@ void
 Session::on_connect(const boost::system::error_code &ec)
 {
         if (ec) {
+                end_probe(false);
                 on_failure(id, ec);
                 return;
         }
 
+        if (tls_sessions_)
+                tls_sessions_->prepare(socket->native_handle(), host);
+
         // Perform the SSL handshake
-        socket.async_handshake(
+        socket->async_handshake(
           boost::asio::ssl::stream_base::client,
           std::bind(&Session::on_handshake, shared_from_this(), std::placeholders::_1));
 }
@@ -92,7 +110,10 @@ Session::terminate()
 void
 Session::shutdown()
 {
-        socket.async_shutdown(
+        if (!socket)
+                return;
+
+        socket->async_shutdown(
           std::bind(&Session::on_close, shared_from_this(), std::placeholders::_1));
 }
 
@@ -103,7 +124,29 @@ Session::on_request_complete()
                 return;
 
         boost::system::error_code ec(error_code);
-        on_success(id, parser.get(), ec);
+
+        const bool done       = streaming_parser_ ? streaming_parser_->is_done() : parser.is_done();
+        const bool keep_alive = streaming_parser_ ? streaming_parser_->get().keep_alive()
+                                                  : parser.get().keep_alive();
+
+        // Hand the connection back before running the callback, so that a follow-up request
+        // issued from it can already reuse the connection.
+        if (pool_ && !ec && done && keep_alive)
+                pool_->release(host, port, std::move(socket));
+
+        if (streaming_parser_) {
+                boost::beast::http::response<boost::beast::http::string_body> res(
+                  streaming_parser_->get().base());
+                res.body() = std::move(error_body_);
+
+                on_success(id, res, ec);
+        } else {
+                auto &msg = parser.get();
+                boost::beast::http::response<boost::beast::http::string_body> res(
+                  std::move(msg.base()), std::move(msg.body()));
+
+                on_success(id, res, ec);
+        }
 
         shutdown();
 }
@@ -112,30 +155,139 @@ void
 Session::on_handshake(const boost::system::error_code &ec)
 {
         if (ec) {
+                end_probe(false);
                 on_failure(id, ec);
                 return;
         }
 
+        if (tls_sessions_)
+                tls_sessions_->handshake_done(socket->native_handle());
+
+#ifdef MTXCLIENT_HTTP2
+        if (pool_ && Http2Connection::negotiated(socket->native_handle())) {
+                auto connection = Http2Connection::create(std::move(socket), host);
+                if (!connection) {
+                        end_probe(false);
+                        return on_failure(id, boost::asio::error::no_memory);
+                }
+
+                probing_multiplexed_ = false;
+                pool_->add_multiplexed(host, port, connection);
+                return send_multiplexed(std::move(connection));
+        }
+#endif
+
+        end_probe(true);
+        send_request();
+}
+
+void
+Session::send_request()
+{
+        if (body_source)
+                return send_streamed_request();
+
         boost::beast::http::async_write(
-          socket,
+          *socket,
           request,
           std::bind(
             &Session::on_write, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
 }
 
+void
+Session::send_streamed_request()
+{
+        upload_request_ = std::make_unique<
+          boost::beast::http::request<boost::beast::http::buffer_body>>(request.base());
+        upload_request_->body().data = nullptr;
+        upload_request_->body().more = true;
+
+        upload_serializer_ = std::make_unique<
+          boost::beast::http::request_serializer<boost::beast::http::buffer_body>>(
+          *upload_request_);
+
+        boost::beast::http::async_write_header(*socket,
+                                               *upload_serializer_,
+                                               std::bind(&Session::on_write_body_chunk,
+                                                         shared_from_this(),
+                                                         std::placeholders::_1,
+                                                         std::placeholders::_2));
+}
+
+void
+Session::write_body_chunk()
+{
+        upload_buf_.resize(64 * 1024);
+
+        std::size_t size = upload_buf_.size();
+        upload_started_  = true;
+        if (!body_source(upload_buf_.data(), size)) {
+                upload_aborted_ = true;
+
+                boost::system::error_code ignored;
+                socket->lowest_layer().close(ignored);
+                socket.reset();
+
+                return on_failure(id, boost::asio::error::operation_aborted);
+        }
+
+        // An empty chunk finishes the body.
+        auto &body = upload_request_->body();
+        body.data  = size > 0 ? upload_buf_.data() : nullptr;
+        body.size  = size;
+        body.more  = size > 0;
+
+        boost::beast::http::async_write(*socket,
+                                        *upload_serializer_,
+                                        std::bind(&Session::on_write_body_chunk,
+                                                  shared_from_this(),
+                                                  std::placeholders::_1,
+                                                  std::placeholders::_2));
+}
+
+void
+Session::on_write_body_chunk(const boost::system::error_code &ec, std::size_t bytes_transferred)
+{
+        // The chunk was written and the serializer needs the next one.
+        if (ec == boost::beast::http::error::need_buffer)
+                return write_body_chunk();
+
+        if (ec || upload_serializer_->is_done())
+                return on_write(ec, bytes_transferred);
+
+        write_body_chunk();
+}
+
 void
 Session::on_write(const boost::system::error_code &ec, std::size_t bytes_transferred)
 {
         boost::ignore_unused(bytes_transferred);
 
         if (ec) {
-                on_failure(id, ec);
+                if (!retry_with_new_connection())
+                        on_failure(id, ec);
+                return;
+        }
+
+        if (body_sink) {
+                streaming_parser_ = std::make_unique<
+                  boost::beast::http::response_parser<boost::beast::http::buffer_body>>();
+                streaming_parser_->header_limit(8192);
+                streaming_parser_->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+                boost::beast::http::async_read_header(*socket,
+                                                      output_buf,
+                                                      *streaming_parser_,
+                                                      std::bind(&Session::on_read_header,
+                                                                shared_from_this(),
+                                                                std::placeholders::_1,
+                                                                std::placeholders::_2));
                 return;
         }
 
         // Receive the HTTP response
         boost::beast::http::async_read(
-          socket,
+          *socket,
           output_buf,
           parser,
           std::bind(
@@ -147,28 +299,245 @@ Session::on_read(const boost::system::error_code &ec, std::size_t bytes_transfer
 {
         boost::ignore_unused(bytes_transferred);
 
-        if (ec)
+        if (ec) {
+                if (!parser.got_some() && retry_with_new_connection())
+                        return;
+
                 error_code = ec;
+        }
 
         on_request_complete();
 }
 
+void
+Session::send_multiplexed(std::shared_ptr<MultiplexedConnection> connection)
+{
+        UploadSource source;
+        if (body_source)
+                source = [self = shared_from_this()](char *buffer, std::size_t &size) {
+                        self->upload_started_ = true;
+                        if (self->body_source(buffer, size))
+                                return true;
+
+                        self->upload_aborted_ = true;
+                        return false;
+                };
+
+        connection->submit(request,
+                           std::bind(&Session::on_multiplexed_response,
+                                     shared_from_this(),
+                                     std::placeholders::_1,
+                                     std::placeholders::_2,
+                                     std::placeholders::_3),
+                           body_sink,
+                           std::move(source));
+}
+
+void
+Session::on_multiplexed_response(
+  const boost::system::error_code &ec,
+  boost::beast::http::response<boost::beast::http::string_body> &&res,
+  bool responded)
+{
+        if (ec && !responded && retry_with_new_connection())
+                return;
+
+        if (is_shutting_down_)
+                return;
+
+        if (upload_aborted_)
+                return on_failure(id, boost::asio::error::operation_aborted);
+
+        if (ec && !responded)
+                return on_failure(id, ec);
+
+        on_success(id, res, ec);
+}
+
+void
+Session::on_multiplexed_ready(std::shared_ptr<MultiplexedConnection> connection)
+{
+        if (!connection)
+                return connect();
+
+        reused_connection_ = true;
+        send_multiplexed(std::move(connection));
+}
+
+void
+Session::end_probe(bool unsupported)
+{
+        if (!probing_multiplexed_)
+                return;
+
+        probing_multiplexed_ = false;
+        pool_->multiplexing_unavailable(host, port, unsupported);
+}
+
+void
+Session::on_read_header(const boost::system::error_code &ec, std::size_t bytes_transferred)
+{
+        boost::ignore_unused(bytes_transferred);
+
+        if (ec) {
+                if (!streaming_parser_->got_some() && retry_with_new_connection())
+                        return;
+
+                error_code = ec;
+                return on_request_complete();
+        }
+
+        if (streaming_parser_->is_done())
+                return on_request_complete();
+
+        chunk_buf_.resize(64 * 1024);
+        read_body_chunk();
+}
+
+void
+Session::read_body_chunk()
+{
+        auto &body = streaming_parser_->get().body();
+        body.data  = chunk_buf_.data();
+        body.size  = chunk_buf_.size();
+
+        boost::beast::http::async_read(*socket,
+                                       output_buf,
+                                       *streaming_parser_,
+                                       std::bind(&Session::on_read_chunk,
+                                                 shared_from_this(),
+                                                 std::placeholders::_1,
+                                                 std::placeholders::_2));
+}
+
+void
+Session::on_read_chunk(const boost::system::error_code &ec, std::size_t bytes_transferred)
+{
+        boost::ignore_unused(bytes_transferred);
+
+        // The chunk buffer is full.
+        if (ec && ec != boost::beast::http::error::need_buffer) {
+                error_code = ec;
+                return on_request_complete();
+        }
+
+        const auto &res  = streaming_parser_->get();
+        const auto chunk = chunk_buf_.size() - res.body().size;
+
+        // Only a successful response is the requested content. Error responses are kept, so that
+        // the error can be parsed.
+        const auto status = res.result_int();
+        if (status < 200 || status >= 300) {
+                error_body_.append(chunk_buf_.data(), chunk);
+        } else if (chunk > 0 && !is_shutting_down_ && !body_sink(chunk_buf_.data(), chunk)) {
+                // The rest of the body is still in flight, so the connection can't be reused or
+                // shut down cleanly.
+                boost::system::error_code ignored;
+                socket->lowest_layer().close(ignored);
+                socket.reset();
+
+                error_code = boost::asio::error::operation_aborted;
+                return on_request_complete();
+        }
+
+        if (streaming_parser_->is_done())
+                return on_request_complete();
+
+        read_body_chunk();
+}
+
+bool
+Session::retry_with_new_connection()
+{
+        // The data of a streamed upload can't be read again.
+        if (!reused_connection_ || is_shutting_down_ || upload_started_)
+                return false;
+
+        reused_connection_ = false;
+        socket.reset();
+        streaming_parser_.reset();
+        upload_serializer_.reset();
+        upload_request_.reset();
+        output_buf.consume(output_buf.size());
+
+        connect();
+        return true;
+}
+
 void
 Session::run() noexcept
 {
+        if (pool_) {
+                if (auto connection = pool_->acquire_multiplexed(host, port)) {
+                        reused_connection_ = true;
+                        send_multiplexed(std::move(connection));
+                        return;
+                }
+
+                socket = pool_->acquire(host, port);
+        }
+
+        if (socket) {
+                reused_connection_ = true;
+                send_request();
+                return;
+        }
+
+#ifdef MTXCLIENT_HTTP2
+        // Wait for a concurrent request to the same host, if it may open a HTTP/2 connection,
+        // instead of opening one connection per request.
+        if (pool_) {
+                auto on_ready = std::bind(
+                  &Session::on_multiplexed_ready, shared_from_this(), std::placeholders::_1);
+
+                switch (pool_->probe_multiplexed(host, port, std::move(on_ready))) {
+                case ConnectionPool::Probe::Wait:
+                        return;
+                case ConnectionPool::Probe::Connect:
+                        probing_multiplexed_ = true;
+                        break;
+                case ConnectionPool::Probe::Unsupported:
+                        break;
+                }
+        }
+#endif
+
+        connect();
+}
+
+void
+Session::connect()
+{
+        // Handlers of a connection need to be serialized, unless only a single thread runs them.
+        boost::asio::any_io_executor executor = ios_.get_executor();
+        if (!single_threaded_)
+                executor = boost::asio::make_strand(ios_);
+
+        socket = std::make_unique<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(
+          executor, *ssl_ctx_);
+
         // Set SNI Hostname (many hosts need this to handshake successfully)
-        if (!SSL_set_tlsext_host_name(socket.native_handle(), host.c_str())) {
+        if (!SSL_set_tlsext_host_name(socket->native_handle(), host.c_str())) {
                 boost::system::error_code ec{static_cast<int>(::ERR_get_error()),
                                              boost::asio::error::get_ssl_category()};
                 std::cerr << ec.message() << "\n";
 
+                end_probe(false);
                 return on_failure(id, ec);
         }
 
-        resolver_.async_resolve(host,
-                                std::to_string(port),
-                                std::bind(&Session::on_resolve,
-                                          shared_from_this(),
-                                          std::placeholders::_1,
-                                          std::placeholders::_2));
+#ifdef MTXCLIENT_HTTP2
+        if (pool_) {
+                const auto opts = pool_->options();
+                if (opts.enabled && opts.http2)
+                        Http2Connection::offer_alpn(socket->native_handle());
+        }
+#endif
+
+        dns_->resolve(host,
+                      port,
+                      std::bind(&Session::on_resolve,
+                                shared_from_this(),
+                                std::placeholders::_1,
+                                std::placeholders::_2));
 }
@@ -0,0 +1,66 @@
+#include "mtxclient/http/thread_pool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using namespace mtx::http;
+
+namespace {
+unsigned
+thread_count(unsigned threads)
+{
+        if (threads != 0)
+                return threads;
+
+        return std::min(8U, std::max(1U, std::thread::hardware_concurrency()));
+}
+}
+
+ThreadPool::ThreadPool(unsigned threads)
+  : threads_(thread_count(threads))
+  , ctx_(std::make_shared<Context>(static_cast<int>(threads_)))
+{
+        workers_.reserve(threads_);
+        for (unsigned int i = 0; i < threads_; ++i)
+                workers_.emplace_back([ctx = ctx_]() { ctx->ios.run(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+        if (!on_pool_thread()) {
+                join();
+                return;
+        }
+
+        // Joining would wait for this thread. The threads share the io_context, so the last one
+        // to return from it destroys it.
+        ctx_->work.reset();
+        ctx_->ios.stop();
+        for (auto &worker : workers_)
+                worker.detach();
+}
+
+bool
+ThreadPool::on_pool_thread() const
+{
+        const auto self = boost::this_thread::get_id();
+        return std::any_of(workers_.begin(), workers_.end(), [self](const boost::thread &worker) {
+                return worker.get_id() == self;
+        });
+}
+
+void
+ThreadPool::join()
+{
+        ctx_->work.reset();
+        for (auto &worker : workers_)
+                if (worker.joinable())
+                        worker.join();
+}
+
+void
+ThreadPool::stop()
+{
+        ctx_->ios.stop();
+        join();
+}
@@ -0,0 +1,124 @@
+#include "mtxclient/http/tls_session_cache.hpp"
+
+#include <openssl/ssl.h>
+
+using namespace mtx::http;
+
+namespace {
+//! Index of the ex data slot, that links a SSL_CTX to its cache.
+int
+cache_index()
+{
+        static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+}
+}
+
+TlsSessionCache::TlsSessionCache(boost::asio::ssl::context &ctx)
+  : ctx_(ctx.native_handle())
+{
+        // Sessions may outlive the boost context, keep the SSL_CTX alive as long as we reference it.
+        SSL_CTX_up_ref(ctx_);
+
+        SSL_CTX_set_ex_data(ctx_, cache_index(), this);
+        // We only use our own store, keyed by host. The internal store is keyed by session id,
+        // which a client can't look up before connecting.
+        SSL_CTX_set_session_cache_mode(ctx_,
+                                       SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx_, &TlsSessionCache::on_new_session);
+}
+
+TlsSessionCache::~TlsSessionCache()
+{
+        SSL_CTX_sess_set_new_cb(ctx_, nullptr);
+        SSL_CTX_set_ex_data(ctx_, cache_index(), nullptr);
+
+        clear();
+        SSL_CTX_free(ctx_);
+}
+
+void
+TlsSessionCache::prepare(SSL *ssl, const std::string &host)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = sessions_.find(host);
+        if (it == sessions_.end())
+                return;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        if (!SSL_SESSION_is_resumable(it->second)) {
+                SSL_SESSION_free(it->second);
+                sessions_.erase(it);
+                return;
+        }
+#endif
+
+        // SSL_set_session takes its own reference.
+        if (SSL_set_session(ssl, it->second) == 1)
+                stats_.offered++;
+}
+
+void
+TlsSessionCache::handshake_done(SSL *ssl)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        stats_.handshakes++;
+        if (SSL_session_reused(ssl))
+                stats_.resumed++;
+}
+
+TlsSessionStats
+TlsSessionCache::stats() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+}
+
+void
+TlsSessionCache::clear()
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto &[host, session] : sessions_)
+                SSL_SESSION_free(session);
+        sessions_.clear();
+}
+
+int
+TlsSessionCache::on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+        auto cache = static_cast<TlsSessionCache *>(
+          SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), cache_index()));
+        const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+        if (!cache || !host)
+                return 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        // OpenSSL marks the session of a connection as not resumable, if the connection ends with
+        // an error, which happens frequently, when servers close the connection without a
+        // close_notify. Store a copy, so that the ticket stays usable.
+        if (auto copy = SSL_SESSION_dup(session))
+                cache->store(host, copy);
+
+        return 0;
+#else
+        cache->store(host, session);
+
+        // We keep the reference passed to us.
+        return 1;
+#endif
+}
+
+void
+TlsSessionCache::store(const std::string &host, SSL_SESSION *session)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto &entry = sessions_[host];
+        if (entry)
+                SSL_SESSION_free(entry);
+        entry = session;
+}
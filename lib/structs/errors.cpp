@@ -106,5 +106,8 @@ from_json(const nlohmann::json &obj, Error &error)
 
         if (obj.contains("flows"))
                 error.unauthorized = obj.get<user_interactive::Unauthorized>();
+
+        if (obj.contains("retry_after_ms") && obj.at("retry_after_ms").is_number_unsigned())
+                error.retry_after_ms = obj.at("retry_after_ms").get<std::uint64_t>();
 }
 }
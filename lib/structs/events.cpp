@@ -1,5 +1,10 @@
 #include "mtx/events.hpp"
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -7,192 +12,155 @@ using json = nlohmann::json;
 namespace mtx {
 namespace events {
 
+namespace {
+struct EventTypeName
+{
+        EventType type;
+        std::string_view name;
+};
+
+//! The name of every event type, in the order of the enum.
+constexpr std::array<EventTypeName, static_cast<std::size_t>(EventType::Unsupported) + 1>
+  event_type_names = {{
+  {EventType::KeyVerificationCancel, "m.key.verification.cancel"},
+  {EventType::KeyVerificationRequest, "m.key.verification.request"},
+  {EventType::KeyVerificationStart, "m.key.verification.start"},
+  {EventType::KeyVerificationAccept, "m.key.verification.accept"},
+  {EventType::KeyVerificationKey, "m.key.verification.key"},
+  {EventType::KeyVerificationMac, "m.key.verification.mac"},
+  {EventType::KeyVerificationReady, "m.key.verification.ready"},
+  {EventType::KeyVerificationDone, "m.key.verification.done"},
+  {EventType::Reaction, "m.reaction"},
+  {EventType::RoomKey, "m.room_key"},
+  {EventType::ForwardedRoomKey, "m.forwarded_room_key"},
+  {EventType::RoomKeyRequest, "m.room_key_request"},
+  {EventType::RoomAliases, "m.room.aliases"},
+  {EventType::RoomAvatar, "m.room.avatar"},
+  {EventType::RoomCanonicalAlias, "m.room.canonical_alias"},
+  {EventType::RoomCreate, "m.room.create"},
+  {EventType::RoomEncrypted, "m.room.encrypted"},
+  {EventType::RoomEncryption, "m.room.encryption"},
+  {EventType::RoomGuestAccess, "m.room.guest_access"},
+  {EventType::RoomHistoryVisibility, "m.room.history_visibility"},
+  {EventType::RoomJoinRules, "m.room.join_rules"},
+  {EventType::RoomMember, "m.room.member"},
+  {EventType::RoomMessage, "m.room.message"},
+  {EventType::RoomName, "m.room.name"},
+  {EventType::RoomPowerLevels, "m.room.power_levels"},
+  {EventType::RoomTopic, "m.room.topic"},
+  {EventType::RoomRedaction, "m.room.redaction"},
+  {EventType::RoomPinnedEvents, "m.room.pinned_events"},
+  {EventType::RoomTombstone, "m.room.tombstone"},
+  {EventType::Sticker, "m.sticker"},
+  {EventType::Tag, "m.tag"},
+  {EventType::Presence, "m.presence"},
+  {EventType::PushRules, "m.push_rules"},
+  {EventType::CallInvite, "m.call.invite"},
+  {EventType::CallCandidates, "m.call.candidates"},
+  {EventType::CallAnswer, "m.call.answer"},
+  {EventType::CallHangUp, "m.call.hangup"},
+  {EventType::SecretRequest, "m.secret.request"},
+  {EventType::SecretSend, "m.secret.send"},
+  {EventType::Typing, "m.typing"},
+  {EventType::Receipt, "m.receipt"},
+  {EventType::FullyRead, "m.fully_read"},
+  {EventType::NhekoHiddenEvents, "im.nheko.hidden_events"},
+  {EventType::Unsupported, ""},
+  }};
+
+constexpr bool
+in_enum_order()
+{
+        for (std::size_t i = 0; i < event_type_names.size(); ++i)
+                if (static_cast<std::size_t>(event_type_names[i].type) != i)
+                        return false;
+        return true;
+}
+static_assert(in_enum_order(), "event_type_names must list the event types in enum order");
+
+//! FNV-1a, mixed with a seed, so that a seed without collisions can be searched for.
+constexpr std::uint32_t
+hash(std::string_view s, std::uint32_t seed)
+{
+        std::uint32_t h = 2166136261U ^ seed;
+        for (char c : s)
+                h = (h ^ static_cast<unsigned char>(c)) * 16777619U;
+        return h ^ (h >> 15);
+}
+
+constexpr std::size_t event_type_slots = 256;
+constexpr std::uint8_t empty_slot      = 0xff;
+static_assert(event_type_names.size() < empty_slot);
+
+//! Whether `seed` hashes every event type name into a different slot.
+constexpr bool
+is_perfect(std::uint32_t seed)
+{
+        std::array<bool, event_type_slots> used{};
+        for (const auto &entry : event_type_names) {
+                if (entry.type == EventType::Unsupported)
+                        continue;
+
+                auto &slot = used[hash(entry.name, seed) % event_type_slots];
+                if (slot)
+                        return false;
+                slot = true;
+        }
+        return true;
+}
+
+constexpr std::uint32_t
+find_seed()
+{
+        for (std::uint32_t seed = 0; seed < 10000; ++seed)
+                if (is_perfect(seed))
+                        return seed;
+        return 0;
+}
+
+constexpr std::uint32_t event_type_seed = find_seed();
+static_assert(is_perfect(event_type_seed), "no perfect hash for the event type names");
+
+//! Maps the hash of a name to its index in event_type_names, or to empty_slot.
+constexpr std::array<std::uint8_t, event_type_slots>
+make_event_type_slots()
+{
+        std::array<std::uint8_t, event_type_slots> slots{};
+        for (auto &slot : slots)
+                slot = empty_slot;
+        for (std::size_t i = 0; i < event_type_names.size(); ++i)
+                if (event_type_names[i].type != EventType::Unsupported)
+                        slots[hash(event_type_names[i].name, event_type_seed) % event_type_slots] =
+                          static_cast<std::uint8_t>(i);
+        return slots;
+}
+
+constexpr auto event_type_index = make_event_type_slots();
+}
+
+EventType
+getEventType(std::string_view type)
+{
+        // Every known name has its own slot, so a single comparison tells if it matches.
+        const auto index = event_type_index[hash(type, event_type_seed) % event_type_slots];
+        if (index != empty_slot && event_type_names[index].name == type)
+                return event_type_names[index].type;
+
+        return EventType::Unsupported;
+}
+
 EventType
 getEventType(const std::string &type)
 {
-        if (type == "m.key.verification.request")
-                return EventType::KeyVerificationRequest;
-        else if (type == "m.key.verification.start")
-                return EventType::KeyVerificationStart;
-        else if (type == "m.key.verification.accept")
-                return EventType::KeyVerificationAccept;
-        else if (type == "m.key.verification.ready")
-                return EventType::KeyVerificationReady;
-        else if (type == "m.key.verification.done")
-                return EventType::KeyVerificationDone;
-        else if (type == "m.key.verification.key")
-                return EventType::KeyVerificationKey;
-        else if (type == "m.key.verification.mac")
-                return EventType::KeyVerificationMac;
-        else if (type == "m.key.verification.cancel")
-                return EventType::KeyVerificationCancel;
-        else if (type == "m.reaction")
-                return EventType::Reaction;
-        else if (type == "m.room_key")
-                return EventType::RoomKey;
-        else if (type == "m.forwarded_room_key")
-                return EventType::ForwardedRoomKey;
-        else if (type == "m.room_key_request")
-                return EventType::RoomKeyRequest;
-        else if (type == "m.room.aliases")
-                return EventType::RoomAliases;
-        else if (type == "m.room.avatar")
-                return EventType::RoomAvatar;
-        else if (type == "m.room.canonical_alias")
-                return EventType::RoomCanonicalAlias;
-        else if (type == "m.room.create")
-                return EventType::RoomCreate;
-        else if (type == "m.room.encrypted")
-                return EventType::RoomEncrypted;
-        else if (type == "m.room.encryption")
-                return EventType::RoomEncryption;
-        else if (type == "m.room.guest_access")
-                return EventType::RoomGuestAccess;
-        else if (type == "m.room.history_visibility")
-                return EventType::RoomHistoryVisibility;
-        else if (type == "m.room.join_rules")
-                return EventType::RoomJoinRules;
-        else if (type == "m.room.member")
-                return EventType::RoomMember;
-        else if (type == "m.room.message")
-                return EventType::RoomMessage;
-        else if (type == "m.room.name")
-                return EventType::RoomName;
-        else if (type == "m.room.power_levels")
-                return EventType::RoomPowerLevels;
-        else if (type == "m.room.topic")
-                return EventType::RoomTopic;
-        else if (type == "m.room.redaction")
-                return EventType::RoomRedaction;
-        else if (type == "m.room.pinned_events")
-                return EventType::RoomPinnedEvents;
-        else if (type == "m.room.tombstone")
-                return EventType::RoomTombstone;
-        else if (type == "m.sticker")
-                return EventType::Sticker;
-        else if (type == "m.tag")
-                return EventType::Tag;
-        else if (type == "m.presence")
-                return EventType::Presence;
-        else if (type == "m.push_rules")
-                return EventType::PushRules;
-        else if (type == "m.call.invite")
-                return EventType::CallInvite;
-        else if (type == "m.call.candidates")
-                return EventType::CallCandidates;
-        else if (type == "m.call.answer")
-                return EventType::CallAnswer;
-        else if (type == "m.call.hangup")
-                return EventType::CallHangUp;
-        else if (type == "m.secret.request")
-                return EventType::SecretRequest;
-        else if (type == "m.secret.send")
-                return EventType::SecretSend;
-        else if (type == "m.typing")
-                return EventType::Typing;
-        else if (type == "m.receipt")
-                return EventType::Receipt;
-        else if (type == "m.fully_read")
-                return EventType::FullyRead;
-        else if (type == "im.nheko.hidden_events")
-                return EventType::NhekoHiddenEvents;
-        else
-                return EventType::Unsupported;
+        return getEventType(std::string_view(type));
 }
 
 std::string
 to_string(EventType type)
 {
-        switch (type) {
-        case EventType::KeyVerificationCancel:
-                return "m.key.verification.cancel";
-        case EventType::KeyVerificationRequest:
-                return "m.key.verification.request";
-        case EventType::KeyVerificationStart:
-                return "m.key.verification.start";
-        case EventType::KeyVerificationAccept:
-                return "m.key.verification.accept";
-        case EventType::KeyVerificationKey:
-                return "m.key.verification.key";
-        case EventType::KeyVerificationReady:
-                return "m.key.verification.ready";
-        case EventType::KeyVerificationDone:
-                return "m.key.verification.done";
-        case EventType::KeyVerificationMac:
-                return "m.key.verification.mac";
-        case EventType::Reaction:
-                return "m.reaction";
-        case EventType::RoomKey:
-                return "m.room_key";
-        case EventType::ForwardedRoomKey:
-                return "m.forwarded_room_key";
-        case EventType::RoomKeyRequest:
-                return "m.room_key_request";
-        case EventType::RoomAliases:
-                return "m.room.aliases";
-        case EventType::RoomAvatar:
-                return "m.room.avatar";
-        case EventType::RoomCanonicalAlias:
-                return "m.room.canonical_alias";
-        case EventType::RoomCreate:
-                return "m.room.create";
-        case EventType::RoomEncrypted:
-                return "m.room.encrypted";
-        case EventType::RoomEncryption:
-                return "m.room.encryption";
-        case EventType::RoomGuestAccess:
-                return "m.room.guest_access";
-        case EventType::RoomHistoryVisibility:
-                return "m.room.history_visibility";
-        case EventType::RoomJoinRules:
-                return "m.room.join_rules";
-        case EventType::RoomMember:
-                return "m.room.member";
-        case EventType::RoomMessage:
-                return "m.room.message";
-        case EventType::RoomName:
-                return "m.room.name";
-        case EventType::RoomPowerLevels:
-                return "m.room.power_levels";
-        case EventType::RoomTopic:
-                return "m.room.topic";
-        case EventType::RoomRedaction:
-                return "m.room.redaction";
-        case EventType::RoomPinnedEvents:
-                return "m.room.pinned_events";
-        case EventType::RoomTombstone:
-                return "m.room.tombstone";
-        case EventType::Sticker:
-                return "m.sticker";
-        case EventType::Tag:
-                return "m.tag";
-        case EventType::Presence:
-                return "m.presence";
-        case EventType::PushRules:
-                return "m.push_rules";
-        case EventType::CallInvite:
-                return "m.call.invite";
-        case EventType::CallCandidates:
-                return "m.call.candidates";
-        case EventType::CallAnswer:
-                return "m.call.answer";
-        case EventType::CallHangUp:
-                return "m.call.hangup";
-        case EventType::SecretRequest:
-                return "m.secret.request";
-        case EventType::SecretSend:
-                return "m.secret.send";
-        case EventType::Typing:
-                return "m.typing";
-        case EventType::Receipt:
-                return "m.receipt";
-        case EventType::FullyRead:
-                return "m.fully_read";
-        case EventType::NhekoHiddenEvents:
-                return "im.nheko.hidden_events";
-        case EventType::Unsupported:
-                return "";
-        }
+        const auto index = static_cast<std::size_t>(type);
+        if (index < event_type_names.size())
+                return std::string(event_type_names[index].name);
 
         return "";
 }
@@ -200,8 +168,8 @@ to_string(EventType type)
 EventType
 getEventType(const json &obj)
 {
-        if (obj.find("type") != obj.end())
-                return getEventType(obj.at("type").get<std::string>());
+        if (auto type = obj.find("type"); type != obj.end())
+                return getEventType(type->get_ref<const std::string &>());
 
         return EventType::Unsupported;
 }
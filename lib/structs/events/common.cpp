@@ -240,7 +240,7 @@ parse_relations(const nlohmann::json &content)
                                 if (r.rel_type == RelationType::Replace &&
                                     content.contains("m.new_content") &&
                                     content.at("m.new_content").contains("m.relates_to")) {
-                                        const auto secondRel =
+                                        const auto &secondRel =
                                           content["m.new_content"]["m.relates_to"];
                                         if (secondRel.contains("m.in_reply_to")) {
                                                 Relation r2{};
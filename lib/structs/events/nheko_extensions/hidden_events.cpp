@@ -11,7 +11,7 @@ void
 from_json(const nlohmann::json &obj, HiddenEvents &content)
 {
         for (const auto &typeStr : obj.at("hidden_event_types")) {
-                if (auto type = getEventType(typeStr.get<std::string>());
+                if (auto type = getEventType(typeStr.get_ref<const std::string &>());
                     type != EventType::Unsupported)
                         content.hidden_event_types.push_back(type);
         }
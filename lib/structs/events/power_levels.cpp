@@ -26,9 +26,9 @@ from_json(const json &obj, PowerLevels &power_levels)
                 power_levels.redact = obj.at("redact").get<power_level_t>();
 
         if (obj.count("events") != 0)
-                power_levels.events = obj.at("events").get<std::map<std::string, power_level_t>>();
+                power_levels.events = obj.at("events").get<decltype(power_levels.events)>();
         if (obj.count("users") != 0)
-                power_levels.users = obj.at("users").get<std::map<std::string, power_level_t>>();
+                power_levels.users = obj.at("users").get<decltype(power_levels.users)>();
 
         if (obj.count("events_default") != 0)
                 power_levels.events_default = obj.at("events_default").get<power_level_t>();
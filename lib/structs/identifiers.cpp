@@ -1,10 +1,34 @@
 #include "mtx/identifiers.hpp"
 
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
 #include <nlohmann/json.hpp>
 
 namespace mtx {
 namespace identifiers {
 
+namespace detail {
+const std::string *
+intern(std::string_view id)
+{
+        // A deque never moves its elements, so the pointers to the strings stay valid. Looking up
+        // an id, that is interned already, doesn't allocate.
+        static std::mutex mutex;
+        static std::deque<std::string> strings;
+        static std::unordered_map<std::string_view, const std::string *> table;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto it = table.find(id); it != table.end())
+                return it->second;
+
+        const auto &interned = strings.emplace_back(id);
+        table.emplace(interned, &interned);
+        return &interned;
+}
+}
+
 void
 from_json(const nlohmann::json &obj, User &user)
 {
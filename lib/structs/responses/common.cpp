@@ -1,5 +1,8 @@
 #include "mtx/responses/common.hpp"
 
+#include <array>
+#include <cstddef>
+
 #include <nlohmann/json.hpp>
 
 #include "mtx/events.hpp"
@@ -69,6 +72,257 @@ log_error(std::string err, const json &event)
         std::cout << event.dump(2) << std::endl;
 }
 
+namespace {
+namespace collections = mtx::events::collections;
+using events::EventType;
+
+//! A function decoding an event and appending it to a collection of events.
+template<class Variant>
+using Decoder = void (*)(const json &, std::vector<Variant> &);
+
+//! Decode `e` as an `Event` and append it. Events, that fail to decode, are logged and skipped.
+template<class Event, class Variant>
+void
+decode(const json &e, std::vector<Variant> &container)
+{
+        try {
+                container.emplace_back(Event(e));
+        } catch (json::exception &err) {
+                log_error(err, e);
+        }
+}
+
+//! Events of type `Type` are decoded as `Event`, which has to be an alternative of the collection.
+template<EventType Type, class Event>
+struct As
+{
+        static constexpr std::size_t key = static_cast<std::size_t>(Type);
+        template<class Variant>
+        static constexpr Decoder<Variant> decoder = &decode<Event, Variant>;
+};
+
+//! Events of type `Type` are decoded by `Decode`, which picks the alternative from the content.
+template<EventType Type, auto Decode>
+struct With
+{
+        static constexpr std::size_t key = static_cast<std::size_t>(Type);
+        template<class Variant>
+        static constexpr Decoder<Variant> decoder = Decode;
+};
+
+//! Messages of type `Type` are decoded as `Event`.
+template<events::MessageType Type, class Event>
+struct AsMessage
+{
+        static constexpr std::size_t key = static_cast<std::size_t>(Type);
+        template<class Variant>
+        static constexpr Decoder<Variant> decoder = &decode<Event, Variant>;
+};
+
+//! A table with a decoder for every one of `Size` types, generated from the `Entries`. Types
+//! without an entry aren't part of the collection and their events are skipped.
+template<class Variant, std::size_t Size, class... Entries>
+struct Dispatch
+{
+        static constexpr std::array<Decoder<Variant>, Size> table = [] {
+                std::array<Decoder<Variant>, Size> table{};
+                ((table[Entries::key] = Entries::template decoder<Variant>), ...);
+                return table;
+        }();
+
+        static void parse(std::size_t key, const json &e, std::vector<Variant> &container)
+        {
+                if (auto decoder = table[key])
+                        decoder(e, container);
+        }
+};
+
+constexpr std::size_t event_type_count = static_cast<std::size_t>(EventType::Unsupported) + 1;
+constexpr std::size_t message_type_count =
+  static_cast<std::size_t>(events::MessageType::Unknown) + 1;
+
+template<class Variant, class... Entries>
+using EventDispatch = Dispatch<Variant, event_type_count, Entries...>;
+
+template<class Variant, class... Entries>
+using MessageDispatch = Dispatch<Variant, message_type_count, Entries...>;
+
+// The event types of every collection. Adding an event to a collection means adding its
+// alternative to the variant in collections.hpp and its line here.
+
+using RoomAccountDataDispatch =
+  EventDispatch<collections::RoomAccountDataEvents,
+                As<EventType::Tag, events::AccountDataEvent<Tags>>,
+                As<EventType::FullyRead, events::AccountDataEvent<FullyRead>>,
+                As<EventType::PushRules, events::AccountDataEvent<pushrules::GlobalRuleset>>,
+                As<EventType::NhekoHiddenEvents,
+                   events::AccountDataEvent<nheko_extensions::HiddenEvents>>,
+                As<EventType::Unsupported, events::AccountDataEvent<events::Unknown>>>;
+
+using RoomMessageDispatch =
+  MessageDispatch<collections::TimelineEvents,
+                  AsMessage<events::MessageType::Audio, events::RoomEvent<Audio>>,
+                  AsMessage<events::MessageType::Emote, events::RoomEvent<Emote>>,
+                  AsMessage<events::MessageType::File, events::RoomEvent<File>>,
+                  AsMessage<events::MessageType::Image, events::RoomEvent<Image>>,
+                  // Location messages are skipped, there is no events::msg::Location yet.
+                  AsMessage<events::MessageType::Notice, events::RoomEvent<Notice>>,
+                  AsMessage<events::MessageType::Text, events::RoomEvent<Text>>,
+                  AsMessage<events::MessageType::Video, events::RoomEvent<Video>>,
+                  AsMessage<events::MessageType::KeyVerificationRequest,
+                            events::RoomEvent<KeyVerificationRequest>>>;
+
+//! Decodes an `m.room.message` by its `msgtype`.
+void
+parse_room_message(const json &e, std::vector<collections::TimelineEvents> &container)
+{
+        const auto msg_type = mtx::events::getMessageType(e.at("content"));
+
+        if (msg_type == events::MessageType::Unknown) {
+                try {
+                        auto unsigned_data = e.at("unsigned").at("redacted_by").get<std::string>();
+
+                        if (unsigned_data.empty())
+                                return;
+
+                        container.emplace_back(events::RoomEvent<Redacted>(e));
+                        return;
+                } catch (json::exception &err) {
+                        log_error(err, e);
+                }
+
+                log_error("Invalid event type", e);
+                return;
+        }
+
+        RoomMessageDispatch::parse(static_cast<std::size_t>(msg_type), e, container);
+}
+
+using TimelineDispatch = EventDispatch<
+  collections::TimelineEvents,
+  As<EventType::Reaction, events::RoomEvent<Reaction>>,
+  As<EventType::RoomAliases, events::StateEvent<Aliases>>,
+  As<EventType::RoomAvatar, events::StateEvent<Avatar>>,
+  As<EventType::RoomCanonicalAlias, events::StateEvent<CanonicalAlias>>,
+  As<EventType::RoomCreate, events::StateEvent<Create>>,
+  As<EventType::RoomEncrypted, events::EncryptedEvent<Encrypted>>,
+  As<EventType::RoomEncryption, events::StateEvent<Encryption>>,
+  As<EventType::RoomGuestAccess, events::StateEvent<GuestAccess>>,
+  As<EventType::RoomHistoryVisibility, events::StateEvent<HistoryVisibility>>,
+  As<EventType::RoomJoinRules, events::StateEvent<JoinRules>>,
+  As<EventType::RoomMember, events::StateEvent<Member>>,
+  As<EventType::RoomName, events::StateEvent<Name>>,
+  As<EventType::RoomPowerLevels, events::StateEvent<PowerLevels>>,
+  As<EventType::RoomRedaction, events::RedactionEvent<Redaction>>,
+  As<EventType::RoomTombstone, events::StateEvent<Tombstone>>,
+  As<EventType::RoomTopic, events::StateEvent<Topic>>,
+  As<EventType::KeyVerificationStart, events::RoomEvent<KeyVerificationStart>>,
+  As<EventType::KeyVerificationAccept, events::RoomEvent<KeyVerificationAccept>>,
+  As<EventType::KeyVerificationDone, events::RoomEvent<KeyVerificationDone>>,
+  As<EventType::KeyVerificationReady, events::RoomEvent<KeyVerificationReady>>,
+  As<EventType::KeyVerificationKey, events::RoomEvent<KeyVerificationKey>>,
+  As<EventType::KeyVerificationMac, events::RoomEvent<KeyVerificationMac>>,
+  As<EventType::KeyVerificationCancel, events::RoomEvent<KeyVerificationCancel>>,
+  With<EventType::RoomMessage, &parse_room_message>,
+  As<EventType::Sticker, events::Sticker>,
+  As<EventType::CallInvite, events::RoomEvent<CallInvite>>,
+  As<EventType::CallCandidates, events::RoomEvent<CallCandidates>>,
+  As<EventType::CallAnswer, events::RoomEvent<CallAnswer>>,
+  As<EventType::CallHangUp, events::RoomEvent<CallHangUp>>,
+  As<EventType::Unsupported, events::RoomEvent<events::Unknown>>>;
+
+//! Decodes an `m.room.encrypted` to-device event by its algorithm, olm or megolm.
+void
+parse_encrypted_device_event(const json &e, std::vector<collections::DeviceEvents> &container)
+{
+        try {
+                const auto algo = e.at("content").at("algorithm").get<std::string>();
+                if (algo == "m.olm.v1.curve25519-aes-sha2") {
+                        container.emplace_back(events::DeviceEvent<OlmEncrypted>(e));
+                } else if (algo == "m.megolm.v1.aes-sha2") {
+                        container.emplace_back(events::DeviceEvent<Encrypted>(e));
+                } else {
+                        log_error("Invalid m.room.encrypted algorithm", e);
+                        return;
+                }
+        } catch (json::exception &err) {
+                log_error(err, e);
+        }
+}
+
+using DeviceDispatch =
+  EventDispatch<collections::DeviceEvents,
+                With<EventType::RoomEncrypted, &parse_encrypted_device_event>,
+                As<EventType::RoomKey, events::DeviceEvent<RoomKey>>,
+                As<EventType::ForwardedRoomKey, events::DeviceEvent<ForwardedRoomKey>>,
+                As<EventType::RoomKeyRequest, events::DeviceEvent<KeyRequest>>,
+                As<EventType::KeyVerificationCancel, events::DeviceEvent<KeyVerificationCancel>>,
+                As<EventType::KeyVerificationRequest, events::DeviceEvent<KeyVerificationRequest>>,
+                As<EventType::KeyVerificationStart, events::DeviceEvent<KeyVerificationStart>>,
+                As<EventType::KeyVerificationAccept, events::DeviceEvent<KeyVerificationAccept>>,
+                As<EventType::KeyVerificationKey, events::DeviceEvent<KeyVerificationKey>>,
+                As<EventType::KeyVerificationMac, events::DeviceEvent<KeyVerificationMac>>,
+                As<EventType::KeyVerificationReady, events::DeviceEvent<KeyVerificationReady>>,
+                As<EventType::KeyVerificationDone, events::DeviceEvent<KeyVerificationDone>>,
+                As<EventType::SecretSend, events::DeviceEvent<SecretSend>>,
+                As<EventType::SecretRequest, events::DeviceEvent<SecretRequest>>,
+                As<EventType::Unsupported, events::DeviceEvent<events::Unknown>>>;
+
+using StateDispatch =
+  EventDispatch<collections::StateEvents,
+                As<EventType::RoomAliases, events::StateEvent<Aliases>>,
+                As<EventType::RoomAvatar, events::StateEvent<Avatar>>,
+                As<EventType::RoomCanonicalAlias, events::StateEvent<CanonicalAlias>>,
+                As<EventType::RoomCreate, events::StateEvent<Create>>,
+                As<EventType::RoomEncryption, events::StateEvent<Encryption>>,
+                As<EventType::RoomGuestAccess, events::StateEvent<GuestAccess>>,
+                As<EventType::RoomHistoryVisibility, events::StateEvent<HistoryVisibility>>,
+                As<EventType::RoomJoinRules, events::StateEvent<JoinRules>>,
+                As<EventType::RoomMember, events::StateEvent<Member>>,
+                As<EventType::RoomName, events::StateEvent<Name>>,
+                As<EventType::RoomPowerLevels, events::StateEvent<PowerLevels>>,
+                As<EventType::RoomTombstone, events::StateEvent<Tombstone>>,
+                As<EventType::RoomTopic, events::StateEvent<Topic>>,
+                As<EventType::Unsupported, events::StateEvent<events::Unknown>>>;
+
+using StrippedDispatch =
+  EventDispatch<collections::StrippedEvents,
+                As<EventType::RoomAliases, events::StrippedEvent<Aliases>>,
+                As<EventType::RoomAvatar, events::StrippedEvent<Avatar>>,
+                As<EventType::RoomCanonicalAlias, events::StrippedEvent<CanonicalAlias>>,
+                As<EventType::RoomCreate, events::StrippedEvent<Create>>,
+                As<EventType::RoomGuestAccess, events::StrippedEvent<GuestAccess>>,
+                As<EventType::RoomHistoryVisibility, events::StrippedEvent<HistoryVisibility>>,
+                As<EventType::RoomJoinRules, events::StrippedEvent<JoinRules>>,
+                As<EventType::RoomMember, events::StrippedEvent<Member>>,
+                As<EventType::RoomName, events::StrippedEvent<Name>>,
+                As<EventType::RoomPowerLevels, events::StrippedEvent<PowerLevels>>,
+                As<EventType::RoomTombstone, events::StrippedEvent<Tombstone>>,
+                As<EventType::RoomTopic, events::StrippedEvent<Topic>>,
+                As<EventType::Unsupported, events::StrippedEvent<events::Unknown>>>;
+
+using EphemeralDispatch =
+  EventDispatch<collections::EphemeralEvents,
+                As<EventType::Typing, events::EphemeralEvent<events::ephemeral::Typing>>,
+                As<EventType::Receipt, events::EphemeralEvent<events::ephemeral::Receipt>>,
+                As<EventType::Unsupported, events::EphemeralEvent<events::Unknown>>>;
+
+//! Decode `e` with the decoder for its event type in `Table`.
+template<class Table, class Variant>
+void
+parse_event(const json &e, std::vector<Variant> &container)
+{
+        Table::parse(static_cast<std::size_t>(mtx::events::getEventType(e)), e, container);
+}
+}
+
+void
+parse_room_account_data_event(const json &e,
+                              std::vector<collections::RoomAccountDataEvents> &container)
+{
+        parse_event<RoomAccountDataDispatch>(e, container);
+}
+
 void
 parse_room_account_data_events(
   const json &events,
@@ -77,96 +331,8 @@ parse_room_account_data_events(
         container.clear();
         container.reserve(events.size());
 
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::Tag: {
-                        try {
-                                container.emplace_back(events::AccountDataEvent<Tags>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-                        break;
-                }
-                case events::EventType::FullyRead: {
-                        try {
-                                container.emplace_back(
-                                  events::AccountDataEvent<events::account_data::FullyRead>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::PushRules: {
-                        try {
-                                container.emplace_back(
-                                  events::AccountDataEvent<pushrules::GlobalRuleset>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-                        break;
-                }
-                case events::EventType::NhekoHiddenEvents: {
-                        try {
-                                container.emplace_back(
-                                  events::AccountDataEvent<nheko_extensions::HiddenEvents>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-                        break;
-                }
-                case events::EventType::Unsupported: {
-                        try {
-                                container.emplace_back(events::EphemeralEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-                        break;
-                }
-                case events::EventType::KeyVerificationCancel:
-                case events::EventType::KeyVerificationRequest:
-                case events::EventType::KeyVerificationStart:
-                case events::EventType::KeyVerificationReady:
-                case events::EventType::KeyVerificationDone:
-                case events::EventType::KeyVerificationAccept:
-                case events::EventType::KeyVerificationKey:
-                case events::EventType::KeyVerificationMac:
-                case events::EventType::SecretRequest:
-                case events::EventType::SecretSend:
-                case events::EventType::Presence:
-                case events::EventType::Reaction:
-                case events::EventType::RoomAliases:
-                case events::EventType::RoomAvatar:
-                case events::EventType::RoomCanonicalAlias:
-                case events::EventType::RoomCreate:
-                case events::EventType::RoomEncrypted:
-                case events::EventType::RoomEncryption:
-                case events::EventType::RoomGuestAccess:
-                case events::EventType::RoomHistoryVisibility:
-                case events::EventType::RoomJoinRules:
-                case events::EventType::RoomKey:
-                case events::EventType::ForwardedRoomKey:
-                case events::EventType::RoomKeyRequest:
-                case events::EventType::RoomMember:
-                case events::EventType::RoomMessage:
-                case events::EventType::RoomName:
-                case events::EventType::RoomPinnedEvents:
-                case events::EventType::RoomPowerLevels:
-                case events::EventType::RoomRedaction:
-                case events::EventType::RoomTombstone:
-                case events::EventType::RoomTopic:
-                case events::EventType::Sticker:
-                case events::EventType::CallInvite:
-                case events::EventType::CallCandidates:
-                case events::EventType::CallAnswer:
-                case events::EventType::CallHangUp:
-                case events::EventType::Typing:
-                case events::EventType::Receipt:
-                        continue;
-                }
-        }
+        for (const auto &e : events)
+                parse_room_account_data_event(e, container);
 }
 
 void
@@ -177,6 +343,13 @@ compose_timeline_events(json &events,
         events       = std::visit([](auto e) { return json(e); }, c);
 }
 
+void
+parse_timeline_event(const json &e,
+                     std::vector<mtx::events::collections::TimelineEvents> &container)
+{
+        parse_event<TimelineDispatch>(e, container);
+}
+
 void
 parse_timeline_events(const json &events,
                       std::vector<mtx::events::collections::TimelineEvents> &container)
@@ -184,423 +357,15 @@ parse_timeline_events(const json &events,
         container.clear();
         container.reserve(events.size());
 
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::Reaction: {
-                        try {
-                                container.emplace_back(events::RoomEvent<events::msg::Reaction>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomAliases: {
-                        try {
-                                container.emplace_back(events::StateEvent<Aliases>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomAvatar: {
-                        try {
-                                container.emplace_back(events::StateEvent<Avatar>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCanonicalAlias: {
-                        try {
-                                container.emplace_back(events::StateEvent<CanonicalAlias>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCreate: {
-                        try {
-                                container.emplace_back(events::StateEvent<Create>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomEncrypted: {
-                        try {
-                                container.emplace_back(
-                                  events::EncryptedEvent<mtx::events::msg::Encrypted>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomEncryption: {
-                        try {
-                                container.emplace_back(events::StateEvent<Encryption>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomGuestAccess: {
-                        try {
-                                container.emplace_back(events::StateEvent<GuestAccess>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomHistoryVisibility: {
-                        try {
-                                container.emplace_back(events::StateEvent<HistoryVisibility>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomJoinRules: {
-                        try {
-                                container.emplace_back(events::StateEvent<JoinRules>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomMember: {
-                        try {
-                                container.emplace_back(events::StateEvent<Member>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomName: {
-                        try {
-                                container.emplace_back(events::StateEvent<Name>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomPowerLevels: {
-                        try {
-                                container.emplace_back(events::StateEvent<PowerLevels>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomRedaction: {
-                        try {
-                                container.emplace_back(
-                                  events::RedactionEvent<mtx::events::msg::Redaction>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTombstone: {
-                        try {
-                                container.emplace_back(events::StateEvent<Tombstone>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTopic: {
-                        try {
-                                container.emplace_back(events::StateEvent<Topic>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationStart: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationStart>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationAccept: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationAccept>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationDone: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationDone>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationReady: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationReady>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationKey: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationKey>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationMac: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationMac>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationCancel: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::KeyVerificationCancel>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomMessage: {
-                        using MsgType       = mtx::events::MessageType;
-                        const auto msg_type = mtx::events::getMessageType(e.at("content"));
-
-                        if (msg_type == events::MessageType::Unknown) {
-                                try {
-                                        auto unsigned_data =
-                                          e.at("unsigned").at("redacted_by").get<std::string>();
-
-                                        if (unsigned_data.empty())
-                                                continue;
-
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Redacted>(e));
-                                        continue;
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                log_error("Invalid event type", e);
-                                continue;
-                        }
-
-                        switch (msg_type) {
-                        case MsgType::Audio: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Audio>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Emote: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Emote>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::File: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::File>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Image: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Image>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Location: {
-                                /* events::RoomEvent<events::msg::Location> location = e; */
-                                /* container.emplace_back(location); */
-                                break;
-                        }
-                        case MsgType::Notice: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Notice>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Text: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Text>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Video: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::Video>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::KeyVerificationRequest: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::msg::KeyVerificationRequest>(
-                                            e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-
-                                break;
-                        }
-                        case MsgType::Unknown: {
-                                try {
-                                        container.emplace_back(
-                                          events::RoomEvent<events::Unknown>(e));
-                                } catch (json::exception &err) {
-                                        log_error(err, e);
-                                }
-                                break;
-                        }
-                        }
-                        break;
-                }
-                case events::EventType::Sticker: {
-                        try {
-                                container.emplace_back(events::Sticker(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::CallInvite: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::CallInvite>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::CallCandidates: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::CallCandidates>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::CallAnswer: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::CallAnswer>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::CallHangUp: {
-                        try {
-                                container.emplace_back(
-                                  events::RoomEvent<events::msg::CallHangUp>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::Unsupported: {
-                        try {
-                                container.emplace_back(events::RoomEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
+        for (const auto &e : events)
+                parse_timeline_event(e, container);
+}
 
-                        break;
-                }
-                case events::EventType::KeyVerificationRequest:
-                case events::EventType::RoomPinnedEvents:
-                case events::EventType::RoomKey:          // Not part of timeline or state
-                case events::EventType::ForwardedRoomKey: // Not part of timeline or state
-                case events::EventType::RoomKeyRequest:   // Not part of the timeline
-                case events::EventType::Tag:              // Not part of the timeline or state
-                case events::EventType::Presence:         // Not part of the timeline or state
-                case events::EventType::PushRules:        // Not part of the timeline or state
-                case events::EventType::SecretRequest:    // Not part of the timeline or state
-                case events::EventType::SecretSend:       // Not part of the timeline or state
-                case events::EventType::Typing:
-                case events::EventType::Receipt:
-                case events::EventType::FullyRead:
-                case events::EventType::NhekoHiddenEvents:
-                        continue;
-                }
-        }
+void
+parse_device_event(const json &e,
+                   std::vector<mtx::events::collections::DeviceEvents> &container)
+{
+        parse_event<DeviceDispatch>(e, container);
 }
 
 void
@@ -609,155 +374,15 @@ parse_device_events(const json &events,
 {
         container.clear();
         container.reserve(events.size());
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::RoomEncrypted: {
-                        try {
-                                const auto algo =
-                                  e.at("content").at("algorithm").get<std::string>();
-                                // Algorithm determines whether it's an olm or megolm event
-                                if (algo == "m.olm.v1.curve25519-aes-sha2") {
-                                        container.emplace_back(
-                                          events::DeviceEvent<OlmEncrypted>(e));
-                                } else if (algo == "m.megolm.v1.aes-sha2") {
-                                        container.emplace_back(events::DeviceEvent<Encrypted>(e));
-                                } else {
-                                        log_error("Invalid m.room.encrypted algorithm", e);
-                                        continue;
-                                }
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomKey: {
-                        try {
-                                container.emplace_back(events::DeviceEvent<RoomKey>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::ForwardedRoomKey: {
-                        try {
-                                container.emplace_back(events::DeviceEvent<ForwardedRoomKey>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomKeyRequest: {
-                        try {
-                                container.emplace_back(events::DeviceEvent<KeyRequest>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationCancel: {
-                        try {
-                                container.emplace_back(
-                                  events::DeviceEvent<KeyVerificationCancel>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::KeyVerificationRequest:
-                        try {
-                                container.emplace_back(
-                                  events::DeviceEvent<KeyVerificationRequest>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationStart:
-                        try {
-                                container.emplace_back(
-                                  events::DeviceEvent<KeyVerificationStart>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationAccept:
-                        try {
-                                container.emplace_back(
-                                  events::DeviceEvent<KeyVerificationAccept>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationKey:
-                        try {
-                                container.emplace_back(events::DeviceEvent<KeyVerificationKey>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationMac:
-                        try {
-                                container.emplace_back(events::DeviceEvent<KeyVerificationMac>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationReady:
-                        try {
-                                container.emplace_back(
-                                  events::DeviceEvent<KeyVerificationReady>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::KeyVerificationDone:
-                        try {
-                                container.emplace_back(events::DeviceEvent<KeyVerificationDone>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::SecretSend:
-                        try {
-                                container.emplace_back(events::DeviceEvent<SecretSend>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::SecretRequest:
-                        try {
-                                container.emplace_back(events::DeviceEvent<SecretRequest>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                case events::EventType::Unsupported:
-                        try {
-                                container.emplace_back(events::DeviceEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
+        for (const auto &e : events)
+                parse_device_event(e, container);
+}
 
-                        break;
-                default:
-                        continue;
-                }
-        }
+void
+parse_state_event(const json &e,
+                  std::vector<mtx::events::collections::StateEvents> &container)
+{
+        parse_event<StateDispatch>(e, container);
 }
 
 void
@@ -767,169 +392,15 @@ parse_state_events(const json &events,
         container.clear();
         container.reserve(events.size());
 
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::RoomAliases: {
-                        try {
-                                container.emplace_back(events::StateEvent<Aliases>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomAvatar: {
-                        try {
-                                container.emplace_back(events::StateEvent<Avatar>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCanonicalAlias: {
-                        try {
-                                container.emplace_back(events::StateEvent<CanonicalAlias>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCreate: {
-                        try {
-                                container.emplace_back(events::StateEvent<Create>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomEncryption: {
-                        try {
-                                container.emplace_back(events::StateEvent<Encryption>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomGuestAccess: {
-                        try {
-                                container.emplace_back(events::StateEvent<GuestAccess>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomHistoryVisibility: {
-                        try {
-                                container.emplace_back(events::StateEvent<HistoryVisibility>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomJoinRules: {
-                        try {
-                                container.emplace_back(events::StateEvent<JoinRules>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomMember: {
-                        try {
-                                container.emplace_back(events::StateEvent<Member>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomName: {
-                        try {
-                                container.emplace_back(events::StateEvent<Name>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomPowerLevels: {
-                        try {
-                                container.emplace_back(events::StateEvent<PowerLevels>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTombstone: {
-                        try {
-                                container.emplace_back(events::StateEvent<Tombstone>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTopic: {
-                        try {
-                                container.emplace_back(events::StateEvent<Topic>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::Unsupported: {
-                        try {
-                                container.emplace_back(events::StateEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
+        for (const auto &e : events)
+                parse_state_event(e, container);
+}
 
-                        break;
-                }
-                case events::EventType::Sticker:
-                case events::EventType::Reaction:
-                case events::EventType::RoomEncrypted:    /* Does this need to be here? */
-                case events::EventType::RoomKey:          // Not part of timeline or state
-                case events::EventType::ForwardedRoomKey: // Not part of timeline or state
-                case events::EventType::RoomKeyRequest:   // Not part of the timeline or state
-                case events::EventType::RoomMessage:
-                case events::EventType::RoomPinnedEvents:
-                case events::EventType::RoomRedaction:
-                case events::EventType::Tag:       // Not part of the timeline or state
-                case events::EventType::Presence:  // Not part of the timeline or state
-                case events::EventType::PushRules: // Not part of the timeline or state
-                case events::EventType::KeyVerificationCancel:
-                case events::EventType::KeyVerificationRequest:
-                case events::EventType::KeyVerificationStart:
-                case events::EventType::KeyVerificationReady:
-                case events::EventType::KeyVerificationDone:
-                case events::EventType::KeyVerificationAccept:
-                case events::EventType::KeyVerificationKey:
-                case events::EventType::KeyVerificationMac:
-                case events::EventType::SecretRequest:
-                case events::EventType::SecretSend:
-                case events::EventType::CallInvite:
-                case events::EventType::CallCandidates:
-                case events::EventType::CallAnswer:
-                case events::EventType::CallHangUp:
-                case events::EventType::Typing:
-                case events::EventType::Receipt:
-                case events::EventType::FullyRead:
-                case events::EventType::NhekoHiddenEvents:
-                        continue;
-                }
-        }
+void
+parse_stripped_event(const json &e,
+                     std::vector<mtx::events::collections::StrippedEvents> &container)
+{
+        parse_event<StrippedDispatch>(e, container);
 }
 
 void
@@ -939,161 +410,15 @@ parse_stripped_events(const json &events,
         container.clear();
         container.reserve(events.size());
 
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::RoomAliases: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Aliases>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomAvatar: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Avatar>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCanonicalAlias: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<CanonicalAlias>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomCreate: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Create>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomGuestAccess: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<GuestAccess>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomHistoryVisibility: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<HistoryVisibility>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomJoinRules: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<JoinRules>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomMember: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Member>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomName: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Name>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomPowerLevels: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<PowerLevels>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTombstone: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Tombstone>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::RoomTopic: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<Topic>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::Unsupported: {
-                        try {
-                                container.emplace_back(events::StrippedEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
+        for (const auto &e : events)
+                parse_stripped_event(e, container);
+}
 
-                        break;
-                }
-                case events::EventType::Sticker:
-                case events::EventType::Reaction:
-                case events::EventType::RoomEncrypted:
-                case events::EventType::RoomEncryption:
-                case events::EventType::RoomMessage:
-                case events::EventType::RoomRedaction:
-                case events::EventType::RoomKey:          // Not part of timeline or state
-                case events::EventType::ForwardedRoomKey: // Not part of timeline or state
-                case events::EventType::RoomKeyRequest:   // Not part of the timeline or state
-                case events::EventType::RoomPinnedEvents:
-                case events::EventType::Tag:       // Not part of the timeline or state
-                case events::EventType::Presence:  // Not part of the timeline or state
-                case events::EventType::PushRules: // Not part of the timeline or state
-                case events::EventType::KeyVerificationCancel:
-                case events::EventType::KeyVerificationRequest:
-                case events::EventType::KeyVerificationStart:
-                case events::EventType::KeyVerificationReady:
-                case events::EventType::KeyVerificationDone:
-                case events::EventType::KeyVerificationAccept:
-                case events::EventType::KeyVerificationKey:
-                case events::EventType::KeyVerificationMac:
-                case events::EventType::SecretRequest:
-                case events::EventType::SecretSend:
-                case events::EventType::CallInvite:
-                case events::EventType::CallCandidates:
-                case events::EventType::CallAnswer:
-                case events::EventType::CallHangUp:
-                case events::EventType::Typing:
-                case events::EventType::Receipt:
-                case events::EventType::FullyRead:
-                case events::EventType::NhekoHiddenEvents:
-                        continue;
-                }
-        }
+void
+parse_ephemeral_event(const json &e,
+                      std::vector<mtx::events::collections::EphemeralEvents> &container)
+{
+        parse_event<EphemeralDispatch>(e, container);
 }
 
 void
@@ -1102,43 +427,8 @@ parse_ephemeral_events(const json &events,
 {
         container.clear();
         container.reserve(events.size());
-        for (const auto &e : events) {
-                const auto type = mtx::events::getEventType(e);
-
-                switch (type) {
-                case events::EventType::Typing: {
-                        try {
-                                container.emplace_back(
-                                  events::EphemeralEvent<events::ephemeral::Typing>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::Receipt: {
-                        try {
-                                container.emplace_back(
-                                  events::EphemeralEvent<events::ephemeral::Receipt>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                case events::EventType::Unsupported: {
-                        try {
-                                container.emplace_back(events::EphemeralEvent<events::Unknown>(e));
-                        } catch (json::exception &err) {
-                                log_error(err, e);
-                        }
-
-                        break;
-                }
-                default:
-                        continue;
-                }
-        }
+        for (const auto &e : events)
+                parse_ephemeral_event(e, container);
 }
 }
 }
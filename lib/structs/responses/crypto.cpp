@@ -16,7 +16,7 @@ void
 from_json(const nlohmann::json &obj, QueryKeys &response)
 {
         response.failures    = obj.at("failures").get<std::map<std::string, nlohmann::json>>();
-        response.device_keys = obj.at("device_keys").get<std::map<std::string, DeviceToKeysMap>>();
+        response.device_keys = obj.at("device_keys").get<decltype(response.device_keys)>();
         response.master_keys =
           obj.at("master_keys").get<std::map<std::string, mtx::crypto::CrossSigningKeys>>();
         response.user_signing_keys =
@@ -46,9 +46,7 @@ void
 from_json(const nlohmann::json &obj, ClaimKeys &response)
 {
         response.failures = obj.at("failures").get<std::map<std::string, nlohmann::json>>();
-        response.one_time_keys =
-          obj.at("one_time_keys")
-            .get<std::map<std::string, std::map<std::string, nlohmann::json>>>();
+        response.one_time_keys = obj.at("one_time_keys").get<decltype(response.one_time_keys)>();
 }
 
 void
@@ -5,6 +5,20 @@
 
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <variant>
 
 using json = nlohmann::json;
@@ -143,15 +157,15 @@ void
 from_json(const json &obj, Rooms &rooms)
 {
         if (obj.count("join") != 0) {
-                rooms.join = obj.at("join").get<std::map<std::string, JoinedRoom>>();
+                rooms.join = obj.at("join").get<decltype(rooms.join)>();
         }
 
         if (obj.count("leave") != 0) {
-                rooms.leave = obj.at("leave").get<std::map<std::string, LeftRoom>>();
+                rooms.leave = obj.at("leave").get<decltype(rooms.leave)>();
         }
 
         if (obj.count("invite") != 0) {
-                rooms.invite = obj.at("invite").get<std::map<std::string, InvitedRoom>>();
+                rooms.invite = obj.at("invite").get<decltype(rooms.invite)>();
         }
 }
 
@@ -187,7 +201,8 @@ from_json(const json &obj, Sync &response)
 
         if (obj.count("device_one_time_keys_count") != 0)
                 response.device_one_time_keys_count =
-                  obj.at("device_one_time_keys_count").get<std::map<std::string, uint16_t>>();
+                  obj.at("device_one_time_keys_count")
+                    .get<decltype(response.device_one_time_keys_count)>();
 
         if (obj.count("presence") != 0 && obj.at("presence").contains("events")) {
                 response.presence =
@@ -203,5 +218,1166 @@ from_json(const json &obj, Sync &response)
 
         response.next_batch = obj.at("next_batch").get<std::string>();
 }
+
+namespace {
+//! The size of the first block of a SyncArena. Each further block is twice as large, up to
+//! `max_block_size`.
+constexpr std::size_t min_block_size = 64 * 1024;
+constexpr std::size_t max_block_size = 16 * 1024 * 1024;
+}
+
+std::string_view
+SyncArena::store(std::string_view text)
+{
+        if (text.empty())
+                return {};
+
+        if (static_cast<std::size_t>(end_ - pos_) < text.size()) {
+                const auto last = blocks_.empty() ? 0 : capacity_;
+                const auto size =
+                  std::max(text.size(), std::clamp(last, min_block_size, max_block_size));
+
+                blocks_.push_back(std::make_unique<char[]>(size));
+                pos_ = blocks_.back().get();
+                end_ = pos_ + size;
+                capacity_ += size;
+        }
+
+        const auto copy = pos_;
+        std::memcpy(copy, text.data(), text.size());
+        pos_ += text.size();
+        return {copy, text.size()};
+}
+
+void
+SyncArena::adopt(SyncArena &&other)
+{
+        blocks_.insert(blocks_.end(),
+                       std::make_move_iterator(other.blocks_.begin()),
+                       std::make_move_iterator(other.blocks_.end()));
+        capacity_ += other.capacity_;
+        other = SyncArena{};
+}
+
+namespace {
+//! Decodes rooms on worker threads, while the response is read on the calling thread. The
+//! results are merged in the order of the response, once all rooms are decoded.
+class RoomDecoder
+{
+public:
+        explicit RoomDecoder(unsigned threads)
+        {
+                for (unsigned i = 0; i < threads; ++i)
+                        threads_.emplace_back([this] { run(); });
+        }
+        //! Drops the tasks, that haven't started, and waits for the threads.
+        ~RoomDecoder()
+        {
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        stop_ = true;
+                        tasks_.clear();
+                }
+                work_.notify_all();
+                for (auto &thread : threads_)
+                        thread.join();
+        }
+
+        RoomDecoder(const RoomDecoder &) = delete;
+        RoomDecoder &operator=(const RoomDecoder &) = delete;
+
+        //! Run `task` on one of the threads. It must not throw.
+        void post(std::function<void()> task)
+        {
+                {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        tasks_.push_back(std::move(task));
+                        ++pending_;
+                }
+                work_.notify_one();
+        }
+        //! Run `merge` on the calling thread in `finish`.
+        void defer(std::function<void()> merge) { merges_.push_back(std::move(merge)); }
+        //! Wait for all tasks and run the merges in the order they were deferred.
+        void finish()
+        {
+                {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        done_.wait(lock, [this] { return pending_ == 0; });
+                }
+
+                auto merges = std::move(merges_);
+                merges_.clear();
+                for (const auto &merge : merges)
+                        merge();
+        }
+
+private:
+        void run()
+        {
+                std::unique_lock<std::mutex> lock(mutex_);
+                for (;;) {
+                        work_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                        if (stop_)
+                                return;
+
+                        auto task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                        lock.unlock();
+                        task();
+                        lock.lock();
+
+                        if (--pending_ == 0)
+                                done_.notify_all();
+                }
+        }
+
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable done_;
+        std::deque<std::function<void()>> tasks_;
+        //! Tasks, that were posted and haven't finished.
+        std::size_t pending_ = 0;
+        bool stop_           = false;
+        std::vector<std::function<void()>> merges_;
+};
+
+//! How parse_sync was asked to parse the response.
+struct ParseContext
+{
+        bool lazy_events;
+        const SyncParseFilter &filter;
+        //! Decodes the rooms, if they are decoded in parallel.
+        RoomDecoder *decoder;
+        //! Stores the text of the lazy events.
+        std::shared_ptr<SyncArena> arena;
+
+        //! The event types to keep of room events, or null, if all are kept.
+        const std::set<events::EventType> *event_types() const
+        {
+                return filter.event_types.empty() ? nullptr : &filter.event_types;
+        }
+};
+
+class Level;
+
+//! Parse the object in `data` with `root` as its level. Passes any other value to `not_object`.
+void
+parse_json(std::string_view data,
+           std::unique_ptr<Level> root,
+           const std::function<void(const json &)> &not_object);
+
+//! The part of a /sync response, that is being parsed. Objects and arrays, that are streamed,
+//! get a level of their own, all other values are built as json values and passed to the level
+//! containing them.
+class Level
+{
+public:
+        virtual ~Level() = default;
+
+        //! The level parsing the object or array under `key`, or null, if it is built as a json
+        //! value.
+        virtual std::unique_ptr<Level> stream(const std::string &key, bool is_array) = 0;
+        //! Whether the value under `key` is needed. Otherwise it is skipped.
+        virtual bool keep(const std::string &key) const = 0;
+        //! Take the json value under `key`.
+        virtual void value(const std::string &key, json value) { rest_[key] = std::move(value); }
+        //! Called at the end of the object.
+        virtual void finish() {}
+        //! Whether the values are kept as json text instead. See RawEvent.
+        virtual bool lazy() const { return false; }
+        //! Take the value under `key` kept as json text. The text is only valid during the call.
+        virtual void raw_value(const std::string &, RawEvent) {}
+
+protected:
+        //! The values, that were not streamed.
+        json rest_ = json::object();
+};
+
+//! Whether an event passes the `event_types` of a SyncParseFilter, if there are any.
+bool
+keep_event(const std::set<events::EventType> *event_types, const RawEvent &event)
+{
+        return !event_types || event_types->count(event.type) != 0;
+}
+
+//! The elements of an "events" array. Each event is built as a json value on its own. If only
+//! some `event_types` are kept, the events are kept as json text first and only the ones of
+//! those types are built.
+class EventList : public Level
+{
+public:
+        EventList(std::function<void(const json &)> parse_event,
+                  const std::set<events::EventType> *event_types)
+          : parse_event_(std::move(parse_event))
+          , event_types_(event_types)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &, bool) override { return nullptr; }
+        bool keep(const std::string &) const override { return true; }
+        void value(const std::string &, json event) override { parse_event_(event); }
+        bool lazy() const override { return event_types_ != nullptr; }
+        void raw_value(const std::string &, RawEvent event) override
+        {
+                if (keep_event(event_types_, event))
+                        parse_event_(json::parse(event.json));
+        }
+
+private:
+        std::function<void(const json &)> parse_event_;
+        const std::set<events::EventType> *event_types_;
+};
+
+//! The elements of an "events" array, that are only decoded on demand.
+class LazyEventList : public Level
+{
+public:
+        LazyEventList(std::vector<RawEvent> &events,
+                      const std::set<events::EventType> *event_types,
+                      SyncArena &arena)
+          : events_(events)
+          , event_types_(event_types)
+          , arena_(arena)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &, bool) override { return nullptr; }
+        bool keep(const std::string &) const override { return true; }
+        bool lazy() const override { return true; }
+        void raw_value(const std::string &, RawEvent event) override
+        {
+                if (!keep_event(event_types_, event))
+                        return;
+
+                event.sender   = arena_.store(event.sender);
+                event.event_id = arena_.store(event.event_id);
+                if (event.state_key)
+                        event.state_key = arena_.store(*event.state_key);
+                event.json = arena_.store(event.json);
+                events_.push_back(event);
+        }
+
+private:
+        std::vector<RawEvent> &events_;
+        const std::set<events::EventType> *event_types_;
+        SyncArena &arena_;
+};
+
+//! An object with an "events" array, like the state or the timeline of a room.
+class Events : public Level
+{
+public:
+        //! `finish` gets the values that were not streamed and whether the events were. If
+        //! `raw_events` is set, the events are stored there instead of being parsed, with their
+        //! text in `arena`. Only the events of `event_types` are kept, if it is set.
+        Events(std::function<void(const json &)> parse_event,
+               std::function<void(const json &rest, bool streamed)> finish,
+               std::vector<std::string> extra_keys            = {},
+               const std::set<events::EventType> *event_types = nullptr,
+               std::vector<RawEvent> *raw_events              = nullptr,
+               SyncArena *arena                               = nullptr)
+          : parse_event_(std::move(parse_event))
+          , finish_(std::move(finish))
+          , extra_keys_(std::move(extra_keys))
+          , event_types_(event_types)
+          , raw_events_(raw_events)
+          , arena_(arena)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                // Anything else is left to the json conversion, including its errors.
+                if (key != "events" || !is_array)
+                        return nullptr;
+
+                streamed_ = true;
+                if (raw_events_)
+                        return std::make_unique<LazyEventList>(
+                          *raw_events_, event_types_, *arena_);
+                return std::make_unique<EventList>(parse_event_, event_types_);
+        }
+        bool keep(const std::string &key) const override
+        {
+                return key == "events" ||
+                       std::find(extra_keys_.begin(), extra_keys_.end(), key) != extra_keys_.end();
+        }
+        void finish() override { finish_(rest_, streamed_); }
+
+private:
+        std::function<void(const json &)> parse_event_;
+        std::function<void(const json &rest, bool streamed)> finish_;
+        std::vector<std::string> extra_keys_;
+        const std::set<events::EventType> *event_types_;
+        std::vector<RawEvent> *raw_events_;
+        SyncArena *arena_;
+        bool streamed_ = false;
+};
+
+std::unique_ptr<Level>
+state_events(State &state, const ParseContext &ctx)
+{
+        state = {};
+        if (ctx.lazy_events)
+                state.arena = ctx.arena;
+        return std::make_unique<Events>(
+          [&state](const json &e) { utils::parse_state_event(e, state.events); },
+          [&state](const json &rest, bool streamed) {
+                  if (!streamed)
+                          from_json(rest, state);
+          },
+          std::vector<std::string>{},
+          ctx.event_types(),
+          ctx.lazy_events ? &state.raw_events : nullptr,
+          ctx.arena.get());
+}
+
+std::unique_ptr<Level>
+timeline_events(Timeline &timeline, const ParseContext &ctx)
+{
+        timeline = {};
+        if (ctx.lazy_events)
+                timeline.arena = ctx.arena;
+        return std::make_unique<Events>(
+          [&timeline](const json &e) { utils::parse_timeline_event(e, timeline.events); },
+          [&timeline](const json &rest, bool streamed) {
+                  if (!streamed) {
+                          from_json(rest, timeline);
+                          return;
+                  }
+
+                  timeline.prev_batch = rest.value("prev_batch", std::string{});
+                  timeline.limited    = rest.value("limited", false);
+          },
+          std::vector<std::string>{"prev_batch", "limited"},
+          ctx.event_types(),
+          ctx.lazy_events ? &timeline.raw_events : nullptr,
+          ctx.arena.get());
+}
+
+std::unique_ptr<Level>
+ephemeral_events(Ephemeral &ephemeral, const std::set<events::EventType> *event_types)
+{
+        ephemeral = {};
+        return std::make_unique<Events>(
+          [&ephemeral](const json &e) { utils::parse_ephemeral_event(e, ephemeral.events); },
+          [&ephemeral](const json &rest, bool streamed) {
+                  if (!streamed)
+                          from_json(rest, ephemeral);
+          },
+          std::vector<std::string>{},
+          event_types);
+}
+
+std::unique_ptr<Level>
+account_data_events(AccountData &account_data,
+                    const std::set<events::EventType> *event_types = nullptr)
+{
+        account_data = {};
+        return std::make_unique<Events>(
+          [&account_data](const json &e) {
+                  utils::parse_room_account_data_event(e, account_data.events);
+          },
+          [&account_data](const json &rest, bool streamed) {
+                  if (!streamed && rest.count("events") != 0)
+                          from_json(rest, account_data);
+          },
+          std::vector<std::string>{},
+          event_types);
+}
+
+std::unique_ptr<Level>
+device_events(ToDevice &to_device)
+{
+        to_device = {};
+        return std::make_unique<Events>(
+          [&to_device](const json &e) { utils::parse_device_event(e, to_device.events); },
+          [&to_device](const json &rest, bool streamed) {
+                  if (!streamed)
+                          from_json(rest, to_device);
+          });
+}
+
+std::unique_ptr<Level>
+presence_events(std::vector<mtx::events::Event<mtx::events::presence::Presence>> &presence)
+{
+        using Presence = mtx::events::Event<mtx::events::presence::Presence>;
+
+        presence = {};
+        return std::make_unique<Events>(
+          [&presence](const json &e) { presence.push_back(e.get<Presence>()); },
+          [&presence](const json &rest, bool streamed) {
+                  if (!streamed && rest.contains("events"))
+                          presence = rest.at("events").get<std::vector<Presence>>();
+          });
+}
+
+class JoinedRoomLevel : public Level
+{
+public:
+        JoinedRoomLevel(JoinedRoom &room, const ParseContext &ctx)
+          : room_(room)
+          , ctx_(ctx)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array)
+                        return nullptr;
+
+                if (key == "state")
+                        return state_events(room_.state, ctx_);
+                if (key == "timeline")
+                        return timeline_events(room_.timeline, ctx_);
+                if (key == "ephemeral")
+                        return ephemeral_events(room_.ephemeral, ctx_.event_types());
+                if (key == "account_data")
+                        return account_data_events(room_.account_data, ctx_.event_types());
+
+                return nullptr;
+        }
+        bool keep(const std::string &key) const override
+        {
+                return key == "state" || key == "timeline" || key == "unread_notifications" ||
+                       key == "ephemeral" || key == "account_data";
+        }
+        void finish() override { from_json(rest_, room_); }
+
+private:
+        JoinedRoom &room_;
+        const ParseContext &ctx_;
+};
+
+class LeftRoomLevel : public Level
+{
+public:
+        LeftRoomLevel(LeftRoom &room, const ParseContext &ctx)
+          : room_(room)
+          , ctx_(ctx)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array)
+                        return nullptr;
+
+                if (key == "state")
+                        return state_events(room_.state, ctx_);
+                if (key == "timeline")
+                        return timeline_events(room_.timeline, ctx_);
+
+                return nullptr;
+        }
+        bool keep(const std::string &key) const override
+        {
+                return key == "state" || key == "timeline";
+        }
+        void finish() override { from_json(rest_, room_); }
+
+private:
+        LeftRoom &room_;
+        const ParseContext &ctx_;
+};
+
+class InvitedRoomLevel : public Level
+{
+public:
+        InvitedRoomLevel(InvitedRoom &room, const ParseContext &ctx)
+          : room_(room)
+          , ctx_(ctx)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array || key != "invite_state")
+                        return nullptr;
+
+                streamed_ = true;
+                return std::make_unique<Events>(
+                  [this](const json &e) { utils::parse_stripped_event(e, room_.invite_state); },
+                  [this](const json &rest, bool streamed) {
+                          if (!streamed)
+                                  utils::parse_stripped_events(rest.at("events"),
+                                                               room_.invite_state);
+                  },
+                  std::vector<std::string>{},
+                  ctx_.event_types());
+        }
+        bool keep(const std::string &key) const override { return key == "invite_state"; }
+        void finish() override
+        {
+                if (!streamed_)
+                        from_json(rest_, room_);
+        }
+
+private:
+        InvitedRoom &room_;
+        const ParseContext &ctx_;
+        bool streamed_ = false;
+};
+
+std::unique_ptr<Level>
+room_level(JoinedRoom &room, const ParseContext &ctx)
+{
+        return std::make_unique<JoinedRoomLevel>(room, ctx);
+}
+
+std::unique_ptr<Level>
+room_level(LeftRoom &room, const ParseContext &ctx)
+{
+        return std::make_unique<LeftRoomLevel>(room, ctx);
+}
+
+std::unique_ptr<Level>
+room_level(InvitedRoom &room, const ParseContext &ctx)
+{
+        return std::make_unique<InvitedRoomLevel>(room, ctx);
+}
+
+//! Point the lazy events of a room, that was decoded into an arena of its own, to `arena`, after
+//! it adopted the text of the room.
+void
+share_arena(JoinedRoom &room, const std::shared_ptr<SyncArena> &arena)
+{
+        if (room.state.arena)
+                room.state.arena = arena;
+        if (room.timeline.arena)
+                room.timeline.arena = arena;
+}
+
+void
+share_arena(LeftRoom &room, const std::shared_ptr<SyncArena> &arena)
+{
+        if (room.state.arena)
+                room.state.arena = arena;
+        if (room.timeline.arena)
+                room.timeline.arena = arena;
+}
+
+void
+share_arena(InvitedRoom &, const std::shared_ptr<SyncArena> &)
+{}
+
+//! A room, that is decoded on a RoomDecoder thread.
+template<class Room>
+struct PendingRoom
+{
+        std::string id;
+        //! The room as json text in the response.
+        std::string_view json;
+        Room room;
+        std::exception_ptr error;
+        //! The text of the lazy events of the room, until it is merged into the one of the Sync.
+        std::shared_ptr<SyncArena> arena = std::make_shared<SyncArena>();
+};
+
+//! The rooms of one membership, by room id. Rooms, that the filter doesn't select, are skipped.
+//! With a RoomDecoder, the rooms are kept as json text and decoded on its threads.
+template<class Room>
+class RoomMapLevel : public Level
+{
+public:
+        RoomMapLevel(mtx::common::Map<std::string, Room> &rooms, const ParseContext &ctx)
+          : rooms_(rooms)
+          , ctx_(ctx)
+        {}
+        ~RoomMapLevel() override
+        {
+                // The response is broken further on. Errors in the rooms before still come first.
+                if (!pending_.empty())
+                        ctx_.decoder->defer([pending = std::move(pending_)] { check(pending); });
+        }
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array || !keep(key) || ctx_.decoder)
+                        return nullptr;
+
+                parsed_.emplace_back(key, Room{});
+                return room_level(parsed_.back().second, ctx_);
+        }
+        bool keep(const std::string &key) const override
+        {
+                return ctx_.filter.rooms.empty() || ctx_.filter.rooms.count(key) != 0;
+        }
+        bool lazy() const override { return ctx_.decoder != nullptr; }
+        void raw_value(const std::string &key, RawEvent value) override
+        {
+                // Anything but a room object is left to the json conversion.
+                if (value.json.empty() || value.json.front() != '{') {
+                        rest_[key] = json::parse(value.json);
+                        return;
+                }
+
+                auto pending  = std::make_shared<PendingRoom<Room>>();
+                pending->id   = key;
+                pending->json = value.json;
+                ctx_.decoder->post([pending, &ctx = ctx_] {
+                        auto room_ctx  = ctx;
+                        room_ctx.arena = pending->arena;
+                        try {
+                                parse_json(
+                                  pending->json, room_level(pending->room, room_ctx), {});
+                        } catch (...) {
+                                pending->error = std::current_exception();
+                        }
+                });
+                pending_.push_back(std::move(pending));
+        }
+        void finish() override
+        {
+                if (!ctx_.decoder) {
+                        for (const auto &room : rest_.items())
+                                parsed_.emplace_back(room.key(), room.value().template get<Room>());
+                        store(rooms_, std::move(parsed_));
+                        return;
+                }
+
+                ctx_.decoder->defer([pending = std::move(pending_),
+                                     rest    = std::move(rest_),
+                                     &rooms  = rooms_,
+                                     arena   = ctx_.arena] {
+                        check(pending);
+                        Parsed parsed;
+                        parsed.reserve(pending.size() + rest.size());
+                        for (const auto &room : pending) {
+                                if (arena) {
+                                        arena->adopt(std::move(*room->arena));
+                                        share_arena(room->room, arena);
+                                }
+                                parsed.emplace_back(std::move(room->id), std::move(room->room));
+                        }
+                        for (const auto &room : rest.items())
+                                parsed.emplace_back(room.key(), room.value().template get<Room>());
+                        store(rooms, std::move(parsed));
+                });
+                pending_.clear();
+        }
+
+private:
+        using Pending = std::vector<std::shared_ptr<PendingRoom<Room>>>;
+        using Parsed  = std::vector<std::pair<std::string, Room>>;
+
+        //! Put the rooms into the map at once, instead of inserting them one by one into the
+        //! middle of it. Of a repeated room id the last room wins, as when assigning them in order.
+        static void store(mtx::common::Map<std::string, Room> &rooms, Parsed parsed)
+        {
+                if (!rooms.empty()) {
+                        for (auto &room : parsed)
+                                rooms[room.first] = std::move(room.second);
+                        return;
+                }
+
+                const auto by_id   = [](const auto &a, const auto &b) { return a.first < b.first; };
+                const auto same_id = [](const auto &a, const auto &b) { return a.first == b.first; };
+                std::stable_sort(parsed.begin(), parsed.end(), by_id);
+                parsed.erase(parsed.begin(),
+                             std::unique(parsed.rbegin(), parsed.rend(), same_id).base());
+                rooms.insert(std::make_move_iterator(parsed.begin()),
+                             std::make_move_iterator(parsed.end()));
+        }
+
+        //! Throw the error of the first room, that failed to decode.
+        static void check(const Pending &pending)
+        {
+                for (const auto &room : pending)
+                        if (room->error)
+                                std::rethrow_exception(room->error);
+        }
+
+        mtx::common::Map<std::string, Room> &rooms_;
+        const ParseContext &ctx_;
+        Pending pending_;
+        //! The rooms parsed on this thread, until they are stored in `rooms_`.
+        Parsed parsed_;
+};
+
+class RoomsLevel : public Level
+{
+public:
+        RoomsLevel(Rooms &rooms, const ParseContext &ctx)
+          : rooms_(rooms)
+          , ctx_(ctx)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array)
+                        return nullptr;
+
+                if (key == "join")
+                        return std::make_unique<RoomMapLevel<JoinedRoom>>(rooms_.join, ctx_);
+                if (key == "leave")
+                        return std::make_unique<RoomMapLevel<LeftRoom>>(rooms_.leave, ctx_);
+                if (key == "invite")
+                        return std::make_unique<RoomMapLevel<InvitedRoom>>(rooms_.invite, ctx_);
+
+                return nullptr;
+        }
+        bool keep(const std::string &key) const override
+        {
+                return key == "join" || key == "leave" || key == "invite";
+        }
+        void finish() override { from_json(rest_, rooms_); }
+
+private:
+        Rooms &rooms_;
+        const ParseContext &ctx_;
+};
+
+class SyncLevel : public Level
+{
+public:
+        SyncLevel(Sync &sync, const ParseContext &ctx)
+          : sync_(sync)
+          , ctx_(ctx)
+        {}
+
+        std::unique_ptr<Level> stream(const std::string &key, bool is_array) override
+        {
+                if (is_array)
+                        return nullptr;
+
+                if (key == "rooms") {
+                        sync_.rooms = {};
+                        return std::make_unique<RoomsLevel>(sync_.rooms, ctx_);
+                }
+                if (key == "to_device")
+                        return device_events(sync_.to_device);
+                if (key == "presence")
+                        return presence_events(sync_.presence);
+                if (key == "account_data")
+                        return account_data_events(sync_.account_data);
+
+                return nullptr;
+        }
+        bool keep(const std::string &key) const override
+        {
+                return key == "next_batch" || key == "rooms" || key == "device_lists" ||
+                       key == "to_device" || key == "device_one_time_keys_count" ||
+                       key == "presence" || key == "account_data";
+        }
+        void finish() override { from_json(rest_, sync_); }
+
+private:
+        Sync &sync_;
+        const ParseContext &ctx_;
+};
+
+//! Iterates over the response for nlohmann::json::sax_parse and stores how far it was read, so
+//! that the text of an event can be taken from the response.
+class Cursor
+{
+public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = char;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const char *;
+        using reference         = const char &;
+
+        Cursor(const char *pos, const char **read)
+          : pos_(pos)
+          , read_(read)
+        {}
+
+        reference operator*() const { return *pos_; }
+        Cursor &operator++()
+        {
+                *read_ = ++pos_;
+                return *this;
+        }
+        Cursor operator++(int)
+        {
+                auto old = *this;
+                ++*this;
+                return old;
+        }
+        bool operator==(const Cursor &other) const { return pos_ == other.pos_; }
+        bool operator!=(const Cursor &other) const { return pos_ != other.pos_; }
+
+private:
+        const char *pos_;
+        const char **read_;
+};
+
+//! Receives the events of nlohmann::json::sax_parse and passes them to the levels.
+class Parser
+{
+public:
+        //! `root` is the level of the top object, any other value is passed to `not_object`.
+        //! `read` is updated with the end of the response text read so far.
+        Parser(std::unique_ptr<Level> root,
+               const std::function<void(const json &)> &not_object,
+               const char *const *read)
+          : root_(std::move(root))
+          , not_object_(not_object)
+          , read_(read)
+        {}
+
+        bool null() { return scalar(nullptr); }
+        bool boolean(bool val) { return scalar(val); }
+        bool number_integer(json::number_integer_t val) { return scalar(val); }
+        bool number_unsigned(json::number_unsigned_t val) { return scalar(val); }
+        bool number_float(json::number_float_t val, const json::string_t &) { return scalar(val); }
+        bool string(json::string_t &val) { return scalar(std::move(val)); }
+        //! Only produced by the binary formats.
+        template<class Binary>
+        bool binary(Binary &) { return true; }
+
+        bool start_object(std::size_t) { return start(false); }
+        bool start_array(std::size_t) { return start(true); }
+        bool end_object() { return end(); }
+        bool end_array() { return end(); }
+
+        bool key(json::string_t &val)
+        {
+                if (depth_ == 0) {
+                        key_ = std::move(val);
+                        return true;
+                }
+
+                switch (mode_) {
+                case Mode::Build:
+                        value_key_ = std::move(val);
+                        break;
+                case Mode::Raw:
+                        if (depth_ == 1)
+                                field_ = val == "type"        ? Field::Type
+                                         : val == "sender"    ? Field::Sender
+                                         : val == "event_id"  ? Field::EventId
+                                         : val == "state_key" ? Field::StateKey
+                                                              : Field::None;
+                        break;
+                case Mode::Skip:
+                        break;
+                }
+                return true;
+        }
+
+        template<class Exception>
+        bool parse_error(std::size_t, const std::string &, const Exception &ex)
+        {
+                throw ex;
+        }
+
+private:
+        //! How the value outside of the levels is handled.
+        enum class Mode
+        {
+                //! Built as json value.
+                Build,
+                //! Kept as json text, see RawEvent.
+                Raw,
+                //! Not needed.
+                Skip,
+        };
+        //! The field of a RawEvent, that the next value at the top of the event is stored in.
+        enum class Field
+        {
+                None,
+                Type,
+                Sender,
+                EventId,
+                StateKey,
+        };
+
+        bool start(bool is_array)
+        {
+                if (depth_ == 0) {
+                        if (root_ && !is_array) {
+                                levels_.push_back(std::move(root_));
+                                return true;
+                        }
+
+                        if (!levels_.empty()) {
+                                if (auto level = levels_.back()->stream(key_, is_array)) {
+                                        levels_.push_back(std::move(level));
+                                        return true;
+                                }
+                        }
+
+                        begin_value();
+                }
+
+                switch (mode_) {
+                case Mode::Build:
+                        value_stack_.push_back(&insert(is_array ? json::array() : json::object()));
+                        break;
+                case Mode::Raw:
+                        // The parser has just read the opening bracket.
+                        if (depth_ == 0)
+                                raw_begin_ = *read_ - 1;
+                        field_ = Field::None;
+                        break;
+                case Mode::Skip:
+                        break;
+                }
+
+                ++depth_;
+                return true;
+        }
+
+        bool end()
+        {
+                if (depth_ == 0) {
+                        levels_.back()->finish();
+                        levels_.pop_back();
+                        return true;
+                }
+
+                --depth_;
+                switch (mode_) {
+                case Mode::Build:
+                        value_stack_.pop_back();
+                        break;
+                case Mode::Raw:
+                        // The parser has just read the closing bracket.
+                        if (depth_ == 0)
+                                raw_.json = std::string_view(
+                                  raw_begin_, static_cast<std::size_t>(*read_ - raw_begin_));
+                        break;
+                case Mode::Skip:
+                        break;
+                }
+
+                if (depth_ == 0)
+                        finish_value();
+                return true;
+        }
+
+        template<class T>
+        bool scalar(T &&val)
+        {
+                if (depth_ == 0)
+                        begin_value();
+
+                switch (mode_) {
+                case Mode::Build:
+                        insert(json(std::forward<T>(val)));
+                        break;
+                case Mode::Raw:
+                        // Numbers are only complete, once the parser has read past them.
+                        if (depth_ == 0)
+                                raw_.json = raw_text_ = json(val).dump();
+                        else
+                                raw_field(val);
+                        field_ = Field::None;
+                        break;
+                case Mode::Skip:
+                        break;
+                }
+
+                if (depth_ == 0)
+                        finish_value();
+                return true;
+        }
+
+        //! Decide how the value, that starts outside of the levels, is handled.
+        void begin_value()
+        {
+                if (levels_.empty())
+                        mode_ = Mode::Build;
+                else if (!levels_.back()->keep(key_))
+                        mode_ = Mode::Skip;
+                else if (levels_.back()->lazy())
+                        mode_ = Mode::Raw;
+                else
+                        mode_ = Mode::Build;
+
+                value_ = json();
+                value_stack_.clear();
+                raw_ = RawEvent{};
+                raw_type_.clear();
+                raw_sender_.clear();
+                raw_event_id_.clear();
+                raw_state_key_.clear();
+                has_state_key_ = false;
+                field_ = Field::None;
+        }
+
+        //! Add a value to the one being built.
+        json &insert(json val)
+        {
+                if (value_stack_.empty()) {
+                        value_ = std::move(val);
+                        return value_;
+                }
+
+                auto &parent = *value_stack_.back();
+                if (parent.is_array()) {
+                        parent.push_back(std::move(val));
+                        return parent.back();
+                }
+
+                auto &slot = parent[value_key_];
+                slot       = std::move(val);
+                return slot;
+        }
+
+        template<class T>
+        void raw_field(const T &)
+        {}
+        //! Store a string at the top of the event in the field of the RawEvent for its key.
+        void raw_field(const std::string &val)
+        {
+                switch (field_) {
+                case Field::Type:
+                        raw_type_ = val;
+                        break;
+                case Field::Sender:
+                        raw_sender_ = val;
+                        break;
+                case Field::EventId:
+                        raw_event_id_ = val;
+                        break;
+                case Field::StateKey:
+                        raw_state_key_ = val;
+                        has_state_key_ = true;
+                        break;
+                case Field::None:
+                        break;
+                }
+        }
+
+        //! Pass a complete value to the level containing it.
+        void finish_value()
+        {
+                switch (mode_) {
+                case Mode::Build:
+                        if (levels_.empty())
+                                not_object_(value_);
+                        else
+                                levels_.back()->value(key_, std::move(value_));
+                        break;
+                case Mode::Raw:
+                        raw_.type     = mtx::events::getEventType(raw_type_);
+                        raw_.sender   = raw_sender_;
+                        raw_.event_id = raw_event_id_;
+                        if (has_state_key_)
+                                raw_.state_key = raw_state_key_;
+                        levels_.back()->raw_value(key_, raw_);
+                        break;
+                case Mode::Skip:
+                        break;
+                }
+        }
+
+        std::unique_ptr<Level> root_;
+        const std::function<void(const json &)> &not_object_;
+        const char *const *read_;
+        std::vector<std::unique_ptr<Level>> levels_;
+        //! The key of the next value in the innermost level.
+        std::string key_;
+
+        //! How the value outside of the levels is handled.
+        Mode mode_ = Mode::Build;
+        //! Nesting depth inside of the value.
+        std::size_t depth_ = 0;
+
+        //! The value being built.
+        json value_;
+        //! The objects and arrays, that are being built.
+        std::vector<json *> value_stack_;
+        //! The key of the next value inside of the value being built.
+        std::string value_key_;
+
+        //! The event being kept as json text and where its text starts in the response.
+        RawEvent raw_;
+        const char *raw_begin_ = nullptr;
+        //! The fields of the event, that `raw_` refers to, reused for every event.
+        std::string raw_type_;
+        std::string raw_sender_;
+        std::string raw_event_id_;
+        std::string raw_state_key_;
+        bool has_state_key_ = false;
+        //! The text of a value, that isn't an object or array.
+        std::string raw_text_;
+        Field field_ = Field::None;
+};
+
+void
+parse_json(std::string_view data,
+           std::unique_ptr<Level> root,
+           const std::function<void(const json &)> &not_object)
+{
+        const char *read = data.data();
+        Parser parser(std::move(root), not_object, &read);
+        json::sax_parse(
+          Cursor(data.data(), &read), Cursor(data.data() + data.size(), &read), &parser);
+}
+}
+
+Sync
+parse_sync(const std::string &data,
+           bool lazy_events,
+           const SyncParseFilter &filter,
+           unsigned decode_threads)
+{
+        Sync sync;
+        std::optional<RoomDecoder> decoder;
+        if (decode_threads > 0)
+                decoder.emplace(decode_threads);
+
+        if (lazy_events)
+                sync.arena = std::make_shared<SyncArena>();
+
+        const ParseContext ctx{lazy_events, filter, decoder ? &*decoder : nullptr, sync.arena};
+        try {
+                // Not even the response is an object. Let the conversion fail on it.
+                parse_json(data, std::make_unique<SyncLevel>(sync, ctx), [&sync](const json &j) {
+                        from_json(j, sync);
+                });
+        } catch (...) {
+                // Errors in the rooms before the one thrown come first.
+                if (decoder)
+                        decoder->finish();
+                throw;
+        }
+
+        if (decoder)
+                decoder->finish();
+        return sync;
+}
+
+std::optional<events::collections::TimelineEvents>
+decode_timeline_event(const RawEvent &event)
+{
+        utils::TimelineEvents events;
+        utils::parse_timeline_event(json::parse(event.json), events);
+        if (events.empty())
+                return std::nullopt;
+
+        return std::move(events.front());
+}
+
+std::optional<events::collections::StateEvents>
+decode_state_event(const RawEvent &event)
+{
+        utils::StateEvents events;
+        utils::parse_state_event(json::parse(event.json), events);
+        if (events.empty())
+                return std::nullopt;
+
+        return std::move(events.front());
+}
+
+void
+decode_events(Timeline &timeline)
+{
+        timeline.events.reserve(timeline.events.size() + timeline.raw_events.size());
+        for (const auto &event : timeline.raw_events)
+                utils::parse_timeline_event(json::parse(event.json), timeline.events);
+        timeline.raw_events.clear();
+        timeline.arena.reset();
+}
+
+void
+decode_events(State &state)
+{
+        state.events.reserve(state.events.size() + state.raw_events.size());
+        for (const auto &event : state.raw_events)
+                utils::parse_state_event(json::parse(event.json), state.events);
+        state.raw_events.clear();
+        state.arena.reset();
+}
 }
 }
@@ -1,5 +1,6 @@
 #include "mtxclient/utils.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <iomanip>
 #include <random>
@@ -8,13 +9,8 @@
 #include <utility>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/detail/error.hpp>
-#include <boost/iostreams/detail/forward.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/filter/zlib.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/traits.hpp>
+
+#include <zlib.h>
 
 mtx::client::utils::MxcUrl
 mtx::client::utils::parse_mxc_url(const std::string &url)
@@ -95,34 +91,119 @@ std::string
 mtx::client::utils::decompress(const boost::iostreams::array_source &src,
                                const std::string &type) noexcept
 {
+        auto source             = src;
+        const auto [begin, end] = source.input_sequence();
+        const auto size         = static_cast<std::size_t>(end - begin);
+
         try {
-                boost::iostreams::filtering_istream is;
-                is.set_auto_close(true);
+                std::string decompressed;
+                if (Inflater(type).inflate(begin, size, decompressed))
+                        return decompressed;
+        } catch (const std::bad_alloc &) {
+        }
+
+        return std::string(begin, size);
+}
+
+struct mtx::client::utils::Inflater::Impl
+{
+        ~Impl()
+        {
+                if (inflating || finished)
+                        inflateEnd(&stream);
+        }
+
+        z_stream stream{};
+        bool inflating = false;
+        bool finished  = false;
+        //! Whether any data was decompressed yet.
+        bool produced = false;
+        //! The input consumed before any output was produced. If it turns out not to be
+        //! compressed, it is passed through as is.
+        std::string head;
+};
+
+mtx::client::utils::Inflater::Inflater(const std::string &encoding)
+  : p(std::make_unique<Impl>())
+{
+        if (encoding != "gzip" && encoding != "deflate")
+                return;
 
-                std::stringstream decompressed;
+        // 15 + 32 detects zlib and gzip headers automatically.
+        p->inflating = inflateInit2(&p->stream, 15 + 32) == Z_OK;
+}
 
-                if (type == "deflate")
-                        is.push(boost::iostreams::zlib_decompressor{});
-                else if (type == "gzip")
-                        is.push(boost::iostreams::gzip_decompressor{});
+mtx::client::utils::Inflater::~Inflater() = default;
 
-                is.push(src);
-                boost::iostreams::copy(is, decompressed);
+mtx::client::utils::Inflater::Inflater(Inflater &&) noexcept = default;
 
-                return decompressed.str();
-        } catch (boost::iostreams::gzip_error &) {
-        } catch (boost::iostreams::zlib_error &) {
+mtx::client::utils::Inflater &
+mtx::client::utils::Inflater::operator=(Inflater &&) noexcept = default;
+
+bool
+mtx::client::utils::Inflater::inflate(const char *data, std::size_t size, std::string &out)
+{
+        if (!p->inflating) {
+                if (!p->finished)
+                        out.append(data, size);
+                return true;
         }
 
-        boost::iostreams::filtering_istream is;
-        is.set_auto_close(true);
+        // Zero initializing the space for the output is far cheaper than inflating into it. JSON
+        // usually compresses to less than a quarter of its size.
+        constexpr std::size_t min_space = 16 * 1024;
+        const std::size_t space         = std::max(min_space, size * 4);
 
-        std::stringstream decompressed;
+        if (!p->produced)
+                p->head.append(data, size);
 
-        is.push(src);
-        boost::iostreams::copy(is, decompressed);
+        auto &zs    = p->stream;
+        zs.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zs.avail_in = static_cast<uInt>(size);
+
+        while (zs.avail_in > 0) {
+                const auto used = out.size();
+                out.resize(used + space);
+
+                zs.next_out  = reinterpret_cast<Bytef *>(&out[used]);
+                zs.avail_out = static_cast<uInt>(space);
+
+                const int ret = ::inflate(&zs, Z_NO_FLUSH);
+                out.resize(used + space - zs.avail_out);
+
+                if (out.size() > used && !p->produced) {
+                        p->produced = true;
+                        std::string().swap(p->head);
+                }
+
+                if (ret == Z_STREAM_END) {
+                        // A gzip body may consist of multiple members.
+                        if (zs.avail_in > 0 && inflateReset(&zs) == Z_OK)
+                                continue;
+
+                        p->inflating = false;
+                        p->finished  = true;
+                        break;
+                }
+
+                if (ret == Z_OK || (ret == Z_BUF_ERROR && zs.avail_out == 0))
+                        continue;
+
+                if (ret == Z_BUF_ERROR)
+                        break;
+
+                if (p->produced)
+                        return false;
+
+                // Not compressed after all.
+                inflateEnd(&zs);
+                p->inflating = false;
+                out.append(p->head);
+                std::string().swap(p->head);
+                return true;
+        }
 
-        return decompressed.str();
+        return true;
 }
 
 std::string
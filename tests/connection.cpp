@@ -1,9 +1,15 @@
 #include <gtest/gtest.h>
+#include <future>
 #include <iostream>
 
 #include "mtx/responses.hpp"
 #include "mtxclient/http/client.hpp"
+#include "mtxclient/http/connection_pool.hpp"
+#include "mtxclient/http/dns_cache.hpp"
 #include "mtxclient/http/errors.hpp"
+#include "mtxclient/http/request_scheduler.hpp"
+#include "mtxclient/http/retry.hpp"
+#include "mtxclient/http/thread_pool.hpp"
 
 #include "test_helpers.hpp"
 
@@ -78,3 +84,696 @@ TEST(Basic, Shutdown)
         auto diff = std::chrono::duration_cast<std::chrono::seconds>(end - begin).count();
         ASSERT_TRUE(diff < 5);
 }
+
+TEST(Basic, SequentialRequestsReuseConnection)
+{
+        auto alice = std::make_shared<Client>("localhost", 8448);
+
+        std::atomic<int> responses = 0;
+        std::function<void(const mtx::responses::Versions &, RequestErr)> next;
+        next = [&](const mtx::responses::Versions &, RequestErr err) {
+                ASSERT_FALSE(err);
+                if (++responses < 5)
+                        alice->versions(next);
+        };
+        alice->versions(next);
+
+        WAIT_UNTIL(responses == 5)
+
+        alice->close();
+}
+
+TEST(Basic, ConcurrentRequests)
+{
+        auto alice = std::make_shared<Client>("localhost", 8448);
+
+        // Shares a single connection, if the server supports HTTP/2.
+        std::atomic<int> responses = 0;
+        for (int i = 0; i < 20; ++i)
+                alice->versions([&responses](const mtx::responses::Versions &res, RequestErr err) {
+                        check_error(err);
+                        EXPECT_FALSE(res.versions.empty());
+                        responses++;
+                });
+
+        WAIT_UNTIL(responses == 20)
+
+        alice->close();
+}
+
+TEST(Basic, ExternalIoContext)
+{
+        boost::asio::io_context ios(1);
+        auto alice = std::make_shared<Client>(ios, "localhost", 8448, true);
+
+        int responses = 0;
+        for (int i = 0; i < 5; ++i)
+                alice->versions([&responses](const mtx::responses::Versions &res, RequestErr err) {
+                        check_error(err);
+                        EXPECT_FALSE(res.versions.empty());
+                        responses++;
+                });
+
+        // Everything runs on the calling thread.
+        while (responses < 5 && ios.run_one() > 0)
+                ;
+        EXPECT_EQ(responses, 5);
+
+        alice->close();
+        ios.run();
+}
+
+TEST(Basic, SharedThreadPool)
+{
+        auto pool = std::make_shared<ThreadPool>(2);
+
+        std::vector<std::shared_ptr<Client>> clients;
+        for (int i = 0; i < 10; ++i)
+                clients.push_back(std::make_shared<Client>(pool, "localhost", 8448));
+
+        std::atomic<int> responses = 0;
+        for (auto &client : clients)
+                client->versions([&responses](const mtx::responses::Versions &, RequestErr err) {
+                        check_error(err);
+                        responses++;
+                });
+
+        WAIT_UNTIL(responses == 10)
+
+        for (auto &client : clients)
+                client->close();
+        clients.clear();
+        pool->join();
+}
+
+TEST(Basic, ThreadPoolReleasedOnItsThread)
+{
+        // A client, that shares the pool, may be the last owner and be destroyed in a callback.
+        auto pool   = std::make_shared<ThreadPool>(2);
+        auto client = std::make_shared<Client>(pool, "localhost", 8448);
+
+        std::promise<void> posted, released;
+        auto &ios = pool->context();
+        boost::asio::post(ios,
+                          [pool = std::move(pool), client = std::move(client),
+                           posted = posted.get_future(), &released]() mutable {
+                                  posted.wait();
+                                  client.reset();
+                                  pool.reset();
+                                  released.set_value();
+                          });
+        posted.set_value();
+
+        EXPECT_EQ(released.get_future().wait_for(std::chrono::seconds(5)),
+                  std::future_status::ready);
+}
+
+TEST(ClientLifetime, DestroyedWithRequestsInFlight)
+{
+        using boost::asio::ip::tcp;
+
+        boost::asio::io_context ios(1);
+
+        // Closes every connection right away, so that each attempt fails with a network error.
+        tcp::acceptor acceptor(ios, {boost::asio::ip::address_v4::loopback(), 0});
+        std::function<void()> accept = [&]() {
+                acceptor.async_accept([&](const boost::system::error_code &ec, tcp::socket) {
+                        if (!ec)
+                                accept();
+                });
+        };
+        accept();
+
+        int callbacks = 0;
+        {
+                auto client = std::make_shared<Client>(
+                  ios, "127.0.0.1", acceptor.local_endpoint().port(), true);
+
+                RetryOpts retry;
+                retry.enabled       = true;
+                retry.initial_delay = std::chrono::milliseconds(200);
+                client->set_retry_opts(retry);
+
+                RequestSchedulerOpts scheduler;
+                scheduler.max_in_flight = 1;
+                client->set_request_scheduler_opts(scheduler);
+
+                for (int i = 0; i < 3; ++i)
+                        client->versions([&callbacks](const mtx::responses::Versions &,
+                                                      RequestErr) { callbacks++; });
+
+                // The first request waits for its retry, the second one is in flight and the
+                // third one is queued, when the client goes away.
+                while (client->retry_stats().retries == 0 && ios.run_one() > 0)
+                        ;
+                ASSERT_EQ(client->retry_stats().retries, 1);
+        }
+
+        // The io_context keeps running the aborted requests, which must neither call back nor
+        // touch the destroyed client.
+        acceptor.close();
+        ios.run();
+        EXPECT_EQ(callbacks, 0);
+}
+
+TEST(Basic, ResumesTlsSessions)
+{
+        auto alice = std::make_shared<Client>("localhost", 8448);
+
+        // Force a new connection for every request.
+        ConnectionPoolOpts opts;
+        opts.enabled = false;
+        alice->set_connection_pool_opts(opts);
+
+        for (int i = 0; i < 3; ++i) {
+                std::atomic<bool> done = false;
+                alice->versions([&done](const mtx::responses::Versions &, RequestErr err) {
+                        check_error(err);
+                        done = true;
+                });
+                WAIT_UNTIL(done)
+        }
+
+        auto stats = alice->tls_session_stats();
+        EXPECT_EQ(stats.handshakes, 3);
+        EXPECT_GE(stats.offered, 1);
+        EXPECT_GE(stats.resumed, 1);
+
+        alice->close();
+}
+
+namespace {
+struct PoolTest : public ::testing::Test
+{
+        boost::asio::io_context ios;
+        boost::asio::ssl::context ssl_ctx{boost::asio::ssl::context::tls_client};
+        boost::asio::ip::tcp::acceptor acceptor{
+          ios, {boost::asio::ip::address_v4::loopback(), 0}};
+        std::vector<boost::asio::ip::tcp::socket> server_side;
+
+        std::unique_ptr<ConnectionPool::Stream> connect()
+        {
+                auto stream = std::make_unique<ConnectionPool::Stream>(ios, ssl_ctx);
+                stream->next_layer().connect(acceptor.local_endpoint());
+                server_side.push_back(acceptor.accept());
+                return stream;
+        }
+};
+}
+
+TEST_F(PoolTest, ReusesConnectionPerHost)
+{
+        ConnectionPool pool;
+
+        pool.release("localhost", 8448, connect());
+        EXPECT_EQ(pool.idle_connections(), 1);
+
+        EXPECT_FALSE(pool.acquire("localhost", 443));
+        EXPECT_FALSE(pool.acquire("example.com", 8448));
+
+        auto stream = pool.acquire("localhost", 8448);
+        ASSERT_TRUE(stream);
+        EXPECT_TRUE(stream->next_layer().is_open());
+        EXPECT_EQ(pool.idle_connections(), 0);
+        EXPECT_FALSE(pool.acquire("localhost", 8448));
+}
+
+TEST_F(PoolTest, LimitsIdleConnections)
+{
+        ConnectionPoolOpts opts;
+        opts.max_idle_per_host = 2;
+        ConnectionPool pool(opts);
+
+        for (int i = 0; i < 3; ++i)
+                pool.release("localhost", 8448, connect());
+        pool.release("example.com", 443, connect());
+        EXPECT_EQ(pool.idle_connections(), 3);
+
+        opts.idle_timeout = std::chrono::seconds(0);
+        pool.set_options(opts);
+        EXPECT_EQ(pool.idle_connections(), 0);
+        EXPECT_FALSE(pool.acquire("localhost", 8448));
+
+        opts.idle_timeout = std::chrono::seconds(30);
+        opts.enabled      = false;
+        pool.set_options(opts);
+        pool.release("localhost", 8448, connect());
+        EXPECT_EQ(pool.idle_connections(), 0);
+        EXPECT_FALSE(pool.acquire("localhost", 8448));
+}
+
+TEST_F(PoolTest, DropsConnectionsClosedByServer)
+{
+        ConnectionPool pool;
+
+        pool.release("localhost", 8448, connect());
+        pool.release("localhost", 8448, connect());
+
+        // The most recently released connection is handed out first.
+        server_side.back().close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto stream = pool.acquire("localhost", 8448);
+        ASSERT_TRUE(stream);
+        EXPECT_EQ(pool.idle_connections(), 0);
+
+        server_side.front().close();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        pool.release("localhost", 8448, std::move(stream));
+        EXPECT_FALSE(pool.acquire("localhost", 8448));
+}
+
+namespace {
+struct FakeMultiplexedConnection : public MultiplexedConnection
+{
+        void submit(const boost::beast::http::request<boost::beast::http::string_body> &,
+                    ResponseHandler,
+                    DownloadSink,
+                    UploadSource) override
+        {}
+        bool is_usable() const override { return usable; }
+        std::optional<std::chrono::steady_clock::time_point> idle_since() const override
+        {
+                return std::nullopt;
+        }
+        void close() override { usable = false; }
+
+        bool usable = true;
+};
+}
+
+TEST(MultiplexedPool, CoalescesConnections)
+{
+        ConnectionPool pool;
+
+        std::vector<std::shared_ptr<MultiplexedConnection>> ready;
+        auto on_ready = [&ready](std::shared_ptr<MultiplexedConnection> connection) {
+                ready.push_back(std::move(connection));
+        };
+
+        // The first request connects, the others wait for its connection.
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8448, on_ready),
+                  ConnectionPool::Probe::Connect);
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8448, on_ready),
+                  ConnectionPool::Probe::Wait);
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8448, on_ready),
+                  ConnectionPool::Probe::Wait);
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8449, on_ready),
+                  ConnectionPool::Probe::Connect);
+
+        auto connection = std::make_shared<FakeMultiplexedConnection>();
+        pool.add_multiplexed("localhost", 8448, connection);
+
+        ASSERT_EQ(ready.size(), 2);
+        EXPECT_EQ(ready[0], connection);
+        EXPECT_EQ(ready[1], connection);
+        EXPECT_EQ(pool.acquire_multiplexed("localhost", 8448), connection);
+
+        // Waiting requests connect on their own, if the server only speaks HTTP/1.1.
+        ready.clear();
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8449, on_ready),
+                  ConnectionPool::Probe::Wait);
+        pool.multiplexing_unavailable("localhost", 8449, true);
+
+        ASSERT_EQ(ready.size(), 1);
+        EXPECT_FALSE(ready[0]);
+        EXPECT_EQ(pool.probe_multiplexed("localhost", 8449, on_ready),
+                  ConnectionPool::Probe::Unsupported);
+
+        pool.clear();
+        EXPECT_FALSE(connection->is_usable());
+        EXPECT_FALSE(pool.acquire_multiplexed("localhost", 8448));
+}
+
+namespace {
+struct DnsTest : public ::testing::Test
+{
+        boost::asio::io_context ios;
+        int lookups = 0;
+
+        //! Resolves every host to the loopback address, asynchronously like the real resolver.
+        ResolveFunction stub_lookup(boost::system::error_code result = {})
+        {
+                return [this, result](const std::string &, uint16_t port, ResolveCallback cb) {
+                        lookups++;
+                        boost::asio::post(ios, [cb, port, result]() {
+                                std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+                                if (!result)
+                                        endpoints.emplace_back(
+                                          boost::asio::ip::address_v4::loopback(), port);
+                                cb(result, endpoints);
+                        });
+                };
+        }
+};
+}
+
+TEST_F(DnsTest, MergesConcurrentLookups)
+{
+        auto dns = std::make_shared<DnsCache>(ios, stub_lookup());
+
+        int resolved = 0;
+        for (int i = 0; i < 100; ++i)
+                dns->resolve("example.com",
+                             443,
+                             [&resolved](const boost::system::error_code &ec,
+                                         std::vector<boost::asio::ip::tcp::endpoint> endpoints) {
+                                     EXPECT_FALSE(ec);
+                                     ASSERT_EQ(endpoints.size(), 1);
+                                     EXPECT_EQ(endpoints[0].port(), 443);
+                                     resolved++;
+                             });
+        ios.run();
+
+        EXPECT_EQ(resolved, 100);
+        EXPECT_EQ(lookups, 1);
+
+        // Served from the cache.
+        dns->resolve("example.com", 443, [&resolved](auto, auto) { resolved++; });
+        ios.restart();
+        ios.run();
+        EXPECT_EQ(resolved, 101);
+        EXPECT_EQ(lookups, 1);
+
+        // A different port is a different entry.
+        dns->resolve("example.com", 8448, [&resolved](auto, auto) { resolved++; });
+        ios.restart();
+        ios.run();
+        EXPECT_EQ(lookups, 2);
+}
+
+TEST_F(DnsTest, ExpiresEntries)
+{
+        ResolverOpts opts;
+        opts.ttl = std::chrono::seconds(0);
+        auto dns = std::make_shared<DnsCache>(ios, stub_lookup(), opts);
+
+        for (int i = 0; i < 3; ++i) {
+                dns->resolve("example.com", 443, [](auto, auto) {});
+                ios.restart();
+                ios.run();
+        }
+        EXPECT_EQ(lookups, 3);
+
+        opts.ttl           = std::chrono::seconds(60);
+        opts.cache_enabled = false;
+        dns->set_options(opts);
+        for (int i = 0; i < 3; ++i)
+                dns->resolve("example.com", 443, [](auto, auto) {});
+        ios.restart();
+        ios.run();
+        EXPECT_EQ(lookups, 6);
+}
+
+TEST_F(DnsTest, DoesNotCacheFailures)
+{
+        auto dns = std::make_shared<DnsCache>(ios, stub_lookup(boost::asio::error::host_not_found));
+
+        int failed = 0;
+        for (int i = 0; i < 2; ++i) {
+                dns->resolve(
+                  "example.com", 443, [&failed](const boost::system::error_code &ec, auto) {
+                          EXPECT_EQ(ec, boost::asio::error::host_not_found);
+                          failed++;
+                  });
+                ios.restart();
+                ios.run();
+        }
+
+        EXPECT_EQ(failed, 2);
+        EXPECT_EQ(lookups, 2);
+}
+
+TEST(HappyEyeballs, InterleavesAddressFamilies)
+{
+        using boost::asio::ip::make_address;
+        using boost::asio::ip::tcp;
+
+        std::vector<tcp::endpoint> endpoints = {{make_address("::1"), 1},
+                                                {make_address("::2"), 1},
+                                                {make_address("::3"), 1},
+                                                {make_address("10.0.0.1"), 1},
+                                                {make_address("10.0.0.2"), 1}};
+
+        auto ordered = interleave_address_families(endpoints);
+        ASSERT_EQ(ordered.size(), 5);
+        EXPECT_EQ(ordered[0].address(), make_address("::1"));
+        EXPECT_EQ(ordered[1].address(), make_address("10.0.0.1"));
+        EXPECT_EQ(ordered[2].address(), make_address("::2"));
+        EXPECT_EQ(ordered[3].address(), make_address("10.0.0.2"));
+        EXPECT_EQ(ordered[4].address(), make_address("::3"));
+}
+
+TEST(HappyEyeballs, SkipsUnreachableAddresses)
+{
+        using boost::asio::ip::tcp;
+
+        boost::asio::io_context ios;
+        tcp::acceptor acceptor(ios, {boost::asio::ip::address_v4::loopback(), 0});
+
+        // Nothing listens on the port of the closed acceptor, so connecting is refused.
+        tcp::acceptor closed(ios, {boost::asio::ip::address_v4::loopback(), 0});
+        auto refused = closed.local_endpoint();
+        closed.close();
+
+        tcp::socket socket(ios);
+        boost::system::error_code result = boost::asio::error::would_block;
+        auto on_connect = [&result](const boost::system::error_code &ec) { result = ec; };
+        async_connect_happy_eyeballs(socket,
+                                     {refused, acceptor.local_endpoint()},
+                                     std::chrono::milliseconds(250),
+                                     on_connect);
+        ios.run();
+
+        EXPECT_FALSE(result);
+        ASSERT_TRUE(socket.is_open());
+        EXPECT_EQ(socket.remote_endpoint(), acceptor.local_endpoint());
+
+        tcp::socket failed(ios);
+        async_connect_happy_eyeballs(
+          failed, {refused}, std::chrono::milliseconds(250), on_connect);
+        ios.restart();
+        ios.run();
+
+        EXPECT_EQ(result, boost::asio::error::connection_refused);
+}
+
+TEST(Scheduler, ClassifiesRequests)
+{
+        EXPECT_EQ(request_priority("/_matrix/client/r0/sync?timeout=30000"), RequestPriority::Sync);
+        EXPECT_EQ(request_priority("/_matrix/client/r0/rooms/!a:b/send/m.room.message/txn"),
+                  RequestPriority::Interactive);
+        EXPECT_EQ(request_priority("/_matrix/client/r0/keys/query"),
+                  RequestPriority::KeyManagement);
+        EXPECT_EQ(request_priority("/_matrix/client/r0/sendToDevice/m.room_key_request/txn"),
+                  RequestPriority::KeyManagement);
+        EXPECT_EQ(request_priority("/_matrix/client/unstable/room_keys/version"),
+                  RequestPriority::KeyManagement);
+        EXPECT_EQ(request_priority("/_matrix/media/r0/download/localhost/abc"),
+                  RequestPriority::Media);
+        EXPECT_EQ(request_priority("/_matrix/client/versions"), RequestPriority::Interactive);
+}
+
+TEST(Scheduler, LimitsRequestsPerClass)
+{
+        RequestSchedulerOpts opts;
+        opts[RequestPriority::Media].max_in_flight = 2;
+        auto scheduler = std::make_shared<RequestScheduler>(opts);
+
+        std::vector<std::shared_ptr<RequestScheduler::Slot>> media;
+        for (int i = 0; i < 5; ++i)
+                scheduler->submit(RequestPriority::Media,
+                                  [&media](auto slot) { media.push_back(std::move(slot)); });
+
+        std::shared_ptr<RequestScheduler::Slot> sync;
+        scheduler->submit(RequestPriority::Sync, [&sync](auto slot) { sync = std::move(slot); });
+
+        // A burst of downloads doesn't delay the sync.
+        EXPECT_TRUE(sync);
+        EXPECT_EQ(media.size(), 2);
+        EXPECT_EQ(scheduler->stats()[RequestPriority::Media].queued, 3);
+        EXPECT_EQ(scheduler->stats()[RequestPriority::Media].in_flight, 2);
+
+        media[0]->release();
+        media[0]->release();
+        EXPECT_EQ(media.size(), 3);
+
+        // Destroying the slot frees it, too.
+        media[1].reset();
+        EXPECT_EQ(media.size(), 4);
+        EXPECT_EQ(scheduler->stats()[RequestPriority::Media].queued, 1);
+        EXPECT_EQ(scheduler->stats()[RequestPriority::Media].in_flight, 2);
+
+        scheduler->clear();
+        EXPECT_EQ(scheduler->stats()[RequestPriority::Media].queued, 0);
+}
+
+TEST(Scheduler, SharesSlotsByWeight)
+{
+        RequestSchedulerOpts opts;
+        opts.max_in_flight = 1;
+        for (auto &c : opts.classes)
+                c = {0, 1};
+        opts[RequestPriority::Interactive].weight = 3;
+        auto scheduler = std::make_shared<RequestScheduler>(opts);
+
+        std::shared_ptr<RequestScheduler::Slot> blocker;
+        scheduler->submit(RequestPriority::Sync, [&blocker](auto slot) { blocker = slot; });
+
+        std::vector<RequestPriority> order;
+        std::shared_ptr<RequestScheduler::Slot> current;
+        for (int i = 0; i < 8; ++i) {
+                for (auto priority : {RequestPriority::Interactive, RequestPriority::Media})
+                        scheduler->submit(priority, [&order, &current, priority](auto slot) {
+                                order.push_back(priority);
+                                current = std::move(slot);
+                        });
+        }
+
+        blocker.reset();
+        while (order.size() < 16) {
+                const auto size = order.size();
+                current.reset();
+                ASSERT_GT(order.size(), size);
+        }
+
+        // Interactive requests get three of four slots, until they run out. Media requests still
+        // get some.
+        const std::vector<RequestPriority> first(order.begin(), order.begin() + 8);
+        EXPECT_EQ(std::count(first.begin(), first.end(), RequestPriority::Interactive), 6);
+        EXPECT_EQ(std::count(first.begin(), first.end(), RequestPriority::Media), 2);
+}
+
+namespace {
+boost::beast::http::request<boost::beast::http::string_body>
+make_request(boost::beast::http::verb method, const std::string &target)
+{
+        return {method, target, 11};
+}
+
+boost::beast::http::response<boost::beast::http::string_body>
+make_response(boost::beast::http::status status, const std::string &body = "")
+{
+        boost::beast::http::response<boost::beast::http::string_body> res{status, 11};
+        res.body() = body;
+        return res;
+}
+}
+
+TEST(Retry, ClassifiesIdempotentRequests)
+{
+        using boost::beast::http::verb;
+
+        EXPECT_TRUE(is_idempotent(verb::get, "/_matrix/client/r0/sync?since=s1"));
+        EXPECT_TRUE(is_idempotent(verb::put, "/_matrix/client/r0/rooms/!r:b/send/m.text/1"));
+        EXPECT_TRUE(is_idempotent(verb::delete_, "/_matrix/client/r0/devices/ABC"));
+        EXPECT_TRUE(is_idempotent(verb::post, "/_matrix/client/r0/keys/query"));
+        EXPECT_TRUE(is_idempotent(verb::post, "/_matrix/client/r0/search?next_batch=x"));
+        EXPECT_FALSE(is_idempotent(verb::post, "/_matrix/client/r0/createRoom"));
+        EXPECT_FALSE(is_idempotent(verb::post, "/_matrix/client/r0/keys/claim"));
+        EXPECT_FALSE(is_idempotent(verb::post, "/_matrix/client/r0/search/other"));
+}
+
+TEST(Retry, ReadsRetryAfter)
+{
+        using boost::beast::http::status;
+
+        EXPECT_EQ(
+          retry_after(make_response(status::too_many_requests,
+                                    R"({"errcode":"M_LIMIT_EXCEEDED","retry_after_ms":2000})")),
+          std::chrono::milliseconds(2000));
+
+        auto res = make_response(status::service_unavailable, "<html>");
+        EXPECT_EQ(retry_after(res), std::nullopt);
+        res.set(boost::beast::http::field::retry_after, "3");
+        EXPECT_EQ(retry_after(res), std::chrono::seconds(3));
+        res.set(boost::beast::http::field::retry_after, "Wed, 21 Oct 2015 07:28:00 GMT");
+        EXPECT_EQ(retry_after(res), std::nullopt);
+}
+
+TEST(Retry, RetriesRateLimitedRequests)
+{
+        using boost::beast::http::status;
+        using boost::beast::http::verb;
+
+        RetryOpts opts;
+        opts.enabled = true;
+        RetryPolicy policy(opts);
+
+        // Any request can be retried, the server didn't process it.
+        const auto req = make_request(verb::post, "/_matrix/client/r0/createRoom");
+        const auto res = make_response(status::too_many_requests, R"({"retry_after_ms":1000})");
+        const boost::system::error_code ok;
+
+        for (unsigned attempt = 0; attempt < opts.max_retries; ++attempt) {
+                const auto delay = policy.next_attempt(req, &res, ok, attempt, true, false);
+                ASSERT_TRUE(delay);
+                EXPECT_GE(*delay, std::chrono::milliseconds(1000));
+                EXPECT_LE(*delay, std::chrono::milliseconds(1100));
+        }
+        EXPECT_FALSE(policy.next_attempt(req, &res, ok, opts.max_retries, true, false));
+
+        // Waiting longer than allowed passes the error on.
+        const auto long_wait =
+          make_response(status::too_many_requests, R"({"retry_after_ms":60000})");
+        EXPECT_FALSE(policy.next_attempt(req, &long_wait, ok, 0, true, false));
+
+        // An upload, that was read from a source, can't be sent again.
+        EXPECT_FALSE(policy.next_attempt(req, &res, ok, 0, false, false));
+
+        const auto stats = policy.stats();
+        EXPECT_EQ(stats.retries, 3);
+        EXPECT_EQ(stats.rate_limited, 3);
+        EXPECT_EQ(stats.gave_up, 2);
+}
+
+TEST(Retry, RetriesServerErrorsOfIdempotentRequests)
+{
+        using boost::beast::http::status;
+        using boost::beast::http::verb;
+
+        RetryOpts opts;
+        opts.enabled       = true;
+        opts.initial_delay = std::chrono::milliseconds(100);
+        opts.max_delay     = std::chrono::milliseconds(1000);
+        opts.max_retries   = 10;
+        RetryPolicy policy(opts);
+
+        const auto get = make_request(verb::get, "/_matrix/client/r0/sync");
+        const auto res = make_response(status::bad_gateway);
+        const boost::system::error_code ok;
+
+        // Jittered between half and the full exponential delay, capped at the maximum.
+        for (unsigned attempt = 0; attempt < 6; ++attempt) {
+                const auto full  = std::min(opts.initial_delay * (1 << attempt), opts.max_delay);
+                const auto delay = policy.next_attempt(get, &res, ok, attempt, true, false);
+                ASSERT_TRUE(delay);
+                EXPECT_GE(*delay, full / 2);
+                EXPECT_LE(*delay, full);
+        }
+
+        const auto post = make_request(verb::post, "/_matrix/client/r0/createRoom");
+        EXPECT_FALSE(policy.next_attempt(post, &res, ok, 0, true, false));
+
+        const auto not_found = make_response(status::not_found);
+        EXPECT_FALSE(policy.next_attempt(get, &not_found, ok, 0, true, false));
+
+        const auto reset =
+          boost::asio::error::make_error_code(boost::asio::error::connection_reset);
+        EXPECT_TRUE(policy.next_attempt(get, nullptr, reset, 0, true, false));
+        // Part of a streamed download may have been passed on already.
+        EXPECT_FALSE(policy.next_attempt(get, nullptr, reset, 0, true, true));
+        const auto aborted =
+          boost::asio::error::make_error_code(boost::asio::error::operation_aborted);
+        EXPECT_FALSE(policy.next_attempt(get, nullptr, aborted, 0, true, false));
+
+        opts.enabled = false;
+        policy.set_options(opts);
+        EXPECT_FALSE(policy.next_attempt(get, &res, ok, 0, true, false));
+
+        const auto stats = policy.stats();
+        EXPECT_EQ(stats.retries, 7);
+        EXPECT_EQ(stats.server_errors, 6);
+        EXPECT_EQ(stats.network_errors, 1);
+        EXPECT_EQ(stats.gave_up, 0);
+}
@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "mtxclient/crypto/store.hpp"
+#include "mtxclient/crypto/utils.hpp"
+
+using namespace mtx::crypto;
+
+namespace fs = std::filesystem;
+
+namespace {
+//! A path for a store, that doesn't exist yet.
+std::string
+store_path(const std::string &name)
+{
+        auto path = fs::temp_directory_path() / ("mtxclient_" + name + ".store");
+        fs::remove(path);
+        return path.string();
+}
+}
+
+TEST(CryptoStore, SaveAndLoad)
+{
+        const auto path = store_path("save_and_load");
+        {
+                CryptoStore store(path);
+                EXPECT_FALSE(store.account());
+
+                store.save_account("account pickle");
+                store.save_olm_session("curve_a", "olm_1", "olm pickle 1");
+                store.save_olm_session("curve_a", "olm_2", "olm pickle 2");
+                store.save_olm_session("curve_b", "olm_3", "olm pickle 3");
+                store.save_inbound_group_session("!room:example.org", "megolm_1", "inbound 1");
+                store.save_inbound_group_session("!other:example.org", "megolm_1", "inbound 2");
+                store.save_outbound_group_session("!room:example.org", "outbound 1");
+
+                EXPECT_EQ(store.account(), "account pickle");
+                EXPECT_EQ(store.olm_session("curve_a", "olm_2"), "olm pickle 2");
+                EXPECT_EQ(store.inbound_group_session("!other:example.org", "megolm_1"),
+                          "inbound 2");
+        }
+
+        CryptoStore store(path);
+        EXPECT_EQ(store.account(), "account pickle");
+        EXPECT_EQ(store.olm_session("curve_a", "olm_1"), "olm pickle 1");
+        EXPECT_EQ(store.olm_session("curve_b", "olm_3"), "olm pickle 3");
+        EXPECT_FALSE(store.olm_session("curve_b", "olm_1"));
+        EXPECT_EQ(store.inbound_group_session("!room:example.org", "megolm_1"), "inbound 1");
+        EXPECT_EQ(store.inbound_group_session("!other:example.org", "megolm_1"), "inbound 2");
+        EXPECT_FALSE(store.inbound_group_session("!room:example.org", "megolm_2"));
+        EXPECT_EQ(store.outbound_group_session("!room:example.org"), "outbound 1");
+        EXPECT_FALSE(store.outbound_group_session("!other:example.org"));
+
+        auto ids = store.olm_session_ids("curve_a");
+        std::sort(ids.begin(), ids.end());
+        EXPECT_EQ(ids, (std::vector<std::string>{"olm_1", "olm_2"}));
+        EXPECT_TRUE(store.olm_session_ids("curve_c").empty());
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, ReplaceAndErase)
+{
+        const auto path = store_path("replace_and_erase");
+        {
+                CryptoStore store(path);
+                store.save_outbound_group_session("!room:example.org", "outbound 1");
+                store.save_outbound_group_session("!room:example.org", "outbound 2");
+                store.save_olm_session("curve_a", "olm_1", "olm pickle 1");
+                store.save_olm_session("curve_a", "olm_2", "olm pickle 2");
+
+                EXPECT_TRUE(store.erase_olm_session("curve_a", "olm_1"));
+                EXPECT_FALSE(store.erase_olm_session("curve_a", "olm_1"));
+                EXPECT_FALSE(store.erase_inbound_group_session("!room:example.org", "megolm"));
+
+                EXPECT_EQ(store.outbound_group_session("!room:example.org"), "outbound 2");
+                EXPECT_FALSE(store.olm_session("curve_a", "olm_1"));
+                EXPECT_GT(store.garbage_size(), 0u);
+        }
+
+        CryptoStore store(path);
+        EXPECT_EQ(store.outbound_group_session("!room:example.org"), "outbound 2");
+        EXPECT_FALSE(store.olm_session("curve_a", "olm_1"));
+        EXPECT_EQ(store.olm_session_ids("curve_a"), std::vector<std::string>{"olm_2"});
+
+        const auto size = store.file_size();
+        store.compact();
+        EXPECT_EQ(store.garbage_size(), 0u);
+        EXPECT_LT(store.file_size(), size);
+        EXPECT_EQ(store.file_size(), fs::file_size(path));
+        EXPECT_EQ(store.outbound_group_session("!room:example.org"), "outbound 2");
+        EXPECT_EQ(store.olm_session("curve_a", "olm_2"), "olm pickle 2");
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, WritesOnlyTheChange)
+{
+        const auto path = store_path("writes_only_the_change");
+        CryptoStore store(path);
+
+        const std::string pickle(1000, 'p');
+        for (int i = 0; i < 1000; ++i)
+                store.save_inbound_group_session(
+                  "!room" + std::to_string(i) + ":example.org", "megolm", pickle);
+
+        const auto size = store.file_size();
+        store.save_inbound_group_session("!room0:example.org", "megolm", pickle);
+        EXPECT_LT(store.file_size() - size, 2 * pickle.size());
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, CompactsGarbage)
+{
+        const auto path = store_path("compacts_garbage");
+        CryptoStore store(path);
+
+        // Saving the same session over and over leaves the old records as garbage, until the
+        // store rewrites the file.
+        const std::string pickle(10000, 'p');
+        for (int i = 0; i < 1000; ++i)
+                store.save_outbound_group_session("!room:example.org", pickle + std::to_string(i));
+
+        EXPECT_LT(store.file_size(), 2 * 1024 * 1024u);
+        EXPECT_EQ(store.outbound_group_session("!room:example.org"), pickle + "999");
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, DropsPartialRecord)
+{
+        const auto path = store_path("drops_partial_record");
+        {
+                CryptoStore store(path);
+                store.save_account("account pickle");
+                store.save_inbound_group_session("!room:example.org", "megolm_1", "inbound 1");
+        }
+
+        // A record cut off by a crash while saving it.
+        const auto size = fs::file_size(path);
+        {
+                CryptoStore store(path);
+                store.save_inbound_group_session("!room:example.org", "megolm_2", "inbound 2");
+        }
+        fs::resize_file(path, fs::file_size(path) - 3);
+
+        {
+                CryptoStore store(path);
+                EXPECT_EQ(store.file_size(), size);
+                EXPECT_EQ(store.account(), "account pickle");
+                EXPECT_EQ(store.inbound_group_session("!room:example.org", "megolm_1"),
+                          "inbound 1");
+                EXPECT_FALSE(store.inbound_group_session("!room:example.org", "megolm_2"));
+
+                store.save_inbound_group_session("!room:example.org", "megolm_3", "inbound 3");
+        }
+
+        CryptoStore store(path);
+        EXPECT_EQ(store.inbound_group_session("!room:example.org", "megolm_3"), "inbound 3");
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, DropsRecordWithGarbageSizes)
+{
+        const auto path = store_path("drops_record_with_garbage_sizes");
+        {
+                CryptoStore store(path);
+                store.save_account("account pickle");
+        }
+
+        // A torn header, whose sizes would need gigabytes, if they were trusted.
+        const auto size = fs::file_size(path);
+        {
+                std::ofstream out(path, std::ios::binary | std::ios::app);
+                const char header[] = "\xff\xff\xff\x7f\xfe\xff\xff\xff\0\0\0\0";
+                out.write(header, sizeof(header) - 1);
+        }
+
+        CryptoStore store(path);
+        EXPECT_EQ(store.file_size(), size);
+        EXPECT_EQ(fs::file_size(path), size);
+        EXPECT_EQ(store.account(), "account pickle");
+
+        fs::remove(path);
+}
+
+TEST(CryptoStore, RejectsOtherFiles)
+{
+        const auto path = store_path("rejects_other_files");
+        std::ofstream(path) << "{\"account\": \"json storage\"}";
+
+        EXPECT_THROW(CryptoStore store(path), crypto_exception);
+
+        fs::remove(path);
+}
@@ -1,4 +1,7 @@
 #include <atomic>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 
@@ -7,6 +10,7 @@
 #include <nlohmann/json.hpp>
 
 #include "mtxclient/crypto/client.hpp"
+#include "mtxclient/crypto/session_cache.hpp"
 #include "mtxclient/crypto/types.hpp"
 #include "mtxclient/http/client.hpp"
 
@@ -666,6 +670,76 @@ TEST(Encryption, OlmSessions)
         ASSERT_EQ(body_str, plaintext);
 }
 
+TEST(Encryption, OlmEncryptedToDeviceBody)
+{
+        auto alice = std::make_shared<OlmClient>("@alice:example.org", "ALICEDEVICE");
+        alice->create_new_account();
+        const auto alice_key = alice->identity_keys().curve25519;
+
+        // Bob has three devices, each with an olm session with Alice.
+        std::vector<std::shared_ptr<OlmClient>> devices;
+        std::vector<OlmSessionPtr> outbound_sessions;
+        std::vector<OlmRecipient> recipients;
+        for (int i = 0; i < 3; ++i) {
+                auto device = std::make_shared<OlmClient>("@bob:example.org",
+                                                          "BOBDEVICE" + std::to_string(i));
+                device->create_new_account();
+                device->generate_one_time_keys(1);
+
+                const auto keys = device->identity_keys();
+                outbound_sessions.push_back(alice->create_outbound_session(
+                  keys.curve25519, device->one_time_keys().curve25519.begin()->second));
+                recipients.push_back({"@bob:example.org",
+                                      "BOBDEVICE" + std::to_string(i),
+                                      keys.ed25519,
+                                      keys.curve25519,
+                                      outbound_sessions.back().get()});
+                devices.push_back(device);
+        }
+
+        const json room_key = {{"type", "m.room_key"},
+                               {"content",
+                                {{"algorithm", "m.megolm.v1.aes-sha2"},
+                                 {"room_id", "!room:example.org"},
+                                 {"session_id", "session"},
+                                 {"session_key", "key"}}}};
+
+        std::vector<OlmSessionPtr> inbound_sessions(devices.size());
+        for (unsigned threads : {0U, 2U}) {
+                auto body =
+                  alice->create_olm_encrypted_to_device_body(room_key, recipients, threads);
+
+                ASSERT_EQ(body.at("messages").at("@bob:example.org").size(), devices.size());
+                for (std::size_t i = 0; i < devices.size(); ++i) {
+                        const auto &recipient = recipients[i];
+                        const auto content =
+                          body.at("messages").at("@bob:example.org").at(recipient.device_id);
+                        EXPECT_EQ(content.at("algorithm"), "m.olm.v1.curve25519-aes-sha2");
+                        EXPECT_EQ(content.at("sender_key"), alice_key);
+
+                        const auto ciphertext = content.at("ciphertext").at(recipient.curve25519);
+                        const auto message    = ciphertext.at("body").get<std::string>();
+                        const auto type       = ciphertext.at("type").get<std::size_t>();
+                        EXPECT_EQ(type, 0);
+
+                        if (!inbound_sessions[i])
+                                inbound_sessions[i] =
+                                  devices[i]->create_inbound_session_from(alice_key, message);
+                        auto plaintext = json::parse(to_string(
+                          devices[i]->decrypt_message(inbound_sessions[i].get(), type, message)));
+
+                        EXPECT_EQ(plaintext.at("type"), "m.room_key");
+                        EXPECT_EQ(plaintext.at("content"), room_key.at("content"));
+                        EXPECT_EQ(plaintext.at("sender"), "@alice:example.org");
+                        EXPECT_EQ(plaintext.at("sender_device"), "ALICEDEVICE");
+                        EXPECT_EQ(plaintext.at("keys").at("ed25519"),
+                                  alice->identity_keys().ed25519);
+                        EXPECT_EQ(plaintext.at("recipient"), "@bob:example.org");
+                        EXPECT_EQ(plaintext.at("recipient_keys").at("ed25519"), recipient.ed25519);
+                }
+        }
+}
+
 TEST(Encryption, MegolmSessions)
 {
         auto alice = std::make_shared<OlmClient>();
@@ -1225,6 +1299,213 @@ TEST(Encryption, PickleMegolmSessions)
         EXPECT_EQ(std::string((char *)plaintext.data.data(), plaintext.data.size()), SECRET);
 }
 
+TEST(Encryption, DecryptGroupMessages)
+{
+        auto alice = make_shared<mtx::crypto::OlmClient>();
+        alice->create_new_account();
+
+        auto first_outbound  = alice->init_outbound_group_session();
+        auto second_outbound = alice->init_outbound_group_session();
+        auto first_inbound =
+          alice->init_inbound_group_session(mtx::crypto::session_key(first_outbound.get()));
+        auto second_inbound =
+          alice->init_inbound_group_session(mtx::crypto::session_key(second_outbound.get()));
+
+        // The messages of both sessions interleaved, and one, that isn't a megolm message.
+        std::vector<std::string> ciphertexts;
+        std::vector<GroupCiphertext> messages;
+        for (int i = 0; i < 10; ++i) {
+                auto outbound = i % 2 ? second_outbound.get() : first_outbound.get();
+                ciphertexts.push_back(
+                  to_string(alice->encrypt_group_message(outbound, "message " + to_string(i))));
+        }
+        ciphertexts.push_back("not a megolm message");
+        for (std::size_t i = 0; i < ciphertexts.size(); ++i) {
+                auto inbound = i % 2 ? second_inbound.get() : first_inbound.get();
+                messages.push_back({inbound, ciphertexts[i]});
+        }
+
+        for (unsigned threads : {0U, 4U}) {
+                auto results = alice->decrypt_group_messages(messages, threads);
+                ASSERT_EQ(results.size(), messages.size());
+
+                for (std::size_t i = 0; i < 10; ++i) {
+                        EXPECT_EQ(results[i].error, OlmErrorCode::SUCCESS);
+                        EXPECT_EQ(to_string(results[i].plaintext.data), "message " + to_string(i));
+                        EXPECT_EQ(results[i].plaintext.message_index, i / 2);
+
+                        auto single = alice->decrypt_group_message(messages[i].session,
+                                                                   ciphertexts[i]);
+                        EXPECT_EQ(single.data, results[i].plaintext.data);
+                        EXPECT_EQ(single.message_index, results[i].plaintext.message_index);
+                }
+
+                EXPECT_NE(results.back().error, OlmErrorCode::SUCCESS);
+                EXPECT_TRUE(results.back().plaintext.data.empty());
+        }
+
+        EXPECT_THROW(alice->decrypt_group_message(first_inbound.get(), ciphertexts.back()),
+                     olm_exception);
+}
+
+TEST(Encryption, InboundSessionCache)
+{
+        auto alice = make_shared<mtx::crypto::OlmClient>();
+        alice->create_new_account();
+
+        // Three rooms with a session each, of which the cache holds two.
+        std::map<std::string, std::string> pickles;
+        std::vector<InboundSessionKey> keys;
+        std::vector<std::string> ciphertexts;
+        for (int i = 0; i < 3; ++i) {
+                auto outbound = alice->init_outbound_group_session();
+                auto inbound  = alice->init_inbound_group_session(session_key(outbound.get()));
+
+                InboundSessionKey key{"!room" + to_string(i) + ":example.org",
+                                      alice->identity_keys().curve25519,
+                                      session_id(outbound.get())};
+                pickles[key.session_id] = pickle<InboundSessionObject>(inbound.get(), "secret");
+                keys.push_back(key);
+                ciphertexts.push_back(
+                  to_string(alice->encrypt_group_message(outbound.get(), "room " + to_string(i))));
+        }
+
+        int loads = 0;
+        InboundSessionCache cache(
+          2,
+          "secret",
+          [&](const InboundSessionKey &key) -> std::optional<std::string> {
+                  ++loads;
+                  auto it = pickles.find(key.session_id);
+                  if (it == pickles.end())
+                          return std::nullopt;
+                  return it->second;
+          },
+          [&](const InboundSessionKey &key, const std::string &pickled) {
+                  pickles[key.session_id] = pickled;
+          });
+
+        for (int round = 0; round < 3; ++round) {
+                for (int i : {0, 1, 0, 1}) {
+                        auto plaintext = cache.decrypt(*alice, keys[i], ciphertexts[i]);
+                        ASSERT_TRUE(plaintext);
+                        EXPECT_EQ(to_string(plaintext->data), "room " + to_string(i));
+                }
+        }
+
+        auto stats = cache.stats();
+        EXPECT_EQ(loads, 2);
+        EXPECT_EQ(stats.misses, 2u);
+        EXPECT_EQ(stats.hits, 10u);
+        EXPECT_EQ(stats.evictions, 0u);
+        EXPECT_EQ(cache.size(), 2u);
+
+        // Room 0 is the least recently used one, so it is dropped for room 2. Decrypting didn't
+        // change it, so it isn't written back.
+        auto plaintext = cache.decrypt(*alice, keys[2], ciphertexts[2]);
+        ASSERT_TRUE(plaintext);
+        EXPECT_EQ(to_string(plaintext->data), "room 2");
+        stats = cache.stats();
+        EXPECT_EQ(stats.evictions, 1u);
+        EXPECT_EQ(stats.write_backs, 0u);
+        EXPECT_EQ(cache.size(), 2u);
+
+        plaintext = cache.decrypt(*alice, keys[0], ciphertexts[0]);
+        ASSERT_TRUE(plaintext);
+        EXPECT_EQ(to_string(plaintext->data), "room 0");
+        EXPECT_EQ(loads, 4);
+
+        InboundSessionKey unknown{"!room0:example.org", "sender", "unknown"};
+        EXPECT_FALSE(cache.decrypt(*alice, unknown, ciphertexts[0]));
+        EXPECT_THROW(cache.decrypt(*alice, keys[0], ciphertexts[1]), olm_exception);
+
+        // Only a use, that may change the session, makes it written back.
+        auto write_backs = cache.stats().write_backs;
+        cache.flush();
+        EXPECT_EQ(cache.stats().write_backs, write_backs);
+        EXPECT_TRUE(cache.with_session(keys[0], [](OlmInboundGroupSession *) {}));
+        cache.flush();
+        EXPECT_EQ(cache.stats().write_backs, write_backs + 1);
+
+        // A new session is stored, when the cache is flushed.
+        auto outbound = alice->init_outbound_group_session();
+        InboundSessionKey added{"!room3:example.org", "sender", session_id(outbound.get())};
+        cache.insert(added, alice->init_inbound_group_session(session_key(outbound.get())));
+        EXPECT_EQ(pickles.count(added.session_id), 0u);
+        cache.flush();
+        ASSERT_EQ(pickles.count(added.session_id), 1u);
+
+        auto restored = unpickle<InboundSessionObject>(pickles[added.session_id], "secret");
+        auto message  = to_string(alice->encrypt_group_message(outbound.get(), "room 3"));
+        EXPECT_EQ(to_string(alice->decrypt_group_message(restored.get(), message).data), "room 3");
+}
+
+TEST(Encryption, InboundSessionCacheEvictionRace)
+{
+        auto alice = make_shared<mtx::crypto::OlmClient>();
+        alice->create_new_account();
+
+        auto first_outbound  = alice->init_outbound_group_session();
+        auto second_outbound = alice->init_outbound_group_session();
+        InboundSessionKey first{"!room0:example.org", "sender", session_id(first_outbound.get())};
+        InboundSessionKey second{"!room1:example.org", "sender", session_id(second_outbound.get())};
+        auto ciphertext = to_string(alice->encrypt_group_message(first_outbound.get(), "room 0"));
+
+        std::mutex pickles_mutex;
+        std::map<std::string, std::string> pickles;
+        std::promise<void> storing, decrypting;
+        auto decrypting_future = decrypting.get_future();
+        bool held_up           = false;
+
+        InboundSessionCache cache(
+          1,
+          "secret",
+          [&](const InboundSessionKey &key) -> std::optional<std::string> {
+                  std::lock_guard<std::mutex> lock(pickles_mutex);
+                  auto it = pickles.find(key.session_id);
+                  if (it == pickles.end())
+                          return std::nullopt;
+                  return it->second;
+          },
+          [&](const InboundSessionKey &key, const std::string &pickled) {
+                  // Hold up the write-back of the first session, while it is decrypted with.
+                  if (key == first && !held_up) {
+                          held_up = true;
+                          storing.set_value();
+                          decrypting_future.wait();
+                          std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                  }
+
+                  std::lock_guard<std::mutex> lock(pickles_mutex);
+                  pickles[key.session_id] = pickled;
+          });
+
+        // The first session was never stored, when the second one evicts it.
+        cache.insert(first, alice->init_inbound_group_session(session_key(first_outbound.get())));
+        std::thread evicting([&]() {
+                cache.insert(second,
+                             alice->init_inbound_group_session(session_key(second_outbound.get())));
+        });
+
+        storing.get_future().wait();
+        auto decrypted = std::async(std::launch::async, [&]() {
+                decrypting.set_value();
+                return cache.decrypt(*alice, first, ciphertext);
+        });
+
+        auto plaintext = decrypted.get();
+        evicting.join();
+        ASSERT_TRUE(plaintext);
+        EXPECT_EQ(to_string(plaintext->data), "room 0");
+
+        // The session was cached again instead of being loaded, which evicted the second one.
+        EXPECT_EQ(cache.stats().misses, 0u);
+        EXPECT_EQ(cache.size(), 1u);
+        std::lock_guard<std::mutex> lock(pickles_mutex);
+        EXPECT_EQ(pickles.count(first.session_id), 1u);
+        EXPECT_EQ(pickles.count(second.session_id), 1u);
+}
+
 TEST(ExportSessions, InboundMegolmSessions)
 {
         auto alice = std::make_shared<OlmClient>();
@@ -1362,6 +1643,8 @@ TEST(Encryption, SAS)
 
         ASSERT_EQ(alice_sas->public_key().length(), 43);
         ASSERT_EQ(bob_sas->public_key().length(), 43);
+        // The keys are generated from random input.
+        ASSERT_NE(alice_sas->public_key(), bob_sas->public_key());
 
         alice_sas->set_their_key(bob_sas->public_key());
         bob_sas->set_their_key(alice_sas->public_key());
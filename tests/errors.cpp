@@ -28,3 +28,17 @@ TEST(MatrixErrors, BasicError)
         EXPECT_EQ(err.errcode, ErrorCode::M_MISSING_TOKEN);
         EXPECT_EQ(err.error, "Missing access token");
 }
+
+TEST(MatrixErrors, RateLimited)
+{
+        nlohmann::json data = R"({
+	  "errcode": "M_LIMIT_EXCEEDED",
+	  "error": "Too many requests",
+	  "retry_after_ms": 2000
+	})"_json;
+
+        Error err = data;
+
+        EXPECT_EQ(err.errcode, ErrorCode::M_LIMIT_EXCEEDED);
+        EXPECT_EQ(err.retry_after_ms, 2000);
+}
@@ -111,6 +111,27 @@ TEST(Events, Conversions)
         EXPECT_EQ("m.tag", ns::to_string(ns::EventType::Tag));
 }
 
+TEST(Events, ParseEventType)
+{
+        for (int i = 0; i < static_cast<int>(ns::EventType::Unsupported); ++i) {
+                const auto type = static_cast<ns::EventType>(i);
+                EXPECT_EQ(ns::getEventType(ns::to_string(type)), type) << ns::to_string(type);
+        }
+
+        EXPECT_EQ(ns::getEventType(std::string_view("m.room.message")),
+                  ns::EventType::RoomMessage);
+        EXPECT_EQ(ns::getEventType(std::string("im.nheko.hidden_events")),
+                  ns::EventType::NhekoHiddenEvents);
+        EXPECT_EQ(ns::getEventType(json{{"type", "m.room.member"}}), ns::EventType::RoomMember);
+        EXPECT_EQ(ns::getEventType(json{{"content", json::object()}}), ns::EventType::Unsupported);
+
+        for (std::string_view unknown : {"", "m.room", "m.room.messages", "m.room.messag",
+                                         "M.ROOM.MESSAGE", "org.example.custom"})
+                EXPECT_EQ(ns::getEventType(unknown), ns::EventType::Unsupported) << unknown;
+
+        EXPECT_EQ(ns::to_string(ns::EventType::Unsupported), "");
+}
+
 TEST(StateEvents, Aliases)
 {
         json data = R"({
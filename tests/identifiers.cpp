@@ -54,3 +54,32 @@ TEST(MatrixIdentifiers, IdentifierInvalid)
         ASSERT_THROW(parse<Room>("39fasdsdfsdf:example.com:5000"), std::invalid_argument);
         ASSERT_THROW(parse<User>("39fasdsdfsdf:example.com:5000"), std::invalid_argument);
 }
+
+TEST(MatrixIdentifiers, Interned)
+{
+        const auto user1 = intern<User>("@alice:example.com");
+        const auto user2 = intern<User>(std::string("@alice:") + "example.com");
+        const auto user3 = parse<User>("@alice:example.com");
+
+        EXPECT_TRUE(user1.is_interned());
+        EXPECT_FALSE(user3.is_interned());
+        EXPECT_EQ(user1.view().data(), user2.view().data());
+        EXPECT_EQ(user1.localpart(), "alice");
+        EXPECT_EQ(user1.hostname(), "example.com");
+        EXPECT_EQ(user1.to_string(), "@alice:example.com");
+        EXPECT_TRUE(user1 == user2);
+        EXPECT_TRUE(user1 == user3);
+        EXPECT_FALSE(user1 == intern<User>("@bob:example.com"));
+        EXPECT_FALSE(user1 < user3);
+
+        const auto copy = user1;
+        EXPECT_EQ(copy.view().data(), user1.view().data());
+
+        ASSERT_THROW(intern<Room>("@alice:example.com"), std::invalid_argument);
+        EXPECT_FALSE(intern<Event>("").is_interned());
+
+        // V3 event ids without a hostname.
+        const auto event = intern<Event>("$acR1l0raoZnm60CBwAVgqbZqoO/mYU81xysh1u7XcJk");
+        EXPECT_EQ(event.localpart(), "$acR1l0raoZnm60CBwAVgqbZqoO/mYU81xysh1u7XcJk");
+        EXPECT_EQ(event.hostname(), "$acR1l0raoZnm60CBwAVgqbZqoO/mYU81xysh1u7XcJk");
+}
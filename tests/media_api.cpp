@@ -75,6 +75,130 @@ TEST(MediaAPI, UploadTextFile)
         alice->close();
 }
 
+TEST(MediaAPI, StreamedDownload)
+{
+        std::shared_ptr<Client> bob = std::make_shared<Client>("localhost");
+
+        bob->login("bob", "secret", [bob](const mtx::responses::Login &, RequestErr err) {
+                ASSERT_FALSE(err);
+
+                const auto audio = read_file("./fixtures/sound.mp3");
+
+                bob->upload(
+                  audio,
+                  "audio/mp3",
+                  "sound.mp3",
+                  [bob, audio](const mtx::responses::ContentURI &res, RequestErr err) {
+                          validate_upload(res, err);
+
+                          auto data = std::make_shared<string>();
+                          bob->download(
+                            res.content_uri,
+                            [data](const char *chunk, std::size_t size) {
+                                    data->append(chunk, size);
+                                    return true;
+                            },
+                            [audio, data](const string &content_type,
+                                          const string &original_filename,
+                                          RequestErr err) {
+                                    ASSERT_FALSE(err);
+                                    EXPECT_EQ(*data, audio);
+                                    EXPECT_EQ(content_type, "audio/mp3");
+                                    EXPECT_EQ(original_filename, "sound.mp3");
+                            });
+                  });
+        });
+
+        bob->close();
+}
+
+TEST(MediaAPI, UploadFile)
+{
+        std::shared_ptr<Client> carl = std::make_shared<Client>("localhost");
+
+        carl->login("carl", "secret", [carl](const mtx::responses::Login &, RequestErr err) {
+                ASSERT_FALSE(err);
+
+                carl->upload_file(
+                  "./fixtures/sound.mp3",
+                  "audio/mp3",
+                  "sound.mp3",
+                  [carl](const mtx::responses::ContentURI &res, RequestErr err) {
+                          validate_upload(res, err);
+
+                          carl->download(res.content_uri,
+                                         [](const string &data,
+                                            const string &content_type,
+                                            const string &original_filename,
+                                            RequestErr err) {
+                                                 ASSERT_FALSE(err);
+                                                 EXPECT_EQ(data, read_file("./fixtures/sound.mp3"));
+                                                 EXPECT_EQ(content_type, "audio/mp3");
+                                                 EXPECT_EQ(original_filename, "sound.mp3");
+                                         });
+                  });
+        });
+
+        carl->close();
+}
+
+TEST(MediaAPI, UploadMissingFile)
+{
+        std::shared_ptr<Client> carl = std::make_shared<Client>("localhost");
+
+        carl->upload_file("./fixtures/missing.mp3",
+                          "audio/mp3",
+                          "missing.mp3",
+                          [](const mtx::responses::ContentURI &, RequestErr err) {
+                                  ASSERT_TRUE(err);
+                                  EXPECT_EQ(err->error_code,
+                                            boost::system::errc::no_such_file_or_directory);
+                          });
+
+        carl->close();
+}
+
+TEST(MediaAPI, UploadChunked)
+{
+        std::shared_ptr<Client> alice = std::make_shared<Client>("localhost");
+
+        alice->login("alice", "secret", [alice](const mtx::responses::Login &, RequestErr err) {
+                ASSERT_FALSE(err);
+
+                // The size is not known up front, so the data is sent chunked.
+                auto chunks = std::make_shared<int>(0);
+                alice->upload(
+                  [chunks](char *buffer, std::size_t &size) {
+                          const std::string chunk = "chunk " + std::to_string(*chunks) + "\n";
+                          if (++*chunks > 3) {
+                                  size = 0;
+                                  return true;
+                          }
+
+                          size = chunk.copy(buffer, size);
+                          return true;
+                  },
+                  std::nullopt,
+                  "text/plain",
+                  "chunks.txt",
+                  [alice](const mtx::responses::ContentURI &res, RequestErr err) {
+                          validate_upload(res, err);
+
+                          alice->download(res.content_uri,
+                                          [](const string &data,
+                                             const string &,
+                                             const string &original_filename,
+                                             RequestErr err) {
+                                                  ASSERT_FALSE(err);
+                                                  EXPECT_EQ(data, "chunk 0\nchunk 1\nchunk 2\n");
+                                                  EXPECT_EQ(original_filename, "chunks.txt");
+                                          });
+                  });
+        });
+
+        alice->close();
+}
+
 TEST(MediaAPI, UploadAudio)
 {
         std::shared_ptr<Client> bob = std::make_shared<Client>("localhost");
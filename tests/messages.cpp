@@ -514,6 +514,64 @@ TEST(RoomEvents, TextMessage)
         EXPECT_EQ(data.dump(), json(event).dump());
 }
 
+TEST(RoomEvents, EditedTextMessage)
+{
+        json data = R"({
+          "origin_server_ts": 1510489356530,
+          "sender": "@nheko_test:matrix.org",
+          "event_id": "$15104893562785758wEgEU:matrix.org",
+          "content": {
+            "body": "* hey there",
+            "msgtype": "m.text",
+            "m.new_content": {
+              "body": "hey there",
+              "format": "org.matrix.custom.html",
+              "formatted_body": "<b>hey</b> there",
+              "msgtype": "m.text",
+              "m.relates_to": {
+                "m.in_reply_to": {
+                  "event_id": "$reply"
+                }
+              }
+            },
+            "m.relates_to": {
+              "rel_type": "m.replace",
+              "event_id": "$original"
+            }
+          },
+          "type": "m.room.message",
+          "room_id": "!lfoDRlNFWlvOnvkBwQ:matrix.org"
+         })"_json;
+
+        RoomEvent<msg::Text> event = data;
+
+        EXPECT_EQ(event.sender, "@nheko_test:matrix.org");
+        EXPECT_EQ(event.content.body, "hey there");
+        EXPECT_EQ(event.content.format, "org.matrix.custom.html");
+        EXPECT_EQ(event.content.formatted_body, "<b>hey</b> there");
+        ASSERT_FALSE(event.content.relations.relations.empty());
+        EXPECT_EQ(event.content.relations.relations.at(0).rel_type,
+                  mtx::common::RelationType::Replace);
+        EXPECT_EQ(event.content.relations.relations.at(0).event_id, "$original");
+        EXPECT_EQ(event.content.relations.replaces(), std::optional<std::string>("$original"));
+
+        // Unsupported events keep all of the merged content.
+        RoomEvent<Unknown> unknown = data;
+        auto content               = json::parse(unknown.content.content);
+        EXPECT_EQ(content["body"], "hey there");
+        EXPECT_EQ(content["m.relates_to"], data["content"]["m.relates_to"]);
+        EXPECT_EQ(content["m.new_content"], data["content"]["m.new_content"]);
+
+        DeviceEvent<msg::KeyVerificationDone> device = R"({
+          "sender": "@alice:example.com",
+          "type": "m.key.verification.done",
+          "content": {"transaction_id": "abc"}
+        })"_json;
+        EXPECT_EQ(device.sender, "@alice:example.com");
+        EXPECT_EQ(device.type, EventType::KeyVerificationDone);
+        EXPECT_EQ(device.content.transaction_id, "abc");
+}
+
 TEST(RoomEvents, VideoMessage)
 {
         json data = R"({
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
 #include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
 #include <variant>
 
 #include <nlohmann/json.hpp>
@@ -395,6 +399,300 @@ TEST(Responses, SyncWithEncryption)
         EXPECT_EQ(event_id, "$1522842442112652dsEBQ:matrix.org");
 }
 
+namespace {
+template<class Event>
+json
+events_json(const std::vector<Event> &events)
+{
+        json j = json::array();
+        for (const auto &e : events)
+                j.push_back(std::visit([](const auto &ev) { return json(ev); }, e));
+        return j;
+}
+
+//! Everything in a Sync as json, so that two of them can be compared.
+json
+sync_json(const Sync &sync)
+{
+        json j;
+        j["next_batch"] = sync.next_batch;
+        for (const auto &[id, room] : sync.rooms.join) {
+                auto &r                 = j["join"][id];
+                r["state"]              = events_json(room.state.events);
+                r["timeline"]           = events_json(room.timeline.events);
+                r["prev_batch"]         = room.timeline.prev_batch;
+                r["limited"]            = room.timeline.limited;
+                r["ephemeral"]          = events_json(room.ephemeral.events);
+                r["account_data"]       = events_json(room.account_data.events);
+                r["highlight_count"]    = room.unread_notifications.highlight_count;
+                r["notification_count"] = room.unread_notifications.notification_count;
+        }
+        for (const auto &[id, room] : sync.rooms.leave) {
+                auto &r         = j["leave"][id];
+                r["state"]      = events_json(room.state.events);
+                r["timeline"]   = events_json(room.timeline.events);
+                r["prev_batch"] = room.timeline.prev_batch;
+                r["limited"]    = room.timeline.limited;
+        }
+        for (const auto &[id, room] : sync.rooms.invite)
+                j["invite"][id] = events_json(room.invite_state);
+        j["to_device"]    = events_json(sync.to_device.events);
+        j["account_data"] = events_json(sync.account_data.events);
+        j["presence"]     = sync.presence;
+        j["changed"]      = sync.device_lists.changed;
+        j["left"]         = sync.device_lists.left;
+        j["otk_count"]    = sync.device_one_time_keys_count;
+        return j;
+}
+
+//! Parse with parse_sync, also decoding the rooms in parallel, and from_json and compare the
+//! results or the exceptions.
+void
+expect_same_sync(const std::string &data)
+{
+        std::optional<Sync> from_dom;
+        std::string dom_error;
+        try {
+                from_dom = json::parse(data).get<Sync>();
+        } catch (const json::exception &e) {
+                dom_error = e.what();
+        }
+
+        std::optional<Sync> from_sax;
+        std::string sax_error;
+        try {
+                from_sax = parse_sync(data);
+        } catch (const json::exception &e) {
+                sax_error = e.what();
+        }
+
+        EXPECT_EQ(sax_error, dom_error) << data;
+        ASSERT_EQ(from_sax.has_value(), from_dom.has_value()) << data;
+        if (from_dom) {
+                EXPECT_EQ(sync_json(*from_sax), sync_json(*from_dom)) << data;
+        }
+
+        std::optional<Sync> parallel;
+        std::string parallel_error;
+        try {
+                parallel = parse_sync(data, false, {}, 4);
+        } catch (const json::exception &e) {
+                parallel_error = e.what();
+        }
+
+        EXPECT_EQ(parallel_error, dom_error) << data;
+        ASSERT_EQ(parallel.has_value(), from_dom.has_value()) << data;
+        if (from_dom) {
+                EXPECT_EQ(sync_json(*parallel), sync_json(*from_dom)) << data;
+        }
+}
+}
+
+TEST(Responses, SyncSaxParser)
+{
+        for (const auto path :
+             {"./fixtures/responses/sync.json", "./fixtures/responses/sync_with_crypto.json"}) {
+                std::ifstream file(path);
+                const std::string data((std::istreambuf_iterator<char>(file)),
+                                       std::istreambuf_iterator<char>());
+                ASSERT_FALSE(data.empty()) << path;
+
+                expect_same_sync(data);
+        }
+
+        // Values, that are not streamed, and malformed responses are left to the json
+        // conversion.
+        for (const auto data : {
+               R"({"next_batch": "s1", "device_one_time_keys_count": {}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"timeline": {"events": {}}}}}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"timeline": {}}}}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"state": []}}}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": []}, "leave": 1}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"state": {"events": [1]}},
+                   "!c:d": {"timeline": {"events": {}}}}, "leave": 1}})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"state": {"events": [1]}},
+                   "!c:d": {"timeline": [)",
+               R"({"next_batch": "s1", "rooms": {"invite": {"!a:b": {}}}})",
+               R"({"next_batch": "s1", "rooms": {"invite": {"!a:b": {"invite_state": {}}}}})",
+               R"({"next_batch": "s1", "presence": {"events": [{"type": "m.presence"}]}})",
+               R"({"next_batch": "s1", "presence": {}, "account_data": {}, "to_device": []})",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"timeline": {
+                   "limited": true, "prev_batch": "p1", "unknown": {"a": [1, 2]},
+                   "events": [{"type": "m.room.message", "content": {"body": "a"}}, 5]}}}}})",
+               R"({"rooms": {}})",
+               R"({"errcode": "M_UNKNOWN_TOKEN", "error": "Invalid token"})",
+               R"([])",
+               R"("sync")",
+               R"({"next_batch": "s1", "rooms": {"join": {"!a:b": {"timeline": {"events": [)",
+               R"({"next_batch": "s1"} trailing)",
+               "",
+             })
+                expect_same_sync(data);
+}
+
+TEST(Responses, SyncLazyEvents)
+{
+        std::ifstream file("./fixtures/responses/sync.json");
+        const std::string data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+        ASSERT_FALSE(data.empty());
+
+        const auto eager = parse_sync(data);
+        auto lazy        = parse_sync(data, true);
+
+        ASSERT_EQ(lazy.rooms.join.size(), eager.rooms.join.size());
+        for (const auto &[id, room] : lazy.rooms.join) {
+                EXPECT_TRUE(room.state.events.empty());
+                EXPECT_TRUE(room.timeline.events.empty());
+                EXPECT_EQ(room.timeline.prev_batch, eager.rooms.join.at(id).timeline.prev_batch);
+        }
+
+        const auto &timeline =
+          lazy.rooms.join.at("!XqBunHwQIXUiqCaoxq:matrix.org").timeline.raw_events;
+        ASSERT_EQ(timeline.size(), 10);
+        EXPECT_EQ(timeline[0].type, EventType::RoomMember);
+        EXPECT_EQ(timeline[0].sender, "@ImpYoo:matrix.org");
+        EXPECT_EQ(timeline[0].event_id, "$15106534421575085AcTQW:matrix.org");
+        EXPECT_EQ(timeline[0].state_key, "@ImpYoo:matrix.org");
+        EXPECT_EQ(timeline[3].type, EventType::RoomMessage);
+        EXPECT_EQ(timeline[3].sender, "@matthew:matrix.org");
+        EXPECT_FALSE(timeline[3].state_key.has_value());
+        EXPECT_EQ(json::parse(timeline[3].json),
+                  json::parse(data)["rooms"]["join"]["!XqBunHwQIXUiqCaoxq:matrix.org"]["timeline"]
+                                   ["events"][3]);
+
+        auto member = decode_state_event(timeline[0]);
+        ASSERT_TRUE(member.has_value());
+        EXPECT_TRUE(std::holds_alternative<StateEvent<state::Member>>(*member));
+
+        auto message = decode_timeline_event(timeline[3]);
+        ASSERT_TRUE(message.has_value());
+        EXPECT_TRUE(std::holds_alternative<RoomEvent<msg::Text>>(*message));
+        EXPECT_FALSE(decode_state_event(timeline[3]).has_value());
+
+        // Decoding every event gives the same response as parsing it eagerly.
+        for (auto &[id, room] : lazy.rooms.join) {
+                decode_events(room.state);
+                decode_events(room.timeline);
+                EXPECT_TRUE(room.state.raw_events.empty());
+                EXPECT_TRUE(room.timeline.raw_events.empty());
+        }
+        for (auto &[id, room] : lazy.rooms.leave) {
+                decode_events(room.state);
+                decode_events(room.timeline);
+        }
+        EXPECT_EQ(sync_json(lazy), sync_json(eager));
+}
+
+TEST(Responses, SyncArena)
+{
+        std::ifstream file("./fixtures/responses/sync.json");
+        auto data = std::make_unique<std::string>((std::istreambuf_iterator<char>(file)),
+                                                  std::istreambuf_iterator<char>());
+        ASSERT_FALSE(data->empty());
+
+        const auto expected = json::parse(*data)["rooms"]["join"]["!XqBunHwQIXUiqCaoxq:matrix.org"]
+                                                ["timeline"]["events"][0];
+
+        // The events point into the arena of the response, not into the parsed text, and stay
+        // valid in copies of the response.
+        auto sync = parse_sync(*data, true, {}, 2);
+        data.reset();
+        ASSERT_TRUE(sync.arena);
+        EXPECT_GT(sync.arena->capacity(), 0);
+
+        const auto copy = sync;
+        sync            = Sync{};
+
+        const auto &event =
+          copy.rooms.join.at("!XqBunHwQIXUiqCaoxq:matrix.org").timeline.raw_events.at(0);
+        EXPECT_EQ(event.sender, "@ImpYoo:matrix.org");
+        EXPECT_EQ(event.state_key, "@ImpYoo:matrix.org");
+        EXPECT_EQ(json::parse(event.json), expected);
+
+        EXPECT_FALSE(parse_sync(R"({"next_batch": "s1"})").arena);
+
+        SyncArena arena;
+        EXPECT_EQ(arena.store("abc"), "abc");
+        EXPECT_EQ(arena.store(std::string(1 << 20, 'x')).size(), 1 << 20);
+        EXPECT_GE(arena.capacity(), (1 << 20) + 3);
+}
+
+TEST(Responses, SyncArenaInCopiedRooms)
+{
+        std::ifstream file("./fixtures/responses/sync.json");
+        const std::string data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+        ASSERT_FALSE(data.empty());
+
+        const std::string room_id = "!XqBunHwQIXUiqCaoxq:matrix.org";
+        const auto expected = json::parse(data)["rooms"]["join"][room_id]["timeline"]["events"][0];
+
+        // Rooms copied out of the response keep the text of their events, when the response is
+        // destroyed, no matter if they were decoded in parallel.
+        for (unsigned threads : {0u, 2u}) {
+                JoinedRoom room;
+                Timeline timeline;
+                {
+                        auto sync = parse_sync(data, true, {}, threads);
+                        room      = sync.rooms.join.at(room_id);
+                        timeline  = sync.rooms.join.at(room_id).timeline;
+                        EXPECT_EQ(timeline.arena, sync.arena);
+                }
+
+                ASSERT_FALSE(timeline.raw_events.empty());
+                EXPECT_EQ(timeline.raw_events[0].sender, "@ImpYoo:matrix.org");
+                EXPECT_EQ(json::parse(timeline.raw_events[0].json), expected);
+                ASSERT_FALSE(room.timeline.raw_events.empty());
+                EXPECT_EQ(json::parse(room.timeline.raw_events[0].json), expected);
+
+                decode_events(room.timeline);
+                EXPECT_FALSE(room.timeline.arena);
+                EXPECT_TRUE(timeline.arena);
+        }
+}
+
+TEST(Responses, SyncParseFilter)
+{
+        std::ifstream file("./fixtures/responses/sync.json");
+        const std::string data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+        ASSERT_FALSE(data.empty());
+
+        const std::string room_id = "!XqBunHwQIXUiqCaoxq:matrix.org";
+        const auto eager          = parse_sync(data);
+
+        SyncParseFilter filter;
+        filter.rooms = {room_id};
+        auto sync    = parse_sync(data, false, filter);
+
+        ASSERT_EQ(sync.rooms.join.size(), 1);
+        EXPECT_EQ(sync_json(sync)["join"][room_id], sync_json(eager)["join"][room_id]);
+        EXPECT_EQ(sync.next_batch, eager.next_batch);
+
+        filter.event_types = {EventType::RoomMessage, EventType::Receipt};
+        sync               = parse_sync(data, false, filter);
+
+        const auto &room = sync.rooms.join.at(room_id);
+        EXPECT_TRUE(room.state.events.empty());
+        EXPECT_EQ(room.timeline.events.size(), 5);
+        for (const auto &e : room.timeline.events)
+                EXPECT_TRUE(std::holds_alternative<RoomEvent<msg::Text>>(e));
+        EXPECT_EQ(room.timeline.prev_batch, eager.rooms.join.at(room_id).timeline.prev_batch);
+        ASSERT_EQ(room.ephemeral.events.size(), 1);
+        EXPECT_TRUE(
+          std::holds_alternative<EphemeralEvent<ephemeral::Receipt>>(room.ephemeral.events[0]));
+        EXPECT_TRUE(room.account_data.events.empty());
+
+        // Lazy events are filtered the same way.
+        auto lazy = parse_sync(data, true, filter);
+        ASSERT_EQ(lazy.rooms.join.size(), 1);
+        auto &timeline = lazy.rooms.join.at(room_id).timeline;
+        ASSERT_EQ(timeline.raw_events.size(), 5);
+        decode_events(timeline);
+        EXPECT_EQ(events_json(timeline.events), events_json(room.timeline.events));
+}
+
 TEST(Responses, Rooms) {}
 
 TEST(Responses, Profile)
@@ -1153,3 +1451,37 @@ TEST(Responses, PublicRooms)
         EXPECT_EQ(publicRooms.prev_batch, "p1902");
         EXPECT_EQ(publicRooms.total_room_count_estimate, 115);
 }
+
+TEST(Responses, FlatMap)
+{
+        using mtx::common::FlatMap;
+
+        FlatMap<std::string, int> map = {{"b", 2}, {"a", 1}, {"c", 3}, {"a", 4}};
+        ASSERT_EQ(map.size(), 3);
+        EXPECT_EQ(map.at("a"), 1);
+        EXPECT_EQ(map.begin()->first, "a");
+        EXPECT_EQ(map.rbegin()->first, "c");
+        EXPECT_THROW(map.at("d"), std::out_of_range);
+        EXPECT_EQ(map.count(std::string_view("b")), 1);
+        EXPECT_EQ(map.find("d"), map.end());
+
+        map["d"] = 5;
+        EXPECT_FALSE(map.emplace("d", 6).second);
+        EXPECT_TRUE(map.insert({"0", 0}).second);
+        EXPECT_FALSE(map.insert_or_assign("b", 7).second);
+        EXPECT_EQ(map.erase("c"), 1);
+        EXPECT_EQ(map.erase("c"), 0);
+
+        // Ranges keep the values already in the map, like std::map.
+        std::vector<std::pair<std::string, int>> more = {{"f", 8}, {"a", 9}, {"e", 10}};
+        map.insert(more.begin(), more.end());
+
+        using Entries          = std::vector<std::pair<std::string, int>>;
+        const Entries expected = {{"0", 0}, {"a", 1}, {"b", 7}, {"d", 5}, {"e", 10}, {"f", 8}};
+        EXPECT_EQ(Entries(map.begin(), map.end()), expected);
+
+        // Converts to json like std::map.
+        json j = map;
+        EXPECT_EQ(j, json(std::map<std::string, int>(expected.begin(), expected.end())));
+        EXPECT_TRUE(j.get<decltype(map)>() == map);
+}
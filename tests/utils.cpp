@@ -1,8 +1,17 @@
 #include <gtest/gtest.h>
 
+#include <boost/beast/http/parser.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
 #include <mtxclient/crypto/client.hpp>
+#include <mtxclient/http/inflating_body.hpp>
+#include <mtxclient/utils.hpp>
 #include <nlohmann/json.hpp>
 
+#include <sstream>
+
 #include <olm/olm.h>
 
 using json = nlohmann::json;
@@ -198,3 +207,87 @@ TEST(Utilities, VerifyIdentityKeyJson)
 
         ASSERT_TRUE(verify_identity_signature(data, DeviceId(device_id), UserId(user_id)));
 }
+
+static std::string
+gzip(const std::string &data)
+{
+        boost::iostreams::filtering_istream is;
+        is.push(boost::iostreams::gzip_compressor{});
+        is.push(boost::iostreams::array_source{data.data(), data.size()});
+
+        std::stringstream compressed;
+        boost::iostreams::copy(is, compressed);
+        return compressed.str();
+}
+
+TEST(Utilities, InflateChunked)
+{
+        std::string data;
+        for (int i = 0; i < 10000; ++i)
+                data += R"({"type":"m.room.message","content":{"body":")" + std::to_string(i) +
+                        "\"}}";
+
+        const auto compressed = gzip(data);
+        ASSERT_LT(compressed.size(), data.size());
+
+        std::string out;
+        mtx::client::utils::Inflater inflater("gzip");
+        for (std::size_t pos = 0; pos < compressed.size(); pos += 100) {
+                const auto size = std::min<std::size_t>(100, compressed.size() - pos);
+                ASSERT_TRUE(inflater.inflate(compressed.data() + pos, size, out));
+        }
+
+        EXPECT_EQ(out, data);
+        EXPECT_EQ(mtx::client::utils::decompress(
+                    boost::iostreams::array_source{compressed.data(), compressed.size()}, "gzip"),
+                  data);
+}
+
+TEST(Utilities, InflateUncompressed)
+{
+        const std::string data = R"({"errcode":"M_UNKNOWN"})";
+
+        std::string out;
+        mtx::client::utils::Inflater identity("");
+        ASSERT_TRUE(identity.inflate(data.data(), data.size(), out));
+        EXPECT_EQ(out, data);
+
+        // Some servers claim to compress, but don't.
+        out.clear();
+        mtx::client::utils::Inflater mislabeled("gzip");
+        ASSERT_TRUE(mislabeled.inflate(data.data(), 5, out));
+        ASSERT_TRUE(mislabeled.inflate(data.data() + 5, data.size() - 5, out));
+        EXPECT_EQ(out, data);
+
+        // Once data was decompressed, a corrupt body is an error, here a wrong checksum.
+        std::string text;
+        for (int i = 0; i < 1000; ++i)
+                text += std::to_string(i * 7919);
+        auto corrupt = gzip(text);
+        corrupt[corrupt.size() - 8] ^= 0xff;
+
+        out.clear();
+        mtx::client::utils::Inflater inflater("gzip");
+        EXPECT_FALSE(inflater.inflate(corrupt.data(), corrupt.size(), out));
+}
+
+TEST(Utilities, InflatingBody)
+{
+        const std::string data = R"({"next_batch":"s72595_4483_1934"})";
+        const auto compressed  = gzip(data);
+        const auto raw         = "HTTP/1.1 200 OK\r\n"
+                         "Content-Encoding: gzip\r\n"
+                         "Content-Length: " +
+                         std::to_string(compressed.size()) + "\r\n\r\n" + compressed;
+
+        boost::beast::http::response_parser<mtx::http::InflatingBody> parser;
+        parser.eager(true);
+
+        boost::system::error_code ec;
+        parser.put(boost::asio::buffer(raw), ec);
+
+        ASSERT_FALSE(ec);
+        ASSERT_TRUE(parser.is_done());
+        EXPECT_EQ(parser.get().body(), data);
+        EXPECT_EQ(parser.get().count(boost::beast::http::field::content_encoding), 0);
+}